@@ -0,0 +1,151 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "benchmark/BenchmarkHelpers.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/FileBlock.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Shows how contiguous the block chains of files written at the same time
+ * end up, with and without extent and delayed allocation, and how long it
+ * then takes to read the files back.
+ */
+class AllocationBenchmark
+{
+  public:
+    AllocationBenchmark()
+        : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        benchmark::showHeader("Block allocation (4 files written in turn, 16 MB each)",
+                              "extents", "contiguous links");
+        auto blockAtATime(writeInterleaved(false, 0, "block at a time"));
+        auto extents(writeInterleaved(true, 0, "extents"));
+        auto delayed(writeInterleaved(true, 4194304, "delayed extents"));
+
+        benchmark::showHeader("Reading back the interleaved files");
+        readBack(blockAtATime, "block at a time");
+        readBack(extents, "extents");
+        readBack(delayed, "delayed extents");
+    }
+
+    ~AllocationBenchmark()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static int const WRITERS = 4;
+    static int const WRITES_PER_FILE = 256;
+    static int const WRITE_SIZE = 65536;
+
+    struct WrittenFiles
+    {
+        knoxcrypt::SharedCoreIO io;
+        std::vector<uint64_t> startBlocks;
+    };
+
+    WrittenFiles writeInterleaved(bool const extentAllocation,
+                                  uint64_t const delayedAllocationBytes,
+                                  std::string const &policy)
+    {
+        auto io(benchmark::buildImage(m_uniquePath / boost::filesystem::unique_path(), 32768));
+        io->extentAllocation = extentAllocation;
+        io->delayedAllocationBytes = delayedAllocationBytes;
+
+        std::vector<uint64_t> startBlocks;
+        {
+            std::vector<std::shared_ptr<knoxcrypt::File>> files;
+            for (int f = 0; f < WRITERS; ++f) {
+                files.push_back(std::make_shared<knoxcrypt::File>(io, std::to_string(f)));
+            }
+            std::vector<char> const data(WRITE_SIZE, 'k');
+            for (int w = 0; w < WRITES_PER_FILE; ++w) {
+                for (auto & file : files) {
+                    file->write(&data.front(), data.size());
+                }
+            }
+            for (auto & file : files) {
+                file->flush();
+                startBlocks.push_back(file->getStartVolumeBlockIndex());
+            }
+        }
+
+        // an extent is a run of blocks that follow on from one another
+        uint64_t extents(0);
+        uint64_t links(0);
+        uint64_t contiguousLinks(0);
+        for (auto block : startBlocks) {
+            ++extents;
+            while (true) {
+                knoxcrypt::FileBlock fileBlock(io, block, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+                uint64_t const next = fileBlock.getNextIndex();
+                if (next == block) {
+                    break;
+                }
+                ++links;
+                if (next == block + 1) {
+                    ++contiguousLinks;
+                } else {
+                    ++extents;
+                }
+                block = next;
+            }
+        }
+        benchmark::showRow("chain layout", policy, std::to_string(extents),
+                           str(boost::format("%1$.1f%%") % (100.0 * contiguousLinks / links)));
+
+        return WrittenFiles{io, startBlocks};
+    }
+
+    void readBack(WrittenFiles const &written, std::string const &policy)
+    {
+        double const megabytes = double(WRITERS) * WRITES_PER_FILE * WRITE_SIZE / (1024 * 1024);
+        benchmark::timeRun("sequential read", policy, megabytes, [&]() {
+            std::vector<char> buffer(WRITE_SIZE);
+            for (int f = 0; f < WRITERS; ++f) {
+                knoxcrypt::File file(written.io, std::to_string(f), written.startBlocks[f],
+                                     knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+                while (file.read(&buffer.front(), buffer.size()) > 0) {
+                }
+            }
+        });
+    }
+};
@@ -0,0 +1,120 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "cryptostreampp/Algorithms.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/FileBlockBuilder.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "utility/MakeKnoxCrypt.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/format.hpp>
+#include <boost/timer/timer.hpp>
+
+#include <functional>
+#include <iostream>
+#include <string>
+
+namespace benchmark {
+
+    /// prints a row of a results table
+    inline void showRow(std::string const &operation,
+                        std::string const &implementation,
+                        std::string const &first,
+                        std::string const &second)
+    {
+        std::cout<<boost::format("%1% %|40t|%2% %|60t|%3% %|75t|%4%\n") % operation % implementation % first % second;
+    }
+
+    /// prints the header of a results table
+    inline void showHeader(std::string const &title,
+                           std::string const &first = "ms",
+                           std::string const &second = "MB/s")
+    {
+        std::cout<<std::endl<<title<<std::endl<<std::endl;
+        showRow("Operation", "Implementation", first, second);
+        showRow("---------", "--------------", std::string(first.length(), '-'), std::string(second.length(), '-'));
+    }
+
+    /// times a single run of f, which processes the given number of bytes,
+    /// and prints the result as a row of the current table
+    inline double timeRun(std::string const &operation,
+                          std::string const &implementation,
+                          double const megabytes,
+                          std::function<void()> const &f)
+    {
+        boost::timer::cpu_timer timer;
+        f();
+        timer.stop();
+        double const ms = timer.elapsed().wall / 1e6;
+        double const rate = ms > 0 ? megabytes / (ms / 1000.0) : 0;
+        showRow(operation, implementation, str(boost::format("%1$.1f") % ms), str(boost::format("%1$.0f") % rate));
+        return ms;
+    }
+
+    /// the io to access an AES-encrypted container built by buildImage
+    inline knoxcrypt::SharedCoreIO openImage(boost::filesystem::path const &path,
+                                             uint64_t const blocks,
+                                             bool const mapImage = false,
+                                             bool const ioUring = false,
+                                             unsigned const cipherThreads = 1)
+    {
+        auto io(std::make_shared<knoxcrypt::CoreIO>());
+        io->path = path.string();
+        io->blocks = blocks;
+        io->freeBlocks = blocks;
+        io->encProps.password = "benchmark";
+        io->encProps.iv = uint64_t(3081342484970028645);
+        io->encProps.iv2 = uint64_t(3081342484970028645);
+        io->encProps.iv3 = uint64_t(3081342484970028645);
+        io->encProps.iv4 = uint64_t(3081342484970028645);
+        io->rounds = 64;
+        io->encProps.cipher = cryptostreampp::Algorithm::AES;
+        io->rootBlock = 0;
+        io->useBlockCache = true;
+        io->mapImage = mapImage;
+        io->ioUring = ioUring;
+        io->cipherThreads = cipherThreads;
+        io->bitmap = knoxcrypt::VolumeBitmap::load(io);
+        io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
+        return io;
+    }
+
+    /// builds a sparse, AES-encrypted container and the io to access it
+    inline knoxcrypt::SharedCoreIO buildImage(boost::filesystem::path const &path,
+                                              uint64_t const blocks)
+    {
+        auto io(openImage(path, blocks));
+        knoxcrypt::MakeKnoxCrypt(io, true /* sparse */).buildImage();
+        io->freeBlocks = io->bitmap->mount();
+        return io;
+    }
+
+}
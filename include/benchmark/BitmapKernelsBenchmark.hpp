@@ -0,0 +1,195 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "benchmark/BenchmarkHelpers.hpp"
+#include "knoxcrypt/detail/DetailBitmapKernels.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Compares the bitmap kernels against the byte-at-a-time loops that the
+ * bitmap helpers used previously. The byte loops view the same memory as
+ * bytes, which matches the on-disk layout on little-endian hosts.
+ */
+class BitmapKernelsBenchmark
+{
+  public:
+    explicit BitmapKernelsBenchmark(uint64_t const megabytes)
+        : m_megabytes(megabytes)
+        , m_words((megabytes * 1024 * 1024) / 8)
+    {
+        benchmark::showHeader(str(boost::format("Bitmap kernels (%1% MB bitmap)") % megabytes));
+        benchCountSetBits();
+        benchFindFirstClearBit();
+        benchFindClearBits();
+        benchSetBitRange();
+    }
+
+  private:
+
+    using Words = std::vector<uint64_t>;
+    double m_megabytes;
+    Words m_words;
+
+    uint8_t *bytes()
+    {
+        return (uint8_t*)m_words.data();
+    }
+
+    uint64_t byteCount() const
+    {
+        return m_words.size() * 8;
+    }
+
+    /// runs f with each kernel implementation the CPU supports
+    void forEachKernel(std::string const &operation, std::function<void()> const &f)
+    {
+        auto const original = knoxcrypt::detail::getBitmapKernel();
+        std::pair<knoxcrypt::detail::BitmapKernel, std::string> const kernels[] = {
+            { knoxcrypt::detail::BitmapKernel::Scalar, "scalar words" },
+            { knoxcrypt::detail::BitmapKernel::AVX2, "AVX2" },
+            { knoxcrypt::detail::BitmapKernel::AVX512, "AVX-512" }
+        };
+        for (auto const & kernel : kernels) {
+            if (knoxcrypt::detail::isBitmapKernelSupported(kernel.first)) {
+                knoxcrypt::detail::setBitmapKernel(kernel.first);
+                benchmark::timeRun(operation, kernel.second, m_megabytes, f);
+            }
+        }
+        knoxcrypt::detail::setBitmapKernel(original);
+    }
+
+    void benchCountSetBits()
+    {
+        std::mt19937_64 gen(1);
+        for (auto & word : m_words) {
+            word = gen();
+        }
+
+        volatile uint64_t result;
+        benchmark::timeRun("popcount", "byte loop", m_megabytes, [&]() {
+            uint64_t allocatedBlocks(0);
+            for (uint64_t byte = 0; byte < byteCount(); ++byte) {
+                uint8_t dat = bytes()[byte];
+                if (dat == 0xFF) {
+                    allocatedBlocks += 8;
+                    continue;
+                }
+                for (int i = 0; i < 8; ++i) {
+                    if (knoxcrypt::detail::isBitSetInByte(dat, i)) {
+                        ++allocatedBlocks;
+                    }
+                }
+            }
+            result = allocatedBlocks;
+        });
+        forEachKernel("popcount", [&]() {
+            result = knoxcrypt::detail::countSetBits(m_words.data(), m_words.size());
+        });
+        (void)result;
+    }
+
+    void benchFindFirstClearBit()
+    {
+        // a full volume apart from its very last block
+        std::fill(m_words.begin(), m_words.end(), ~uint64_t(0));
+        m_words.back() &= ~(uint64_t(1) << 63);
+
+        volatile uint64_t result;
+        benchmark::timeRun("find first zero", "byte loop", m_megabytes, [&]() {
+            uint64_t bitCounter(0);
+            for (uint64_t i = 0; i < byteCount(); ++i) {
+                int availableBit = knoxcrypt::detail::getNextAvailableBitInAByte(bytes()[i]);
+                if (availableBit > -1) {
+                    bitCounter += availableBit;
+                    break;
+                }
+                bitCounter += 8;
+            }
+            result = bitCounter;
+        });
+        forEachKernel("find first zero", [&]() {
+            result = *knoxcrypt::detail::findFirstClearBit(m_words.data(), m_words.size());
+        });
+        (void)result;
+    }
+
+    void benchFindClearBits()
+    {
+        // a nearly full volume with a free block every 4096 blocks
+        std::fill(m_words.begin(), m_words.end(), ~uint64_t(0));
+        for (uint64_t w = 0; w < m_words.size(); w += 64) {
+            m_words[w] &= ~uint64_t(1);
+        }
+        uint64_t const wanted = m_words.size() / 64;
+
+        volatile uint64_t result;
+        benchmark::timeRun("find N zeros", "byte loop", m_megabytes, [&]() {
+            Words found;
+            found.reserve(wanted);
+            for (uint64_t i = 0; i < byteCount() && found.size() < wanted; ++i) {
+                if (bytes()[i] != 0xFF) {
+                    for (int b = 0; b < 8; ++b) {
+                        if (!knoxcrypt::detail::isBitSetInByte(bytes()[i], b)) {
+                            found.push_back((i * 8) + b);
+                        }
+                    }
+                }
+            }
+            result = found.size();
+        });
+        forEachKernel("find N zeros", [&]() {
+            Words found;
+            found.reserve(wanted);
+            knoxcrypt::detail::findClearBits(m_words.data(), m_words.size(), 0, wanted, found);
+            result = found.size();
+        });
+        (void)result;
+    }
+
+    void benchSetBitRange()
+    {
+        // clear all but the first and last few blocks
+        uint64_t const first = 3;
+        uint64_t const last = (m_words.size() * 64) - 3;
+
+        benchmark::timeRun("clear bit range", "byte loop", m_megabytes, [&]() {
+            for (uint64_t b = first; b < last; ++b) {
+                knoxcrypt::detail::setBitInByte(bytes()[b / 8], b % 8, false);
+            }
+        });
+        forEachKernel("clear bit range", [&]() {
+            knoxcrypt::detail::setBitRange(m_words.data(), first, last, false);
+        });
+    }
+};
@@ -0,0 +1,194 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "benchmark/BenchmarkHelpers.hpp"
+#include "knoxcrypt/CipherPool.hpp"
+#include "knoxcrypt/File.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Measures how enciphering large transfers scales with the number of cipher
+ * threads (see CoreIO::cipherThreads), first for each cipher on its own and
+ * then for AES through whole file reads and writes of a hot image.
+ */
+class CipherBenchmark
+{
+  public:
+    CipherBenchmark()
+        : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+        , m_imagePath(m_uniquePath / "image")
+        , m_startBlock(0)
+        , m_threadCounts({1, 2, 4})
+    {
+        unsigned const cores = std::thread::hardware_concurrency();
+        if (cores > m_threadCounts.back()) {
+            m_threadCounts.push_back(cores);
+        }
+
+        benchmark::showHeader("CTR ciphers (1 MB transfers, 256 MB enciphered)");
+        std::vector<std::pair<std::string, cryptostreampp::Algorithm>> const ciphers = {
+            {"aes", cryptostreampp::Algorithm::AES},
+            {"twofish", cryptostreampp::Algorithm::Twofish},
+            {"serpent", cryptostreampp::Algorithm::Serpent},
+            {"rc6", cryptostreampp::Algorithm::RC6},
+            {"mars", cryptostreampp::Algorithm::MARS},
+            {"cast256", cryptostreampp::Algorithm::CAST256},
+            {"camellia", cryptostreampp::Algorithm::Camellia},
+            {"rc5", cryptostreampp::Algorithm::RC5},
+            {"shacal2", cryptostreampp::Algorithm::SHACAL2}
+        };
+        for (auto const & cipher : ciphers) {
+            for (auto const threads : m_threadCounts) {
+                encipher(cipher.first, cipher.second, threads);
+            }
+        }
+
+        boost::filesystem::create_directories(m_uniquePath);
+        writeFile();
+        benchmark::showHeader("AES file transfers (hot host cache, 1 MB at a time, 64 MB 4 times)");
+        for (auto const threads : m_threadCounts) {
+            readFile(threads);
+        }
+        for (auto const threads : m_threadCounts) {
+            overwriteFile(threads);
+        }
+    }
+
+    ~CipherBenchmark()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+    boost::filesystem::path m_imagePath;
+    uint64_t m_startBlock;
+    std::vector<unsigned> m_threadCounts;
+
+    static uint64_t const BLOCKS = 32768;
+    static int const PASSES = 4;
+    static int const FILE_MEGABYTES = 64;
+    static int const CIPHER_MEGABYTES = 256;
+    static int const TRANSFER_SIZE = 1048576;
+
+    static std::string threadsLabel(unsigned const threads)
+    {
+        return str(boost::format("%1% thread%2%") % threads % (threads == 1 ? "" : "s"));
+    }
+
+    void encipher(std::string const &name, cryptostreampp::Algorithm const algorithm, unsigned const threads)
+    {
+        auto io(std::make_shared<knoxcrypt::CoreIO>());
+        io->encProps.password = "benchmark";
+        io->encProps.iv = uint64_t(3081342484970028645);
+        io->encProps.iv2 = uint64_t(3081342484970028645);
+        io->encProps.iv3 = uint64_t(3081342484970028645);
+        io->encProps.iv4 = uint64_t(3081342484970028645);
+        io->encProps.cipher = algorithm;
+
+        // one thread is the calling thread's own transformer, as the image
+        // uses for anything too small to split
+        auto cipher(cryptostreampp::buildByteTransformer(io->encProps));
+        knoxcrypt::UniqueCipherPool pool;
+        if (threads > 1) {
+            pool = std::make_unique<knoxcrypt::CipherPool>(io->encProps, threads);
+        }
+        std::vector<char> buffer(TRANSFER_SIZE, 'c');
+        benchmark::timeRun(name + " encipher", threadsLabel(threads), double(CIPHER_MEGABYTES), [&]() {
+            for (int t = 0; t < CIPHER_MEGABYTES; ++t) {
+                uint64_t const offset = uint64_t(t) * TRANSFER_SIZE;
+                if (pool) {
+                    pool->encrypt({{&buffer.front(), &buffer.front(), offset, long(buffer.size())}});
+                } else {
+                    cipher->encrypt(&buffer.front(), &buffer.front(),
+                                    std::ios_base::streamoff(offset), long(buffer.size()));
+                }
+            }
+        });
+    }
+
+    void writeFile()
+    {
+        auto io(benchmark::buildImage(m_imagePath, BLOCKS));
+        knoxcrypt::File file(io, "data");
+        std::vector<char> const data(TRANSFER_SIZE, 'k');
+        for (int w = 0; w < FILE_MEGABYTES; ++w) {
+            file.write(&data.front(), data.size());
+        }
+        file.flush();
+        m_startBlock = file.getStartVolumeBlockIndex();
+    }
+
+    void readFile(unsigned const threads)
+    {
+        auto io(benchmark::openImage(m_imagePath, BLOCKS, false, false, threads));
+        std::vector<char> buffer(TRANSFER_SIZE);
+        auto const readOnce = [&]() {
+            knoxcrypt::File file(io, "data", m_startBlock,
+                                 knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            while (file.read(&buffer.front(), buffer.size()) > 0) {
+            }
+        };
+
+        // the first read makes sure the host has the image cached
+        readOnce();
+        benchmark::timeRun("file read", threadsLabel(threads), double(PASSES * FILE_MEGABYTES), [&]() {
+            for (int pass = 0; pass < PASSES; ++pass) {
+                readOnce();
+            }
+        });
+    }
+
+    void overwriteFile(unsigned const threads)
+    {
+        auto io(benchmark::openImage(m_imagePath, BLOCKS, false, false, threads));
+        std::vector<char> const data(TRANSFER_SIZE, 'w');
+        benchmark::timeRun("file overwrite", threadsLabel(threads), double(PASSES * FILE_MEGABYTES), [&]() {
+            for (int pass = 0; pass < PASSES; ++pass) {
+                knoxcrypt::File file(io, "data", m_startBlock,
+                                     knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+                for (int w = 0; w < FILE_MEGABYTES; ++w) {
+                    file.write(&data.front(), data.size());
+                }
+                file.flush();
+            }
+        });
+    }
+};
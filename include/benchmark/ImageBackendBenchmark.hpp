@@ -0,0 +1,180 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "benchmark/BenchmarkHelpers.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/File.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Compares reading the container with system calls, one block at a time
+ * or batched through io_uring (see CoreIO::ioUring), against reading it
+ * through a memory mapping (see CoreIO::mapImage) once the host has all of
+ * the image cached, so that only the cost of getting at the bytes and
+ * deciphering them is measured.
+ */
+class ImageBackendBenchmark
+{
+  public:
+    ImageBackendBenchmark()
+        : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+        , m_imagePath(m_uniquePath / "image")
+        , m_startBlock(0)
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        writeFile();
+        benchmark::showHeader("Image backends (hot host cache, 64 MB file read or written 4 times)");
+        readFile(Backend::Direct, "pread");
+        readFile(Backend::Batched, "io_uring");
+        readFile(Backend::Mapped, "mmap");
+        readStream(Backend::Direct, "fstream");
+        readStream(Backend::Mapped, "mmap");
+        readRandom(Backend::Direct, "pread");
+        readRandom(Backend::Mapped, "mmap");
+        overwriteFile(Backend::Direct, "pwrite");
+        overwriteFile(Backend::Batched, "io_uring");
+    }
+
+    ~ImageBackendBenchmark()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+    boost::filesystem::path m_imagePath;
+    uint64_t m_startBlock;
+
+    static uint64_t const BLOCKS = 32768;
+    static int const PASSES = 4;
+    static int const FILE_MEGABYTES = 64;
+    static int const READ_SIZE = 65536;
+    static int const RANDOM_READ_SIZE = 4096;
+
+    enum class Backend { Direct, Batched, Mapped };
+
+    knoxcrypt::SharedCoreIO openImage(Backend const backend) const
+    {
+        return benchmark::openImage(m_imagePath, BLOCKS, backend == Backend::Mapped,
+                                    backend == Backend::Batched);
+    }
+
+    void writeFile()
+    {
+        auto io(benchmark::buildImage(m_imagePath, BLOCKS));
+        knoxcrypt::File file(io, "data");
+        std::vector<char> const data(READ_SIZE, 'k');
+        for (int w = 0; w < FILE_MEGABYTES * 1024 * 1024 / READ_SIZE; ++w) {
+            file.write(&data.front(), data.size());
+        }
+        file.flush();
+        m_startBlock = file.getStartVolumeBlockIndex();
+    }
+
+    void readFile(Backend const which, std::string const &backend)
+    {
+        auto io(openImage(which));
+        std::vector<char> buffer(READ_SIZE);
+        auto const readOnce = [&]() {
+            knoxcrypt::File file(io, "data", m_startBlock,
+                                 knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            while (file.read(&buffer.front(), buffer.size()) > 0) {
+            }
+        };
+
+        // the first read makes sure the host has the image cached
+        readOnce();
+        benchmark::timeRun("sequential file read", backend, double(PASSES * FILE_MEGABYTES), [&]() {
+            for (int pass = 0; pass < PASSES; ++pass) {
+                readOnce();
+            }
+        });
+    }
+
+    void readStream(Backend const which, std::string const &backend)
+    {
+        auto io(openImage(which));
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
+        std::vector<char> buffer(READ_SIZE);
+        uint64_t const reads = uint64_t(FILE_MEGABYTES) * 1024 * 1024 / READ_SIZE;
+        auto const readOnce = [&]() {
+            (void)stream.seekg(0);
+            for (uint64_t r = 0; r < reads; ++r) {
+                (void)stream.read(&buffer.front(), buffer.size());
+            }
+        };
+        readOnce();
+        benchmark::timeRun("sequential stream read", backend, double(PASSES * FILE_MEGABYTES), [&]() {
+            for (int pass = 0; pass < PASSES; ++pass) {
+                readOnce();
+            }
+        });
+    }
+
+    void readRandom(Backend const which, std::string const &backend)
+    {
+        auto io(openImage(which));
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
+        std::vector<char> buffer(RANDOM_READ_SIZE);
+        uint64_t const span = uint64_t(FILE_MEGABYTES) * 1024 * 1024 - RANDOM_READ_SIZE;
+        uint64_t const reads = uint64_t(PASSES * FILE_MEGABYTES) * 1024 * 1024 / RANDOM_READ_SIZE;
+        std::mt19937_64 generator(42);
+        std::uniform_int_distribution<uint64_t> offsets(0, span);
+        benchmark::timeRun("random 4 KB reads", backend, double(PASSES * FILE_MEGABYTES), [&]() {
+            for (uint64_t r = 0; r < reads; ++r) {
+                (void)stream.readAt(offsets(generator), &buffer.front(), buffer.size());
+            }
+        });
+    }
+
+    void overwriteFile(Backend const which, std::string const &backend)
+    {
+        auto io(openImage(which));
+        std::vector<char> const data(READ_SIZE, 'w');
+        uint64_t const writes = uint64_t(FILE_MEGABYTES) * 1024 * 1024 / READ_SIZE;
+        benchmark::timeRun("sequential file overwrite", backend, double(PASSES * FILE_MEGABYTES), [&]() {
+            for (int pass = 0; pass < PASSES; ++pass) {
+                knoxcrypt::File file(io, "data", m_startBlock,
+                                     knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+                for (uint64_t w = 0; w < writes; ++w) {
+                    file.write(&data.front(), data.size());
+                }
+                file.flush();
+            }
+        });
+    }
+};
@@ -0,0 +1,149 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class BlockCache;
+    using SharedBlockCache = std::shared_ptr<BlockCache>;
+
+    /**
+     * @brief holds on to the decrypted contents of the container's most
+     *        recently read blocks so that reading them again doesn't mean
+     *        going back to the image and its cipher.
+     *
+     * The image is split into blocks of io->blockSize bytes from its start,
+     * so block n is the bytes [n * blockSize, (n + 1) * blockSize); in an
+     * aligned container (see CoreIO::alignedBlocks) these are exactly the
+     * data areas of the volume's blocks. Every ContainerImageStream made
+     * with an io that has a cache reads through it and writes through it
+     * (see ContainerImageStream), so a block once in the cache is always
+     * up to date. The least recently used block is dropped once the cache
+     * holds as many blocks as it is allowed.
+     *
+     * Streams on the same image must all share the one cache; anything
+     * changing the image other than through a ContainerImageStream has to
+     * call invalidate.
+     */
+    class BlockCache
+    {
+      public:
+        BlockCache() = delete;
+
+        /**
+         * @brief an empty cache
+         * @param blockSize the size of each cached block; io->blockSize
+         * @param capacity the most blocks held at once
+         */
+        BlockCache(uint64_t const blockSize, uint64_t const capacity);
+
+        uint64_t blockSize() const;
+
+        uint64_t capacity() const;
+
+        /// the number of blocks held at the moment
+        uint64_t size() const;
+
+        /// the number of reads of a block that were found in the cache
+        uint64_t hits() const;
+
+        /// the number of reads of a block that had to go to the image
+        uint64_t misses() const;
+
+        /**
+         * @brief  copies part of a block out of the cache, counting a hit if
+         *         the block is held and a miss if it isn't
+         * @param  block the block to read from
+         * @param  offset where in the block to start
+         * @param  buf where to copy to
+         * @param  n the number of bytes, not going past the block's end
+         * @return true if the block was held
+         */
+        bool read(uint64_t const block, uint64_t const offset,
+                  char * const buf, uint64_t const n);
+
+        /**
+         * @brief  marks the start of a read from the image, made after a
+         *         miss, of a block to be added with insert
+         * @return what insert needs to tell whether the block was written
+         *         to in the meantime
+         */
+        uint64_t beginLoad() const;
+
+        /**
+         * @brief adds a block read in from the image after a miss
+         * @param block the block
+         * @param data its decrypted contents; blockSize bytes
+         * @param ticket what beginLoad gave before the block was read; the
+         *        block isn't added if the image has been written to since,
+         *        as what was read might already be out of date
+         */
+        void insert(uint64_t const block, std::vector<char> data, uint64_t const ticket);
+
+        /**
+         * @brief brings the blocks held in the cache up to date with a
+         *        write to the image
+         * @param offset where in the image the data was written to
+         * @param buf the data written
+         * @param n the number of bytes written
+         */
+        void update(uint64_t const offset, char const * const buf, uint64_t const n);
+
+        /**
+         * @brief drops any blocks that cover part of a stretch of the image
+         * @param offset the start of the stretch
+         * @param n its length in bytes
+         */
+        void invalidate(uint64_t const offset, uint64_t const n);
+
+        /// drops every block
+        void clear();
+
+      private:
+        using Entry = std::pair<uint64_t, std::vector<char>>;
+        using Entries = std::list<Entry>; // most recently used first
+
+        uint64_t const m_blockSize;
+        uint64_t const m_capacity;
+        Entries m_entries;
+        std::unordered_map<uint64_t, Entries::iterator> m_index;
+        uint64_t m_hits;
+        uint64_t m_misses;
+        uint64_t m_writes; // how many times the image has been written to
+        mutable std::mutex m_mutex;
+    };
+
+}
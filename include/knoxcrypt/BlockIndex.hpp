@@ -0,0 +1,195 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class BlockIndex;
+    using SharedBlockIndex = std::shared_ptr<BlockIndex>;
+
+    /**
+     * @brief an on-disk map from the position of a block within a file to
+     *        where that block is in the volume, so that a file needn't be
+     *        walked block by block to get to the middle of it. Used by
+     *        containers of format version 21 onwards.
+     *
+     * The index is a tree of ordinary blocks. Its root is the file's start
+     * block and holds the depth of the tree, the number of blocks indexed
+     * and the first level of block pointers. Each level below holds
+     * nothing but pointers, the lowest of which are the file's own blocks.
+     * Finding a block costs one small read per level, and a tree of four
+     * levels indexes more blocks than any volume can have.
+     *
+     * The file's blocks stay linked together as before; the index sits
+     * alongside the chain rather than replacing it. The exception is a
+     * file with holes: a hole has no block of its own, only a pointer of
+     * detail::HOLE_BLOCK, and for such a file the index alone is to be
+     * trusted. So too in a container whose files can share blocks (see
+     * BlockRefCounts), where a block can be in more than one file.
+     */
+    class BlockIndex
+    {
+      public:
+        BlockIndex() = delete;
+
+        /**
+         * @brief creates a new, empty index
+         * @param io the core knoxcrypt io
+         * @param enforceRootBlock true to put the root at io->rootBlock
+         * @throw KnoxCryptException OutOfSpace if no block is free
+         */
+        BlockIndex(SharedCoreIO const &io, bool const enforceRootBlock);
+
+        /**
+         * @brief opens an existing index
+         * @param io the core knoxcrypt io
+         * @param rootBlock the block the index is rooted at
+         */
+        BlockIndex(SharedCoreIO const &io, uint64_t const rootBlock);
+
+        /// the block the index is rooted at, i.e., the file's start block
+        uint64_t getRootBlock() const;
+
+        /// the number of blocks indexed
+        uint64_t size() const;
+
+        /**
+         * @brief  finds where a block of the file is
+         * @param  n the position of the block within the file
+         * @return the block's index in the volume
+         */
+        uint64_t lookup(uint64_t const n) const;
+
+        /**
+         * @brief  adds a block to the end of the file
+         * @param  block the block's index in the volume
+         * @throw  KnoxCryptException OutOfSpace if the index can't grow
+         */
+        void append(uint64_t const block);
+
+        /**
+         * @brief  adds blocks to the end of the file, e.g., those of another
+         *         file that this one is to share
+         * @param  blocks the blocks' indices in the volume, holes included
+         * @throw  KnoxCryptException OutOfSpace if the index can't grow
+         */
+        void append(std::vector<uint64_t> const &blocks);
+
+        /**
+         * @brief  adds a run of holes to the end of the file
+         * @param  count the number of blocks' worth of hole
+         * @throw  KnoxCryptException OutOfSpace if the index can't grow
+         */
+        void appendHoles(uint64_t const count);
+
+        /**
+         * @brief  changes where a block of the file is, e.g., when a hole
+         *         is given a block
+         * @param  n the position of the block within the file
+         * @param  block the block's index in the volume
+         */
+        void set(uint64_t const n, uint64_t const block);
+
+        /**
+         * @brief  forgets about all blocks from position count onwards
+         * @param  count the number of blocks to keep
+         * @return the blocks of the index itself that are no longer needed;
+         *         these are left for the caller to free
+         */
+        std::vector<uint64_t> shrink(uint64_t const count);
+
+        /// all of the blocks indexed, in file order
+        std::vector<uint64_t> getBlocks() const;
+
+        /// all of the blocks making up the index itself, root included
+        std::vector<uint64_t> getIndexBlocks() const;
+
+      private:
+
+        SharedCoreIO m_io;
+        mutable SharedImageStream m_stream;
+        uint64_t m_root;
+        uint64_t m_depth;
+        uint64_t m_count;
+
+        /// pointers in the root and in the levels below it
+        uint64_t rootFanout() const;
+        uint64_t nodeFanout() const;
+
+        /// how many blocks sit under each pointer of an index block at a
+        /// given level; the lowest level is 1 and the root is at m_depth
+        uint64_t pointerSpan(uint64_t const level) const;
+
+        /// where a pointer of the root or of a lower level block is
+        uint64_t rootPointerOffset(uint64_t const slot) const;
+        uint64_t nodePointerOffset(uint64_t const node, uint64_t const slot) const;
+
+        /// where the pointer to the block at position n of the file is
+        uint64_t blockPointerOffset(uint64_t n) const;
+
+        ContainerImageStream &stream() const;
+        uint64_t readPointer(uint64_t const offset) const;
+        std::vector<uint64_t> readPointers(uint64_t const offset, uint64_t const count) const;
+        void writePointer(uint64_t const offset, uint64_t const value);
+        void writeHeader();
+
+        /// allocates and writes out a block for the index
+        uint64_t newIndexBlock(bool const enforceRootBlock = false);
+
+        /// adds another level above the root's pointers
+        void grow();
+
+        /// adds count pointers all of the same value to the end, or the
+        /// count pointers at blocks if given
+        void appendRun(uint64_t const block, uint64_t count, uint64_t const * blocks = nullptr);
+
+        /// collects the index and data blocks below a pointer
+        void collect(uint64_t const node,
+                     uint64_t const level,
+                     uint64_t const count,
+                     std::vector<uint64_t> &blocks,
+                     bool const indexBlocks) const;
+
+        /// collects the index blocks below a pointer that hold nothing
+        /// before position keep
+        void collectUnneeded(uint64_t const node,
+                             uint64_t const level,
+                             uint64_t const keep,
+                             uint64_t const count,
+                             std::vector<uint64_t> &blocks) const;
+    };
+
+}
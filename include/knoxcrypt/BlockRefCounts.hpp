@@ -0,0 +1,129 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class BlockRefCounts;
+    using SharedBlockRefCounts = std::shared_ptr<BlockRefCounts>;
+
+    /**
+     * @brief counts the files sharing each block of a container whose files
+     *        can be cloned without copying their data (format versions 36
+     *        onwards; see CoreIO::sharedBlocks).
+     *
+     * There is a byte for every block of the volume, holding how many files
+     * other than the first refer to it; most blocks have a count of 0. The
+     * counts are kept in the last blocks of the volume, which are marked as
+     * in use when the image is built, and are read in whole when first
+     * needed. Changes are written straight back.
+     *
+     * A block with a count above 0 is never written to; a file wanting to
+     * change it takes a copy of its own first (see File). Only a file's block
+     * index says which blocks are its own in such a container, not the chain
+     * of next indices.
+     */
+    class BlockRefCounts
+    {
+      public:
+        BlockRefCounts() = delete;
+
+        /**
+         * @brief prepares access to the counts of the container
+         * @param io the core knoxcrypt io (path, blocks, password)
+         */
+        explicit BlockRefCounts(SharedCoreIO const &io);
+
+        /**
+         * @brief  retrieves the resident counts of the container at io->path,
+         *         reading them in if they aren't resident already
+         * @param  io the core knoxcrypt io (path, blocks, password)
+         * @param  reread true to discard any resident copy
+         * @return the resident counts
+         */
+        static SharedBlockRefCounts load(SharedCoreIO const &io, bool const reread = false);
+
+        /**
+         * @brief sets aside the blocks holding the counts and zeroes them;
+         *        done once, when the image is built
+         * @param io the core knoxcrypt io, with its bitmap loaded
+         */
+        static void format(SharedCoreIO const &io);
+
+        /// the first of the blocks the counts are kept in
+        static uint64_t firstTableBlock(SharedCoreIO const &io);
+
+        /**
+         * @brief  determines whether a block is shared by more than one file
+         * @param  block the block to query
+         * @return true if shared, false otherwise
+         */
+        bool isShared(uint64_t const block) const;
+
+        /**
+         * @brief  counts one more file as referring to each of some blocks
+         * @param  blocks the blocks being shared
+         * @return false, with no count changed, if any of the blocks is
+         *         already shared by as many files as can be counted
+         */
+        bool share(std::vector<uint64_t> const &blocks);
+
+        /**
+         * @brief  counts one file fewer as referring to each of some blocks
+         * @param  blocks the blocks a file no longer refers to
+         * @return those of the blocks that no file refers to any longer,
+         *         which are left for the caller to free
+         */
+        std::vector<uint64_t> release(std::vector<uint64_t> blocks);
+
+      private:
+        SharedImageStream m_stream;
+        uint64_t m_blocks;
+
+        // the data bytes of each block the counts are kept in
+        uint64_t m_space;
+        std::vector<uint64_t> m_offsets;
+
+        mutable std::vector<uint8_t> m_counts;
+        mutable bool m_resident;
+
+        void makeResident() const;
+
+        /// writes back the counts of the given blocks, sorted
+        void write(std::vector<uint64_t> const &blocks);
+    };
+
+}
@@ -0,0 +1,129 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "cryptostreampp/CryptoStreamPP.hpp"
+#include "cryptostreampp/EncryptionProperties.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class CipherPool;
+    using UniqueCipherPool = std::unique_ptr<CipherPool>;
+
+    /**
+     * @brief worker threads that encipher and decipher large transfers
+     *        together.
+     *
+     * In CTR mode each 16-byte stretch of the image is enciphered with a
+     * keystream block worked out from its offset alone, so a transfer can be
+     * cut into chunks done in any order by any thread. Each thread has a
+     * transformer of its own, the transformers keeping state as they go. The
+     * calling thread takes its share of the chunks too and returns once all
+     * of them are done. One transfer is worked on at a time; see ImageFile
+     * for the pool's one user.
+     */
+    class CipherPool
+    {
+      public:
+        /// a stretch of a transfer: n bytes from in, sitting at offset in
+        /// the image, enciphered or deciphered into out (which may be in)
+        struct Piece
+        {
+            char *in;
+            char *out;
+            uint64_t offset;
+            long n;
+        };
+
+        CipherPool() = delete;
+
+        /**
+         * @brief starts the pool's workers
+         * @param encProps the image's cipher, key and iv
+         * @param threads how many threads take part, the calling thread
+         *        among them; at least two
+         */
+        CipherPool(cryptostreampp::EncryptionProperties const &encProps, unsigned const threads);
+
+        ~CipherPool();
+
+        CipherPool(CipherPool const &) = delete;
+        CipherPool &operator=(CipherPool const &) = delete;
+
+        /// how many threads take part, the calling thread among them
+        unsigned threads() const;
+
+        /// enciphers the pieces, returning once they're all done
+        void encrypt(std::vector<Piece> const &pieces);
+
+        /// deciphers the pieces, returning once they're all done
+        void decrypt(std::vector<Piece> const &pieces);
+
+        /// the most a thread takes on at once; transfers any smaller are
+        /// best left to the calling thread alone
+        static long const CHUNK_BYTES = 65536;
+
+      private:
+        using Ciphers = std::vector<cryptostreampp::SharedByteTransformer>;
+
+        Ciphers m_ciphers; // the calling thread's first, then each worker's
+        std::vector<std::thread> m_workers;
+
+        // the transfer being worked on, handed out a chunk at a time
+        std::mutex m_runMutex;
+        std::vector<Piece> m_chunks;
+        bool m_encrypt;
+        std::atomic<size_t> m_next;
+
+        // wakes the workers for each transfer and tells when they're done
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        uint64_t m_generation;
+        unsigned m_busy;
+        bool m_stop;
+
+        void run(bool const encrypt, std::vector<Piece> const &pieces);
+
+        /// takes chunks until there are none left
+        void work(cryptostreampp::IByteTransformer &cipher);
+
+        void workerLoop(unsigned const worker);
+    };
+
+}
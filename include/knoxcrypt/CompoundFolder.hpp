@@ -144,7 +144,8 @@ namespace knoxcrypt
 
         void writeNewMetaDataForEntry(std::string const &name,
                                       EntryType const &entryType,
-                                      uint64_t startBlock);
+                                      uint64_t startBlock,
+                                      uint64_t const fileSize = 0);
 
       private:
         void doAddContentFolder();
@@ -28,7 +28,9 @@
 
 #pragma once
 
+#include "knoxcrypt/BlockCache.hpp"
 #include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ImageFile.hpp"
 #include "utility/EventType.hpp"
 #include "cryptostreampp/CryptoStreamPP.hpp"
 
@@ -37,12 +39,24 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 
 namespace knoxcrypt
 {
     class ContainerImageStream;
     using SharedImageStream = std::shared_ptr<ContainerImageStream>;
 
+    /**
+     * @brief the encrypted container image, read and written as plain
+     *        bytes, either as a stream or by offset with readAt and
+     *        writeAt. When the io has a block cache (see CoreIO::blockCache)
+     *        reads are served from it where possible. When the image is
+     *        mapped (see CoreIO::mapImage) the stream's reads and writes go
+     *        through the mapping too. Large reads and writes that would be
+     *        split between cipher threads (see CoreIO::cipherThreads) go by
+     *        offset as well. A seek is only made on the underlying stream
+     *        once it's next needed.
+     */
     class ContainerImageStream
     {
       public:
@@ -54,6 +68,44 @@ namespace knoxcrypt
 
         ContainerImageStream& write(char const * buf, std::streamsize const n);
 
+        /**
+         * @brief  reads from an offset in the image without using or moving
+         *         the stream's position
+         * @param  offset where in the image to read from
+         * @param  buf where to put what's read
+         * @param  n the number of bytes to read
+         * @return the number of bytes read; fewer than n at the end of the
+         *         image, -1 on failure
+         */
+        std::streamsize readAt(uint64_t const offset, char * const buf, std::streamsize const n);
+
+        /**
+         * @brief  writes to an offset in the image without using or moving
+         *         the stream's position. The data is in the image, not held
+         *         on to, once this returns
+         * @param  offset where in the image to write to
+         * @param  buf the data to write
+         * @param  n the number of bytes to write
+         * @return the number of bytes written; -1 on failure
+         */
+        std::streamsize writeAt(uint64_t const offset, char const * const buf, std::streamsize const n);
+
+        /**
+         * @brief  reads several stretches of the image at once without using
+         *         or moving the stream's position (see ImageFile::readBatch).
+         *         What the block cache holds is taken from it and the blocks
+         *         it doesn't hold are read together
+         * @param  transfers the stretches to read, which mustn't overlap
+         * @return false if any stretch couldn't be read in full
+         */
+        bool readBatch(std::vector<ImageFile::Transfer> const &transfers);
+
+        /// starts batching the image's writes (see ImageFile::beginBatch)
+        void beginBatch();
+
+        /// ends a batch of writes; false if any of them failed
+        bool endBatch();
+
         ContainerImageStream& seekg(std::streampos pos);
         ContainerImageStream& seekg(std::streamoff off, std::ios_base::seekdir way);
         ContainerImageStream& seekp(std::streampos pos);
@@ -73,6 +125,30 @@ namespace knoxcrypt
                   std::ios::openmode mode = std::ios::out | std::ios::binary);
       private:
         cryptostreampp::SharedCryptoStream m_cryptoStream;
+        SharedImageFile m_image;
+        SharedBlockCache m_cache;
+
+        // where the next read or write goes when known here rather than
+        // only to the image stream, which is behind it if m_behind is set
+        std::streamoff m_pos;
+        bool m_behind;
+        bool m_append;
+
+        // whether the image stream has writes it hasn't passed on yet
+        bool m_dirty;
+
+        // whether the image has been written to by offset since the image
+        // stream last sought, so that what it has buffered may be out of date
+        bool m_stale;
+
+        /// where the next read or write goes; -1 if the image stream failed
+        std::streamoff position();
+
+        /// brings the image stream to m_pos if it's behind
+        void catchUp();
+
+        /// passes on any writes the image stream is holding on to
+        void flushPending();
     };
 
 }
@@ -199,10 +199,13 @@ namespace knoxcrypt
          * @param name name of entry
          * @param entryType the type of the entry
          * @param startBlock start block of entry
+         * @param fileSize the size of a file, recorded if the container
+         *        records file sizes in folder entries
          */
         void writeNewMetaDataForEntry(std::string const &name,
                                       EntryType const& entryType,
-                                      uint64_t startBlock);
+                                      uint64_t startBlock,
+                                      uint64_t const fileSize = 0);
 
         long getAliveEntryCount() const;
         long getTotalEntryCount() const;
@@ -214,13 +217,33 @@ namespace knoxcrypt
       private:
         /**
          * @brief for writing new entry metadata
-         * @param name name of entry
-         * @param entryType the type of the entry
-         * @param startBlock start block of entry
+         * @param metaData the entry's complete metadata
+         */
+        void doWriteNewMetaDataForEntry(std::vector<uint8_t> const &metaData);
+
+        /**
+         * @brief computes how many bytes a file can have and stay in its entry
+         * @param name the name of the file
+         * @return the number of bytes; 0 if the file can't be inline
          */
-        void doWriteNewMetaDataForEntry(std::string const &name,
-                                        EntryType const& entryType,
-                                        uint64_t startBlock);
+        uint32_t inlineCapacity(std::string const &name) const;
+
+        /**
+         * @brief gathers the data of an inline file and the means for the
+         * file to write it back to its entry
+         * @param info the entry info of the file
+         * @return the inline data
+         */
+        InlineData buildInlineData(SharedEntryInfo const &info) const;
+
+        /**
+         * @brief builds what a file calls on to report its size. The size is
+         * kept in the file's entry info and, once the file has been flushed,
+         * recorded in its entry if the container records file sizes
+         * @param info the entry info of the file
+         * @return the callback
+         */
+        std::function<void(uint64_t, bool)> buildSizeUpdateCallback(SharedEntryInfo const &info) const;
 
         /**
          * @brief a private accessor for getting file entry from metadata
@@ -254,26 +277,12 @@ namespace knoxcrypt
          */
         std::streamsize doWrite(char const * buf, std::streampos n);
 
-        /**
-         * @brief write the first byte of the file metadata data
-         * @note assumes in correct position
-         * @return
-         */
-        std::streamsize doWriteFirstByteToEntryMetaData(EntryType const &entryType);
-
         /**
          * @brief write filename file metadata
          * @return number of bytes writeen
          */
         std::streamsize doWriteFilenameToEntryMetaData(std::string const &name);
 
-        /**
-         * @brief writes the first block index bytes to the file metadata
-         * @param first block, the block index of the file entry
-         * @return number of bytes written
-         */
-        std::streamsize doWriteFirstBlockIndexToEntryMetaData(uint64_t firstBlock);
-
         /**
          * @brief seeks to where the metadata should be written. If
          * metadata for a previous entry has been deleted, we should
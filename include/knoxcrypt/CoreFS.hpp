@@ -62,6 +62,11 @@ namespace knoxcrypt
          */
         long getBlockSize() const;
 
+        /**
+         * Retrieve the number of file data bytes that fit in one block
+         */
+        long getBlockWriteSpace() const;
+
         /**
          * @brief  retrieves folder entry for given path
          * @param  path the path to retrieve entry for
@@ -150,6 +155,70 @@ namespace knoxcrypt
          */
         void truncateFile(std::string const &path, std::ios_base::streamoff offset);
 
+        /**
+         * @brief allocates up front the blocks a file needs to grow to a
+         *        given size. With keepSize, blocks past the end of the file
+         *        are only held while it is the file last used here; they
+         *        are freed again once another file is accessed
+         * @param path the file to preallocate blocks for
+         * @param bytes the size the file is expected to grow to
+         * @param keepSize false to also grow the file to bytes, filling
+         *        it with zeros
+         * @throw KnoxCryptException NotFound if the file can't be found
+         * @throw KnoxCryptException OutOfSpace if there aren't enough blocks
+         */
+        void preallocate(std::string const &path, uint64_t const bytes, bool const keepSize = true);
+
+        /**
+         * @brief  finds the first data, or the first hole, of a file at or
+         *         after an offset, as lseek's SEEK_DATA and SEEK_HOLE do
+         * @param  path the file to look in
+         * @param  offset the offset to look from
+         * @param  hole true to look for a hole, false for data
+         * @return where the data or hole is; -1 if offset isn't before
+         *         the end of the file
+         * @throw  KnoxCryptException NotFound if the file can't be found
+         */
+        int64_t findDataOrHole(std::string const &path, int64_t const offset, bool const hole);
+
+        /**
+         * @brief copies a file. Where the container lets files share blocks
+         *        the copy shares the source's blocks rather than duplicating
+         *        them; either file copies a shared block when writing to it
+         * @param src the file to copy
+         * @param dst the copy, which is created if it doesn't exist and
+         *        has its contents replaced if it does
+         * @throw KnoxCryptException NotFound if src or the parent of dst
+         *        can't be found
+         * @throw KnoxCryptException AlreadyExists if dst is a folder
+         */
+        void cloneFile(std::string const &src, std::string const &dst);
+
+        /**
+         * @brief writes out a file's data that is still held back from
+         *        allocation; to be called when the file is closed
+         * @param path the file to flush
+         */
+        void flushFile(std::string const &path);
+
+        /**
+         * @brief gives the space of all free blocks back to the host file
+         *        system by punching holes in the container image. Useful
+         *        for containers whose deletes weren't punched as they happened
+         * @return the number of blocks whose space was released
+         */
+        uint64_t trim();
+
+        /**
+         * @brief writes out and lets go of the open file, then records the
+         *        free block count and marks the container as cleanly
+         *        unmounted. The open file can still allocate blocks, or give
+         *        back ones set aside for it, so the count is only final once
+         *        it has gone. Nothing else is to be done through the CoreFS
+         *        afterwards
+         */
+        void unmount();
+
         /**
          * @brief gets file system info; used when a 'df' command is issued
          * @param buf stores the filesystem stats data
@@ -208,6 +277,12 @@ namespace knoxcrypt
                            SharedCompoundFolder const &parentEntry,
                            OpenDisposition openMode) const;
 
-        void resetCachedFile(::boost::filesystem::path const &path);
+        /**
+         * @brief lets go of the cached file if it is, or lies under, path
+         * @param path the file or folder that has been moved or removed
+         * @param removed true if path has been removed, in which case any
+         *        data the cached file still holds back is thrown away
+         */
+        void resetCachedFile(::boost::filesystem::path const &path, bool const removed = false);
     };
 }
@@ -42,6 +42,12 @@ namespace knoxcrypt
 
     class FileBlockBuilder;
     using SharedBlockBuilder = std::shared_ptr<FileBlockBuilder>;
+    class VolumeBitmap;
+    using SharedVolumeBitmap = std::shared_ptr<VolumeBitmap>;
+    class BlockRefCounts;
+    using SharedBlockRefCounts = std::shared_ptr<BlockRefCounts>;
+    class BlockCache;
+    using SharedBlockCache = std::shared_ptr<BlockCache>;
 
     struct CoreIO
     {
@@ -53,10 +59,36 @@ namespace knoxcrypt
         unsigned int rounds;             // number of rounds used by enc. process
         uint64_t rootBlock;              // the start block of the root folder
         SharedBlockBuilder blockBuilder; // a block factory / resource manage
+        SharedVolumeBitmap bitmap;       // resident copy of the volume bitmap
         using Callback = std::function<void(knoxcrypt::EventType)>;
         using OptionalCallback = boost::optional<Callback>;
         OptionalCallback ccb;            // call back for cipher
         bool useBlockCache;              // cache available file blocks for faster retrieval
+        bool extentAllocation = true;    // keep the blocks of growing files contiguous
+        uint64_t delayedAllocationBytes = 4194304; // appended data a file holds before
+                                                   // giving it blocks; 0 to allocate on write
+        bool punchHoles = false;         // give the space of freed blocks back to the host
+        bool blockIndex = false;         // files keep an on-disk index of their blocks;
+                                         // format versions 21 and 23
+        bool alignedBlocks = false;      // block metadata kept in a table apart from
+                                         // page-aligned data; format versions 22 and 23
+        bool inlineFiles = false;        // small files kept in their folder entries;
+                                         // format versions 24 to 27
+        uint32_t inlineFileBytes = 254;  // the largest file kept inline; the entry of a
+                                         // file with a long name may hold fewer bytes
+        bool entrySizes = false;         // file sizes recorded in folder entries;
+                                         // format versions 28 to 35
+        bool sharedBlocks = false;       // cloned files share blocks until written to;
+                                         // format versions 36 to 51, with blockIndex
+        SharedBlockRefCounts refCounts;  // resident copy of the block reference counts
+        SharedBlockCache blockCache;     // decrypted blocks shared by every image stream
+                                         // of the io; none if not set
+        bool mapImage = false;           // the image read and written through a shared
+                                         // memory mapping rather than pread and pwrite
+        bool ioUring = false;            // reads and writes over several blocks batched
+                                         // through io_uring where the host has it
+        unsigned cipherThreads = 1;      // threads enciphering and deciphering a large
+                                         // transfer, the calling thread among them
         bool firstTimeInit;              // initialized very first time
         
         // Should key be initialized very first time?
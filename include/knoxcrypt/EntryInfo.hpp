@@ -84,6 +84,21 @@ namespace knoxcrypt
          */
         uint64_t firstFileBlock() const;
 
+        /**
+         * @brief  records where a file's blocks now start; a file that was
+         *         kept inline in its folder entry no longer is
+         * @param  firstFileBlock the index of the first file block
+         */
+        void updateFirstFileBlock(uint64_t const firstFileBlock);
+
+        /**
+         * @brief  indicates if the file's data is kept in its folder entry
+         *         rather than in file blocks
+         * @return true if the file is inline
+         */
+        bool isInline() const;
+        void setInline(bool const isInline);
+
         /**
          * @brief  reports the index of the entry's position in the folder's list of entries
          * @return the index of the entry in the folder
@@ -106,6 +121,7 @@ namespace knoxcrypt
         bool m_writable;
         uint64_t m_firstFileBlock;
         uint64_t m_folderIndex;
+        bool m_inline;
         bool m_hasBucketIndex;
         uint64_t m_bucketIndex;
     };
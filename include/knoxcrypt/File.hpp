@@ -47,11 +47,34 @@ namespace knoxcrypt
 
     class File;
     using SharedFile = std::shared_ptr<File>;
+    struct BlockReservation;
+    using SharedBlockReservation = std::shared_ptr<BlockReservation>;
+    class BlockIndex;
+    using SharedBlockIndex = std::shared_ptr<BlockIndex>;
+
+    /// the content of a file small enough to be kept in its folder entry
+    /// rather than in file blocks, and the means to write it back there
+    struct InlineData
+    {
+        // the file's data
+        std::vector<uint8_t> bytes;
+
+        // the most bytes that the folder entry can hold
+        uint32_t capacity;
+
+        // writes the data back to the folder entry; false if it no longer fits
+        std::function<bool(std::vector<uint8_t> const &)> store;
+
+        // points the folder entry at the file's start block once the
+        // file has outgrown the entry
+        std::function<void(uint64_t)> promote;
+    };
 
     class File
     {
 
-        using SetEntryInfoSizeCallback = std::function<void(uint64_t)>;
+        // given the file's size and whether the file has just been flushed
+        using SetEntryInfoSizeCallback = std::function<void(uint64_t, bool)>;
         using OptionalSizeCallback = boost::optional<SetEntryInfoSizeCallback>;
         using SharedFileBlock = std::shared_ptr<FileBlock>;
 
@@ -77,6 +100,23 @@ namespace knoxcrypt
                     uint64_t const startBlock,
                     OpenDisposition const &openDisposition);
 
+        /**
+         * @brief for a file whose data is kept in its folder entry. The file
+         *        is moved to file blocks when it grows past what the entry holds
+         * @param io the core knoxcrypt io (path, blocks, password)
+         * @param name the name of the file entry
+         * @param inlineData the file's data and where it is kept
+         * @param openDisposition open mode
+         */
+        File(SharedCoreIO const &io,
+             std::string const &name,
+             InlineData inlineData,
+             OpenDisposition const &openDisposition);
+
+        /// gives blocks to any data still held back from allocation and
+        /// gives back any reserved blocks that weren't needed
+        ~File();
+
         typedef char                                   char_type;
         typedef boost::iostreams::seekable_device_tag  category;
 
@@ -94,16 +134,52 @@ namespace knoxcrypt
 
         /**
          * @brief  retrieves the first file block making up this knoxcrypt file
+         * @note   a file kept in its folder entry has no blocks; see isInline
          * @return the start block index of this file
          */
         uint64_t getStartVolumeBlockIndex() const;
 
         /**
-         * @brief truncates a file to new size
+         * @brief  retrieves the block holding the start of the file's data.
+         *         This is the start block unless the file has a block index,
+         *         whose root the start block is
+         * @return the block index of the file's first data block
+         */
+        uint64_t getFirstDataVolumeBlockIndex() const;
+
+        /**
+         * @brief  indicates if the file's data is kept in its folder entry
+         * @return true if the file has no blocks of its own
+         */
+        bool isInline() const;
+
+        /**
+         * @brief truncates a file to new size, or grows it with zeros or
+         *        holes (see extendTo). Blocks past a new, smaller end are
+         *        freed in one batch
          * @param newSize the new fileSize
          */
         void truncate(std::ios_base::streamoff newSize);
 
+        /**
+         * @brief allocates, in one go, the blocks needed for the file to
+         *        grow to a given size. Later writes use them up rather than
+         *        going back to the allocator. The file size is unchanged and
+         *        blocks still unused when the file is closed are freed again,
+         *        which for a file opened through CoreFS is once another
+         *        file is accessed
+         * @param bytes the size the file is expected to grow to
+         * @throw KnoxCryptException OutOfSpace if the blocks aren't there
+         */
+        void reserve(uint64_t const bytes);
+
+        /**
+         * @brief writes out whatever the file still holds back and frees the
+         *        blocks reserved for it that haven't been used, as happens
+         *        when the file goes; for where a failure can be reported
+         */
+        void close();
+
         /**
          * @brief  for reading bytes from the knoxcrypt file
          * @param  s buffer to store the read bytes
@@ -121,7 +197,9 @@ namespace knoxcrypt
         std::streamsize write(const char* s, std::streamsize n);
 
         /**
-         * @brief  allows seeking to a given position in the knoxcrypt file
+         * @brief  allows seeking to a given position in the knoxcrypt file.
+         *         A file open for writing can be sought past its end; the
+         *         gap is filled with zeros, or holes, when next written to
          * @param  off the offset to seek to
          * @param  way the position of where to offset from (begin, current, or end)
          * @return returns the offset (NOTE: should this be returning the actual
@@ -137,10 +215,39 @@ namespace knoxcrypt
         boost::iostreams::stream_offset tell() const;
 
         /**
-         * @brief flushes any remaining data
+         * @brief  finds the first data at or after an offset, as lseek's
+         *         SEEK_DATA does. Only a file with a block index has holes
+         * @param  off the offset to look from
+         * @return where the data is; -1 if off isn't before the end
+         */
+        boost::iostreams::stream_offset nextData(boost::iostreams::stream_offset const off) const;
+
+        /**
+         * @brief  finds the first hole at or after an offset, as lseek's
+         *         SEEK_HOLE does. The end of the file counts as a hole
+         * @param  off the offset to look from
+         * @return where the hole is; -1 if off isn't before the end
+         */
+        boost::iostreams::stream_offset nextHole(boost::iostreams::stream_offset const off) const;
+
+        /**
+         * @brief flushes any remaining data, first allocating blocks for
+         *        appended data that has been held back
          */
         void flush();
 
+        /**
+         * @brief  replaces the file's contents with another file's by having
+         *         it share that file's blocks rather than copying them. A
+         *         shared block is copied by whichever file next writes to it
+         * @note   only in a container whose files can share blocks (see
+         *         CoreIO::sharedBlocks) and only for a file with blocks
+         * @param  other the file to share the blocks of
+         * @return false, leaving this file as it was, if the blocks can't
+         *         be shared and have to be copied instead
+         */
+        bool shareBlocksOf(File &other);
+
         /**
          * @brief deallocates blocks associated with this file entry; used
          * in conjunction with deleting the file
@@ -149,7 +256,9 @@ namespace knoxcrypt
 
         /**
          * @brief sets the callback that will be used to updated the reported
-         * file size as stored in the entry info metadata of the parent
+         * file size as stored in the entry info metadata of the parent. The
+         * callback is also told when the file has been flushed, e.g., so that
+         * the size can be recorded in the file's folder entry
          * @param callback the setSize function (probably) of EntryInfo
          */
         void setOptionalSizeUpdateCallback(SetEntryInfoSizeCallback callback);
@@ -185,9 +294,17 @@ namespace knoxcrypt
         // a buffer used for storing chunks of data
         std::vector<uint8_t> m_buffer;
 
-        // the start file block index
+        // data appended to the end of the file that hasn't been given any
+        // blocks yet; see CoreIO::delayedAllocationBytes
+        std::vector<uint8_t> m_delayed;
+
+        // the start file block index; the root of the file's block index
+        // if the container has them (see CoreIO::blockIndex)
         mutable uint64_t m_startVolumeBlock;
 
+        // where each of the file's blocks is, if the container keeps track
+        mutable SharedBlockIndex m_index;
+
         // the index of the block in the actual blocks container;
         // in comparison to m_currentBlock, this is where the block
         // exists in m_fileBlocks
@@ -202,6 +319,12 @@ namespace knoxcrypt
         // how many blocks make up the file?
         mutable uint64_t m_blockCount;
 
+        // the volume blocks making up the file, in order; gathered when the
+        // file is opened so that blocks are found without following the chain.
+        // Left empty for a file with a block index, which is looked in
+        // instead, and for a file with holes
+        mutable std::vector<uint64_t> m_blocks;
+
         // an optional size update callback to be used in setting the reported
         // size in the entry info held in the parent folder entry info cache
         OptionalSizeCallback m_optionalSizeCallback;
@@ -210,6 +333,18 @@ namespace knoxcrypt
         // instantiating a new FileBlock
         mutable SharedImageStream m_stream;
 
+        // blocks set aside so that the file grows contiguously
+        mutable SharedBlockReservation m_blockReservation;
+
+        // blocks allocated up front by reserve, in the order to be used
+        mutable std::deque<uint64_t> m_preallocated;
+
+        // the file's data if it is kept in its folder entry
+        boost::optional<InlineData> m_inline;
+
+        // whether the inline data has changed since it was last stored
+        bool m_inlineDirty;
+
         /**
          * @brief  for keeping track of what the current file block as indicated
          *         by the current working file block
@@ -223,10 +358,128 @@ namespace knoxcrypt
         void newWritableFileBlock() const;
 
         /**
-         * @brief counts the number of blocks and sets file size
+         * @brief links a new block onto the end of the file and makes it
+         *        the working block
+         * @param block the new block
+         */
+        void chainNewWorkingBlock(FileBlock block) const;
+
+        /**
+         * @brief counts the number of blocks and sets file size. A file with
+         *        a block index gets both from the index and its last block
+         *        rather than from going through all of its blocks
          */
         void enumerateBlockStats();
 
+        /// all of the file's volume blocks, in order
+        std::vector<uint64_t> getBlocks() const;
+
+        /**
+         * @brief grows the file to a given size with zeros. Where the file
+         *        has a block index, whole blocks of them are left as holes
+         *        which have no blocks and read back as zeros
+         * @param newSize the size to grow to
+         * @param writeFollows true if data is to be written straight after,
+         *        in which case the file may be left ending in a hole
+         */
+        void extendTo(uint64_t const newSize, bool const writeFollows = false);
+
+        /**
+         * @brief  gives a hole a block of zeros of its own
+         * @param  n the position of the hole within the file
+         * @return the new block
+         */
+        FileBlock fillHole(uint64_t const n) const;
+
+        /**
+         * @brief  gives the file a block of its own in place of one it
+         *         shares with other files, copying the block's data
+         * @param  n the position of the shared block within the file
+         * @return the new block
+         */
+        FileBlock copyOnWrite(uint64_t const n) const;
+
+        /**
+         * @brief  puts a new block holding the given data at a position of
+         *         the file's block index
+         * @param  n the position within the file
+         * @param  data what the new block is to hold
+         * @return the new block
+         */
+        FileBlock replaceBlock(uint64_t const n, std::vector<char> const &data) const;
+
+        /// whether a block is shared with another file and so mustn't be
+        /// written to
+        bool isShared(FileBlock const &block) const;
+
+        /// gives the file an empty block index, which takes its start block
+        void createIndex() const;
+
+        /// see nextData and nextHole
+        boost::iostreams::stream_offset nextDataOrHole(boost::iostreams::stream_offset const off,
+                                                       bool const hole) const;
+
+        /// frees the reserved blocks that haven't been used
+        void releasePreallocatedBlocks();
+
+        /**
+         * @brief frees all of the file's blocks in one batch
+         * @param keepIndexRoot true to keep the root of the file's block
+         *        index, and so its start block, for the file to carry on
+         *        with, e.g., after being truncated on opening
+         */
+        void freeBlocks(bool const keepIndexRoot);
+
+        /**
+         * @brief frees the blocks past the first count, along with any
+         *        block index blocks no longer needed, in one batch
+         * @param count the number of blocks the file now has
+         */
+        void freeTailBlocks(uint64_t const count);
+
+        /**
+         * @brief marks blocks as no longer in use with a single bitmap
+         *        update, punching them out of the image if asked to. Blocks
+         *        still shared with other files are left to them
+         * @param blocks the blocks to free
+         */
+        void releaseBlocks(std::vector<uint64_t> blocks);
+
+        /// the volume block of the file's first block
+        uint64_t getFirstBlock() const;
+
+        /**
+         * @brief  determines whether a write can be held back rather than
+         *         allocated straight away, i.e., whether it appends to the
+         *         end of the file
+         * @return true if the write can be delayed
+         */
+        bool canDelayAllocation() const;
+
+        /**
+         * @brief  computes how many new blocks are needed to append some
+         *         number of bytes to what has already been allocated
+         * @param  bytes the number of bytes to append
+         * @return the number of new blocks
+         */
+        uint64_t blocksNeededFor(uint64_t const bytes) const;
+
+        /**
+         * @brief writes out the data held back from allocation, all blocks
+         *        for which are reserved in one run
+         * @param bytesToFollow the number of bytes about to be appended
+         *        straight after, which the run is made big enough for too
+         */
+        void allocateDelayedData(uint64_t const bytesToFollow = 0);
+
+        /**
+         * @brief  writes bytes block by block, allocating blocks as needed
+         * @param  s buffer that stores the bytes to write
+         * @param  n the number of bytes to write
+         * @return the number of bytes written
+         */
+        std::streamsize writeToBlocks(const char* s, std::streamsize n);
+
         /**
          * @brief  buffers as many bytes as permitted by the working block
          * @param  s the data to buffer
@@ -248,6 +501,16 @@ namespace knoxcrypt
          */
         std::streamsize readWorkingBlockBytes(uint32_t const bytes);
 
+        /**
+         * @brief  reads from the working block on through the blocks after
+         *         it, the reads of all the blocks going out together (see
+         *         ContainerImageStream::readBatch)
+         * @param  s where to put what's read
+         * @param  n the number of bytes to read
+         * @return the number of bytes read
+         */
+        std::streamsize readBlocks(char * const s, std::streamsize const n);
+
 
         /**
          * @brief will build a new file block for writing to if there are
@@ -279,6 +542,13 @@ namespace knoxcrypt
         /// to be called during unlinking and when the data
         /// represents a folder and there are no more entries
         void doReset();
+
+        /**
+         * @brief moves the data of an inline file to file blocks and points
+         *        its folder entry at them; from then on the file is an
+         *        ordinary one
+         */
+        void promoteInlineData();
     };
 
 }
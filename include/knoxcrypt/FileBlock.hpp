@@ -76,6 +76,16 @@ namespace knoxcrypt
                   OpenDisposition const &openDisposition,
                   SharedImageStream const &stream = SharedImageStream());
 
+        /**
+         * @brief for a hole in a file; a hole has no block of its own, is
+         *        always full and reads back as zeros
+         * @param io the core knoxcrypt io (path, blocks, password)
+         * @param openDisposition open mode
+         * @note  a hole can't be written to; it has to be given a block first
+         */
+        FileBlock(SharedCoreIO const &io,
+                  OpenDisposition const &openDisposition);
+
         /**
          * @brief  reads from the current file block
          * @param  buf the buffer to store the read data in
@@ -86,12 +96,20 @@ namespace knoxcrypt
 
         /**
          * @brief  writes to the current file block
+         * @note   the data and any change to the block's size are held on to
+         *         until the block is flushed or read from
          * @param  buf the data to write
          * @param  n the number of bytes to write
          * @return the number of bytes written
          */
         std::streamsize write(char const * const buf, std::streamsize const n) const;
 
+        /**
+         * @brief  writes out any held-on-to data together with the block's
+         *         size and next index
+         */
+        void flush() const;
+
         /**
          * @brief  seeks to a position in this file block
          * @param  off where to seek to given the seek-from type
@@ -133,6 +151,12 @@ namespace knoxcrypt
          */
         uint64_t getIndex() const;
 
+        /**
+         * @brief  is this a hole rather than a block in the volume?
+         * @return true if a hole, false otherwise
+         */
+        bool isHole() const;
+
         /**
          * @brief when the block has been used, it registers itself with the
          *        volume bitmap indicating that it's in use. The block can then
@@ -142,7 +166,7 @@ namespace knoxcrypt
 
         /**
          * @brief when we want to set number of bytes written
-         * useful when truncating
+         * useful when truncating. Written out when the block is flushed
          * @param size the number of bytes written
          */
         void setSize(std::ios_base::streamoff size) const;
@@ -150,7 +174,8 @@ namespace knoxcrypt
         void setSizeOnFlush() const;
 
         /**
-         * @brief sets the next index of 'this'
+         * @brief sets the next index of 'this'. Written out when the block
+         *        is flushed
          * @param nextIndex the next index to set this to
          */
         void setNextIndex(uint64_t nextIndex) const;
@@ -184,6 +209,12 @@ namespace knoxcrypt
          */
         void doSetNextIndex(ContainerImageStream &stream, uint64_t nextIndex) const;
 
+        /**
+         * @brief fills in the block's metadata, size followed by next index
+         * @param meta where to put the metadata
+         */
+        void buildMetaData(uint8_t * const meta) const;
+
         /**
          * @brief check if the image stream pointer is initialized,
          * initializing it if not
@@ -195,7 +226,8 @@ namespace knoxcrypt
         mutable uint32_t m_bytesWritten;
         mutable uint32_t m_initialBytesWritten;
         mutable uint64_t m_next;
-        mutable uint64_t m_offset;
+        mutable uint64_t m_offset;     // where the block's metadata lives
+        mutable uint64_t m_dataOffset; // where the block's data lives
         mutable boost::iostreams::stream_offset m_seekPos;
         mutable boost::iostreams::stream_offset m_positionBeforeWrite;
         OpenDisposition m_openDisposition;
@@ -203,6 +235,16 @@ namespace knoxcrypt
         // used for writing to the underlying image stream
         mutable SharedImageStream m_stream;
 
+        // written data not yet in the image and where in the block it goes
+        mutable std::vector<uint8_t> m_pending;
+        mutable boost::iostreams::stream_offset m_pendingPos;
+
+        // whether the size or next index need writing out
+        mutable bool m_headerDirty;
+
+        // whether this stands in for a hole
+        bool m_hole;
+
     };
 
 }
@@ -35,6 +35,7 @@
 #include <memory>
 
 #include <deque>
+#include <vector>
 
 namespace knoxcrypt
 {
@@ -43,6 +44,20 @@ namespace knoxcrypt
     using SharedBlockBuilder = std::shared_ptr<FileBlockBuilder>;
     using BlockDeque = std::deque<uint64_t>;
 
+    /**
+     * @brief a run of blocks [next, end) set aside for one growing file so
+     *        that its blocks end up contiguous in the image. Other files are
+     *        kept out of the run for as long as the reservation is alive
+     */
+    struct BlockReservation
+    {
+        uint64_t next = 0;
+        uint64_t end = 0;
+        uint64_t wanted = 0; // how many blocks the file is known to still
+                             // need, if more than usual; sizes the next run
+    };
+    using SharedBlockReservation = std::shared_ptr<BlockReservation>;
+
     class FileBlockBuilder
     {
       public:
@@ -54,15 +69,102 @@ namespace knoxcrypt
                                          SharedImageStream &stream,
                                          bool const enforceRootBlock = false);
 
+        /**
+         * @brief  builds a new block for a file that is growing. The block is
+         *         taken from the file's reservation, which is topped up with a
+         *         fresh run of free blocks, starting at goal if possible, when
+         *         it runs out
+         * @param  io the core knoxcrypt io
+         * @param  openDisposition the open mode of the block
+         * @param  stream the image stream
+         * @param  reservation the file's reservation
+         * @param  goal where the block would ideally be, i.e., just after
+         *         the file's previous block
+         * @return the new block
+         */
+        FileBlock buildWritableFileBlock(SharedCoreIO const &io,
+                                         OpenDisposition const &openDisposition,
+                                         SharedImageStream &stream,
+                                         SharedBlockReservation const &reservation,
+                                         uint64_t const goal);
+
         FileBlock buildFileBlock(SharedCoreIO const &io,
                                  uint64_t const index,
                                  OpenDisposition const &openDisposition,
                                  SharedImageStream &stream);
 
+        /**
+         * @brief  allocates a number of blocks in one go, e.g., when a file
+         *         is told how big it will get. The blocks are taken in
+         *         ascending order from goal onwards so that they are
+         *         contiguous where the volume allows
+         * @param  io the core knoxcrypt io
+         * @param  count the number of blocks wanted
+         * @param  goal where the blocks would ideally start
+         * @return the allocated blocks
+         * @throw  KnoxCryptException OutOfSpace if there aren't count free
+         *         blocks, in which case nothing is allocated
+         */
+        std::vector<uint64_t> allocateBlocks(SharedCoreIO const &io,
+                                             uint64_t const count,
+                                             uint64_t const goal);
+
+        /**
+         * @brief  builds a writable block from a block that has already
+         *         been allocated with allocateBlocks
+         * @param  io the core knoxcrypt io
+         * @param  id the allocated block
+         * @param  openDisposition the open mode of the block
+         * @param  stream the image stream
+         * @return the block
+         */
+        FileBlock buildAllocatedFileBlock(SharedCoreIO const &io,
+                                          uint64_t const id,
+                                          OpenDisposition const &openDisposition,
+                                          SharedImageStream &stream);
+
       private:
 
+        /// a bounded window of free blocks, refilled from the volume
+        /// bitmap when it runs dry; never holds more than a few thousand
+        /// blocks whatever the size of the container
         BlockDeque m_blockDeque;
 
+        /// where the window is next filled from, i.e., just past the last
+        /// block it handed out, so that blocks reserved by other files are
+        /// only looked at once per trip round the volume
+        uint64_t m_windowFrom;
+
+        /// the reservations of files that are still being written
+        std::vector<std::weak_ptr<BlockReservation>> m_reservations;
+
+        /// takes the next free block from the window
+        uint64_t takeCachedBlock(SharedCoreIO const &io);
+
+        /// takes any free block that no file has reserved
+        uint64_t takeUnreservedBlock(SharedCoreIO const &io);
+
+        /// is the block reserved by a file other than the given one?
+        bool isReservedByOther(uint64_t const block, BlockReservation const *self);
+
+        /// counts the free, unreserved blocks starting at block, up to limit
+        uint64_t getRunLength(SharedCoreIO const &io,
+                              uint64_t const block,
+                              BlockReservation const *self,
+                              uint64_t const limit);
+
+        /// finds a run of free blocks for a reservation, preferably at goal
+        void reserveRun(SharedCoreIO const &io,
+                        SharedBlockReservation const &reservation,
+                        uint64_t const goal);
+
+        /// builds the block with the given index, writing it out first if it
+        /// lies beyond the end of a sparse image
+        FileBlock buildBlockWithIndex(SharedCoreIO const &io,
+                                      uint64_t const id,
+                                      OpenDisposition const &openDisposition,
+                                      SharedImageStream &stream);
+
         /// store how many blocks have actually been written
         /// when we get a block to use if it is greater than the number
         /// of blocks written then image is probably sparse in which case
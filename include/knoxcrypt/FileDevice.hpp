@@ -42,7 +42,10 @@ namespace knoxcrypt
       public:
 
         typedef char                                   char_type;
-        typedef boost::iostreams::seekable_device_tag  category;
+        struct category
+            : boost::iostreams::seekable_device_tag
+            , boost::iostreams::closable_tag
+        {};
 
         FileDevice() = delete;
         explicit FileDevice(SharedFile const &entry);
@@ -53,6 +56,9 @@ namespace knoxcrypt
         std::streampos tellg() const;
         std::streampos tellp() const;
 
+        /// flushes the file when the stream using the device is closed
+        void close();
+
       private:
         SharedFile m_entry;
     };
@@ -0,0 +1,269 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/CipherPool.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/IoRing.hpp"
+#include "cryptostreampp/CryptoStreamPP.hpp"
+#include "cryptostreampp/EncryptionProperties.hpp"
+
+#include <atomic>
+#include <ios>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace knoxcrypt
+{
+
+    class ImageFile;
+    using SharedImageFile = std::shared_ptr<ImageFile>;
+
+    /**
+     * @brief the container image read and written by offset, with no
+     *        position of its own.
+     *
+     * Reads and writes go straight to the host file with pread and pwrite
+     * and are deciphered or enciphered in memory with the keystream for
+     * their offset, so any number of threads can use the one descriptor at
+     * once. The transformers keep state as they go, so each thread takes
+     * one of its own for as long as it's deciphering or enciphering. Every
+     * ContainerImageStream on an image shares the one ImageFile (see
+     * ContainerImageStream::readAt and writeAt).
+     *
+     * With io->mapImage set, the image is mapped into memory instead and
+     * read and written through the mapping: a read deciphers straight from
+     * the mapped pages into the caller's buffer and a write enciphers
+     * straight into them, with no system call on the way. The mapping is
+     * grown as the image grows; anything still past its end is read and
+     * written with pread and pwrite. The image must not be shrunk while it
+     * is mapped.
+     *
+     * Where the host has io_uring (see IoRing) and io->ioUring is set, the
+     * reads of a readBatch all go to the kernel together, and the writes made
+     * between beginBatch and endBatch are handed over as they come without
+     * being waited on. Without it, or for a mapped image, the same calls read
+     * and write one stretch after another.
+     *
+     * With io->cipherThreads above one, a transfer large enough to be worth it
+     * (see enciphersInParallel) is enciphered or deciphered by a CipherPool,
+     * as are the stretches of a readBatch taken together. The writes made
+     * between beginBatch and endBatch are then held on to and enciphered
+     * together once enough of them have built up, or when the image is next
+     * read. Smaller transfers are done by the calling thread alone.
+     */
+    class ImageFile
+    {
+      public:
+        /// a stretch of the image read as part of a batch
+        struct Transfer
+        {
+            uint64_t offset;
+            char *buf;
+            std::streamsize n;
+        };
+
+        ImageFile() = delete;
+
+        /**
+         * @brief opens the image at io->path for reading and, if allowed,
+         *        writing, and maps it if io->mapImage is set
+         * @param io the core knoxcrypt io (path, blocks, password)
+         */
+        explicit ImageFile(SharedCoreIO const &io);
+
+        ~ImageFile();
+
+        ImageFile(ImageFile const &) = delete;
+        ImageFile &operator=(ImageFile const &) = delete;
+
+        /**
+         * @brief  retrieves the open image at io->path, opening it if it
+         *         isn't open already; images mapped or not, batching with
+         *         io_uring or not, or with different numbers of cipher
+         *         threads are kept apart
+         * @param  io the core knoxcrypt io (path, blocks, password)
+         * @return the open image
+         */
+        static SharedImageFile open(SharedCoreIO const &io);
+
+        /// whether the image could be opened
+        bool isOpen() const;
+
+        /// whether the image is read and written through a memory mapping
+        bool isMapped() const;
+
+        /// whether a transfer of n bytes is enciphered or deciphered by more
+        /// than one thread
+        bool enciphersInParallel(std::streamsize const n) const;
+
+        /**
+         * @brief  reads and deciphers bytes of the image
+         * @param  offset where in the image to read from
+         * @param  buf where to put what's read
+         * @param  n the number of bytes to read
+         * @return the number of bytes read; fewer than n at the end of the
+         *         image, -1 on failure
+         */
+        std::streamsize readAt(uint64_t const offset, char * const buf, std::streamsize const n) const;
+
+        /**
+         * @brief  enciphers and writes bytes to the image
+         * @param  offset where in the image to write to
+         * @param  buf the data to write
+         * @param  n the number of bytes to write
+         * @return the number of bytes written; -1 on failure
+         */
+        std::streamsize writeAt(uint64_t const offset, char const * const buf, std::streamsize const n) const;
+
+        /**
+         * @brief hands what has been written through the mapping to the
+         *        host, much as flushing a stream does; nothing to do if the
+         *        image isn't mapped
+         */
+        void sync() const;
+
+        /**
+         * @brief  reads and deciphers several stretches of the image. Each
+         *         stretch is deciphered as soon as it has been read, while
+         *         the others may still be being read
+         * @param  transfers the stretches, which mustn't overlap
+         * @return false if any stretch couldn't be read in full, e.g. for
+         *         going past the end of the image
+         */
+        bool readBatch(std::vector<Transfer> const &transfers) const;
+
+        /**
+         * @brief starts a batch of writes: until the batch is ended, writeAt
+         *        enciphers the data and hands it to the kernel without
+         *        waiting for it to be written. A read of the image waits
+         *        for the writes first. Batches may be nested
+         */
+        void beginBatch() const;
+
+        /**
+         * @brief  ends a batch of writes, waiting for them once the outermost
+         *         batch is ended
+         * @return false if any of the batch's writes failed
+         */
+        bool endBatch() const;
+
+      private:
+        int m_fd;
+        cryptostreampp::EncryptionProperties m_encProps;
+        UniqueCipherPool m_pool;
+        bool m_writable;
+
+        // the mapping; only remapped under an exclusive lock
+        bool m_mapImage;
+        mutable char *m_map;
+        mutable uint64_t m_mapped;
+        mutable uint64_t m_size; // how much of the mapping the image covers
+        mutable std::shared_timed_mutex m_mapMutex;
+        mutable std::atomic<bool> m_mapDirty;
+
+        // the ring, set up the first time it's wanted, and the writes it has
+        // yet to complete, keyed by tag
+        struct PendingWrite
+        {
+            uint64_t offset;
+            std::vector<char> data;
+            struct iovec iov;
+        };
+        bool m_ringAllowed;
+        mutable bool m_ringTried;
+        mutable UniqueIoRing m_ring;
+        mutable std::mutex m_ringMutex;
+        mutable std::map<uint64_t, PendingWrite> m_writes;
+        mutable std::atomic<bool> m_writesPending;
+        mutable uint64_t m_nextTag;
+        mutable unsigned m_unsubmitted;
+        mutable int m_batchDepth;
+        mutable bool m_batchFailed;
+
+        // the plain text of a batch's writes, held on to until it's
+        // enciphered together by the pool
+        mutable std::vector<PendingWrite> m_held;
+        mutable std::streamsize m_heldBytes;
+        mutable uint64_t m_heldEnd; // where the furthest of them ends
+
+        // the transformers no thread is using at the moment
+        mutable std::mutex m_cipherMutex;
+        mutable std::vector<cryptostreampp::SharedByteTransformer> m_idleCiphers;
+
+        /// the ring, if there is one to be had; with m_ringMutex held
+        IoRing *ring() const;
+
+        /// hands an enciphered write to the ring; with m_ringMutex held
+        bool queueWrite(uint64_t const offset, std::vector<char> &&data) const;
+
+        /// takes in completed writes, waiting for some; with m_ringMutex held
+        void reapWrites(unsigned const waitFor) const;
+
+        /// waits for every outstanding write, held ones included unless
+        /// they all end by from, before which they can't be seen; with
+        /// m_ringMutex held
+        void drainWrites(uint64_t const from = 0) const;
+
+        /// enciphers the held writes together and writes them; with
+        /// m_ringMutex held
+        void releaseHeld() const;
+
+        /// writes already enciphered bytes, through the mapping if they fit
+        std::streamsize putEnciphered(uint64_t const offset, char const * const data,
+                                      std::streamsize const n) const;
+
+        /// a transformer no other thread is using, made if none is to spare
+        cryptostreampp::SharedByteTransformer takeCipher() const;
+
+        /// hands back a transformer had from takeCipher
+        void giveBackCipher(cryptostreampp::SharedByteTransformer const &cipher) const;
+
+        /// enciphers or deciphers the pieces, with the pool if they're large
+        /// enough together
+        void encipher(std::vector<CipherPool::Piece> const &pieces) const;
+        void decipher(std::vector<CipherPool::Piece> const &pieces) const;
+
+        /// gives up on the ring, doing what it had yet to do directly; with
+        /// m_ringMutex held
+        void abandonRing() const;
+
+        /// maps the image again if it has grown past the mapping
+        void growMapping() const;
+
+        /// unmaps the image
+        void unmap() const;
+    };
+
+}
@@ -0,0 +1,126 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+namespace knoxcrypt
+{
+
+    class IoRing;
+    using UniqueIoRing = std::unique_ptr<IoRing>;
+
+    /**
+     * @brief a Linux io_uring submission and completion queue pair, driven
+     *        with the raw system calls so as to need nothing beyond the
+     *        kernel headers.
+     *
+     * Reads and writes are queued with push, handed to the kernel with
+     * submit, and picked up again with pop as they complete, in whatever
+     * order that is. Not thread safe; see ImageFile for its one user.
+     */
+    class IoRing
+    {
+      public:
+        IoRing(IoRing const &) = delete;
+        IoRing &operator=(IoRing const &) = delete;
+
+        ~IoRing();
+
+        /**
+         * @brief  sets up a ring
+         * @param  entries how many operations can be queued at once
+         * @return the ring; null if the host doesn't have io_uring or won't
+         *         let it be used, in which case the caller does its reads
+         *         and writes itself
+         */
+        static UniqueIoRing create(unsigned const entries);
+
+        /// how many operations can be outstanding at once
+        unsigned capacity() const;
+
+        /**
+         * @brief  queues a read or write, to be handed to the kernel with
+         *         the next submit
+         * @param  write whether to write rather than read
+         * @param  fd the file to read or write
+         * @param  iov what to read into or write from; has to stay put until
+         *         the operation completes
+         * @param  offset where in the file
+         * @param  tag given back by pop when the operation completes
+         * @param  ordered whether the operation has to wait for all those
+         *         queued before it to complete before it starts
+         * @return false if the queue is full
+         */
+        bool push(bool const write, int const fd, struct iovec const * const iov,
+                  uint64_t const offset, uint64_t const tag, bool const ordered = false);
+
+        /**
+         * @brief  hands what has been queued to the kernel
+         * @param  waitFor how many completions to wait for
+         * @return false if the kernel refused
+         */
+        bool submit(unsigned const waitFor);
+
+        /**
+         * @brief  takes a completed operation off the completion queue
+         * @param  tag the tag the operation was pushed with
+         * @param  result bytes read or written, or minus the error number
+         * @return false if nothing has completed
+         */
+        bool pop(uint64_t &tag, int &result);
+
+      private:
+        IoRing();
+
+        int m_fd;
+        unsigned m_entries;
+        unsigned m_unsubmitted;
+
+        // the mapped rings and the kernel's indices into them
+        void *m_sqRing;
+        size_t m_sqRingSize;
+        void *m_cqRing;
+        size_t m_cqRingSize;
+        void *m_sqes;
+        size_t m_sqesSize;
+        unsigned *m_sqHead;
+        unsigned *m_sqTail;
+        unsigned *m_sqMask;
+        unsigned *m_sqArray;
+        unsigned *m_cqHead;
+        unsigned *m_cqTail;
+        unsigned *m_cqMask;
+        void *m_cqes;
+    };
+
+}
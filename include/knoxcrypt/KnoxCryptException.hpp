@@ -33,7 +33,7 @@
 namespace knoxcrypt
 {
 
-    enum class KnoxCryptError { NotFound, AlreadyExists, IllegalFilename, FolderNotEmpty };
+    enum class KnoxCryptError { NotFound, AlreadyExists, IllegalFilename, FolderNotEmpty, OutOfSpace };
 
     class KnoxCryptException : public std::exception
     {
@@ -63,6 +63,10 @@ namespace knoxcrypt
                 return "KnoxCrypt: Folder not empty";
             }
 
+            if (m_error == KnoxCryptError::OutOfSpace) {
+                return "KnoxCrypt: No free blocks left";
+            }
+
             return "KnoxCrypt: Unknown error";
         }
 
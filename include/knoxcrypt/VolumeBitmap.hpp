@@ -0,0 +1,222 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <boost/optional.hpp>
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class VolumeBitmap;
+    using SharedVolumeBitmap = std::shared_ptr<VolumeBitmap>;
+
+    /**
+     * @brief a resident, decrypted copy of the container's volume bitmap.
+     *
+     * The bitmap is read in once, when first needed. Allocations
+     * and deallocations only touch the in-memory copy and record which byte
+     * ranges have changed. The changed ranges are coalesced and written back
+     * to the image at sync points (file flush, unlink, unmount).
+     *
+     * There is at most one resident bitmap per container per process so that
+     * several CoreIO handles onto the same image never hand out the same block.
+     *
+     * Searches for free blocks are guided by a free-space summary built over
+     * the bitmap's 64-bit words. Each summary level has one 'has free' bit per
+     * word of the level below: per bitmap word, per chunk of 64 words, per
+     * region of 64 chunks and so on up to a single top-level word. Full parts
+     * of the volume are therefore skipped without being looked at.
+     *
+     * The bitmap also owns the 8-byte volume state stored directly after it,
+     * which holds the free block count and a clean unmount flag. A container
+     * that was cleanly unmounted can be mounted without reading the bitmap.
+     */
+    class VolumeBitmap
+    {
+      public:
+        using OptionalBlock = boost::optional<uint64_t>;
+
+        VolumeBitmap() = delete;
+
+        /**
+         * @brief prepares access to the volume bitmap of the container
+         * @param io the core knoxcrypt io (path, blocks, password)
+         */
+        explicit VolumeBitmap(SharedCoreIO const &io);
+
+        /// writes back any outstanding changes
+        ~VolumeBitmap();
+
+        /**
+         * @brief  retrieves the resident bitmap of the container at io->path,
+         *         reading it in if it isn't resident already
+         * @param  io the core knoxcrypt io (path, blocks, password)
+         * @param  reread true to discard any resident copy, e.g., when the
+         *         image has just been built
+         * @return the resident bitmap
+         */
+        static SharedVolumeBitmap load(SharedCoreIO const &io, bool const reread = false);
+
+        /**
+         * @brief  determines whether a file block is in use
+         * @param  block the block to query
+         * @return true if allocated, false otherwise
+         */
+        bool isBlockInUse(uint64_t const block) const;
+
+        /**
+         * @brief sets or clears the bit representing a block
+         * @param block the block to update
+         * @param set true to mark as in use, false to mark as free
+         */
+        void setBlockInUse(uint64_t const block, bool const set = true);
+
+        /**
+         * @brief sets or clears the bits representing a run of blocks
+         * @param first the first block to update
+         * @param last one past the final block to update
+         * @param set true to mark as in use, false to mark as free
+         */
+        void setBlockRangeInUse(uint64_t const first, uint64_t const last, bool const set = true);
+
+        /**
+         * @brief sets or clears the bits representing a batch of blocks,
+         *        e.g., all blocks of a file being unlinked. The affected
+         *        bitmap bytes are marked dirty run by run rather than
+         *        block by block
+         * @param blocks the blocks to update, in any order
+         * @param set true to mark as in use, false to mark as free
+         */
+        void setBlocksInUse(std::vector<uint64_t> blocks, bool const set = true);
+
+        /**
+         * @brief  finds the first free block at or after a given block,
+         *         wrapping around to the start of the volume if necessary
+         * @param  from where to start looking
+         * @return the block index or an empty optional if the volume is full
+         */
+        OptionalBlock getNextAvailableBlock(uint64_t const from = 0) const;
+
+        /**
+         * @brief  finds up to blocksRequired free blocks in ascending order
+         *         starting at a given block and wrapping around if necessary
+         * @param  blocksRequired the number of blocks wanted
+         * @param  from where to start looking
+         * @return the free blocks; fewer than requested if the volume is
+         *         nearly full
+         */
+        std::vector<uint64_t> getNAvailableBlocks(uint64_t const blocksRequired,
+                                                  uint64_t const from = 0) const;
+
+        /**
+         * @brief  counts the number of allocated blocks
+         * @return the number of allocated blocks
+         */
+        uint64_t getNumberOfAllocatedBlocks() const;
+
+        /**
+         * @brief writes all changed byte ranges back to the image
+         */
+        void sync();
+
+        /**
+         * @brief  marks the container as in use and works out how many of
+         *         its blocks are free. The stored free block count is trusted
+         *         if the container was cleanly unmounted; otherwise the
+         *         bitmap is read in and counted
+         * @return the number of free blocks
+         */
+        uint64_t mount();
+
+        /**
+         * @brief writes back any outstanding changes together with the free
+         *        block count and marks the container as cleanly unmounted
+         * @param freeBlocks the number of free blocks
+         */
+        void unmount(uint64_t const freeBlocks);
+
+      private:
+
+        // used for reading in and writing back the bitmap
+        SharedImageStream m_stream;
+
+        // total number of blocks in the container
+        uint64_t m_blocks;
+
+        // the size of the bitmap as stored in the image
+        uint64_t m_byteCount;
+
+        // the bitmap and its summary are read in on first use so that
+        // a cleanly unmounted container mounts without reading them
+        mutable bool m_resident;
+
+        // the decrypted bitmap; bit b of word n represents block 64n + b.
+        // Bits beyond the final byte of the on-disk bitmap read as 'in use'
+        mutable std::vector<uint64_t> m_words;
+
+        // the free-space summary; m_summary[0] holds a bit per bitmap word
+        // and the last level is a single word
+        using SummaryLevel = std::vector<uint64_t>;
+        mutable std::vector<SummaryLevel> m_summary;
+
+        // ranges of on-disk bytes [first, second) that differ from the image.
+        // Ranges are kept disjoint and are merged when they touch
+        using DirtyRanges = std::map<uint64_t, uint64_t>;
+        DirtyRanges m_dirty;
+
+        void markDirty(uint64_t const first, uint64_t const last);
+
+        /// reads in the bitmap and builds its summary if not done already
+        void makeResident() const;
+
+        /// writes the volume state word that follows the bitmap
+        void writeVolumeState(uint64_t const state);
+
+        /// builds all summary levels from the bitmap
+        void buildSummary() const;
+
+        /// updates the summary after bitmap word n has changed
+        void updateSummary(uint64_t const n);
+
+        /// finds the first set bit at or after index in a summary level
+        OptionalBlock findNextSummaryBit(size_t const level, uint64_t const index) const;
+
+        /// finds the first free block at or after block without wrapping around
+        OptionalBlock findAvailableBlockFrom(uint64_t const block) const;
+    };
+
+}
@@ -0,0 +1,159 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <boost/optional.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+namespace knoxcrypt { namespace detail
+{
+
+    /**
+     * Kernels for scanning and updating the volume bitmap a 64-bit word at a
+     * time. Bit b of word n represents block 64n + b. The heavy lifting is
+     * done with AVX-512 or AVX2 instructions where the CPU supports them,
+     * chosen once at runtime, with a scalar fallback everywhere else.
+     */
+
+    /// the implementations the kernels can be run with
+    enum class BitmapKernel { Scalar, AVX2, AVX512 };
+
+    /**
+     * @brief  determines whether a kernel implementation can run on this CPU
+     * @param  kernel the implementation to query
+     * @return true if supported, false otherwise
+     */
+    bool isBitmapKernelSupported(BitmapKernel const kernel);
+
+    /**
+     * @brief  gets the implementation currently in use. Defaults to the
+     *         fastest one supported by the CPU
+     * @return the implementation
+     */
+    BitmapKernel getBitmapKernel();
+
+    /**
+     * @brief forces a particular (supported) implementation; only intended
+     *        for testing and benchmarking and not thread-safe
+     * @param kernel the implementation to use
+     */
+    void setBitmapKernel(BitmapKernel const kernel);
+
+    /**
+     * @brief  counts the set bits of a run of words
+     * @param  words the bitmap words
+     * @param  count the number of words
+     * @return the number of set bits
+     */
+    uint64_t countSetBits(uint64_t const *words, uint64_t const count);
+
+    /**
+     * @brief  finds the first clear bit at or after a given bit
+     * @param  words the bitmap words
+     * @param  count the number of words
+     * @param  from the bit to start looking at
+     * @return the index of the bit or an empty optional if all are set
+     */
+    using OptionalBit = boost::optional<uint64_t>;
+    OptionalBit findFirstClearBit(uint64_t const *words,
+                                  uint64_t const count,
+                                  uint64_t const from = 0);
+
+    /**
+     * @brief finds up to n clear bits at or after a given bit
+     * @param words the bitmap words
+     * @param count the number of words
+     * @param from the bit to start looking at
+     * @param n the number of clear bits wanted
+     * @param found the indices of the clear bits are appended to this in
+     *        ascending order; fewer than n if not enough are clear
+     */
+    void findClearBits(uint64_t const *words,
+                       uint64_t const count,
+                       uint64_t const from,
+                       uint64_t const n,
+                       std::vector<uint64_t> &found);
+
+    /**
+     * @brief sets or clears the bits [first, last)
+     * @param words the bitmap words
+     * @param first the first bit to update
+     * @param last one past the final bit to update
+     * @param set true to set the bits, false to clear them
+     */
+    void setBitRange(uint64_t *words,
+                     uint64_t const first,
+                     uint64_t const last,
+                     bool const set = true);
+
+    /**
+     * @brief converts bitmap bytes as stored in the image into words.
+     *        Bits beyond the final byte are set so they never read as free
+     * @param bytes the bitmap bytes; bit b of byte n represents block 8n + b
+     * @param byteCount the number of bytes
+     * @param words receives the words
+     */
+    inline void convertBitmapBytesToWords(uint8_t const *bytes,
+                                          uint64_t const byteCount,
+                                          std::vector<uint64_t> &words)
+    {
+        words.assign((byteCount + 7) / 8, ~uint64_t(0));
+        for (uint64_t w = 0; w < words.size(); ++w) {
+            uint64_t word(0);
+            for (int i = 7; i >= 0; --i) {
+                uint64_t const byte = (w * 8) + i;
+                word = (word << 8) | (byte < byteCount ? bytes[byte] : 0xFF);
+            }
+            words[w] = word;
+        }
+    }
+
+    /**
+     * @brief converts a range of bitmap words back into bytes as stored in
+     *        the image
+     * @param words the bitmap words
+     * @param firstByte the first byte of the range
+     * @param byteCount the number of bytes in the range
+     * @param bytes receives the bytes
+     */
+    inline void convertBitmapWordsToBytes(uint64_t const *words,
+                                          uint64_t const firstByte,
+                                          uint64_t const byteCount,
+                                          uint8_t *bytes)
+    {
+        for (uint64_t i = 0; i < byteCount; ++i) {
+            uint64_t const byte = firstByte + i;
+            bytes[i] = uint8_t(words[byte / 8] >> ((byte % 8) * 8));
+        }
+    }
+
+}
+}
@@ -32,7 +32,9 @@
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <stdint.h>
 #include <vector>
 
@@ -52,10 +54,73 @@ namespace knoxcrypt { namespace detail
         return beginning()                 // where main start after IV
             + 8                            // number of fs blocks
             + volumeBitMapBytes            // volume bit map
-            + 8                            // total number of files
+            + 8                            // volume state
             + (blockSize * block);   // file block
     }
 
+    /// stands in for a block in a file's block index where the file has a
+    /// hole; no block is allocated for it and it reads back as zeros
+    uint64_t const HOLE_BLOCK = std::numeric_limits<uint64_t>::max();
+
+    /// data blocks of an aligned container start on at least this boundary
+    uint64_t const PAGE_ALIGNMENT = 4096;
+
+    /**
+     * @brief gets the offset at which the run of blocks begins
+     * @note in an aligned container the block metadata table comes first
+     * and the blocks are padded to the next page or block boundary
+     * @param io the core io data structure
+     * @return the offset of block 0
+     */
+    inline uint64_t getOffsetOfBlockArea(SharedCoreIO const &io)
+    {
+        uint64_t const start = getOffsetOfFileBlock(io->blockSize, 0, io->blocks);
+        if (!io->alignedBlocks) {
+            return start;
+        }
+        uint64_t const alignment = std::max(uint64_t(io->blockSize), PAGE_ALIGNMENT);
+        uint64_t const tableEnd = start + (io->blocks * FILE_BLOCK_META);
+        return ((tableEnd + alignment - 1) / alignment) * alignment;
+    }
+
+    /**
+     * @brief gets the offset of a block's size and next-index metadata
+     * @param io the core io data structure
+     * @param block the block whose metadata offset is wanted
+     * @return the offset of the block's metadata
+     */
+    inline uint64_t getOffsetOfBlockHeader(SharedCoreIO const &io, uint64_t const block)
+    {
+        if (io->alignedBlocks) {
+            return getOffsetOfFileBlock(io->blockSize, 0, io->blocks) + (block * FILE_BLOCK_META);
+        }
+        return getOffsetOfFileBlock(io->blockSize, block, io->blocks);
+    }
+
+    /**
+     * @brief gets the offset of a block's data bytes
+     * @param io the core io data structure
+     * @param block the block whose data offset is wanted
+     * @return the offset of the block's data
+     */
+    inline uint64_t getOffsetOfBlockData(SharedCoreIO const &io, uint64_t const block)
+    {
+        if (io->alignedBlocks) {
+            return getOffsetOfBlockArea(io) + (block * io->blockSize);
+        }
+        return getOffsetOfFileBlock(io->blockSize, block, io->blocks) + FILE_BLOCK_META;
+    }
+
+    /**
+     * @brief gets the number of data bytes that fit in one block
+     * @param io the core io data structure
+     * @return the block size less any in-block metadata
+     */
+    inline uint32_t getBlockWriteSpace(SharedCoreIO const &io)
+    {
+        return io->alignedBlocks ? io->blockSize : io->blockSize - FILE_BLOCK_META;
+    }
+
     /**
      * @brief gets the next file block index from the given file block
      * @param in the knoxcrypt image stream
@@ -69,9 +134,8 @@ namespace knoxcrypt { namespace detail
                                                           uint64_t const totalBlocks)
     {
         auto offset = getOffsetOfFileBlock(blockSize, n, totalBlocks) + 4;
-        (void)in.seekg(offset);
         uint8_t dat[8];
-        (void)in.read((char*)dat, 8);
+        (void)in.readAt(offset, (char*)dat, 8);
         return convertInt8ArrayToInt64(dat);
     }
 
@@ -88,12 +152,31 @@ namespace knoxcrypt { namespace detail
                                                             uint64_t const totalBlocks)
     {
         uint64_t offset = getOffsetOfFileBlock(blockSize, n, totalBlocks);
-        (void)in.seekg(offset);
         uint8_t dat[4];
-        (void)in.read((char*)dat, 4);
+        (void)in.readAt(offset, (char*)dat, 4);
         return convertInt4ArrayToInt32(dat);
     }
 
+    /**
+     * @brief write the metadata of an empty, unlinked file block to disk
+     * @param io the core io data structure
+     * @param out the image stream to write to
+     * @param block the block whose metadata is written
+     */
+    inline void writeBlockHeader(SharedCoreIO const &io, ContainerImageStream &out, uint64_t const block)
+    {
+        uint8_t meta[FILE_BLOCK_META];
+
+        // m_bytesWritten; 0 to begin with
+        uint32_t size = 0;
+        convertInt32ToInt4Array(size, meta);
+
+        // m_next; begins as same as index
+        convertUInt64ToInt8Array(block, meta + 4);
+
+        (void)out.writeAt(getOffsetOfBlockHeader(io, block), (char*)meta, FILE_BLOCK_META);
+    }
+
     /**
      * @brief write a given file block to disk
      * @param io the core io data structure
@@ -103,27 +186,13 @@ namespace knoxcrypt { namespace detail
     inline void writeBlock(SharedCoreIO const &io, ContainerImageStream &out, uint64_t const block)
     {
         std::vector<uint8_t> ints;
-        ints.assign(io->blockSize - FILE_BLOCK_META, 0);
+        ints.assign(getBlockWriteSpace(io), 0);
 
         // write out block metadata
-        uint64_t offset = getOffsetOfFileBlock(io->blockSize, block, io->blocks);
-        (void)out.seekp(offset);
-
-        // write m_bytesWritten; 0 to begin with
-        uint8_t sizeDat[4];
-        uint32_t size = 0;
-        convertInt32ToInt4Array(size, sizeDat);
-        (void)out.write((char*)sizeDat, 4);
-
-        // write m_next; begins as same as index
-        uint8_t nextDat[8];
-        convertUInt64ToInt8Array(block, nextDat);
-        (void)out.write((char*)nextDat, 8);
+        writeBlockHeader(io, out, block);
 
         // write data bytes
-        (void)out.write((char*)&ints.front(), io->blockSize - FILE_BLOCK_META);
-
-        assert(!out.bad());
+        (void)out.writeAt(getOffsetOfBlockData(io, block), (char*)&ints.front(), ints.size());
     }
 }
 }
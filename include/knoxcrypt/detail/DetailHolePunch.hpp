@@ -0,0 +1,73 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace knoxcrypt { namespace detail
+{
+
+    /**
+     * Giving the space of freed blocks back to the host file system by
+     * punching holes in the container image, so that a sparse container
+     * shrinks when data is deleted rather than only ever growing. A punched
+     * block reads back as zeros, which is harmless: it is free, and its
+     * metadata is written afresh when it is next handed out.
+     *
+     * Only whole host file system pages are actually released, so the gain
+     * comes from runs of several blocks. Where hole punching isn't available
+     * (non-Linux hosts, file systems without support) nothing happens.
+     */
+
+    /// can holes be punched on this platform at all?
+    bool isHolePunchingSupported();
+
+    /**
+     * @brief  gives the space of freed blocks back to the host. The blocks
+     *         are sorted into contiguous runs and each run is released with
+     *         a single call
+     * @param  io the core knoxcrypt io
+     * @param  blocks the freed blocks, in any order
+     * @return the number of blocks whose space was released
+     */
+    uint64_t punchHoles(SharedCoreIO const &io, std::vector<uint64_t> blocks);
+
+    /**
+     * @brief  gives the space of every free block back to the host, e.g.,
+     *         as a trim pass over a container whose deletes weren't punched
+     * @param  io the core knoxcrypt io
+     * @return the number of blocks whose space was released
+     */
+    uint64_t punchFreeBlocks(SharedCoreIO const &io);
+
+}
+}
@@ -29,9 +29,11 @@
 #pragma once
 
 #include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/detail/DetailBitmapKernels.hpp"
 
 #include <boost/optional.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
@@ -278,22 +280,11 @@ namespace knoxcrypt { namespace detail
         buf.assign(bytes, 0);
         (void)in.read((char*)&buf.front(), bytes);
 
-        // note this is quicker than calling isBlockInUse repeatedly
-        uint64_t allocatedBlocks(0);
-        for (uint64_t byte = 0; byte < bytes; ++byte) {
-            uint8_t dat = buf[byte];
-            if(dat == 0xFF) {
-                allocatedBlocks += 8;
-                continue;
-            } 
-            for(int i = 0; i < 8; ++i) {
-                if(isBitSetInByte(dat, i)) {
-                    ++allocatedBlocks;
-                }
-            }
-        }
-
-        return allocatedBlocks;
+        // count a word at a time
+        std::vector<uint64_t> words;
+        convertBitmapBytesToWords(buf.data(), bytes, words);
+        uint64_t const padding = (words.size() * 64) - (bytes * 8);
+        return countSetBits(words.data(), words.size()) - padding;
     }
 
     /**
@@ -320,30 +311,9 @@ namespace knoxcrypt { namespace detail
         (void)in.read((char*)&buf.front(), bytes);
 
         // find out the next available bit
-        uint64_t bitCounter(0);
-
-        for (uint64_t i = 0; i < bytes; ++i) {
-            int availableBit = getNextAvailableBitInAByte(buf[i]);
-            if(availableBit > -1) {
-                bitCounter += availableBit;
-                break;
-            }
-            bitCounter += 8;
-        }
-
-        // no available blocks found
-        if (bitCounter == blocks) {
-            return OptionalBlock();
-        }
-
-        // next available block == bitCounter
-        // derive offset from bit counter. Note blocks
-        // to be stored starting at 0 index.
-        // Metadata starts at 8 (block count) + 8 (file count)
-        // + bytes (volume bit map size) + meta data size
-        //uint64_t const offset = 8 + 8 + bytes + getMetaDataSize(blocks) + (FILE_BLOCK_SIZE * bitCounter);
-
-        return OptionalBlock(bitCounter);
+        std::vector<uint64_t> words;
+        convertBitmapBytesToWords(buf.data(), bytes, words);
+        return findFirstClearBit(words.data(), words.size());
     }
 
 
@@ -369,41 +339,56 @@ namespace knoxcrypt { namespace detail
 
 
         // find n available blocks
-        uint64_t eightCounter(0);
-        std::vector<uint64_t> bitBuffer(blocksRequired);
-        uint64_t filled(0);
-        for (uint64_t i = 0; i < bytes; ++i) {
-            // only continue if at least one bit available
-            if(buf[i] != 0xFF) {
-                for (int b = 0; b < 8; ++b) {
-                    if(!isBitSetInByte(buf[i], b)) {
-                        bitBuffer[filled] = b + eightCounter;
-                        ++filled;
-                        if (filled == blocksRequired) {
-                            return bitBuffer;
-                        }
-                    }
-                }
-            } 
-            
-            eightCounter += 8;
-        }
+        std::vector<uint64_t> words;
+        convertBitmapBytesToWords(buf.data(), bytes, words);
+        std::vector<uint64_t> bitBuffer;
+        bitBuffer.reserve(blocksRequired);
+        findClearBits(words.data(), words.size(), 0, blocksRequired, bitBuffer);
+        bitBuffer.resize(blocksRequired);
         return bitBuffer; // return all blocks that could be found
     }
 
     /**
-     * @brief updates the volume bit map with newly allocated file blocks
+     * @brief updates the volume bit map with a batch of allocated or freed
+     *        file blocks. Blocks are grouped into runs of nearby bitmap bytes
+     *        and each run is read, modified and written back once
      * @param in the knoxcrypt image stream
-     * @param blocksUsed a vector of newly allocated file block indices
+     * @param blocksUsed a vector of file block indices, in any order
      * @param totalBlocks total number of fs blocks
+     * @param set true to mark the blocks as in use, false to mark as free
      */
     inline void updateVolumeBitmap(ContainerImageStream &in,
-                                   std::vector<uint64_t> const &blocksUsed,
-                                   uint64_t const totalBlocks)
+                                   std::vector<uint64_t> blocksUsed,
+                                   uint64_t const,// totalBlocks,
+                                   bool const set = true)
     {
-        for (auto const & it : blocksUsed) {
-            setBlockToInUse(it, totalBlocks, in);
+        if (blocksUsed.empty()) {
+            return;
+        }
+        std::sort(blocksUsed.begin(), blocksUsed.end());
+
+        // bytes this close together are cheaper to rewrite than to seek past
+        uint64_t const gap = 64;
+        std::vector<uint8_t> bytes;
+        auto it = blocksUsed.begin();
+        while (it != blocksUsed.end()) {
+            // find the extent of the run of bytes starting at this block
+            auto runEnd = it;
+            uint64_t lastByte = *it / 8;
+            for (++runEnd; runEnd != blocksUsed.end() && *runEnd / 8 <= lastByte + gap; ++runEnd) {
+                lastByte = *runEnd / 8;
+            }
+            uint64_t const firstByte = *it / 8;
+            bytes.resize(lastByte - firstByte + 1);
+            (void)in.seekg(beginning() + 8 + firstByte);
+            (void)in.read((char*)&bytes.front(), bytes.size());
+            for (; it != runEnd; ++it) {
+                setBitInByte(bytes[*it / 8 - firstByte], *it % 8, set);
+            }
+            (void)in.seekp(beginning() + 8 + firstByte);
+            (void)in.write((char*)&bytes.front(), bytes.size());
         }
+        in.flush();
     }
 
     /**
@@ -420,36 +405,6 @@ namespace knoxcrypt { namespace detail
         setBlockToInUse(blockUsed, totalBlocks, in, set);
     }
 
-    /**
-     * @brief  checks the g position of the stream and updates if necessary
-     * @param  stream the stream to update
-     * @param  offset the position to seek to
-     * @return true seeking was successful, false otherwise
-     */
-    inline bool checkAndSeekG(ContainerImageStream &stream, std::streamoff offset)
-    {
-        if(stream.tellg() != offset) {
-            bool bad = stream.seekg(offset).bad();
-            return (!bad);
-        }
-        return true;
-    }
-
-    /**
-     * @brief checks the p position of the stream and updates if necessary
-     * @param stream the stream to update
-     * @param offset the position to seek to
-     * @return true seeking was successful, false otherwise
-     */
-    inline bool checkAndSeekP(ContainerImageStream &stream, std::streamoff offset)
-    {
-        if(stream.tellp() != offset) {
-            bool bad = stream.seekp(offset).bad();
-            return (!bad);
-        }
-        return true;
-    }
-
     /**
      * @brief reads the initialization vector and number of encryption rounds
      * from a knoxcrypt image and sets the io's iv and rounds fields accordingly
@@ -528,12 +483,28 @@ namespace knoxcrypt { namespace detail
         // store the filesystem's block-size which should be read
         // in when reading the filesystem. Prior to this, the block
         // size is always 4096.
+        //
+        // Versions above 20 add optional features, one bit each on top
+        // of 20: bit 0 (version 21) gives each file an on-disk index of
+        // its blocks (see BlockIndex); a file's start block is then the
+        // root of its index. Bit 1 (version 22) keeps block metadata in a
+        // table of its own so that data blocks are page-aligned (see
+        // getOffsetOfBlockData). Bit 2 (version 24) lets small files be
+        // kept in their folder entries and bit 3 (version 28) records the
+        // sizes of files in their folder entries (see ContentFolder). Bit 4
+        // (version 36) lets cloned files share blocks (see BlockRefCounts).
         char v;
         (void)in.read((char*)&v, 1);
         int version = (int)v;
-        if(version == 20) {
+        bool const versioned = version >= 20 && version <= 51;
+        if(versioned) {
             io->blockSize = detail::convertInt4ArrayToInt32(blockSizeArray);
         }
+        io->blockIndex = versioned && ((version - 20) & 1);
+        io->alignedBlocks = versioned && ((version - 20) & 2);
+        io->inlineFiles = versioned && ((version - 20) & 4);
+        io->entrySizes = versioned && ((version - 20) & 8);
+        io->sharedBlocks = versioned && ((version - 20) & 16);
         in.close();
         io->encProps.iv = knoxcrypt::detail::convertInt8ArrayToInt64(&ivBuffer.front());
         io->encProps.iv2 = knoxcrypt::detail::convertInt8ArrayToInt64(&ivBuffer2.front());
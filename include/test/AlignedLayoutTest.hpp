@@ -0,0 +1,173 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class AlignedLayoutTest
+{
+  public:
+    AlignedLayoutTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageVersionRecorded();
+        testBlockDataIsPageAligned();
+        testFileDataLandsInBlockData();
+        testFileSystemOnAlignedImage(false /* sparse */, false /* indexed */);
+        testFileSystemOnAlignedImage(true /* sparse */, true /* indexed */);
+    }
+
+    ~AlignedLayoutTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    void testImageVersionRecorded()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath, TestIOOptions().aligned())));
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(true, io->alignedBlocks, "AlignedLayoutTest::testImageVersionRecorded aligned");
+        ASSERT_EQUAL(false, io->blockIndex, "AlignedLayoutTest::testImageVersionRecorded not indexed");
+        ASSERT_EQUAL(4096, io->blockSize, "AlignedLayoutTest::testImageVersionRecorded block size");
+
+        auto indexedIo(createTestIO(buildImage(m_uniquePath, TestIOOptions().aligned().indexed())));
+        knoxcrypt::detail::readImageIVAndRounds(indexedIo);
+        ASSERT_EQUAL(true, indexedIo->alignedBlocks, "AlignedLayoutTest::testImageVersionRecorded indexed aligned");
+        ASSERT_EQUAL(true, indexedIo->blockIndex, "AlignedLayoutTest::testImageVersionRecorded indexed");
+
+        auto plainIo(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::detail::readImageIVAndRounds(plainIo);
+        ASSERT_EQUAL(false, plainIo->alignedBlocks, "AlignedLayoutTest::testImageVersionRecorded not aligned");
+    }
+
+    void testBlockDataIsPageAligned()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().aligned(), false /* sparse */);
+        auto io(createTestIO(testPath, TestIOOptions().aligned()));
+        ASSERT_EQUAL(io->blockSize, knoxcrypt::detail::getBlockWriteSpace(io),
+                     "AlignedLayoutTest::testBlockDataIsPageAligned write space");
+
+        bool aligned = true;
+        for (uint64_t block = 0; block < io->blocks; block += 97) {
+            aligned = aligned && knoxcrypt::detail::getOffsetOfBlockData(io, block) % 4096 == 0;
+        }
+        ASSERT_EQUAL(true, aligned, "AlignedLayoutTest::testBlockDataIsPageAligned offsets");
+
+        // the table sits between the volume state and the data area
+        ASSERT_EQUAL(true, knoxcrypt::detail::getOffsetOfBlockHeader(io, io->blocks) <=
+                           knoxcrypt::detail::getOffsetOfBlockData(io, 0),
+                     "AlignedLayoutTest::testBlockDataIsPageAligned table");
+        uint64_t const expectedSize = knoxcrypt::detail::getOffsetOfBlockData(io, io->blocks);
+        ASSERT_EQUAL(expectedSize, boost::filesystem::file_size(testPath),
+                     "AlignedLayoutTest::testBlockDataIsPageAligned image size");
+    }
+
+    void testFileDataLandsInBlockData()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().aligned());
+        auto io(createTestIO(testPath, TestIOOptions().aligned()));
+        std::string const data(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(data.c_str(), data.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // a whole block's worth of file data is found at the block's data offset
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        (void)in.seekg(knoxcrypt::detail::getOffsetOfBlockData(io, startBlock));
+        std::vector<char> buffer(io->blockSize);
+        (void)in.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(data.substr(0, buffer.size()), std::string(buffer.begin(), buffer.end()),
+                     "AlignedLayoutTest::testFileDataLandsInBlockData content");
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(data.length(), entry.fileSize(), "AlignedLayoutTest::testFileDataLandsInBlockData size");
+        std::vector<char> readBack(100);
+        entry.seek(io->blockSize * 3 - 50, std::ios_base::beg);
+        entry.read(&readBack.front(), readBack.size());
+        ASSERT_EQUAL(data.substr(io->blockSize * 3 - 50, 100), std::string(readBack.begin(), readBack.end()),
+                     "AlignedLayoutTest::testFileDataLandsInBlockData seek");
+    }
+
+    void testFileSystemOnAlignedImage(bool const sparse, bool const indexed)
+    {
+        auto const options(TestIOOptions().aligned().indexed(indexed));
+        boost::filesystem::path testPath = buildImage(m_uniquePath, options, sparse);
+        std::string const testString(createLargeStringToWrite());
+        uint64_t allocated;
+        {
+            auto io(createTestIO(testPath, options));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            allocated = io->bitmap->getNumberOfAllocatedBlocks();
+            kc.addFile("/folder/test.txt");
+            auto device(kc.openFile("/folder/test.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write(testString.c_str(), testString.length());
+            device.close();
+        }
+
+        auto io(createTestIO(testPath, options));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(testString.length(), kc.getInfo("/folder/test.txt").size(),
+                     "AlignedLayoutTest::testFileSystemOnAlignedImage size");
+        auto device(kc.openFile("/folder/test.txt", knoxcrypt::OpenDisposition::buildReadOnlyDisposition()));
+        std::vector<char> buffer(testString.length());
+        (void)device.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(testString, std::string(buffer.begin(), buffer.end()),
+                     "AlignedLayoutTest::testFileSystemOnAlignedImage content");
+
+        kc.removeFile("/folder/test.txt");
+        ASSERT_EQUAL(false, kc.fileExists("/folder/test.txt"),
+                     "AlignedLayoutTest::testFileSystemOnAlignedImage removed");
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "AlignedLayoutTest::testFileSystemOnAlignedImage freed");
+    }
+};
@@ -0,0 +1,298 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/ImageFile.hpp"
+#include "knoxcrypt/IoRing.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace simpletest;
+
+class BatchedIOTest
+{
+  public:
+    BatchedIOTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testRingReadsAndWrites();
+        testReadBatch();
+        testReadBatchPastEnd();
+        testBatchedWritesReadBack();
+        testLargeFileTransfers(true);
+        testLargeFileTransfers(false);
+        testTruncatedImageReadFails(true);
+        testTruncatedImageReadFails(false);
+        testHolesReadTogether();
+        testCachedBlocksReadTogether();
+    }
+
+    ~BatchedIOTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static std::ios::openmode readWrite()
+    {
+        return std::ios::in | std::ios::out | std::ios::binary;
+    }
+
+    void testRingReadsAndWrites()
+    {
+        auto ring(knoxcrypt::IoRing::create(8));
+        if (!ring) {
+            return; // the host has no io_uring; everything else falls back
+        }
+        auto const path(m_uniquePath / "ring");
+        std::ofstream(path.string().c_str()).write("0123456789", 10);
+        int const fd = ::open(path.string().c_str(), O_RDWR);
+
+        std::string data("ring");
+        struct iovec iov;
+        iov.iov_base = &data[0];
+        iov.iov_len = data.length();
+        ASSERT_EQUAL(true, ring->push(true, fd, &iov, 3, 7), "BatchedIOTest::testRingReadsAndWrites pushed");
+        ASSERT_EQUAL(true, ring->submit(1), "BatchedIOTest::testRingReadsAndWrites submitted");
+        uint64_t tag = 0;
+        int result = 0;
+        ASSERT_EQUAL(true, ring->pop(tag, result), "BatchedIOTest::testRingReadsAndWrites completed");
+        ASSERT_EQUAL(uint64_t(7), tag, "BatchedIOTest::testRingReadsAndWrites tag");
+        ASSERT_EQUAL(4, result, "BatchedIOTest::testRingReadsAndWrites written");
+
+        std::string back(10, 'x');
+        iov.iov_base = &back[0];
+        iov.iov_len = back.length();
+        (void)ring->push(false, fd, &iov, 0, 8);
+        (void)ring->submit(1);
+        (void)ring->pop(tag, result);
+        ASSERT_EQUAL(10, result, "BatchedIOTest::testRingReadsAndWrites read");
+        ASSERT_EQUAL(std::string("012ring789"), back, "BatchedIOTest::testRingReadsAndWrites content");
+        ASSERT_EQUAL(false, ring->pop(tag, result), "BatchedIOTest::testRingReadsAndWrites nothing more");
+        (void)::close(fd);
+    }
+
+    void testReadBatch()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream stream(createTestIO(path, TestIOOptions().uring()), readWrite());
+        std::vector<std::string> const data{"first", "second stretch", "third"};
+        std::vector<uint64_t> const offsets{30000, 5000, 17001};
+        for (size_t i = 0; i < data.size(); ++i) {
+            (void)stream.writeAt(offsets[i], data[i].c_str(), data[i].length());
+        }
+
+        std::vector<std::string> back;
+        std::vector<knoxcrypt::ImageFile::Transfer> transfers;
+        for (size_t i = 0; i < data.size(); ++i) {
+            back.push_back(std::string(data[i].length(), 'x'));
+        }
+        for (size_t i = 0; i < data.size(); ++i) {
+            transfers.push_back(knoxcrypt::ImageFile::Transfer{offsets[i], &back[i][0], std::streamsize(back[i].length())});
+        }
+        knoxcrypt::ContainerImageStream reader(createTestIO(path), std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(true, reader.readBatch(transfers), "BatchedIOTest::testReadBatch all read");
+        ASSERT_EQUAL(true, data == back, "BatchedIOTest::testReadBatch content");
+    }
+
+    void testReadBatchPastEnd()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream stream(createTestIO(path, TestIOOptions().uring()), readWrite());
+        uint64_t const size = boost::filesystem::file_size(path);
+        std::string const data("before the end");
+        (void)stream.writeAt(size - data.length(), data.c_str(), data.length());
+
+        // the stretch that's there is read even though the other isn't
+        std::string back(data.length(), 'x');
+        std::string past(10, 'x');
+        std::vector<knoxcrypt::ImageFile::Transfer> transfers{
+            knoxcrypt::ImageFile::Transfer{size + 100, &past[0], std::streamsize(past.length())},
+            knoxcrypt::ImageFile::Transfer{size - data.length(), &back[0], std::streamsize(back.length())}};
+        ASSERT_EQUAL(false, stream.readBatch(transfers), "BatchedIOTest::testReadBatchPastEnd not all read");
+        ASSERT_EQUAL(data, back, "BatchedIOTest::testReadBatchPastEnd content");
+    }
+
+    void testBatchedWritesReadBack()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream stream(createTestIO(path, TestIOOptions().uring()), readWrite());
+
+        // more writes than the ring holds, some over others still outstanding
+        std::string expected(400 * 100, 'x');
+        stream.beginBatch();
+        for (size_t i = 0; i < 400; ++i) {
+            std::string const data(100, char('a' + i % 26));
+            (void)stream.writeAt(50000 + i * 100, data.c_str(), data.length());
+            expected.replace(i * 100, 100, data);
+            if (i % 3 == 0) {
+                (void)stream.writeAt(50000 + i * 100 + 10, "over", 4);
+                expected.replace(i * 100 + 10, 4, "over");
+            }
+        }
+
+        // a read in the middle of a batch sees what's been written so far
+        ASSERT_EQUAL(expected.substr(0, 1000), readAt(stream, 50000, 1000), "BatchedIOTest::testBatchedWritesReadBack during");
+        (void)stream.writeAt(50000, "last", 4);
+        expected.replace(0, 4, "last");
+        ASSERT_EQUAL(true, stream.endBatch(), "BatchedIOTest::testBatchedWritesReadBack written");
+
+        knoxcrypt::ContainerImageStream reader(createTestIO(path), std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(true, expected == readAt(reader, 50000, expected.length()), "BatchedIOTest::testBatchedWritesReadBack");
+    }
+
+    void testLargeFileTransfers(bool const ioUring)
+    {
+        std::string const label(ioUring ? " io_uring" : " direct");
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().uring(ioUring)));
+        std::string const data(createLargeStringToWrite().substr(0, 100000));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            (void)entry.write(data.c_str(), data.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+        ASSERT_EQUAL(true, data == readAll(entry), "BatchedIOTest::testLargeFileTransfers whole" + label);
+
+        // reading on after a read over several blocks carries on from it
+        (void)entry.seek(5000, std::ios_base::beg);
+        std::string middle(50000, 'x');
+        ASSERT_EQUAL(50000, entry.read(&middle[0], middle.length()), "BatchedIOTest::testLargeFileTransfers count" + label);
+        std::string next(1000, 'x');
+        (void)entry.read(&next[0], next.length());
+        ASSERT_EQUAL(true, data.substr(5000, 50000) == middle, "BatchedIOTest::testLargeFileTransfers middle" + label);
+        ASSERT_EQUAL(data.substr(55000, 1000), next, "BatchedIOTest::testLargeFileTransfers next" + label);
+
+        // as does writing
+        std::string const over(30000, 'o');
+        (void)entry.write(over.c_str(), over.length());
+        (void)entry.write("end", 3);
+        entry.flush();
+        std::string expected(data);
+        expected.replace(56000, over.length(), over);
+        expected.replace(86000, 3, "end");
+        knoxcrypt::File other(createTestIO(path), "test.txt", startBlock,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(true, expected == readAll(other), "BatchedIOTest::testLargeFileTransfers overwritten" + label);
+    }
+
+    void testTruncatedImageReadFails(bool const ioUring)
+    {
+        std::string const label(ioUring ? " io_uring" : " direct");
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().uring(ioUring)));
+        std::string const data(createLargeStringToWrite().substr(0, 100000));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            (void)entry.write(data.c_str(), data.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // the image loses the file's later blocks after it's been opened
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        boost::filesystem::resize_file(path, knoxcrypt::detail::getOffsetOfBlockData(io, startBlock) + 5 * io->blockSize);
+        bool failed = false;
+        try {
+            std::string back(data.length(), 'x');
+            (void)entry.read(&back[0], back.length());
+        } catch (std::runtime_error const &) {
+            failed = true;
+        }
+        ASSERT_EQUAL(true, failed, "BatchedIOTest::testTruncatedImageReadFails" + label);
+    }
+
+    void testHolesReadTogether()
+    {
+        auto const options(TestIOOptions().uring().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+
+        uint64_t const offset = knoxcrypt::detail::getBlockWriteSpace(io) * 10 + 5;
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write("abc", 3);
+            (void)entry.seek(offset, std::ios_base::beg);
+            entry.write("xyz", 3);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::string expected(offset + 3, 0);
+        expected.replace(0, 3, "abc");
+        expected.replace(offset, 3, "xyz");
+        ASSERT_EQUAL(true, expected == readAll(entry), "BatchedIOTest::testHolesReadTogether");
+    }
+
+    void testCachedBlocksReadTogether()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().uring().cached()));
+        std::string const data(createLargeStringToWrite().substr(0, 60000));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            (void)entry.write(data.c_str(), data.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // the blocks read together are held on to, so reading them again
+        // misses nothing
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(true, data == readAll(entry), "BatchedIOTest::testCachedBlocksReadTogether first");
+        uint64_t const misses = io->blockCache->misses();
+        ASSERT_EQUAL(true, data == readAll(entry), "BatchedIOTest::testCachedBlocksReadTogether again");
+        ASSERT_EQUAL(misses, io->blockCache->misses(), "BatchedIOTest::testCachedBlocksReadTogether no more misses");
+    }
+};
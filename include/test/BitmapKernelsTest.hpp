@@ -0,0 +1,154 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/detail/DetailBitmapKernels.hpp"
+#include "test/SimpleTest.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class BitmapKernelsTest
+{
+  public:
+    BitmapKernelsTest()
+    {
+        auto const original = knoxcrypt::detail::getBitmapKernel();
+        testKernel(knoxcrypt::detail::BitmapKernel::Scalar, "Scalar");
+        testKernel(knoxcrypt::detail::BitmapKernel::AVX2, "AVX2");
+        testKernel(knoxcrypt::detail::BitmapKernel::AVX512, "AVX512");
+        knoxcrypt::detail::setBitmapKernel(original);
+    }
+
+  private:
+
+    using Words = std::vector<uint64_t>;
+
+    /// a bitmap of long full runs broken up by partially full and empty words
+    Words buildBitmap() const
+    {
+        std::mt19937_64 gen(12345);
+        Words words(1000, ~uint64_t(0));
+        for (size_t w = 0; w < words.size(); w += 1 + (gen() % 40)) {
+            words[w] = (gen() % 4 == 0) ? 0 : gen();
+        }
+        words.back() = ~uint64_t(0);
+        return words;
+    }
+
+    static bool isSet(Words const &words, uint64_t const bit)
+    {
+        return (words[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    void testKernel(knoxcrypt::detail::BitmapKernel const kernel, std::string const &name)
+    {
+        if (!knoxcrypt::detail::isBitmapKernelSupported(kernel)) {
+            return;
+        }
+        knoxcrypt::detail::setBitmapKernel(kernel);
+        testCountSetBits(name);
+        testFindFirstClearBit(name);
+        testFindClearBits(name);
+        testSetBitRange(name);
+    }
+
+    void testCountSetBits(std::string const &name)
+    {
+        auto const words = buildBitmap();
+        uint64_t expected(0);
+        for (uint64_t b = 0; b < words.size() * 64; ++b) {
+            expected += isSet(words, b);
+        }
+        ASSERT_EQUAL(expected, knoxcrypt::detail::countSetBits(words.data(), words.size()),
+                     "BitmapKernelsTest::testCountSetBits " + name);
+    }
+
+    void testFindFirstClearBit(std::string const &name)
+    {
+        auto const words = buildBitmap();
+        uint64_t const bits = words.size() * 64;
+        bool allCorrect = true;
+        for (uint64_t from = 0; from < bits; from += 37) {
+            uint64_t expected = from;
+            while (expected < bits && isSet(words, expected)) {
+                ++expected;
+            }
+            auto const found = knoxcrypt::detail::findFirstClearBit(words.data(), words.size(), from);
+            if ((expected == bits) ? !!found : (!found || *found != expected)) {
+                allCorrect = false;
+                break;
+            }
+        }
+        ASSERT_EQUAL(true, allCorrect, "BitmapKernelsTest::testFindFirstClearBit " + name);
+
+        Words const full(100, ~uint64_t(0));
+        ASSERT_EQUAL(false, !!knoxcrypt::detail::findFirstClearBit(full.data(), full.size()),
+                     "BitmapKernelsTest::testFindFirstClearBit full " + name);
+    }
+
+    void testFindClearBits(std::string const &name)
+    {
+        auto const words = buildBitmap();
+        uint64_t const from = 1000;
+        Words expected;
+        for (uint64_t b = from; b < words.size() * 64 && expected.size() < 5000; ++b) {
+            if (!isSet(words, b)) {
+                expected.push_back(b);
+            }
+        }
+        Words found;
+        knoxcrypt::detail::findClearBits(words.data(), words.size(), from, 5000, found);
+        ASSERT_EQUAL(true, expected == found, "BitmapKernelsTest::testFindClearBits " + name);
+
+        // asking for more than there are gives all of them
+        found.clear();
+        knoxcrypt::detail::findClearBits(words.data(), words.size(), 0, words.size() * 64, found);
+        ASSERT_EQUAL((words.size() * 64) - knoxcrypt::detail::countSetBits(words.data(), words.size()),
+                     found.size(), "BitmapKernelsTest::testFindClearBits all " + name);
+    }
+
+    void testSetBitRange(std::string const &name)
+    {
+        auto words = buildBitmap();
+        auto expected = words;
+        uint64_t const ranges[][2] = { {3, 5}, {60, 70}, {100, 1900}, {2000, 2001}, {5000, 64000} };
+        bool set = false;
+        for (auto const & range : ranges) {
+            knoxcrypt::detail::setBitRange(words.data(), range[0], range[1], set);
+            for (uint64_t b = range[0]; b < range[1]; ++b) {
+                uint64_t const bit = uint64_t(1) << (b % 64);
+                expected[b / 64] = set ? (expected[b / 64] | bit) : (expected[b / 64] & ~bit);
+            }
+            set = !set;
+        }
+        ASSERT_EQUAL(true, expected == words, "BitmapKernelsTest::testSetBitRange " + name);
+    }
+};
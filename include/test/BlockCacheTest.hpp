@@ -0,0 +1,191 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/ContentFolder.hpp"
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class BlockCacheTest
+{
+  public:
+    BlockCacheTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testLeastRecentlyUsedDropped();
+        testWritesKeepBlocksUpToDate();
+        testLoadOverlappingWriteNotHeld();
+        testRepeatedFileReadsHit();
+        testFileWritesReadBack();
+        testFolderReadsHit();
+    }
+
+    ~BlockCacheTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static void writeFile(knoxcrypt::CoreFS &theBfs, std::string const &path, std::string const &data)
+    {
+        theBfs.addFile(path);
+        auto device(theBfs.openFile(path, knoxcrypt::OpenDisposition::buildAppendDisposition()));
+        (void)device.write(data.c_str(), data.length());
+        theBfs.flushFile(path);
+    }
+
+    static std::vector<char> blockOf(char const c)
+    {
+        return std::vector<char>(16, c);
+    }
+
+    void testLeastRecentlyUsedDropped()
+    {
+        knoxcrypt::BlockCache cache(16, 2);
+        cache.insert(0, blockOf('a'), cache.beginLoad());
+        cache.insert(1, blockOf('b'), cache.beginLoad());
+
+        // reading block 0 leaves block 1 as the least recently used
+        char c = 0;
+        ASSERT_EQUAL(true, cache.read(0, 3, &c, 1), "BlockCacheTest::testLeastRecentlyUsedDropped first held");
+        ASSERT_EQUAL('a', c, "BlockCacheTest::testLeastRecentlyUsedDropped first content");
+        cache.insert(2, blockOf('c'), cache.beginLoad());
+        ASSERT_EQUAL(uint64_t(2), cache.size(), "BlockCacheTest::testLeastRecentlyUsedDropped size");
+        ASSERT_EQUAL(false, cache.read(1, 0, &c, 1), "BlockCacheTest::testLeastRecentlyUsedDropped dropped");
+        ASSERT_EQUAL(true, cache.read(0, 0, &c, 1), "BlockCacheTest::testLeastRecentlyUsedDropped kept");
+        ASSERT_EQUAL(true, cache.read(2, 15, &c, 1), "BlockCacheTest::testLeastRecentlyUsedDropped added");
+        ASSERT_EQUAL(uint64_t(3), cache.hits(), "BlockCacheTest::testLeastRecentlyUsedDropped hits");
+        ASSERT_EQUAL(uint64_t(1), cache.misses(), "BlockCacheTest::testLeastRecentlyUsedDropped misses");
+    }
+
+    void testWritesKeepBlocksUpToDate()
+    {
+        knoxcrypt::BlockCache cache(16, 4);
+        cache.insert(0, blockOf('a'), cache.beginLoad());
+        cache.insert(1, blockOf('b'), cache.beginLoad());
+
+        // a write across the end of block 0 and the start of block 1
+        std::string const data("xyz");
+        cache.update(15, data.c_str(), data.length());
+        std::vector<char> bytes(4);
+        (void)cache.read(0, 14, &bytes.front(), 2);
+        (void)cache.read(1, 0, &bytes[2], 2);
+        ASSERT_EQUAL("axyz", std::string(bytes.begin(), bytes.end()), "BlockCacheTest::testWritesKeepBlocksUpToDate content");
+
+        cache.invalidate(20, 1);
+        ASSERT_EQUAL(uint64_t(1), cache.size(), "BlockCacheTest::testWritesKeepBlocksUpToDate invalidated");
+    }
+
+    void testLoadOverlappingWriteNotHeld()
+    {
+        knoxcrypt::BlockCache cache(16, 4);
+
+        // what was read may predate the write
+        auto const ticket = cache.beginLoad();
+        cache.update(0, "x", 1);
+        cache.insert(0, blockOf('a'), ticket);
+        ASSERT_EQUAL(uint64_t(0), cache.size(), "BlockCacheTest::testLoadOverlappingWriteNotHeld");
+    }
+
+    void testRepeatedFileReadsHit()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().cached()));
+        knoxcrypt::CoreFS theBfs(io);
+        std::string const data(createLargeStringToWrite().substr(0, 20000));
+        writeFile(theBfs, "/a.txt", data);
+
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "BlockCacheTest::testRepeatedFileReadsHit first read");
+        uint64_t const misses = io->blockCache->misses();
+        uint64_t const hits = io->blockCache->hits();
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "BlockCacheTest::testRepeatedFileReadsHit second read");
+        ASSERT_EQUAL(misses, io->blockCache->misses(), "BlockCacheTest::testRepeatedFileReadsHit no more misses");
+        ASSERT_EQUAL(true, io->blockCache->hits() > hits, "BlockCacheTest::testRepeatedFileReadsHit hits");
+    }
+
+    void testFileWritesReadBack()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().cached(4)));
+        std::string data(createLargeStringToWrite().substr(0, 30000));
+        {
+            knoxcrypt::CoreFS theBfs(io);
+            writeFile(theBfs, "/a.txt", data);
+            ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "BlockCacheTest::testFileWritesReadBack before overwrite");
+
+            // overwrite the middle of what's now held, and more besides
+            std::string const xs(9000, 'x');
+            {
+                auto device(theBfs.openFile("/a.txt", knoxcrypt::OpenDisposition::buildOverwriteDisposition()));
+                (void)device.seek(10000, std::ios_base::beg);
+                (void)device.write(xs.c_str(), xs.length());
+                theBfs.flushFile("/a.txt");
+            }
+            data.replace(10000, xs.length(), xs);
+            ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "BlockCacheTest::testFileWritesReadBack after overwrite");
+        }
+
+        // the image itself holds the same as the cache did
+        knoxcrypt::CoreFS uncachedBfs(createTestIO(path));
+        ASSERT_EQUAL(true, data == readAll(uncachedBfs, "/a.txt"), "BlockCacheTest::testFileWritesReadBack uncached");
+    }
+
+    void testFolderReadsHit()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().cached()));
+        {
+            knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+            folder.addFile("test.txt");
+            folder.addContentFolder("folderA");
+            folder.addFile("picture.jpg");
+        }
+
+        uint64_t const hits = io->blockCache->hits();
+        knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+        ASSERT_EQUAL("picture.jpg", folder.getEntryInfo(2).filename(), "BlockCacheTest::testFolderReadsHit entry");
+        ASSERT_EQUAL(true, io->blockCache->hits() > hits, "BlockCacheTest::testFolderReadsHit hits");
+
+        knoxcrypt::ContentFolder uncachedFolder(createTestIO(path), 0, std::string("root"));
+        ASSERT_EQUAL("folderA", uncachedFolder.getEntryInfo(1).filename(), "BlockCacheTest::testFolderReadsHit uncached");
+    }
+};
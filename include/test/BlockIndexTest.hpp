@@ -0,0 +1,258 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/BlockIndex.hpp"
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/FileBlockIterator.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+// enough blocks for a block index to need a second level
+uint64_t const INDEXED_BLOCKS = 770;
+
+class BlockIndexTest
+{
+  public:
+    BlockIndexTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageVersionRecorded();
+        testIndexMatchesChain();
+        testSeekAndReadAnywhere();
+        testShrinkReleasesIndexBlocks();
+        testUnlinkFreesIndex();
+        testOpenAndAppendUseIndex();
+        testFileSystemOnIndexedImage();
+    }
+
+    ~BlockIndexTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    /// fills a file with INDEXED_BLOCKS blocks of data, each byte giving its offset
+    static std::string buildData(knoxcrypt::SharedCoreIO const &io)
+    {
+        std::string data((io->blockSize - knoxcrypt::detail::FILE_BLOCK_META) * INDEXED_BLOCKS, 0);
+        for (size_t i = 0; i < data.length(); ++i) {
+            data[i] = char(i * 7);
+        }
+        return data;
+    }
+
+    static uint64_t writeFile(knoxcrypt::SharedCoreIO const &io, std::string const &data)
+    {
+        knoxcrypt::File entry(io, "test.txt");
+        entry.write(data.c_str(), data.length());
+        entry.flush();
+        return entry.getStartVolumeBlockIndex();
+    }
+
+    void testImageVersionRecorded()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath));
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(true, io->blockIndex, "BlockIndexTest::testImageVersionRecorded indexed");
+
+        auto plainIo(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::detail::readImageIVAndRounds(plainIo);
+        ASSERT_EQUAL(false, plainIo->blockIndex, "BlockIndexTest::testImageVersionRecorded not indexed");
+    }
+
+    void testIndexMatchesChain()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        uint64_t const startBlock = writeFile(io, buildData(io));
+
+        knoxcrypt::BlockIndex index(io, startBlock);
+        ASSERT_EQUAL(INDEXED_BLOCKS, index.size(), "BlockIndexTest::testIndexMatchesChain size");
+
+        std::vector<uint64_t> chain;
+        knoxcrypt::FileBlockIterator it(io, index.lookup(0), knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        knoxcrypt::FileBlockIterator end;
+        for (; it != end; ++it) {
+            chain.push_back(it->getIndex());
+        }
+        ASSERT_EQUAL(true, chain == index.getBlocks(), "BlockIndexTest::testIndexMatchesChain blocks");
+
+        bool lookupsMatch = chain.size() == INDEXED_BLOCKS;
+        for (uint64_t n = 0; n < chain.size(); ++n) {
+            lookupsMatch = lookupsMatch && index.lookup(n) == chain[n];
+        }
+        ASSERT_EQUAL(true, lookupsMatch, "BlockIndexTest::testIndexMatchesChain lookups");
+
+        // a root plus one lowest level block per 510 blocks
+        ASSERT_EQUAL(size_t(3), index.getIndexBlocks().size(), "BlockIndexTest::testIndexMatchesChain index blocks");
+    }
+
+    void testSeekAndReadAnywhere()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        std::string const data(buildData(io));
+        uint64_t const startBlock = writeFile(io, data);
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(data.length(), entry.fileSize(), "BlockIndexTest::testSeekAndReadAnywhere size");
+
+        bool readsMatch = true;
+        std::vector<uint64_t> const offsets{data.length() - 100, 5000, 2500000, 0, 1234567};
+        for (auto const offset : offsets) {
+            std::vector<char> buffer(100);
+            entry.seek(offset, std::ios_base::beg);
+            entry.read(&buffer.front(), buffer.size());
+            readsMatch = readsMatch && std::equal(buffer.begin(), buffer.end(), data.begin() + offset);
+        }
+        ASSERT_EQUAL(true, readsMatch, "BlockIndexTest::testSeekAndReadAnywhere reads");
+    }
+
+    void testShrinkReleasesIndexBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        uint64_t const startBlock = writeFile(io, buildData(io));
+
+        knoxcrypt::BlockIndex index(io, startBlock);
+        auto const blocks(index.getBlocks());
+        auto const unneeded(index.shrink(100));
+        ASSERT_EQUAL(size_t(1), unneeded.size(), "BlockIndexTest::testShrinkReleasesIndexBlocks unneeded");
+        ASSERT_EQUAL(uint64_t(100), index.size(), "BlockIndexTest::testShrinkReleasesIndexBlocks size");
+
+        // growing again puts the blocks back where they were
+        for (uint64_t n = 100; n < blocks.size(); ++n) {
+            index.append(blocks[n]);
+        }
+        knoxcrypt::BlockIndex reopened(io, startBlock);
+        ASSERT_EQUAL(true, blocks == reopened.getBlocks(), "BlockIndexTest::testShrinkReleasesIndexBlocks regrown");
+    }
+
+    void testUnlinkFreesIndex()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const startBlock = writeFile(io, buildData(io));
+        ASSERT_EQUAL(allocated + INDEXED_BLOCKS + 3, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "BlockIndexTest::testUnlinkFreesIndex allocated");
+
+        // a truncate frees the blocks past the new end and the index block
+        // that only they needed
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+        entry.truncate((io->blockSize - knoxcrypt::detail::FILE_BLOCK_META) * 100);
+        ASSERT_EQUAL(allocated + 100 + 2, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "BlockIndexTest::testUnlinkFreesIndex truncated");
+
+        entry.unlink();
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(), "BlockIndexTest::testUnlinkFreesIndex freed");
+    }
+
+    void testOpenAndAppendUseIndex()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        std::string const data(buildData(io));
+        uint64_t const startBlock = writeFile(io, data.substr(0, data.length() - 100));
+
+        // cut the chain short after the first block; had the file been
+        // gone through block by block, it would now seem to be one block long
+        knoxcrypt::BlockIndex index(io, startBlock);
+        knoxcrypt::FileBlock first(io, index.lookup(0), knoxcrypt::OpenDisposition::buildAppendDisposition());
+        first.setNextIndex(first.getIndex());
+        first.flush();
+
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+            ASSERT_EQUAL(data.length() - 100, entry.fileSize(), "BlockIndexTest::testOpenAndAppendUseIndex size");
+            entry.write(data.c_str() + data.length() - 100, 100);
+            entry.flush();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(data.length(), entry.fileSize(), "BlockIndexTest::testOpenAndAppendUseIndex appended size");
+        std::vector<char> buffer(300);
+        (void)entry.seek(data.length() - buffer.size(), std::ios_base::beg);
+        ASSERT_EQUAL(std::streamsize(buffer.size()), entry.read(&buffer.front(), buffer.size()),
+                     "BlockIndexTest::testOpenAndAppendUseIndex read count");
+        ASSERT_EQUAL(true, std::equal(buffer.begin(), buffer.end(), data.end() - buffer.size()),
+                     "BlockIndexTest::testOpenAndAppendUseIndex appended data");
+    }
+
+    void testFileSystemOnIndexedImage()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().indexed());
+        std::string const testString(createLargeStringToWrite());
+        uint64_t allocated;
+        {
+            auto io(createTestIO(testPath, TestIOOptions().indexed()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            kc.addFile("/folder/other.txt");
+            allocated = io->bitmap->getNumberOfAllocatedBlocks();
+            kc.addFile("/folder/test.txt");
+            auto device(kc.openFile("/folder/test.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write(testString.c_str(), testString.length());
+            device.close();
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().indexed()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(true, kc.fileExists("/folder/other.txt"), "BlockIndexTest::testFileSystemOnIndexedImage entries");
+        ASSERT_EQUAL(testString.length(), kc.getInfo("/folder/test.txt").size(),
+                     "BlockIndexTest::testFileSystemOnIndexedImage size");
+        auto device(kc.openFile("/folder/test.txt", knoxcrypt::OpenDisposition::buildReadOnlyDisposition()));
+        std::vector<char> buffer(testString.length());
+        (void)device.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(testString, std::string(buffer.begin(), buffer.end()),
+                     "BlockIndexTest::testFileSystemOnIndexedImage content");
+
+        kc.removeFile("/folder/test.txt");
+        ASSERT_EQUAL(false, kc.fileExists("/folder/test.txt"), "BlockIndexTest::testFileSystemOnIndexedImage removed");
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "BlockIndexTest::testFileSystemOnIndexedImage freed");
+    }
+};
@@ -0,0 +1,207 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CipherPool.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class CipherPoolTest
+{
+  public:
+    CipherPoolTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testMatchesOneThread();
+        testManyPieces();
+        testLargeStreamTransfers();
+        testLargeFileTransfers(false);
+        testLargeFileTransfers(true);
+        testHeldWritesKeepOrder();
+    }
+
+    ~CipherPoolTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    /// test data of the given length, longer than the usual large string
+    static std::string largeData(size_t const n)
+    {
+        std::string data;
+        while (data.length() < n) {
+            data += createLargeStringToWrite();
+        }
+        return data.substr(0, n);
+    }
+
+    void testMatchesOneThread()
+    {
+        auto const encProps(createTestIO(m_uniquePath / "props")->encProps);
+        auto cipher(cryptostreampp::buildByteTransformer(encProps));
+        knoxcrypt::CipherPool pool(encProps, 4);
+        ASSERT_EQUAL(4u, pool.threads(), "CipherPoolTest::testMatchesOneThread threads");
+
+        // an offset and length that split keystream blocks at both ends
+        std::string const plain(largeData(300007));
+        uint64_t const offset = 70001;
+        std::string expected(plain);
+        cipher->encrypt(&expected[0], &expected[0], std::ios_base::streamoff(offset), long(expected.length()));
+
+        std::string data(plain);
+        pool.encrypt({{&data[0], &data[0], offset, long(data.length())}});
+        ASSERT_EQUAL(true, expected == data, "CipherPoolTest::testMatchesOneThread enciphered");
+        std::string back(data.length(), 'x');
+        pool.decrypt({{&data[0], &back[0], offset, long(data.length())}});
+        ASSERT_EQUAL(true, plain == back, "CipherPoolTest::testMatchesOneThread deciphered");
+    }
+
+    void testManyPieces()
+    {
+        auto const encProps(createTestIO(m_uniquePath / "props")->encProps);
+        auto cipher(cryptostreampp::buildByteTransformer(encProps));
+        knoxcrypt::CipherPool pool(encProps, 3);
+
+        // pieces of a few bytes up to several chunks, in no particular order
+        std::vector<long> const sizes{1, 4064, 200000, 15, 65536, 131073, 0, 4064};
+        std::vector<uint64_t> const offsets{9, 1000000, 40, 500, 700000, 250000, 3, 5000000};
+        std::vector<std::string> expected;
+        std::vector<std::string> data;
+        for (size_t p = 0; p < sizes.size(); ++p) {
+            data.push_back(std::string(size_t(sizes[p]), char('a' + p)));
+            expected.push_back(data.back());
+            if (sizes[p] > 0) {
+                cipher->encrypt(&expected[p][0], &expected[p][0], std::ios_base::streamoff(offsets[p]), sizes[p]);
+            }
+        }
+        std::vector<knoxcrypt::CipherPool::Piece> pieces;
+        for (size_t p = 0; p < sizes.size(); ++p) {
+            pieces.push_back(knoxcrypt::CipherPool::Piece{&data[p][0], &data[p][0], offsets[p], sizes[p]});
+        }
+        pool.encrypt(pieces);
+        ASSERT_EQUAL(true, expected == data, "CipherPoolTest::testManyPieces");
+    }
+
+    void testLargeStreamTransfers()
+    {
+        auto const path(buildImage(m_uniquePath));
+        std::string const data(largeData(500000));
+        {
+            knoxcrypt::ContainerImageStream stream(createTestIO(path, TestIOOptions().threads(4)), std::ios::in | std::ios::out | std::ios::binary);
+            ASSERT_EQUAL(std::streamsize(data.length()), stream.writeAt(20011, data.c_str(), data.length()),
+                         "CipherPoolTest::testLargeStreamTransfers written");
+            ASSERT_EQUAL(true, data == readAt(stream, 20011, data.length()), "CipherPoolTest::testLargeStreamTransfers read back");
+
+            // the stream's own reads and writes are split between the threads too
+            std::string const over(300000, 'o');
+            (void)stream.seekp(100000);
+            (void)stream.write(over.c_str(), over.length());
+            stream.flush();
+        }
+        std::string expected(data);
+        expected.replace(100000 - 20011, 300000, std::string(300000, 'o'));
+        knoxcrypt::ContainerImageStream reader(createTestIO(path), std::ios::in | std::ios::binary);
+        (void)reader.seekg(20011);
+        std::string back(data.length(), 'x');
+        (void)reader.read(&back[0], back.length());
+        ASSERT_EQUAL(true, expected == back, "CipherPoolTest::testLargeStreamTransfers one thread");
+    }
+
+    void testLargeFileTransfers(bool const mapImage)
+    {
+        std::string const label(mapImage ? " mapped" : " unmapped");
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path, TestIOOptions().threads(4).mapped(mapImage)));
+        std::string const data(largeData(600000));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            (void)entry.write(data.c_str(), data.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+        ASSERT_EQUAL(true, data == readAll(entry), "CipherPoolTest::testLargeFileTransfers whole" + label);
+
+        // an overwrite large enough to be held on to and enciphered together
+        std::string const over(250000, 'o');
+        (void)entry.seek(123456, std::ios_base::beg);
+        (void)entry.write(over.c_str(), over.length());
+        entry.flush();
+        std::string expected(data);
+        expected.replace(123456, over.length(), over);
+        ASSERT_EQUAL(true, expected == readAll(entry), "CipherPoolTest::testLargeFileTransfers overwritten" + label);
+
+        knoxcrypt::File other(createTestIO(path), "test.txt", startBlock,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(true, expected == readAll(other), "CipherPoolTest::testLargeFileTransfers one thread" + label);
+    }
+
+    void testHeldWritesKeepOrder()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream stream(createTestIO(path, TestIOOptions().threads(4)), std::ios::in | std::ios::out | std::ios::binary);
+
+        // writes over each other, more than are held on to at once
+        std::string expected(2000000, 'x');
+        (void)stream.writeAt(50000, expected.c_str(), expected.length());
+        stream.beginBatch();
+        for (size_t i = 0; i < 40; ++i) {
+            std::string const data(50000, char('a' + i % 26));
+            (void)stream.writeAt(50000 + i * 45000, data.c_str(), data.length());
+            expected.replace(i * 45000, data.length(), data);
+        }
+
+        // a read in the middle of a batch sees what's been written so far
+        ASSERT_EQUAL(true, expected.substr(0, 100000) == readAt(stream, 50000, 100000),
+                     "CipherPoolTest::testHeldWritesKeepOrder during");
+        (void)stream.writeAt(50010, "last", 4);
+        expected.replace(10, 4, "last");
+        ASSERT_EQUAL(true, stream.endBatch(), "CipherPoolTest::testHeldWritesKeepOrder written");
+
+        knoxcrypt::ContainerImageStream reader(createTestIO(path), std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(true, expected == readAt(reader, 50000, expected.length()), "CipherPoolTest::testHeldWritesKeepOrder");
+    }
+};
@@ -37,6 +37,7 @@
 #include <boost/filesystem/operations.hpp>
 #include <boost/iostreams/copy.hpp>
 
+#include <algorithm>
 #include <sstream>
 
 using namespace simpletest;
@@ -69,6 +70,8 @@ class CoreFSTest
         testMoveFileToSubFolder();
         testMoveFileFromSubFolderToParentFolder();
         testThatDeletingEverythingDeallocatesEverything();
+        testPreallocateGrowsFileWithZeros();
+        testUnmountRecordsCountAfterOpenFile();
         //testDebugging();
     }
 
@@ -417,6 +420,56 @@ class CoreFSTest
         ASSERT_EQUAL(testString, recovered, "CoreFSTest::testWriteToStream() content");
     }
 
+    void testPreallocateGrowsFileWithZeros()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::CompoundFolder root = createTestFolder(testPath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::CoreFS kc(io);
+
+        // keeping the size only sets blocks aside
+        uint64_t const freeBlocks = io->freeBlocks;
+        kc.preallocate("/some.log", 100000);
+        ASSERT_EQUAL(uint64_t(0), kc.getInfo("/some.log").size(), "CoreFSTest::testPreallocateGrowsFileWithZeros size kept");
+        ASSERT_EQUAL(true, io->freeBlocks < freeBlocks, "CoreFSTest::testPreallocateGrowsFileWithZeros blocks set aside");
+
+        kc.preallocate("/test.txt", 12345, false);
+        ASSERT_EQUAL(uint64_t(12345), kc.getInfo("/test.txt").size(), "CoreFSTest::testPreallocateGrowsFileWithZeros size grown");
+        knoxcrypt::FileDevice device = kc.openFile("/test.txt", knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buffer(12345, 'x');
+        (void)device.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(true, std::all_of(buffer.begin(), buffer.end(), [](char c) { return c == 0; }),
+                     "CoreFSTest::testPreallocateGrowsFileWithZeros zeros");
+
+        // the blocks set aside for the first file went back when it was closed
+        ASSERT_EQUAL(freeBlocks - 3, io->freeBlocks, "CoreFSTest::testPreallocateGrowsFileWithZeros released");
+    }
+
+    void testUnmountRecordsCountAfterOpenFile()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            io->freeBlocks = io->bitmap->mount();
+            knoxcrypt::CoreFS kc(io);
+            kc.addFile("/a.txt");
+
+            // the open file has blocks set aside and data held back from
+            // allocation when the container is unmounted
+            kc.preallocate("/a.txt", 100000);
+            knoxcrypt::FileDevice device = kc.openFile("/a.txt", knoxcrypt::OpenDisposition::buildAppendDisposition());
+            std::string const data(createLargeStringToWrite().substr(0, 20000));
+            (void)device.write(data.c_str(), data.length());
+            kc.unmount();
+        }
+
+        // the count stored is that of the blocks in use once the file went
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->bitmap = knoxcrypt::VolumeBitmap::load(io, true /* reread */);
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        ASSERT_EQUAL(io->blocks - allocated, io->bitmap->mount(), "CoreFSTest::testUnmountRecordsCountAfterOpenFile");
+    }
+
     void testListAllEntriesEmpty()
     {
         boost::filesystem::path testPath = buildImage(m_uniquePath);
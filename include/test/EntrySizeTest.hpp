@@ -0,0 +1,170 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/FileBlock.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+
+using namespace simpletest;
+
+class EntrySizeTest
+{
+  public:
+    EntrySizeTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageVersionRecorded();
+        testSizeReadFromEntry();
+        testRenameAndMoveKeepSize();
+        testTruncateRecordsSize();
+        testLongNameStillMeasured();
+    }
+
+    ~EntrySizeTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static void writeFile(knoxcrypt::CoreFS &kc, std::string const &path, std::string const &data)
+    {
+        kc.addFile(path);
+        auto device(kc.openFile(path, knoxcrypt::OpenDisposition::buildAppendDisposition()));
+        (void)device.write(data.c_str(), data.length());
+        device.close();
+    }
+
+    /// cuts a file's chain of blocks short after its first block so that
+    /// its size can't be had from going through its blocks
+    static void cutChain(knoxcrypt::SharedCoreIO const &io, uint64_t const firstBlock)
+    {
+        knoxcrypt::FileBlock block(io, firstBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+        block.setNextIndex(block.getIndex());
+        block.flush();
+    }
+
+    void testImageVersionRecorded()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath, TestIOOptions().entrySized())));
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(true, io->entrySizes, "EntrySizeTest::testImageVersionRecorded entry sizes");
+
+        auto plainIo(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::detail::readImageIVAndRounds(plainIo);
+        ASSERT_EQUAL(false, plainIo->entrySizes, "EntrySizeTest::testImageVersionRecorded no entry sizes");
+    }
+
+    void testSizeReadFromEntry()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().entrySized());
+        std::string const data(createLargeStringToWrite());
+        {
+            auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            writeFile(kc, "/folder/test.txt", data);
+            writeFile(kc, "/folder/empty.txt", "");
+            cutChain(io, kc.getInfo("/folder/test.txt").firstFileBlock());
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(data.length(), kc.getInfo("/folder/test.txt").size(), "EntrySizeTest::testSizeReadFromEntry size");
+        ASSERT_EQUAL(uint64_t(0), kc.getInfo("/folder/empty.txt").size(), "EntrySizeTest::testSizeReadFromEntry empty");
+    }
+
+    void testRenameAndMoveKeepSize()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().entrySized());
+        std::string const data(createLargeStringToWrite());
+        {
+            auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            kc.addFolder("/other");
+            writeFile(kc, "/folder/a.txt", data);
+            writeFile(kc, "/folder/b.txt", data.substr(0, 5000));
+            kc.renameEntry("/folder/a.txt", "/folder/renamed.txt");
+            kc.renameEntry("/folder/b.txt", "/other/moved.txt");
+            cutChain(io, kc.getInfo("/folder/renamed.txt").firstFileBlock());
+            cutChain(io, kc.getInfo("/other/moved.txt").firstFileBlock());
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(data.length(), kc.getInfo("/folder/renamed.txt").size(), "EntrySizeTest::testRenameAndMoveKeepSize renamed");
+        ASSERT_EQUAL(uint64_t(5000), kc.getInfo("/other/moved.txt").size(), "EntrySizeTest::testRenameAndMoveKeepSize moved");
+    }
+
+    void testTruncateRecordsSize()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().entrySized());
+        std::string const data(createLargeStringToWrite());
+        {
+            auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            writeFile(kc, "/folder/test.txt", data);
+            kc.truncateFile("/folder/test.txt", 10000);
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(uint64_t(10000), kc.getInfo("/folder/test.txt").size(), "EntrySizeTest::testTruncateRecordsSize");
+    }
+
+    void testLongNameStillMeasured()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().entrySized());
+        std::string const data(createLargeStringToWrite());
+        std::string const path("/folder/" + std::string(250, 'n'));
+        {
+            auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            writeFile(kc, path, data);
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().entrySized()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(data.length(), kc.getInfo(path).size(), "EntrySizeTest::testLongNameStillMeasured");
+    }
+};
@@ -57,6 +57,9 @@ class FileBlockTest
         blockWriteAndReadTest();
         testWritingToNonWritableThrows();
         testReadingFromNonReadableThrows();
+        testBlockCacheHandsOutEveryFreeBlock();
+        testBlockCacheSkipsLongReservation();
+        testMetaDataWrittenOnFlush();
     }
 
     ~FileBlockTest()
@@ -80,6 +83,7 @@ class FileBlockTest
         std::string testData("Hello, world!Hello, world!");
         std::vector<uint8_t> vec(testData.begin(), testData.end());
         block.write((char*)&vec.front(), testData.length());
+        block.flush();
 
         // test that actual written correct
         assert(block.getDataBytesWritten() == 26);
@@ -157,4 +161,109 @@ class FileBlockTest
         }
     }
 
+    void testBlockCacheHandsOutEveryFreeBlock()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->useBlockCache = true;
+        knoxcrypt::FileBlockBuilder builder(io);
+
+        // more blocks than fit in the builder's window of free blocks
+        bool inOrder = true;
+        knoxcrypt::SharedImageStream stream;
+        for (uint64_t expected = 1; expected < io->blocks; ++expected) {
+            auto block = builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(), stream);
+            if (block.getIndex() != expected) {
+                inOrder = false;
+                break;
+            }
+            io->bitmap->setBlockInUse(block.getIndex());
+        }
+        ASSERT_EQUAL(true, inOrder, "FileBlockTest::testBlockCacheHandsOutEveryFreeBlock() all blocks");
+
+        bool outOfSpace = false;
+        try {
+            (void)builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(), stream);
+        } catch (knoxcrypt::KnoxCryptException const &e) {
+            outOfSpace = (e == knoxcrypt::KnoxCryptException(knoxcrypt::KnoxCryptError::OutOfSpace));
+        }
+        ASSERT_EQUAL(true, outOfSpace, "FileBlockTest::testBlockCacheHandsOutEveryFreeBlock() out of space");
+    }
+
+    void testBlockCacheSkipsLongReservation()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->useBlockCache = true;
+        knoxcrypt::FileBlockBuilder builder(io);
+        knoxcrypt::SharedImageStream stream;
+
+        // one file reserves more blocks than fit in the window
+        auto reservation = std::make_shared<knoxcrypt::BlockReservation>();
+        reservation->wanted = 1500;
+        auto first = builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(),
+                                                    stream, reservation, 1);
+        io->bitmap->setBlockInUse(first.getIndex());
+        ASSERT_EQUAL(uint64_t(1501), reservation->end, "FileBlockTest::testBlockCacheSkipsLongReservation() reserved");
+
+        // another file's block comes from past the reservation
+        auto second = builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(), stream);
+        ASSERT_EQUAL(uint64_t(1501), second.getIndex(), "FileBlockTest::testBlockCacheSkipsLongReservation() second file");
+
+        // and once every free block is reserved there are none to be had
+        auto rest = std::make_shared<knoxcrypt::BlockReservation>();
+        rest->wanted = io->blocks;
+        auto third = builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(),
+                                                    stream, rest, 1502);
+        io->bitmap->setBlockInUse(third.getIndex());
+        io->bitmap->setBlockInUse(second.getIndex());
+        bool outOfSpace = false;
+        try {
+            (void)builder.buildWritableFileBlock(io, knoxcrypt::OpenDisposition::buildAppendDisposition(), stream);
+        } catch (knoxcrypt::KnoxCryptException const &e) {
+            outOfSpace = (e == knoxcrypt::KnoxCryptException(knoxcrypt::KnoxCryptError::OutOfSpace));
+        }
+        ASSERT_EQUAL(true, outOfSpace, "FileBlockTest::testBlockCacheSkipsLongReservation() out of space");
+    }
+
+    void testMetaDataWrittenOnFlush()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+        uint64_t const sizeBefore = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io->blockSize, 0, blocks);
+        uint64_t const nextBefore = knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(stream, io->blockSize, 0, blocks);
+
+        knoxcrypt::FileBlock block(io, uint64_t(0), uint64_t(0),
+                                 knoxcrypt::OpenDisposition::buildAppendDisposition());
+        std::string const testData("Hello, world!");
+        for (int i = 0; i < 4; ++i) {
+            block.write(testData.c_str(), testData.length());
+        }
+        block.setNextIndex(7);
+
+        // nothing has gone out to the image yet
+        uint64_t size = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io->blockSize, 0, blocks);
+        uint64_t next = knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(stream, io->blockSize, 0, blocks);
+        ASSERT_EQUAL(size, sizeBefore, "FileBlockTest::testMetaDataWrittenOnFlush() size held back");
+        ASSERT_EQUAL(next, nextBefore, "FileBlockTest::testMetaDataWrittenOnFlush() next held back");
+
+        block.flush();
+        size = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io->blockSize, 0, blocks);
+        next = knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(stream, io->blockSize, 0, blocks);
+        ASSERT_EQUAL(size, 52, "FileBlockTest::testMetaDataWrittenOnFlush() size written");
+        ASSERT_EQUAL(next, 7, "FileBlockTest::testMetaDataWrittenOnFlush() next written");
+
+        // reading makes sure what was written can be seen
+        block.write("HELLO", 5);
+        std::string dat(57, 0);
+        block.seek(0);
+        (void)block.read(&dat[0], 57);
+        ASSERT_EQUAL(dat.substr(39), std::string("Hello, world!HELLO"), "FileBlockTest::testMetaDataWrittenOnFlush() read back");
+        size = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io->blockSize, 0, blocks);
+        ASSERT_EQUAL(size, 57, "FileBlockTest::testMetaDataWrittenOnFlush() size after read");
+        stream.close();
+    }
+
 };
@@ -54,6 +54,7 @@ class FileTest
         testFileSizeReportedCorrectly();
         testBlocksAllocated();
         testFileUnlink();
+        testBlocksReusedAfterUnlinkStartAfresh();
         testReadingFromNonReadableThrows();
         testWritingToNonWritableThrows();
         testBigWriteFollowedByRead();
@@ -72,6 +73,13 @@ class FileTest
         testSeekingFromCurrentPositive_bigSeek();
         testEdgeCaseEndOfBlockOverWrite();
         testEdgeCaseEndOfBlockAppend();
+        testInterleavedWritesStayContiguous();
+        testAllocationDelayedUntilFlush();
+        testUnlinkBeforeFlushAllocatesNothing();
+        testReserveAllocatesUpFront();
+        testSeeksFollowAppendAndTruncate();
+        testBlockMetaDataWrittenPerBlock();
+        testTruncateFreesTailBlocks();
     }
 
     ~FileTest()
@@ -191,6 +199,42 @@ class FileTest
         }
     }
 
+    void testBlocksReusedAfterUnlinkStartAfresh()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+
+        // unlinking leaves the metadata of the freed blocks as it was
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "big.txt");
+            std::string testData(createLargeStringToWrite());
+            entry.write(testData.c_str(), BIG_SIZE);
+            entry.flush();
+            entry.unlink();
+        }
+
+        // a shorter file written over the freed blocks must end where its
+        // own data ends rather than running on into the old chain
+        std::string const testData(createLargeStringToWrite().substr(0, 2500));
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "small.txt");
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "small.txt", startBlock,
+                                  knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            ASSERT_EQUAL(testData.length(), entry.fileSize(), "FileTest::testBlocksReusedAfterUnlinkStartAfresh size");
+            std::vector<char> vec(testData.length());
+            entry.read(&vec.front(), vec.size());
+            ASSERT_EQUAL(testData, std::string(vec.begin(), vec.end()), "FileTest::testBlocksReusedAfterUnlinkStartAfresh content");
+        }
+    }
+
     void testReadingFromNonReadableThrows()
     {
         boost::filesystem::path testPath = buildImage(m_uniquePath);
@@ -540,7 +584,7 @@ class FileTest
             std::string const testString("Hello and goodbye!");
             std::string testData(testString);
             std::vector<uint8_t> vec(testData.begin(), testData.end());
-            entry.write((char*)&vec.front(), BIG_SIZE);
+            entry.write((char*)&vec.front(), vec.size());
             entry.flush();
         }
 
@@ -827,4 +871,230 @@ class FileTest
             ASSERT_EQUAL(recovered, testData, "FileTest:: testEdgeCaseEndOfBlockAppend() content");
         }
     }
+
+    /// counts the links in a file's block chain that aren't to the very next block
+    uint64_t countChainBreaks(knoxcrypt::SharedCoreIO const &io, uint64_t block)
+    {
+        uint64_t breaks(0);
+        while (true) {
+            knoxcrypt::FileBlock fileBlock(io, block, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            uint64_t const next = fileBlock.getNextIndex();
+            if (next == block) {
+                return breaks;
+            }
+            if (next != block + 1) {
+                ++breaks;
+            }
+            block = next;
+        }
+    }
+
+    void testInterleavedWritesStayContiguous()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        std::string const chunk(io->blockSize * 3, 'x');
+        uint64_t startA;
+        uint64_t startB;
+        {
+            knoxcrypt::File entryA(io, "a");
+            knoxcrypt::File entryB(io, "b");
+            for (int i = 0; i < 10; ++i) {
+                entryA.write(chunk.c_str(), chunk.length());
+                entryB.write(chunk.c_str(), chunk.length());
+            }
+            entryA.flush();
+            entryB.flush();
+            startA = entryA.getStartVolumeBlockIndex();
+            startB = entryB.getStartVolumeBlockIndex();
+        }
+
+        // rather than alternating, each file's blocks should follow on
+        // from one another
+        ASSERT_EQUAL(0, countChainBreaks(io, startA), "FileTest::testInterleavedWritesStayContiguous() A");
+        ASSERT_EQUAL(0, countChainBreaks(io, startB), "FileTest::testInterleavedWritesStayContiguous() B");
+    }
+
+    void testAllocationDelayedUntilFlush()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        std::string const testData(createLargeStringToWrite());
+        knoxcrypt::File entry(io, "delayed.txt");
+        uint64_t const startBlock = entry.getStartVolumeBlockIndex();
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+
+        // written in small pieces, none of which gets a block of its own
+        for (size_t offset = 0; offset < testData.length(); offset += 1000) {
+            entry.write(testData.c_str() + offset, std::min(size_t(1000), testData.length() - offset));
+        }
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testAllocationDelayedUntilFlush nothing allocated");
+        ASSERT_EQUAL(testData.length(), entry.fileSize(), "FileTest::testAllocationDelayedUntilFlush size before flush");
+        ASSERT_EQUAL(testData.length(), static_cast<size_t>(entry.tell()), "FileTest::testAllocationDelayedUntilFlush tell before flush");
+
+        // on flush, the whole file goes in one run
+        entry.flush();
+        uint64_t const blockSpace = io->blockSize - knoxcrypt::detail::FILE_BLOCK_META;
+        uint64_t const blocksUsed = (testData.length() + blockSpace - 1) / blockSpace;
+        ASSERT_EQUAL(allocated + blocksUsed - 1, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testAllocationDelayedUntilFlush allocated");
+        ASSERT_EQUAL(0, countChainBreaks(io, startBlock), "FileTest::testAllocationDelayedUntilFlush contiguous");
+
+        knoxcrypt::File readBack(io, "delayed.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> vec(testData.length());
+        readBack.read(&vec.front(), vec.size());
+        ASSERT_EQUAL(testData, std::string(vec.begin(), vec.end()), "FileTest::testAllocationDelayedUntilFlush content");
+    }
+
+    void testUnlinkBeforeFlushAllocatesNothing()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        {
+            knoxcrypt::File entry(io, "temp.txt");
+            (void)entry.getStartVolumeBlockIndex();
+            std::string const testData(createLargeStringToWrite());
+            entry.write(testData.c_str(), testData.length());
+            entry.unlink();
+        }
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testUnlinkBeforeFlushAllocatesNothing");
+    }
+
+    void testReserveAllocatesUpFront()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        std::string const testData(createLargeStringToWrite());
+        uint64_t const blockSpace = io->blockSize - knoxcrypt::detail::FILE_BLOCK_META;
+        uint64_t const blocksUsed = (testData.length() + blockSpace - 1) / blockSpace;
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const freeBlocks = io->freeBlocks;
+        {
+            knoxcrypt::File entry(io, "reserved.txt");
+            entry.reserve(testData.length() + 10 * blockSpace);
+            ASSERT_EQUAL(allocated + blocksUsed + 10, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testReserveAllocatesUpFront allocated");
+            ASSERT_EQUAL(freeBlocks - blocksUsed - 10, io->freeBlocks, "FileTest::testReserveAllocatesUpFront free count");
+            ASSERT_EQUAL(0, entry.fileSize(), "FileTest::testReserveAllocatesUpFront size unchanged");
+
+            // the writes use up the reserved blocks rather than new ones
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            ASSERT_EQUAL(allocated + blocksUsed + 10, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testReserveAllocatesUpFront nothing more");
+            ASSERT_EQUAL(0, countChainBreaks(io, entry.getStartVolumeBlockIndex()), "FileTest::testReserveAllocatesUpFront contiguous");
+        }
+
+        // the blocks that went unused are given back
+        ASSERT_EQUAL(allocated + blocksUsed, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testReserveAllocatesUpFront released");
+        ASSERT_EQUAL(freeBlocks - blocksUsed, io->freeBlocks, "FileTest::testReserveAllocatesUpFront free count after");
+    }
+
+    void testSeeksFollowAppendAndTruncate()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        std::string const first(createLargeStringToWrite());
+        std::string const second(createLargeStringToWrite("Goodbye, World!"));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(first.c_str(), first.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // blocks added after opening are found as well as those there before
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+        entry.write(second.c_str(), second.length());
+        entry.flush();
+        std::string const all(first + second);
+        std::vector<uint64_t> const offsets{200000, 100, 130001, 4084 * 10, 0, all.length() - 50};
+        bool readsMatch = true;
+        for (auto const offset : offsets) {
+            std::vector<char> buffer(50);
+            (void)entry.seek(offset, std::ios_base::beg);
+            (void)entry.read(&buffer.front(), buffer.size());
+            readsMatch = readsMatch && std::equal(buffer.begin(), buffer.end(), all.begin() + offset);
+        }
+        ASSERT_EQUAL(true, readsMatch, "FileTest::testSeeksFollowAppendAndTruncate after append");
+
+        // and those cut off by a truncate are forgotten
+        entry.truncate(10000);
+        (void)entry.seek(0, std::ios_base::beg);
+        std::vector<char> buffer(1000);
+        (void)entry.seek(100000, std::ios_base::beg);
+        ASSERT_EQUAL(0, entry.read(&buffer.front(), buffer.size()), "FileTest::testSeeksFollowAppendAndTruncate past end");
+        ASSERT_EQUAL(10000, entry.fileSize(), "FileTest::testSeeksFollowAppendAndTruncate size after truncate");
+        (void)entry.seek(9900, std::ios_base::beg);
+        ASSERT_EQUAL(100, entry.read(&buffer.front(), buffer.size()), "FileTest::testSeeksFollowAppendAndTruncate read to end");
+        ASSERT_EQUAL(true, std::equal(buffer.begin(), buffer.begin() + 100, all.begin() + 9900),
+                     "FileTest::testSeeksFollowAppendAndTruncate after truncate");
+    }
+
+    void testBlockMetaDataWrittenPerBlock()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->delayedAllocationBytes = 0;
+        uint64_t const blockSpace = io->blockSize - knoxcrypt::detail::FILE_BLOCK_META;
+        std::string const data(createLargeStringToWrite());
+
+        // lots of small appends, spilling over into several blocks
+        knoxcrypt::File entry(io, "test.txt");
+        uint64_t written = 0;
+        while (written < blockSpace * 3 + 100) {
+            entry.write(data.c_str() + written, 37);
+            written += 37;
+        }
+        uint64_t const startBlock = entry.getStartVolumeBlockIndex();
+
+        // the blocks that were filled up are complete in the image while
+        // the one still being written to is held back
+        {
+            knoxcrypt::File other(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            ASSERT_EQUAL(blockSpace * 3, other.fileSize(), "FileTest::testBlockMetaDataWrittenPerBlock before flush");
+        }
+
+        entry.flush();
+        {
+            knoxcrypt::File other(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            ASSERT_EQUAL(written, other.fileSize(), "FileTest::testBlockMetaDataWrittenPerBlock after flush");
+            std::vector<char> buffer(written);
+            (void)other.read(&buffer.front(), written);
+            ASSERT_EQUAL(true, std::equal(buffer.begin(), buffer.end(), data.begin()),
+                         "FileTest::testBlockMetaDataWrittenPerBlock data");
+        }
+    }
+
+    void testTruncateFreesTailBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const blockSpace = io->blockSize - knoxcrypt::detail::FILE_BLOCK_META;
+        std::string const data(createLargeStringToWrite());
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const freeBlocks = io->freeBlocks;
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(data.c_str(), blockSpace * 20);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // the 18 blocks past the new end are given back
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+        entry.truncate(blockSpace + 10);
+        ASSERT_EQUAL(allocated + 2, io->bitmap->getNumberOfAllocatedBlocks(), "FileTest::testTruncateFreesTailBlocks allocated");
+        ASSERT_EQUAL(freeBlocks - 2, io->freeBlocks, "FileTest::testTruncateFreesTailBlocks free count");
+
+        // and the file carries on from its new end
+        (void)entry.seek(0, std::ios_base::end);
+        entry.write(data.c_str() + blockSpace + 10, blockSpace);
+        entry.flush();
+        knoxcrypt::File other(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(blockSpace * 2 + 10, other.fileSize(), "FileTest::testTruncateFreesTailBlocks size");
+        std::vector<char> buffer(other.fileSize());
+        (void)other.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(true, std::equal(buffer.begin(), buffer.end(), data.begin()), "FileTest::testTruncateFreesTailBlocks data");
+    }
 };
@@ -0,0 +1,134 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/detail/DetailHolePunch.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace simpletest;
+
+class HolePunchTest
+{
+  public:
+    HolePunchTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        if (knoxcrypt::detail::isHolePunchingSupported()) {
+            testUnlinkPunchesHoles();
+            testTrimPunchesFreeBlocks();
+        }
+    }
+
+    ~HolePunchTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    /// the bytes of the image actually backed by the host file system
+    static uint64_t allocatedBytes(boost::filesystem::path const &path)
+    {
+        struct stat st;
+        (void)::stat(path.string().c_str(), &st);
+        return uint64_t(st.st_blocks) * 512;
+    }
+
+    /// writes a big file, returning its start block
+    static uint64_t writeBigFile(knoxcrypt::SharedCoreIO const &io, std::string const &name)
+    {
+        knoxcrypt::File entry(io, name);
+        std::string const testData(createLargeStringToWrite());
+        entry.write(testData.c_str(), testData.length());
+        entry.flush();
+        return entry.getStartVolumeBlockIndex();
+    }
+
+    void testUnlinkPunchesHoles()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        uint64_t before;
+        uint64_t after;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            io->punchHoles = true;
+            knoxcrypt::File entry(io, "big.txt");
+            std::string const testData(createLargeStringToWrite());
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            before = allocatedBytes(testPath);
+            entry.unlink();
+            after = allocatedBytes(testPath);
+        }
+        ASSERT_EQUAL(true, after + BIG_SIZE / 2 < before, "testUnlinkPunchesHoles: space released");
+
+        // the punched blocks are handed out again like any other free blocks
+        std::string const testData(createLargeStringToWrite());
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const startBlock = writeBigFile(io, "again.txt");
+        knoxcrypt::File entry(io, "again.txt", startBlock,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buffer(testData.length());
+        entry.read(&buffer.front(), buffer.size());
+        ASSERT_EQUAL(testData, std::string(buffer.begin(), buffer.end()),
+                     "testUnlinkPunchesHoles: blocks reusable");
+    }
+
+    void testTrimPunchesFreeBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const startBlock = writeBigFile(io, "big.txt");
+        uint64_t const written = allocatedBytes(testPath);
+        {
+            knoxcrypt::File entry(io, "big.txt", startBlock,
+                                  knoxcrypt::OpenDisposition::buildAppendDisposition());
+            entry.unlink();
+        }
+
+        // without hole punching a delete leaves the space allocated...
+        ASSERT_EQUAL(written, allocatedBytes(testPath), "testTrimPunchesFreeBlocks: not punched on unlink");
+
+        // ...until a trim pass gives it back
+        ASSERT_EQUAL(true, knoxcrypt::detail::punchFreeBlocks(io) > 0, "testTrimPunchesFreeBlocks: blocks punched");
+        ASSERT_EQUAL(true, allocatedBytes(testPath) + BIG_SIZE / 2 < written, "testTrimPunchesFreeBlocks: space released");
+    }
+};
@@ -0,0 +1,247 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class InlineFileTest
+{
+  public:
+    InlineFileTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageVersionRecorded();
+        testSmallFileTakesNoBlocks();
+        testGrowingFileMovesToBlocks();
+        testOverwriteAndTruncate();
+        testRenameKeepsData();
+        testMoveToOtherFolderKeepsData();
+        testRemoveInlineFile();
+        testThresholdOfZeroDisablesInlining();
+    }
+
+    ~InlineFileTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static void writeFile(knoxcrypt::CoreFS &kc, std::string const &path, std::string const &data)
+    {
+        auto device(kc.openFile(path, knoxcrypt::OpenDisposition::buildAppendDisposition()));
+        (void)device.write(data.c_str(), data.length());
+        device.close();
+    }
+
+    static std::string readFile(knoxcrypt::CoreFS &kc, std::string const &path)
+    {
+        auto device(kc.openFile(path, knoxcrypt::OpenDisposition::buildReadOnlyDisposition()));
+        std::vector<char> buffer(kc.getInfo(path).size());
+        if (!buffer.empty()) {
+            (void)device.read(&buffer.front(), buffer.size());
+        }
+        return std::string(buffer.begin(), buffer.end());
+    }
+
+    void testImageVersionRecorded()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath, TestIOOptions().inlined())));
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(true, io->inlineFiles, "InlineFileTest::testImageVersionRecorded inline");
+
+        auto plainIo(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::detail::readImageIVAndRounds(plainIo);
+        ASSERT_EQUAL(false, plainIo->inlineFiles, "InlineFileTest::testImageVersionRecorded not inline");
+    }
+
+    void testSmallFileTakesNoBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        std::string const data("a tiny config file");
+        uint64_t allocated;
+        {
+            auto io(createTestIO(testPath, TestIOOptions().inlined()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+
+            // the folder's first file gives it somewhere to keep entries
+            kc.addFile("/folder/first.txt");
+            allocated = io->bitmap->getNumberOfAllocatedBlocks();
+            kc.addFile("/folder/test.txt");
+            writeFile(kc, "/folder/test.txt", data);
+            ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(),
+                         "InlineFileTest::testSmallFileTakesNoBlocks allocated");
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(data.length(), kc.getInfo("/folder/test.txt").size(),
+                     "InlineFileTest::testSmallFileTakesNoBlocks size");
+        ASSERT_EQUAL(true, kc.getInfo("/folder/test.txt").isInline(),
+                     "InlineFileTest::testSmallFileTakesNoBlocks inline");
+        ASSERT_EQUAL(data, readFile(kc, "/folder/test.txt"), "InlineFileTest::testSmallFileTakesNoBlocks content");
+    }
+
+    void testGrowingFileMovesToBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        std::string const start("the start of a file that grows; ");
+        std::string const rest(createLargeStringToWrite());
+        uint64_t allocated;
+        {
+            auto io(createTestIO(testPath, TestIOOptions().inlined()));
+            knoxcrypt::CoreFS kc(io);
+            allocated = io->bitmap->getNumberOfAllocatedBlocks();
+            kc.addFile("/test.txt");
+            writeFile(kc, "/test.txt", start);
+            writeFile(kc, "/test.txt", rest);
+            ASSERT_EQUAL(false, kc.getInfo("/test.txt").isInline(), "InlineFileTest::testGrowingFileMovesToBlocks moved");
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(false, kc.getInfo("/test.txt").isInline(), "InlineFileTest::testGrowingFileMovesToBlocks reopened");
+        ASSERT_EQUAL(start + rest, readFile(kc, "/test.txt"), "InlineFileTest::testGrowingFileMovesToBlocks content");
+        kc.removeFile("/test.txt");
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "InlineFileTest::testGrowingFileMovesToBlocks freed");
+    }
+
+    void testOverwriteAndTruncate()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        kc.addFile("/test.txt");
+        writeFile(kc, "/test.txt", "hello, inline world");
+        {
+            auto device(kc.openFile("/test.txt", knoxcrypt::OpenDisposition::buildOverwriteDisposition()));
+            (void)device.seek(7, std::ios_base::beg);
+            (void)device.write("INLINE", 6);
+            device.close();
+        }
+        ASSERT_EQUAL("hello, INLINE world", readFile(kc, "/test.txt"), "InlineFileTest::testOverwriteAndTruncate overwrite");
+
+        kc.truncateFile("/test.txt", 5);
+        kc.flushFile("/test.txt");
+        ASSERT_EQUAL("hello", readFile(kc, "/test.txt"), "InlineFileTest::testOverwriteAndTruncate truncate");
+        ASSERT_EQUAL(true, kc.getInfo("/test.txt").isInline(), "InlineFileTest::testOverwriteAndTruncate inline");
+    }
+
+    void testRenameKeepsData()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        std::string const data(200, 'x');
+        {
+            auto io(createTestIO(testPath, TestIOOptions().inlined()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFile("/a.txt");
+            writeFile(kc, "/a.txt", data);
+            kc.renameEntry("/a.txt", "/b.txt");
+
+            // a name this long leaves too little room for the data
+            kc.addFile("/c.txt");
+            writeFile(kc, "/c.txt", data);
+            kc.renameEntry("/c.txt", "/" + std::string(100, 'c'));
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(true, kc.getInfo("/b.txt").isInline(), "InlineFileTest::testRenameKeepsData inline");
+        ASSERT_EQUAL(data, readFile(kc, "/b.txt"), "InlineFileTest::testRenameKeepsData content");
+        std::string const longPath("/" + std::string(100, 'c'));
+        ASSERT_EQUAL(false, kc.getInfo(longPath).isInline(), "InlineFileTest::testRenameKeepsData long name moved");
+        ASSERT_EQUAL(data, readFile(kc, longPath), "InlineFileTest::testRenameKeepsData long name content");
+    }
+
+    void testMoveToOtherFolderKeepsData()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        std::string const data("moved about");
+        {
+            auto io(createTestIO(testPath, TestIOOptions().inlined()));
+            knoxcrypt::CoreFS kc(io);
+            kc.addFolder("/folder");
+            kc.addFile("/test.txt");
+            writeFile(kc, "/test.txt", data);
+            kc.renameEntry("/test.txt", "/folder/moved.txt");
+        }
+
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        ASSERT_EQUAL(false, kc.fileExists("/test.txt"), "InlineFileTest::testMoveToOtherFolderKeepsData source");
+        ASSERT_EQUAL(data, readFile(kc, "/folder/moved.txt"), "InlineFileTest::testMoveToOtherFolderKeepsData content");
+    }
+
+    void testRemoveInlineFile()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        knoxcrypt::CoreFS kc(io);
+        kc.addFile("/test.txt");
+        writeFile(kc, "/test.txt", "short lived");
+        kc.removeFile("/test.txt");
+        ASSERT_EQUAL(false, kc.fileExists("/test.txt"), "InlineFileTest::testRemoveInlineFile removed");
+
+        // the entry is reused and starts out empty
+        kc.addFile("/other.txt");
+        ASSERT_EQUAL(0, kc.getInfo("/other.txt").size(), "InlineFileTest::testRemoveInlineFile reused");
+    }
+
+    void testThresholdOfZeroDisablesInlining()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, TestIOOptions().inlined());
+        auto io(createTestIO(testPath, TestIOOptions().inlined()));
+        io->inlineFileBytes = 0;
+        knoxcrypt::CoreFS kc(io);
+        kc.addFolder("/folder");
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        kc.addFile("/test.txt");
+        writeFile(kc, "/test.txt", "in a block");
+        ASSERT_EQUAL(false, kc.getInfo("/test.txt").isInline(), "InlineFileTest::testThresholdOfZeroDisablesInlining inline");
+        ASSERT_EQUAL(allocated + 1, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "InlineFileTest::testThresholdOfZeroDisablesInlining allocated");
+        ASSERT_EQUAL("in a block", readFile(kc, "/test.txt"), "InlineFileTest::testThresholdOfZeroDisablesInlining content");
+    }
+};
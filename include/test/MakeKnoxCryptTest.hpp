@@ -50,6 +50,7 @@ class MakeKnoxCryptTest
         correctBlockCountIsReported();
         firstBlockIsReportedAsBeingFree();
         blocksCanBeSetAndCleared();
+        blocksCanBeSetAndClearedInBatches();
         testThatRootFolderContainsZeroEntries();
     }
 
@@ -126,6 +127,31 @@ class MakeKnoxCryptTest
         is.close();
     }
 
+    void blocksCanBeSetAndClearedInBatches()
+    {
+        int blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        knoxcrypt::ContainerImageStream is(io, std::ios::in | std::ios::out | std::ios::binary);
+        std::vector<uint64_t> batch;
+        for (int i = blocks - 1; i > 0; --i) {
+            batch.push_back(i);
+        }
+        knoxcrypt::detail::updateVolumeBitmap(is, batch, blocks);
+        ASSERT_EQUAL(true, !knoxcrypt::detail::getNextAvailableBlock(is), "MakeKnoxCryptTest::blocksCanBeSetAndClearedInBatches full");
+
+        // far apart blocks are freed in separate runs
+        knoxcrypt::detail::updateVolumeBitmap(is, {1900, 7, 8}, blocks, false);
+        auto p = knoxcrypt::detail::getNAvailableBlocks(is, 3, blocks);
+        ASSERT_EQUAL(7, p[0], "MakeKnoxCryptTest::blocksCanBeSetAndClearedInBatches A");
+        ASSERT_EQUAL(8, p[1], "MakeKnoxCryptTest::blocksCanBeSetAndClearedInBatches B");
+        ASSERT_EQUAL(1900, p[2], "MakeKnoxCryptTest::blocksCanBeSetAndClearedInBatches C");
+
+        is.close();
+    }
+
     void testThatRootFolderContainsZeroEntries()
     {
         boost::filesystem::path testPath = buildImage(m_uniquePath);
@@ -0,0 +1,172 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ImageFile.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+
+using namespace simpletest;
+
+class MappedImageTest
+{
+  public:
+    MappedImageTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageMapped();
+        testMappedWritesSeenUnmapped();
+        testUnmappedWritesSeenMapped();
+        testMappingGrows();
+        testStreamThroughMapping();
+        testFilesThroughMapping();
+    }
+
+    ~MappedImageTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static std::ios::openmode readWrite()
+    {
+        return std::ios::in | std::ios::out | std::ios::binary;
+    }
+
+    void testImageMapped()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path));
+        auto const unmapped(knoxcrypt::ImageFile::open(io));
+        ASSERT_EQUAL(false, unmapped->isMapped(), "MappedImageTest::testImageMapped unmapped");
+        io->mapImage = true;
+        auto const mapped(knoxcrypt::ImageFile::open(io));
+        ASSERT_EQUAL(true, mapped->isMapped(), "MappedImageTest::testImageMapped mapped");
+        ASSERT_EQUAL(false, mapped == unmapped, "MappedImageTest::testImageMapped kept apart");
+    }
+
+    void testMappedWritesSeenUnmapped()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream mapped(createTestIO(path, TestIOOptions().mapped()), readWrite());
+        knoxcrypt::ContainerImageStream unmapped(createTestIO(path), readWrite());
+        std::string const data("through the mapping");
+        uint64_t const offset = boost::filesystem::file_size(path) - 100;
+        ASSERT_EQUAL(19, mapped.writeAt(offset, data.c_str(), data.length()), "MappedImageTest::testMappedWritesSeenUnmapped written");
+        ASSERT_EQUAL(data, readAt(unmapped, offset, data.length()), "MappedImageTest::testMappedWritesSeenUnmapped");
+    }
+
+    void testUnmappedWritesSeenMapped()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream mapped(createTestIO(path, TestIOOptions().mapped()), readWrite());
+        knoxcrypt::ContainerImageStream unmapped(createTestIO(path), readWrite());
+        std::string const data("around the mapping");
+        uint64_t const offset = boost::filesystem::file_size(path) - 100;
+        (void)unmapped.writeAt(offset, data.c_str(), data.length());
+        ASSERT_EQUAL(data, readAt(mapped, offset, data.length()), "MappedImageTest::testUnmappedWritesSeenMapped");
+    }
+
+    void testMappingGrows()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream mapped(createTestIO(path, TestIOOptions().mapped()), readWrite());
+        knoxcrypt::ContainerImageStream unmapped(createTestIO(path), readWrite());
+
+        // the image grows past the mapping both through it and around it
+        uint64_t const size = boost::filesystem::file_size(path);
+        std::string const data("grown");
+        (void)mapped.writeAt(size + 5000, data.c_str(), data.length());
+        ASSERT_EQUAL(data, readAt(unmapped, size + 5000, data.length()), "MappedImageTest::testMappingGrows through");
+        (void)unmapped.writeAt(size + 200000, data.c_str(), data.length());
+        ASSERT_EQUAL(data, readAt(mapped, size + 200000, data.length()), "MappedImageTest::testMappingGrows around");
+
+        // the grown image is written through the mapping too
+        std::string const more("more");
+        (void)mapped.writeAt(size + 5001, more.c_str(), more.length());
+        ASSERT_EQUAL(std::string("gmore"), readAt(unmapped, size + 5000, data.length()), "MappedImageTest::testMappingGrows written");
+    }
+
+    void testStreamThroughMapping()
+    {
+        auto const path(buildImage(m_uniquePath));
+        knoxcrypt::ContainerImageStream mapped(createTestIO(path, TestIOOptions().mapped()), readWrite());
+        uint64_t const offset = boost::filesystem::file_size(path) - 100;
+        std::string const data("streamed");
+        (void)mapped.seekp(offset);
+        (void)mapped.write(data.c_str(), data.length());
+        ASSERT_EQUAL(offset + data.length(), uint64_t(mapped.tellp()), "MappedImageTest::testStreamThroughMapping position");
+        mapped.flush();
+
+        std::string back(data.length(), 'x');
+        (void)mapped.seekg(offset);
+        (void)mapped.read(&back[0], back.length());
+        ASSERT_EQUAL(data, back, "MappedImageTest::testStreamThroughMapping read");
+        knoxcrypt::ContainerImageStream unmapped(createTestIO(path), readWrite());
+        ASSERT_EQUAL(data, readAt(unmapped, offset, data.length()), "MappedImageTest::testStreamThroughMapping unmapped");
+    }
+
+    void testFilesThroughMapping()
+    {
+        auto const path(buildImage(m_uniquePath));
+        std::string data(createLargeStringToWrite().substr(0, 30000));
+        {
+            knoxcrypt::CoreFS theBfs(createTestIO(path, TestIOOptions().mapped()));
+            theBfs.addFile("/a.txt");
+            auto device(theBfs.openFile("/a.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write(data.c_str(), data.length());
+            theBfs.flushFile("/a.txt");
+            ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "MappedImageTest::testFilesThroughMapping mapped");
+        }
+
+        knoxcrypt::CoreFS unmappedBfs(createTestIO(path));
+        ASSERT_EQUAL(true, data == readAll(unmappedBfs, "/a.txt"), "MappedImageTest::testFilesThroughMapping unmapped");
+
+        // and what's written unmapped is read back through the mapping
+        unmappedBfs.addFile("/b.txt");
+        {
+            auto device(unmappedBfs.openFile("/b.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write(data.c_str(), data.length());
+            unmappedBfs.flushFile("/b.txt");
+        }
+        knoxcrypt::CoreFS mappedBfs(createTestIO(path, TestIOOptions().mapped()));
+        ASSERT_EQUAL(true, data == readAll(mappedBfs, "/b.txt"), "MappedImageTest::testFilesThroughMapping read mapped");
+    }
+};
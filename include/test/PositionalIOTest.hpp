@@ -0,0 +1,242 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ImageFile.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace simpletest;
+
+class PositionalIOTest
+{
+  public:
+    PositionalIOTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testWriteAtReadBackByStream();
+        testStreamWriteReadBackAt();
+        testStreamPositionUnmoved();
+        testStreamSeesWritesAt();
+        testReadAtEndOfImage();
+        testImageShared();
+        testCachedReadAt();
+        testConcurrentReadAt();
+    }
+
+    ~PositionalIOTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static std::ios::openmode readWrite()
+    {
+        return std::ios::in | std::ios::out | std::ios::binary;
+    }
+
+    /// reads n bytes at offset through the stream interface
+    static std::string streamRead(knoxcrypt::ContainerImageStream &stream, uint64_t const offset, size_t const n)
+    {
+        std::string data(n, 'x');
+        (void)stream.seekg(offset);
+        (void)stream.read(&data[0], n);
+        return data;
+    }
+
+    void testWriteAtReadBackByStream()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        std::string const data("positional");
+        ASSERT_EQUAL(10, stream.writeAt(5000, data.c_str(), data.length()), "PositionalIOTest::testWriteAtReadBackByStream written");
+
+        // enciphered for where it is, so a fresh stream reads it back too
+        knoxcrypt::ContainerImageStream other(io, std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(data, streamRead(other, 5000, data.length()), "PositionalIOTest::testWriteAtReadBackByStream");
+    }
+
+    void testStreamWriteReadBackAt()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        std::string const data("streamed");
+        (void)stream.seekp(7001);
+        (void)stream.write(data.c_str(), data.length());
+
+        // what the stream still holds on to is read too
+        std::string back(data.length(), 'x');
+        ASSERT_EQUAL(8, stream.readAt(7001, &back[0], back.length()), "PositionalIOTest::testStreamWriteReadBackAt read");
+        ASSERT_EQUAL(data, back, "PositionalIOTest::testStreamWriteReadBackAt");
+    }
+
+    void testStreamPositionUnmoved()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        std::string const first("first");
+        std::string const second("second");
+        (void)stream.writeAt(6000, first.c_str(), first.length());
+        (void)stream.writeAt(9000, second.c_str(), second.length());
+
+        // reads and writes by offset leave the stream where it was
+        (void)stream.seekg(6000);
+        std::string bytes(second.length(), 'x');
+        (void)stream.readAt(9000, &bytes[0], bytes.length());
+        (void)stream.writeAt(12000, first.c_str(), first.length());
+        ASSERT_EQUAL(6000, stream.tellg(), "PositionalIOTest::testStreamPositionUnmoved position");
+        std::string streamed(first.length(), 'x');
+        (void)stream.read(&streamed[0], streamed.length());
+        ASSERT_EQUAL(first, streamed, "PositionalIOTest::testStreamPositionUnmoved stream read");
+        ASSERT_EQUAL(second, bytes, "PositionalIOTest::testStreamPositionUnmoved read at");
+    }
+
+    void testStreamSeesWritesAt()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        std::string const filler(40, 'f');
+        (void)stream.writeAt(20000, filler.c_str(), filler.length());
+
+        // the stream has likely buffered past what it read when the
+        // bytes after it are written by offset
+        std::string head(10, 'x');
+        (void)stream.seekg(20000);
+        (void)stream.read(&head[0], head.length());
+        std::string const data("after");
+        (void)stream.writeAt(20010, data.c_str(), data.length());
+        std::string next(data.length(), 'x');
+        (void)stream.read(&next[0], next.length());
+        ASSERT_EQUAL(data, next, "PositionalIOTest::testStreamSeesWritesAt");
+    }
+
+    void testReadAtEndOfImage()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path));
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        uint64_t const size = boost::filesystem::file_size(path);
+        std::vector<char> bytes(100);
+        ASSERT_EQUAL(40, stream.readAt(size - 40, &bytes.front(), bytes.size()), "PositionalIOTest::testReadAtEndOfImage short");
+        ASSERT_EQUAL(0, stream.readAt(size, &bytes.front(), bytes.size()), "PositionalIOTest::testReadAtEndOfImage past end");
+    }
+
+    void testImageShared()
+    {
+        auto const path(buildImage(m_uniquePath));
+        auto io(createTestIO(path));
+        auto const image(knoxcrypt::ImageFile::open(io));
+        ASSERT_EQUAL(true, image == knoxcrypt::ImageFile::open(createTestIO(path)), "PositionalIOTest::testImageShared same image");
+
+        // one stream's write is seen straight away by another
+        knoxcrypt::ContainerImageStream writer(io, readWrite());
+        knoxcrypt::ContainerImageStream reader(io, std::ios::in | std::ios::binary);
+        std::string const data("shared");
+        (void)writer.writeAt(30000, data.c_str(), data.length());
+        std::string back(data.length(), 'x');
+        (void)reader.readAt(30000, &back[0], back.length());
+        ASSERT_EQUAL(data, back, "PositionalIOTest::testImageShared");
+    }
+
+    void testCachedReadAt()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        io->blockCache = std::make_shared<knoxcrypt::BlockCache>(io->blockSize, 16);
+        knoxcrypt::ContainerImageStream stream(io, readWrite());
+        std::string const data(io->blockSize + 100, 'c');
+        (void)stream.writeAt(50000, data.c_str(), data.length());
+
+        // only whole blocks are held, so the image has to go past the data
+        (void)stream.writeAt(50000 + 3 * io->blockSize, data.c_str(), 1);
+
+        // the first read fills the cache and the second is served from it
+        std::string back(data.length(), 'x');
+        (void)stream.readAt(50000, &back[0], back.length());
+        uint64_t const misses = io->blockCache->misses();
+        std::string again(data.length(), 'x');
+        (void)stream.readAt(50000, &again[0], again.length());
+        ASSERT_EQUAL(data, again, "PositionalIOTest::testCachedReadAt content");
+        ASSERT_EQUAL(misses, io->blockCache->misses(), "PositionalIOTest::testCachedReadAt no more misses");
+
+        // a write by offset is seen by the cached blocks
+        (void)stream.writeAt(50010, "zz", 2);
+        (void)stream.readAt(50000, &again[0], again.length());
+        ASSERT_EQUAL(std::string("zz"), again.substr(10, 2), "PositionalIOTest::testCachedReadAt written");
+    }
+
+    void testConcurrentReadAt()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        std::vector<std::string> pieces;
+        {
+            knoxcrypt::ContainerImageStream writer(io, readWrite());
+            for (int i = 0; i < 4; ++i) {
+                pieces.push_back(std::string(3000 + i * 100, static_cast<char>('a' + i)));
+                (void)writer.writeAt(60000 + i * 5000, pieces.back().c_str(), pieces.back().length());
+            }
+        }
+
+        // each thread reads its own piece over and over from the one image,
+        // while the others are deciphering theirs
+        std::vector<std::shared_ptr<knoxcrypt::ContainerImageStream>> streams;
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            streams.push_back(std::make_shared<knoxcrypt::ContainerImageStream>(io, std::ios::in | std::ios::binary));
+        }
+        std::vector<int> good(pieces.size(), 0);
+        std::vector<std::thread> readers;
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            readers.emplace_back([&streams, &pieces, &good, i] {
+                for (int n = 0; n < 200; ++n) {
+                    std::string back(pieces[i].length(), 'x');
+                    (void)streams[i]->readAt(60000 + i * 5000, &back[0], back.length());
+                    good[i] += (back == pieces[i]) ? 1 : 0;
+                }
+            });
+        }
+        for (auto &reader : readers) {
+            reader.join();
+        }
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            ASSERT_EQUAL(200, good[i], "PositionalIOTest::testConcurrentReadAt");
+        }
+    }
+};
@@ -0,0 +1,225 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/BlockRefCounts.hpp"
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+
+using namespace simpletest;
+
+class SharedBlocksTest
+{
+  public:
+    SharedBlocksTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testImageVersionRecorded();
+        testCloneTakesNoDataBlocks();
+        testWritesCopyOnlyTheBlockWritten();
+        testBlocksFreedWithLastFile();
+        testTruncateClone();
+        testCloneFileCopiesWithoutSharing();
+    }
+
+    ~SharedBlocksTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static uint64_t blockSpace(knoxcrypt::SharedCoreIO const &io)
+    {
+        return knoxcrypt::detail::getBlockWriteSpace(io);
+    }
+
+    /// a few blocks' worth of data that differs from block to block
+    static std::string blocksOfData(knoxcrypt::SharedCoreIO const &io, uint64_t const blocks)
+    {
+        std::string data;
+        for (uint64_t b = 0; b < blocks; ++b) {
+            data.append(blockSpace(io), char('a' + b));
+        }
+        return data.substr(0, data.length() - 100);
+    }
+
+    static void writeFile(knoxcrypt::CoreFS &theBfs, std::string const &path, std::string const &data)
+    {
+        theBfs.addFile(path);
+        auto device(theBfs.openFile(path, knoxcrypt::OpenDisposition::buildAppendDisposition()));
+        (void)device.write(data.c_str(), data.length());
+        theBfs.flushFile(path);
+    }
+
+    void testImageVersionRecorded()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath, TestIOOptions().indexed().shared())));
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(true, io->sharedBlocks, "SharedBlocksTest::testImageVersionRecorded shared blocks");
+        ASSERT_EQUAL(true, io->blockIndex, "SharedBlocksTest::testImageVersionRecorded block index");
+
+        // the last block holds the counts
+        io->bitmap = knoxcrypt::VolumeBitmap::load(io, true /* reread */);
+        ASSERT_EQUAL(true, io->bitmap->isBlockInUse(io->blocks - 1), "SharedBlocksTest::testImageVersionRecorded table in use");
+    }
+
+    void testCloneTakesNoDataBlocks()
+    {
+        auto const options(TestIOOptions().indexed().shared());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        knoxcrypt::CoreFS theBfs(io);
+        std::string const data(blocksOfData(io, 10));
+        writeFile(theBfs, "/a.txt", data);
+
+        // the copy has its own index block but no data blocks
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        theBfs.cloneFile("/a.txt", "/b.txt");
+        ASSERT_EQUAL(allocated + 1, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testCloneTakesNoDataBlocks blocks");
+        ASSERT_EQUAL(data.length(), theBfs.getInfo("/b.txt").size(), "SharedBlocksTest::testCloneTakesNoDataBlocks size");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/b.txt"), "SharedBlocksTest::testCloneTakesNoDataBlocks content");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "SharedBlocksTest::testCloneTakesNoDataBlocks original");
+    }
+
+    void testWritesCopyOnlyTheBlockWritten()
+    {
+        auto const options(TestIOOptions().indexed().shared());
+        auto const path(buildImage(m_uniquePath, options));
+        auto io(createTestIO(path, options));
+        auto theBfs(std::make_shared<knoxcrypt::CoreFS>(io));
+        std::string original(blocksOfData(io, 10));
+        writeFile(*theBfs, "/a.txt", original);
+        theBfs->cloneFile("/a.txt", "/b.txt");
+        std::string copy(original);
+
+        // a write in the middle of the copy takes one block of its own
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const space = blockSpace(io);
+        std::string const xs(20, 'x');
+        {
+            auto device(theBfs->openFile("/b.txt", knoxcrypt::OpenDisposition::buildOverwriteDisposition()));
+            (void)device.seek(space * 3 + 10, std::ios_base::beg);
+            (void)device.write(xs.c_str(), xs.length());
+            theBfs->flushFile("/b.txt");
+        }
+        copy.replace(space * 3 + 10, xs.length(), xs);
+        ASSERT_EQUAL(allocated + 1, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten copy blocks");
+        ASSERT_EQUAL(true, copy == readAll(*theBfs, "/b.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten copy content");
+        ASSERT_EQUAL(true, original == readAll(*theBfs, "/a.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten original unchanged");
+
+        // appending to the original copies its last block only
+        std::string const ys(200, 'y');
+        {
+            auto device(theBfs->openFile("/a.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write(ys.c_str(), ys.length());
+            theBfs->flushFile("/a.txt");
+        }
+        original.append(ys);
+        ASSERT_EQUAL(allocated + 3, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten original blocks");
+        ASSERT_EQUAL(true, original == readAll(*theBfs, "/a.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten original content");
+        ASSERT_EQUAL(true, copy == readAll(*theBfs, "/b.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten copy unchanged");
+
+        // and both are as they were after the container is reopened
+        theBfs.reset();
+        knoxcrypt::CoreFS reopenedBfs(createTestIO(path, options));
+        ASSERT_EQUAL(true, original == readAll(reopenedBfs, "/a.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten original reopened");
+        ASSERT_EQUAL(true, copy == readAll(reopenedBfs, "/b.txt"), "SharedBlocksTest::testWritesCopyOnlyTheBlockWritten copy reopened");
+    }
+
+    void testBlocksFreedWithLastFile()
+    {
+        auto const options(TestIOOptions().indexed().shared());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        knoxcrypt::CoreFS theBfs(io);
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        std::string const data(blocksOfData(io, 10));
+        writeFile(theBfs, "/a.txt", data);
+        theBfs.cloneFile("/a.txt", "/b.txt");
+        theBfs.cloneFile("/b.txt", "/c.txt");
+
+        // only the index of each file goes until the last of them goes
+        uint64_t const withAll = io->bitmap->getNumberOfAllocatedBlocks();
+        theBfs.removeFile("/a.txt");
+        ASSERT_EQUAL(withAll - 1, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testBlocksFreedWithLastFile first");
+        theBfs.removeFile("/c.txt");
+        ASSERT_EQUAL(withAll - 2, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testBlocksFreedWithLastFile second");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/b.txt"), "SharedBlocksTest::testBlocksFreedWithLastFile content");
+        theBfs.removeFile("/b.txt");
+        ASSERT_EQUAL(allocated, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testBlocksFreedWithLastFile last");
+    }
+
+    void testTruncateClone()
+    {
+        auto const options(TestIOOptions().indexed().shared());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        knoxcrypt::CoreFS theBfs(io);
+        std::string const data(blocksOfData(io, 10));
+        writeFile(theBfs, "/a.txt", data);
+        theBfs.cloneFile("/a.txt", "/b.txt");
+
+        // the copy's new last block becomes its own; the blocks after it
+        // stay with the original
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const newSize = blockSpace(io) * 4 + 10;
+        theBfs.truncateFile("/b.txt", newSize);
+        theBfs.flushFile("/b.txt");
+        ASSERT_EQUAL(allocated + 1, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testTruncateClone blocks");
+        ASSERT_EQUAL(true, data.substr(0, newSize) == readAll(theBfs, "/b.txt"), "SharedBlocksTest::testTruncateClone copy");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "SharedBlocksTest::testTruncateClone original");
+    }
+
+    void testCloneFileCopiesWithoutSharing()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        knoxcrypt::CoreFS theBfs(io);
+        std::string const data(blocksOfData(io, 10));
+        writeFile(theBfs, "/a.txt", data);
+        writeFile(theBfs, "/b.txt", "something to be replaced");
+
+        // the copy has blocks of its own, replacing what it had
+        uint64_t const allocated = io->bitmap->getNumberOfAllocatedBlocks();
+        theBfs.cloneFile("/a.txt", "/b.txt");
+        ASSERT_EQUAL(allocated + 9, io->bitmap->getNumberOfAllocatedBlocks(), "SharedBlocksTest::testCloneFileCopiesWithoutSharing blocks");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/b.txt"), "SharedBlocksTest::testCloneFileCopiesWithoutSharing content");
+        (void)theBfs.openFile("/b.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()).write("z", 1);
+        theBfs.flushFile("/b.txt");
+        ASSERT_EQUAL(true, data == readAll(theBfs, "/a.txt"), "SharedBlocksTest::testCloneFileCopiesWithoutSharing original");
+    }
+};
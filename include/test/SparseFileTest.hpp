@@ -0,0 +1,266 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class SparseFileTest
+{
+  public:
+    SparseFileTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testWritesInTheMiddleCrossBlocks();
+        testWritePastEndLeavesHole();
+        testHoleBiggerThanVolume();
+        testWriteIntoHole();
+        testTruncateGrowsAndShrinksOverHoles();
+        testUnlinkFreesAroundHoles();
+        testFindDataAndHoles();
+        testZerosWithoutIndex();
+    }
+
+    ~SparseFileTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    static uint64_t blockSpace(knoxcrypt::SharedCoreIO const &io)
+    {
+        return knoxcrypt::detail::getBlockWriteSpace(io);
+    }
+
+    void testWritesInTheMiddleCrossBlocks()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        uint64_t const space = blockSpace(io);
+        std::string expected(space * 3, 'a');
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(expected.c_str(), expected.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // writes are made in the append mode too, as they are through fuse
+        std::string const bs(space * 2, 'b');
+        std::string const cs(space + 10, 'c');
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            (void)entry.seek(100, std::ios_base::beg);
+            entry.write(bs.c_str(), bs.length());
+            entry.flush();
+            expected.replace(100, bs.length(), bs);
+            ASSERT_EQUAL(space * 3, entry.fileSize(), "SparseFileTest::testWritesInTheMiddleCrossBlocks overwrite size");
+        }
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+            (void)entry.seek(space * 2 - 5, std::ios_base::beg);
+            entry.write(cs.c_str(), cs.length());
+            entry.flush();
+            expected.replace(space * 2 - 5, cs.length(), cs);
+            ASSERT_EQUAL(expected.length(), entry.fileSize(), "SparseFileTest::testWritesInTheMiddleCrossBlocks append size");
+        }
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(expected.length(), entry.fileSize(), "SparseFileTest::testWritesInTheMiddleCrossBlocks reopened size");
+        ASSERT_EQUAL(true, expected == readAll(entry), "SparseFileTest::testWritesInTheMiddleCrossBlocks content");
+    }
+
+    void testWritePastEndLeavesHole()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const space = blockSpace(io);
+        uint64_t const offset = space * 10 + 5;
+        uint64_t startBlock;
+        uint64_t const freeBefore = io->freeBlocks;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write("abc", 3);
+            ASSERT_EQUAL(offset, static_cast<uint64_t>(entry.seek(offset, std::ios_base::beg)), "SparseFileTest::testWritePastEndLeavesHole seek");
+            ASSERT_EQUAL(3, entry.fileSize(), "SparseFileTest::testWritePastEndLeavesHole size before write");
+            entry.write("xyz", 3);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // the index, the first block and the last block; no more
+        ASSERT_EQUAL(3, freeBefore - io->freeBlocks, "SparseFileTest::testWritePastEndLeavesHole blocks used");
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(offset + 3, entry.fileSize(), "SparseFileTest::testWritePastEndLeavesHole size");
+        std::string expected(offset + 3, 0);
+        expected.replace(0, 3, "abc");
+        expected.replace(offset, 3, "xyz");
+        ASSERT_EQUAL(true, expected == readAll(entry), "SparseFileTest::testWritePastEndLeavesHole content");
+    }
+
+    void testHoleBiggerThanVolume()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const size = blockSpace(io) * io->blocks * 2;
+        knoxcrypt::File entry(io, "test.txt");
+        entry.truncate(size);
+        entry.flush();
+        ASSERT_EQUAL(size, entry.fileSize(), "SparseFileTest::testHoleBiggerThanVolume size");
+
+        std::vector<char> buffer(100, 'x');
+        (void)entry.seek(size / 2, std::ios_base::beg);
+        ASSERT_EQUAL(100, entry.read(&buffer.front(), buffer.size()), "SparseFileTest::testHoleBiggerThanVolume read");
+        ASSERT_EQUAL(true, std::count(buffer.begin(), buffer.end(), 0) == 100, "SparseFileTest::testHoleBiggerThanVolume zeros");
+    }
+
+    void testWriteIntoHole()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const space = blockSpace(io);
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.truncate(space * 8);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // a write that starts in one hole and ends in the next
+        std::string const data(space + 20, 'd');
+        uint64_t const offset = space * 3 + 100;
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildAppendDisposition());
+            (void)entry.seek(offset, std::ios_base::beg);
+            entry.write(data.c_str(), data.length());
+            entry.flush();
+            ASSERT_EQUAL(space * 8, entry.fileSize(), "SparseFileTest::testWriteIntoHole size kept");
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::string expected(space * 8, 0);
+        expected.replace(offset, data.length(), data);
+        ASSERT_EQUAL(true, expected == readAll(entry), "SparseFileTest::testWriteIntoHole content");
+        ASSERT_EQUAL(space * 5, static_cast<uint64_t>(entry.nextHole(space * 3)), "SparseFileTest::testWriteIntoHole holes filled");
+    }
+
+    void testTruncateGrowsAndShrinksOverHoles()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const space = blockSpace(io);
+        knoxcrypt::File entry(io, "test.txt");
+        entry.write("abc", 3);
+        entry.truncate(space * 6);
+        ASSERT_EQUAL(3, entry.tell(), "SparseFileTest::testTruncateGrowsAndShrinksOverHoles position kept");
+
+        // cut in the middle of a hole, which leaves a block of zeros at the end
+        entry.truncate(space * 2 + 7);
+        ASSERT_EQUAL(space * 2 + 7, entry.fileSize(), "SparseFileTest::testTruncateGrowsAndShrinksOverHoles size");
+        entry.write("def", 3);
+        std::string expected(space * 2 + 7, 0);
+        expected.replace(0, 6, "abcdef");
+        ASSERT_EQUAL(true, expected == readAll(entry), "SparseFileTest::testTruncateGrowsAndShrinksOverHoles content");
+        ASSERT_EQUAL(space, static_cast<uint64_t>(entry.nextHole(0)), "SparseFileTest::testTruncateGrowsAndShrinksOverHoles last block real");
+    }
+
+    void testUnlinkFreesAroundHoles()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const space = blockSpace(io);
+        uint64_t const freeBefore = io->freeBlocks;
+        knoxcrypt::File entry(io, "test.txt");
+        entry.truncate(space * 1000);
+        (void)entry.seek(space * 500, std::ios_base::beg);
+        entry.write("abc", 3);
+        entry.flush();
+        entry.unlink();
+        ASSERT_EQUAL(freeBefore, io->freeBlocks, "SparseFileTest::testUnlinkFreesAroundHoles");
+    }
+
+    void testFindDataAndHoles()
+    {
+        auto const options(TestIOOptions().indexed());
+        auto io(createTestIO(buildImage(m_uniquePath, options), options));
+        uint64_t const space = blockSpace(io);
+        knoxcrypt::CoreFS coreFS(io);
+        coreFS.addFile("/sparse.txt");
+        {
+            auto device(coreFS.openFile("/sparse.txt", knoxcrypt::OpenDisposition::buildAppendDisposition()));
+            (void)device.write("abc", 3);
+            (void)device.seek(space * 4, std::ios_base::beg);
+            (void)device.write("def", 3);
+            device.close();
+        }
+
+        // data in the first block and in the fifth, holes in between
+        ASSERT_EQUAL(0, coreFS.findDataOrHole("/sparse.txt", 0, false), "SparseFileTest::testFindDataAndHoles data at start");
+        ASSERT_EQUAL(space, static_cast<uint64_t>(coreFS.findDataOrHole("/sparse.txt", 0, true)), "SparseFileTest::testFindDataAndHoles first hole");
+        ASSERT_EQUAL(space * 4, static_cast<uint64_t>(coreFS.findDataOrHole("/sparse.txt", space + 1, false)), "SparseFileTest::testFindDataAndHoles data after hole");
+        ASSERT_EQUAL(space * 2, static_cast<uint64_t>(coreFS.findDataOrHole("/sparse.txt", space * 2, true)), "SparseFileTest::testFindDataAndHoles in hole");
+        ASSERT_EQUAL(space * 4 + 3, static_cast<uint64_t>(coreFS.findDataOrHole("/sparse.txt", space * 4, true)), "SparseFileTest::testFindDataAndHoles hole at end");
+        ASSERT_EQUAL(-1, coreFS.findDataOrHole("/sparse.txt", space * 4 + 3, false), "SparseFileTest::testFindDataAndHoles past end");
+    }
+
+    void testZerosWithoutIndex()
+    {
+        auto io(createTestIO(buildImage(m_uniquePath)));
+        uint64_t const space = blockSpace(io);
+        uint64_t const offset = space * 3 + 10;
+        knoxcrypt::File entry(io, "test.txt");
+        entry.write("abc", 3);
+        (void)entry.seek(offset, std::ios_base::beg);
+        entry.write("xyz", 3);
+        entry.flush();
+
+        // without an index the gap is written out in full
+        std::string expected(offset + 3, 0);
+        expected.replace(0, 3, "abc");
+        expected.replace(offset, 3, "xyz");
+        ASSERT_EQUAL(true, expected == readAll(entry), "SparseFileTest::testZerosWithoutIndex content");
+        ASSERT_EQUAL(offset + 3, static_cast<uint64_t>(entry.nextHole(0)), "SparseFileTest::testZerosWithoutIndex no holes");
+    }
+
+};
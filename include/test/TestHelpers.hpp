@@ -29,9 +29,14 @@
 #pragma once
 
 #include "cryptostreampp/Algorithms.hpp"
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "utility/MakeKnoxCrypt.hpp"
 
 #include <boost/filesystem/path.hpp>
@@ -50,7 +55,38 @@ int testFailures = 0;
 int passedPoints = 0;
 std::vector<std::string> failingTestPoints;
 
-knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath)
+/// the format flags a test image is built and accessed with, and how the
+/// io gets at the image; the setters chain so that a test only names the
+/// ones it turns on, e.g., TestIOOptions().aligned().indexed()
+struct TestIOOptions
+{
+    bool alignedBlocks = false;
+    bool blockIndex = false;
+    bool inlineFiles = false;
+    bool entrySizes = false;
+    bool sharedBlocks = false;
+    uint64_t cacheBlocks = 0; // no block cache if 0
+    bool mapImage = false;
+    bool ioUring = false;
+    unsigned cipherThreads = 1;
+
+    TestIOOptions &aligned(bool const on = true) { alignedBlocks = on; return *this; }
+    TestIOOptions &indexed(bool const on = true) { blockIndex = on; return *this; }
+    TestIOOptions &inlined(bool const on = true) { inlineFiles = on; return *this; }
+    TestIOOptions &entrySized(bool const on = true) { entrySizes = on; return *this; }
+    TestIOOptions &shared(bool const on = true) { sharedBlocks = on; return *this; }
+    TestIOOptions &cached(uint64_t const capacity = 64) { cacheBlocks = capacity; return *this; }
+    TestIOOptions &mapped(bool const on = true) { mapImage = on; return *this; }
+    TestIOOptions &uring(bool const on = true) { ioUring = on; return *this; }
+    TestIOOptions &threads(unsigned const n) { cipherThreads = n; return *this; }
+
+    /// does the io get at the image other than how a plain one does? the
+    /// bitmap then has to be read through the io's own streams
+    bool ownStreams() const { return cacheBlocks > 0 || mapImage || ioUring || cipherThreads != 1; }
+};
+
+knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath,
+                                     TestIOOptions const &options = TestIOOptions())
 {
     knoxcrypt::SharedCoreIO io = std::make_shared<knoxcrypt::CoreIO>();
     io->path = testPath.string();
@@ -64,18 +100,31 @@ knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath)
     io->rounds = 64;
     io->encProps.cipher = cryptostreampp::Algorithm::AES;
     io->rootBlock = 0;
+    io->alignedBlocks = options.alignedBlocks;
+    io->blockIndex = options.blockIndex;
+    io->inlineFiles = options.inlineFiles;
+    io->entrySizes = options.entrySizes;
+    io->sharedBlocks = options.sharedBlocks;
+    io->mapImage = options.mapImage;
+    io->ioUring = options.ioUring;
+    io->cipherThreads = options.cipherThreads;
+    if (options.cacheBlocks > 0) {
+        io->blockCache = std::make_shared<knoxcrypt::BlockCache>(io->blockSize, options.cacheBlocks);
+    }
+    io->bitmap = knoxcrypt::VolumeBitmap::load(io, options.ownStreams());
     io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
     io->useBlockCache = false;
     io->firstTimeInit = false;
     return io;
 }
 
-inline boost::filesystem::path buildImage(boost::filesystem::path const &path)
+inline boost::filesystem::path buildImage(boost::filesystem::path const &path,
+                                          TestIOOptions const &options = TestIOOptions(),
+                                          bool const sparse = true) // quicker testing with sparse images
 {
     std::string testImage(boost::filesystem::unique_path().string());
     boost::filesystem::path testPath = path / testImage;
-    knoxcrypt::SharedCoreIO io(createTestIO(testPath));
-    bool const sparse = true; // quicker testing with sparse images
+    knoxcrypt::SharedCoreIO io(createTestIO(testPath, options));
     knoxcrypt::MakeKnoxCrypt kc(io, sparse);
     kc.buildImage();
     return testPath;
@@ -99,6 +148,38 @@ std::string createAString()
     return theString;
 }
 
+/// reads n bytes at offset without moving the stream
+std::string readAt(knoxcrypt::ContainerImageStream &stream, uint64_t const offset, size_t const n)
+{
+    std::string data(n, 'x');
+    (void)stream.readAt(offset, &data[0], n);
+    return data;
+}
+
+/// reads the whole of a file from its start
+std::string readAll(knoxcrypt::File &entry)
+{
+    std::string data(entry.fileSize(), 'x');
+    (void)entry.seek(0, std::ios_base::beg);
+    if (!data.empty()) {
+        data.resize(entry.read(&data[0], data.length()));
+    }
+    return data;
+}
+
+/// reads the whole of a file through the file system, from the start even
+/// if it was already open
+std::string readAll(knoxcrypt::CoreFS &theBfs, std::string const &path)
+{
+    auto device(theBfs.openFile(path, knoxcrypt::OpenDisposition::buildReadOnlyDisposition()));
+    (void)device.seek(0, std::ios_base::beg);
+    std::string data(theBfs.getInfo(path).size(), 'x');
+    if (!data.empty()) {
+        data.resize(device.read(&data[0], data.length()));
+    }
+    return data;
+}
+
 knoxcrypt::SharedBlockBuilder testBlockBuilder()
 {
     return std::make_shared<knoxcrypt::FileBlockBuilder>();
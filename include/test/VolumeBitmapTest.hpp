@@ -0,0 +1,264 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+using namespace simpletest;
+
+class VolumeBitmapTest
+{
+  public:
+    VolumeBitmapTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        testChangesOnlyWrittenOnSync();
+        testNextAvailableBlock();
+        testNAvailableBlocks();
+        testResidentBitmapIsShared();
+        testSearchWrapsAroundFromHint();
+        testSearchOfNearlyFullLargeVolume();
+        testMountUsesCountStoredOnCleanUnmount();
+        testBlockRangeInUse();
+        testBatchOfBlocksInUse();
+    }
+
+    ~VolumeBitmapTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    boost::filesystem::path m_uniquePath;
+
+    void testChangesOnlyWrittenOnSync()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // set a scattered bunch of blocks; only the resident copy should change
+        for (uint64_t b = 1; b < 1000; b += 3) {
+            io->bitmap->setBlockInUse(b);
+        }
+        ASSERT_EQUAL(true, io->bitmap->isBlockInUse(997), "VolumeBitmapTest::testChangesOnlyWrittenOnSync resident");
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            ASSERT_EQUAL(false, knoxcrypt::detail::isBlockInUse(997, blocks, in),
+                         "VolumeBitmapTest::testChangesOnlyWrittenOnSync not yet on disk");
+        }
+
+        io->bitmap->sync();
+        bool allWritten = true;
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            for (uint64_t b = 1; b < blocks; ++b) {
+                bool const expected = (b < 1000) && ((b - 1) % 3 == 0);
+                if (knoxcrypt::detail::isBlockInUse(b, blocks, in) != expected) {
+                    allWritten = false;
+                    break;
+                }
+            }
+        }
+        ASSERT_EQUAL(true, allWritten, "VolumeBitmapTest::testChangesOnlyWrittenOnSync on disk after sync");
+        ASSERT_EQUAL(334, io->bitmap->getNumberOfAllocatedBlocks(),
+                     "VolumeBitmapTest::testChangesOnlyWrittenOnSync allocated count");
+    }
+
+    void testNextAvailableBlock()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // block 0 is the root folder
+        ASSERT_EQUAL(1, *io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testNextAvailableBlock A");
+        for (uint64_t b = 1; b < 100; ++b) {
+            io->bitmap->setBlockInUse(b);
+        }
+        ASSERT_EQUAL(100, *io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testNextAvailableBlock B");
+        io->bitmap->setBlockInUse(42, false);
+        ASSERT_EQUAL(42, *io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testNextAvailableBlock C");
+    }
+
+    void testNAvailableBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        for (uint64_t b = 1; b < 10; ++b) {
+            io->bitmap->setBlockInUse(b);
+        }
+        auto free = io->bitmap->getNAvailableBlocks(3);
+        ASSERT_EQUAL(3, free.size(), "VolumeBitmapTest::testNAvailableBlocks count");
+        ASSERT_EQUAL(10, free[0], "VolumeBitmapTest::testNAvailableBlocks first");
+        ASSERT_EQUAL(12, free[2], "VolumeBitmapTest::testNAvailableBlocks third");
+
+        // asking for more than there are only returns what is free
+        auto all = io->bitmap->getNAvailableBlocks(io->blocks);
+        ASSERT_EQUAL(io->blocks - 10, all.size(), "VolumeBitmapTest::testNAvailableBlocks all");
+    }
+
+    void testResidentBitmapIsShared()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO ioA(createTestIO(testPath));
+        knoxcrypt::SharedCoreIO ioB(createTestIO(testPath));
+        ioA->bitmap->setBlockInUse(7);
+        ASSERT_EQUAL(true, ioB->bitmap->isBlockInUse(7), "VolumeBitmapTest::testResidentBitmapIsShared");
+    }
+
+    void testSearchWrapsAroundFromHint()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        for (uint64_t b = 1; b < 10; ++b) {
+            io->bitmap->setBlockInUse(b);
+        }
+        ASSERT_EQUAL(500, *io->bitmap->getNextAvailableBlock(500), "VolumeBitmapTest::testSearchWrapsAroundFromHint A");
+        for (uint64_t b = 1000; b < io->blocks; ++b) {
+            io->bitmap->setBlockInUse(b);
+        }
+        ASSERT_EQUAL(10, *io->bitmap->getNextAvailableBlock(1500), "VolumeBitmapTest::testSearchWrapsAroundFromHint B");
+
+        // blocks after the hint come first followed by those before it
+        auto free = io->bitmap->getNAvailableBlocks(io->blocks, 990);
+        ASSERT_EQUAL(990, free.size(), "VolumeBitmapTest::testSearchWrapsAroundFromHint count");
+        ASSERT_EQUAL(990, free[0], "VolumeBitmapTest::testSearchWrapsAroundFromHint first");
+        ASSERT_EQUAL(10, free[10], "VolumeBitmapTest::testSearchWrapsAroundFromHint wrapped");
+        ASSERT_EQUAL(989, free.back(), "VolumeBitmapTest::testSearchWrapsAroundFromHint last");
+    }
+
+    void testSearchOfNearlyFullLargeVolume()
+    {
+        // enough blocks for three summary levels
+        uint64_t const blocks = (64 * 64 * 64) + (64 * 8);
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->blocks = blocks;
+        io->freeBlocks = blocks;
+        knoxcrypt::MakeKnoxCrypt kc(io, true /* sparse */);
+        kc.buildImage();
+
+        for (uint64_t b = 1; b < blocks; ++b) {
+            if (b != 200001 && b != blocks - 1) {
+                io->bitmap->setBlockInUse(b);
+            }
+        }
+        ASSERT_EQUAL(200001, *io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testSearchOfNearlyFullLargeVolume A");
+        ASSERT_EQUAL(blocks - 1, *io->bitmap->getNextAvailableBlock(200002), "VolumeBitmapTest::testSearchOfNearlyFullLargeVolume B");
+        io->bitmap->setBlockInUse(200001);
+        io->bitmap->setBlockInUse(blocks - 1);
+        ASSERT_EQUAL(false, !!io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testSearchOfNearlyFullLargeVolume full");
+        ASSERT_EQUAL(blocks, io->bitmap->getNumberOfAllocatedBlocks(), "VolumeBitmapTest::testSearchOfNearlyFullLargeVolume count");
+        io->bitmap->setBlockInUse(5, false);
+        ASSERT_EQUAL(5, *io->bitmap->getNextAvailableBlock(100000), "VolumeBitmapTest::testSearchOfNearlyFullLargeVolume wrapped");
+    }
+
+    void testMountUsesCountStoredOnCleanUnmount()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // a freshly built image has been cleanly unmounted by its builder
+        ASSERT_EQUAL(io->blocks - 1, io->bitmap->mount(), "VolumeBitmapTest::testMountUsesCountStoredOnCleanUnmount fresh");
+        for (uint64_t b = 1; b < 11; ++b) {
+            io->bitmap->setBlockInUse(b);
+        }
+
+        // the stored count is used as is, without counting the bitmap
+        io->bitmap->unmount(1234);
+        io->bitmap = knoxcrypt::VolumeBitmap::load(io, true /* reread */);
+        ASSERT_EQUAL(1234, io->bitmap->mount(), "VolumeBitmapTest::testMountUsesCountStoredOnCleanUnmount clean");
+
+        // without an unmount, the next mount has to count
+        io->bitmap->sync();
+        io->bitmap = knoxcrypt::VolumeBitmap::load(io, true /* reread */);
+        ASSERT_EQUAL(io->blocks - 11, io->bitmap->mount(), "VolumeBitmapTest::testMountUsesCountStoredOnCleanUnmount unclean");
+    }
+
+    void testBlockRangeInUse()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->bitmap->setBlockRangeInUse(5, 1500);
+        io->bitmap->setBlockRangeInUse(70, 80, false);
+        ASSERT_EQUAL(70, *io->bitmap->getNextAvailableBlock(5), "VolumeBitmapTest::testBlockRangeInUse next");
+        ASSERT_EQUAL(1500, *io->bitmap->getNextAvailableBlock(80), "VolumeBitmapTest::testBlockRangeInUse after range");
+
+        io->bitmap->sync();
+        bool allWritten = true;
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            for (uint64_t b = 1; b < blocks; ++b) {
+                bool const expected = (b >= 5 && b < 70) || (b >= 80 && b < 1500);
+                if (knoxcrypt::detail::isBlockInUse(b, blocks, in) != expected) {
+                    allWritten = false;
+                    break;
+                }
+            }
+        }
+        ASSERT_EQUAL(true, allWritten, "VolumeBitmapTest::testBlockRangeInUse on disk after sync");
+    }
+
+    void testBatchOfBlocksInUse()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // unordered, spread over several words and far apart bytes
+        std::vector<uint64_t> const batch{1500, 3, 64, 65, 4, 2047, 700, 127};
+        io->bitmap->setBlocksInUse(batch);
+        io->bitmap->setBlocksInUse({64, 2047}, false);
+        ASSERT_EQUAL(1, *io->bitmap->getNextAvailableBlock(), "VolumeBitmapTest::testBatchOfBlocksInUse next");
+        ASSERT_EQUAL(5, *io->bitmap->getNextAvailableBlock(3), "VolumeBitmapTest::testBatchOfBlocksInUse after 3 and 4");
+        ASSERT_EQUAL(64, *io->bitmap->getNextAvailableBlock(64), "VolumeBitmapTest::testBatchOfBlocksInUse cleared");
+
+        io->bitmap->sync();
+        bool allWritten = true;
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            for (uint64_t b = 1; b < blocks; ++b) {
+                bool const expected = b == 3 || b == 4 || b == 65 || b == 127 || b == 700 || b == 1500;
+                if (knoxcrypt::detail::isBlockInUse(b, blocks, in) != expected) {
+                    allWritten = false;
+                    break;
+                }
+            }
+        }
+        ASSERT_EQUAL(true, allWritten, "VolumeBitmapTest::testBatchOfBlocksInUse on disk after sync");
+    }
+};
@@ -28,11 +28,14 @@
 
 #pragma once
 
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/BlockRefCounts.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlock.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/CompoundFolder.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 #include "knoxcrypt/detail/DetailFileBlock.hpp"
 #include "utility/EventType.hpp"
@@ -105,9 +108,27 @@ namespace knoxcrypt
         {
 
             broadcastEvent(EventType::ImageBuildStart);
-            for (uint64_t i(0); i < io->blocks ; ++i) {
-                detail::writeBlock(io, out, i);
-                broadcastEvent(EventType::ImageBuildUpdate);
+            if (io->alignedBlocks) {
+                // the image is written front to back so all of the metadata
+                // table goes first, then the padding up to the data area
+                for (uint64_t i(0); i < io->blocks ; ++i) {
+                    detail::writeBlockHeader(io, out, i);
+                }
+                uint64_t const tableEnd = detail::getOffsetOfBlockHeader(io, io->blocks);
+                std::vector<uint8_t> padding(detail::getOffsetOfBlockArea(io) - tableEnd, 0);
+                if (!padding.empty()) {
+                    (void)out.write((char*)&padding.front(), padding.size());
+                }
+                std::vector<uint8_t> ints(io->blockSize, 0);
+                for (uint64_t i(0); i < io->blocks ; ++i) {
+                    (void)out.write((char*)&ints.front(), ints.size());
+                    broadcastEvent(EventType::ImageBuildUpdate);
+                }
+            } else {
+                for (uint64_t i(0); i < io->blocks ; ++i) {
+                    detail::writeBlock(io, out, i);
+                    broadcastEvent(EventType::ImageBuildUpdate);
+                }
             }
             broadcastEvent(EventType::ImageBuildEnd);
         }
@@ -148,7 +169,8 @@ namespace knoxcrypt
          *
          * The first 8 bytes will represent the number of blocks in the FS
          * The next blocks bits will represent the volume bit map
-         * The next 8 bytes will represent the total number of files
+         * The next 8 bytes will represent the volume state (free block
+         * count and clean unmount flag; see VolumeBitmap)
          * The next data will be metadata computed as a fraction of the fs
          * size and number of blocks
          * The remaining bytes will be reserved for actual file data 512 byte blocks
@@ -165,6 +187,11 @@ namespace knoxcrypt
             // as-of-yet, undecided info
             //
             {
+                // the image is written over from scratch
+                if (io->blockCache) {
+                    io->blockCache->clear();
+                }
+
                 broadcastEvent(EventType::IVWriteEvent);
                 uint8_t ivBytes[8];
                 detail::convertUInt64ToInt8Array(io->encProps.iv, ivBytes);
@@ -233,8 +260,15 @@ namespace knoxcrypt
                 // with block size to be read/written from prior 4 bytes.
                 // Anything below 20 will indicate that an earlier version
                 // was used to create the filesystem container for which a
-                // block size of 4096 should be used.
-                int version = 20;
+                // block size of 4096 should be used. Optional features add
+                // to 20: 1 has each file keep an index of its blocks, 2
+                // keeps block metadata apart from page-aligned block data,
+                // 4 keeps small files in their folder entries, 8 records
+                // file sizes in folder entries and 16 lets cloned files
+                // share blocks.
+                int version = 20 + (io->blockIndex ? 1 : 0) + (io->alignedBlocks ? 2 : 0) +
+                    (io->inlineFiles ? 4 : 0) + (io->entrySizes ? 8 : 0) +
+                    (io->sharedBlocks ? 16 : 0);
                 (void)ivout.write((char*)&version, 1);
                 (void)ivout.write((char*)&cipher, 1);
 
@@ -263,12 +297,13 @@ namespace knoxcrypt
             out.write((char*)sizeBytes, 8);
             createVolumeBitMap(io->blocks, out);
 
-            // file count will always be 0 upon initialization
+            // volume state starts out as 0 ('not cleanly unmounted'); it
+            // is properly written once the root folder has been created
             uint64_t fileCount(0);
             uint8_t countBytes[8];
             buildFileCountBytes(fileCount, countBytes);
 
-            // write out file count
+            // write out volume state
             out.write((char*)countBytes, 8);
 
             // write out the file space bytes
@@ -285,7 +320,15 @@ namespace knoxcrypt
             // always be block 0
             // added block builder here since can only work after bitmap created
             // fixes issue https://github.com/benhj/knoxcrypt/issues/15
+            io->bitmap = knoxcrypt::VolumeBitmap::load(io, true /* reread */);
             io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
+
+            // the reference counts of shared blocks take the volume's last
+            // blocks
+            if (io->sharedBlocks) {
+                BlockRefCounts::format(io);
+                io->refCounts = BlockRefCounts::load(io);
+            }
             CompoundFolder rootDir(io, "root");
 
             // create an extra 'magic partition' which is another root folder
@@ -297,6 +340,10 @@ namespace knoxcrypt
                 CompoundFolder magicDir(magicIo, "root", setRoot);
             }
 
+            // make sure the root folder allocations are on disk and record
+            // the free block count so that the first mount needn't count
+            io->bitmap->unmount(io->blocks - io->bitmap->getNumberOfAllocatedBlocks());
+
             broadcastEvent(EventType::ImageBuildEnd);
         }
     };
@@ -0,0 +1,67 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "benchmark/AllocationBenchmark.hpp"
+#include "benchmark/BitmapKernelsBenchmark.hpp"
+#include "benchmark/CipherBenchmark.hpp"
+#include "benchmark/ImageBackendBenchmark.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    namespace po = boost::program_options;
+    uint64_t bitmapMegabytes;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("bitmapMegabytes", po::value<uint64_t>(&bitmapMegabytes)->default_value(2048),
+         "size of the bitmap used by the bitmap kernel benchmarks")
+        ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            std::cout<<desc<<std::endl;
+            return 1;
+        }
+    } catch (...) {
+        std::cout<<"Problem parsing options"<<std::endl;
+        std::cout<<desc<<std::endl;
+        return 1;
+    }
+
+    BitmapKernelsBenchmark bitmapKernels(bitmapMegabytes);
+    AllocationBenchmark allocation;
+    ImageBackendBenchmark imageBackends;
+    CipherBenchmark ciphers;
+}
@@ -33,11 +33,13 @@
  *
  */
 
+#include "knoxcrypt/BlockCache.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "utility/CipherCallback.hpp"
 #include "utility/EcholessPasswordPrompt.hpp"
 #include "utility/EventType.hpp"
@@ -45,6 +47,7 @@
 
 #include <boost/program_options.hpp>
 
+#include <fcntl.h>
 #include <fuse.h>
 #include <stdint.h>
 #include <vector>
@@ -66,6 +69,9 @@ namespace fuselayer
             if (ex == knoxcrypt::KnoxCryptException(knoxcrypt::KnoxCryptError::AlreadyExists)) {
                 return -EEXIST;
             }
+            if (ex == knoxcrypt::KnoxCryptException(knoxcrypt::KnoxCryptError::OutOfSpace)) {
+                return -ENOSPC;
+            }
 
             return 0;
         }
@@ -92,13 +98,13 @@ namespace fuselayer
                     if (info.type() == knoxcrypt::EntryType::FolderType) {
                         stbuf->st_mode = S_IFDIR | 0777;
                         stbuf->st_nlink = 3;
-                        stbuf->st_blksize = knoxcrypt_DATA->getBlockSize() - knoxcrypt::detail::FILE_BLOCK_META;
+                        stbuf->st_blksize = knoxcrypt_DATA->getBlockWriteSpace();
                         return 0;
                     } else if (info.type() == knoxcrypt::EntryType::FileType) {
                         stbuf->st_mode = S_IFREG | 0777;
                         stbuf->st_nlink = 1;
                         stbuf->st_size = info.size();
-                        stbuf->st_blksize = knoxcrypt_DATA->getBlockSize() - knoxcrypt::detail::FILE_BLOCK_META;
+                        stbuf->st_blksize = knoxcrypt_DATA->getBlockWriteSpace();
                         return 0;
                     } else {
                         return -ENOENT;
@@ -294,6 +300,28 @@ namespace fuselayer
             return 0;
         }
 
+#if FUSE_VERSION >= 29
+        // preallocate the blocks for a file that is about to be written
+        static
+        int
+        knoxcrypt_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *)
+        {
+            // only preallocation that grows the file. Blocks reserved past
+            // the end are only held while the file is the one CoreFS has
+            // open, and would go as soon as another file is used, so
+            // FALLOC_FL_KEEP_SIZE isn't offered
+            if (mode != 0) {
+                return -EOPNOTSUPP;
+            }
+            try {
+                knoxcrypt_DATA->preallocate(path, offset + length, false);
+            } catch (knoxcrypt::KnoxCryptException const &e) {
+                return detail::exceptionDispatch(e);
+            }
+            return 0;
+        }
+#endif
+
         static
         int
         knoxcrypt_opendir(const char * path, struct fuse_file_info *)
@@ -377,14 +405,31 @@ namespace fuselayer
             return 0;
         }
 
+        // writes out the data held back from allocation so that running out
+        // of space, say, is reported to close rather than lost
         static
         int
         knoxcrypt_flush(const char * path, struct fuse_file_info *)
         {
-            //knoxcrypt_DATA->closeFile(path);
+            try {
+                knoxcrypt_DATA->flushFile(path);
+            } catch (knoxcrypt::KnoxCryptException const &e) {
+                return detail::exceptionDispatch(e);
+            } catch (std::exception const &) {
+                return -EIO;
+            }
             return 0;
         }
 
+        // the last close of a file; anything written since its final flush
+        // is written out here too
+        static
+        int
+        knoxcrypt_release(const char * path, struct fuse_file_info *fi)
+        {
+            return knoxcrypt_flush(path, fi);
+        }
+
         // to shut-up 'function not implemented warnings'
         // not presently required
         static
@@ -441,10 +486,14 @@ void initOperations(struct fuse_operations &ops, fuselayer::FuseLayer &fuseLayer
     ops.statfs    = fuseLayer.knoxcrypt_statfs;
     ops.setxattr  = fuseLayer.knoxcrypt_setxattr;
     ops.flush     = fuseLayer.knoxcrypt_flush;
+    ops.release   = fuseLayer.knoxcrypt_release;
     ops.chmod     = fuseLayer.knoxcrypt_chmod;
     ops.chown     = fuseLayer.knoxcrypt_chown;
     ops.utimens   = fuseLayer.knoxcrypt_utimens;
     ops.access    = fuseLayer.knoxcrypt_access;
+#if FUSE_VERSION >= 29
+    ops.fallocate = fuseLayer.knoxcrypt_fallocate;
+#endif
 }
 
 int main(int argc, char *argv[])
@@ -453,6 +502,13 @@ int main(int argc, char *argv[])
     // parse the program options
     bool debug = true;
     bool magic = false;
+    bool punchHoles = false;
+    uint32_t inlineFileBytes = 254;
+    bool trim = false;
+    uint64_t blockCache = 1024;
+    bool mapImage = false;
+    bool ioUring = false;
+    unsigned cipherThreads = 1;
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -461,6 +517,13 @@ int main(int argc, char *argv[])
         ("mountPoint", po::value<std::string>(), "mountPoint path")
         ("debug", po::value<bool>(&debug)->default_value(true), "fuse debug")
         ("coffee", po::value<bool>(&magic)->default_value(false), "mount alternative sub-volume")
+        ("punchHoles", po::value<bool>(&punchHoles)->default_value(false), "give deleted file space back to the host")
+        ("inlineFileBytes", po::value<uint32_t>(&inlineFileBytes)->default_value(254), "largest file kept in its folder entry")
+        ("trim", po::value<bool>(&trim)->default_value(false), "give all free space back to the host on unmount")
+        ("blockCache", po::value<uint64_t>(&blockCache)->default_value(1024), "decrypted blocks held in memory; 0 for none")
+        ("mapImage", po::value<bool>(&mapImage)->default_value(false), "read and write the image through a memory mapping")
+        ("ioUring", po::value<bool>(&ioUring)->default_value(false), "batch reads and writes over several blocks with io_uring")
+        ("cipherThreads", po::value<unsigned>(&cipherThreads)->default_value(1), "threads enciphering and deciphering large transfers")
         ;
 
     po::positional_options_description positionalOptions;
@@ -499,6 +562,11 @@ int main(int argc, char *argv[])
     // the knoxcrypt image
     knoxcrypt::SharedCoreIO io(std::make_shared<knoxcrypt::CoreIO>());
     io->useBlockCache = true;
+    io->punchHoles = punchHoles;
+    io->mapImage = mapImage;
+    io->ioUring = ioUring;
+    io->cipherThreads = cipherThreads;
+    io->inlineFileBytes = inlineFileBytes;
     io->path = vm["imageName"].as<std::string>().c_str();
     io->encProps.password = knoxcrypt::utility::getPassword("knoxcrypt password: ");
     io->rootBlock = magic ? atoi(knoxcrypt::utility::getPassword("magic number: ").c_str()) : 0;
@@ -508,6 +576,12 @@ int main(int argc, char *argv[])
     // and the cipher type from the tenth byte
     knoxcrypt::detail::readImageIVAndRounds(io);
 
+    // the block size is known now; the cache has to be in place before the
+    // bitmap opens its stream so that every stream shares it
+    if (blockCache > 0) {
+        io->blockCache = std::make_shared<knoxcrypt::BlockCache>(io->blockSize, blockCache);
+    }
+
     // Obtain the number of blocks in the image by reading the image's block count
     long const amount = knoxcrypt::detail::CIPHER_BUFFER_SIZE / 100000;
     std::function<void(knoxcrypt::EventType)> f(std::bind(&knoxcrypt::cipherCallback, std::placeholders::_1, amount));
@@ -527,13 +601,12 @@ int main(int argc, char *argv[])
 
     io->blocks = knoxcrypt::detail::getBlockCount(stream);
 
-    printf("Counting allocated blocks. Please wait...\n");
-
-    io->freeBlocks = io->blocks - knoxcrypt::detail::getNumberOfAllocatedBlocks(stream);
+    // the bitmap only needs to be read and counted if the container
+    // wasn't cleanly unmounted last time
+    io->bitmap = knoxcrypt::VolumeBitmap::load(io);
+    io->freeBlocks = io->bitmap->mount();
     io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
 
-    printf("Finished counting allocated blocks.\n");
-
     stream.close();
 
     // Create the basic file system
@@ -565,6 +638,29 @@ int main(int argc, char *argv[])
     int fuse_stat = fuse_main(fuseArgCount, fuseArgs, &knoxcrypt_oper, &theBfs);
     fprintf(stderr, "fuse_main returned %d\n", fuse_stat);
 
+    // release the space of free blocks that deletes left behind; done once
+    // fuse has finished so that nothing is being written meanwhile
+    if (trim) {
+        fprintf(stderr, "trimmed %llu blocks\n", (unsigned long long)theBfs.trim());
+    }
+
+    // for sizing the cache
+    if (io->blockCache) {
+        fprintf(stderr, "block cache hits %llu, misses %llu\n",
+                (unsigned long long)io->blockCache->hits(),
+                (unsigned long long)io->blockCache->misses());
+    }
+
+    // record the free block count and mark as cleanly unmounted, once the
+    // file still open has been written out and let go of. If that fails the
+    // container is left marked as in use and is counted when next mounted
+    try {
+        theBfs.unmount();
+    } catch (std::exception const &e) {
+        fprintf(stderr, "unmount failed: %s\n", e.what());
+        return 1;
+    }
+
     return fuse_stat;
 
 }
@@ -0,0 +1,175 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/BlockCache.hpp"
+
+#include <algorithm>
+
+namespace knoxcrypt
+{
+
+    BlockCache::BlockCache(uint64_t const blockSize, uint64_t const capacity)
+        : m_blockSize(blockSize)
+        , m_capacity(capacity)
+        , m_entries()
+        , m_index()
+        , m_hits(0)
+        , m_misses(0)
+        , m_writes(0)
+        , m_mutex()
+    {
+    }
+
+    uint64_t
+    BlockCache::blockSize() const
+    {
+        return m_blockSize;
+    }
+
+    uint64_t
+    BlockCache::capacity() const
+    {
+        return m_capacity;
+    }
+
+    uint64_t
+    BlockCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_index.size();
+    }
+
+    uint64_t
+    BlockCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+
+    uint64_t
+    BlockCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+    bool
+    BlockCache::read(uint64_t const block, uint64_t const offset,
+                     char * const buf, uint64_t const n)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto const it = m_index.find(block);
+        if (it == m_index.end()) {
+            ++m_misses;
+            return false;
+        }
+        ++m_hits;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        auto const &data = it->second->second;
+        std::copy(data.begin() + offset, data.begin() + offset + n, buf);
+        return true;
+    }
+
+    uint64_t
+    BlockCache::beginLoad() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_writes;
+    }
+
+    void
+    BlockCache::insert(uint64_t const block, std::vector<char> data, uint64_t const ticket)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_capacity == 0 || ticket != m_writes || m_index.count(block)) {
+            return;
+        }
+        m_entries.emplace_front(block, std::move(data));
+        m_index[block] = m_entries.begin();
+        if (m_entries.size() > m_capacity) {
+            (void)m_index.erase(m_entries.back().first);
+            m_entries.pop_back();
+        }
+    }
+
+    void
+    BlockCache::update(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_writes;
+        uint64_t const end = offset + n;
+        for (uint64_t block = offset / m_blockSize; block * m_blockSize < end; ++block) {
+            auto const it = m_index.find(block);
+            if (it == m_index.end()) {
+                continue;
+            }
+            uint64_t const start = std::max(offset, block * m_blockSize);
+            uint64_t const stop = std::min(end, (block + 1) * m_blockSize);
+            std::copy(buf + (start - offset), buf + (stop - offset),
+                      it->second->second.begin() + (start - block * m_blockSize));
+        }
+    }
+
+    void
+    BlockCache::invalidate(uint64_t const offset, uint64_t const n)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_writes;
+        uint64_t const first = offset / m_blockSize;
+        uint64_t const last = (offset + n + m_blockSize - 1) / m_blockSize;
+
+        // a long stretch is quicker to deal with by going over what's held
+        if (last - first > m_index.size()) {
+            for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+                if (it->first >= first && it->first < last) {
+                    (void)m_index.erase(it->first);
+                    it = m_entries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            return;
+        }
+        for (uint64_t block = first; block < last; ++block) {
+            auto const it = m_index.find(block);
+            if (it != m_index.end()) {
+                (void)m_entries.erase(it->second);
+                (void)m_index.erase(it);
+            }
+        }
+    }
+
+    void
+    BlockCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_writes;
+        m_entries.clear();
+        m_index.clear();
+    }
+}
@@ -0,0 +1,401 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/BlockIndex.hpp"
+#include "knoxcrypt/FileBlockBuilder.hpp"
+#include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+
+#include <algorithm>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        // the root starts with the depth of the tree and the number of
+        // blocks indexed, 8 bytes each
+        uint64_t const ROOT_HEADER = 16;
+    }
+
+    BlockIndex::BlockIndex(SharedCoreIO const &io, bool const enforceRootBlock)
+        : m_io(io)
+        , m_stream()
+        , m_root(0)
+        , m_depth(1)
+        , m_count(0)
+    {
+        m_root = newIndexBlock(enforceRootBlock);
+        writeHeader();
+    }
+
+    BlockIndex::BlockIndex(SharedCoreIO const &io, uint64_t const rootBlock)
+        : m_io(io)
+        , m_stream()
+        , m_root(rootBlock)
+        , m_depth(1)
+        , m_count(0)
+    {
+        auto const header = readPointers(rootPointerOffset(0) - ROOT_HEADER, 2);
+        m_depth = header[0];
+        m_count = header[1];
+    }
+
+    uint64_t
+    BlockIndex::getRootBlock() const
+    {
+        return m_root;
+    }
+
+    uint64_t
+    BlockIndex::size() const
+    {
+        return m_count;
+    }
+
+    uint64_t
+    BlockIndex::lookup(uint64_t const n) const
+    {
+        return readPointer(blockPointerOffset(n));
+    }
+
+    void
+    BlockIndex::append(uint64_t const block)
+    {
+        appendRun(block, 1);
+    }
+
+    void
+    BlockIndex::append(std::vector<uint64_t> const &blocks)
+    {
+        if (!blocks.empty()) {
+            appendRun(0, blocks.size(), &blocks.front());
+        }
+    }
+
+    void
+    BlockIndex::appendHoles(uint64_t const count)
+    {
+        appendRun(detail::HOLE_BLOCK, count);
+    }
+
+    void
+    BlockIndex::set(uint64_t const n, uint64_t const block)
+    {
+        writePointer(blockPointerOffset(n), block);
+    }
+
+    std::vector<uint64_t>
+    BlockIndex::shrink(uint64_t const count)
+    {
+        std::vector<uint64_t> unneeded;
+        if (count >= m_count) {
+            return unneeded;
+        }
+
+        if (m_depth > 1) {
+            uint64_t const span = pointerSpan(m_depth);
+            uint64_t const slots = (m_count + span - 1) / span;
+            for (uint64_t slot = count / span; slot < slots; ++slot) {
+                uint64_t const first = slot * span;
+                collectUnneeded(readPointer(rootPointerOffset(slot)),
+                                m_depth - 1,
+                                count > first ? count - first : 0,
+                                std::min(span, m_count - first),
+                                unneeded);
+            }
+        }
+
+        m_count = count;
+        writeHeader();
+        return unneeded;
+    }
+
+    std::vector<uint64_t>
+    BlockIndex::getBlocks() const
+    {
+        std::vector<uint64_t> blocks;
+        if (m_depth == 1) {
+            return readPointers(rootPointerOffset(0), m_count);
+        }
+        uint64_t const span = pointerSpan(m_depth);
+        uint64_t const slots = (m_count + span - 1) / span;
+        auto const pointers = readPointers(rootPointerOffset(0), slots);
+        for (uint64_t slot = 0; slot < slots; ++slot) {
+            collect(pointers[slot], m_depth - 1, std::min(span, m_count - (slot * span)), blocks, false);
+        }
+        return blocks;
+    }
+
+    std::vector<uint64_t>
+    BlockIndex::getIndexBlocks() const
+    {
+        std::vector<uint64_t> blocks{m_root};
+        if (m_depth == 1) {
+            return blocks;
+        }
+        uint64_t const span = pointerSpan(m_depth);
+        uint64_t const slots = (m_count + span - 1) / span;
+        auto const pointers = readPointers(rootPointerOffset(0), slots);
+        for (uint64_t slot = 0; slot < slots; ++slot) {
+            collect(pointers[slot], m_depth - 1, std::min(span, m_count - (slot * span)), blocks, true);
+        }
+        return blocks;
+    }
+
+    uint64_t
+    BlockIndex::rootFanout() const
+    {
+        return (detail::getBlockWriteSpace(m_io) - ROOT_HEADER) / 8;
+    }
+
+    uint64_t
+    BlockIndex::nodeFanout() const
+    {
+        return detail::getBlockWriteSpace(m_io) / 8;
+    }
+
+    uint64_t
+    BlockIndex::pointerSpan(uint64_t const level) const
+    {
+        uint64_t span = 1;
+        for (uint64_t l = 1; l < level; ++l) {
+            span *= nodeFanout();
+        }
+        return span;
+    }
+
+    uint64_t
+    BlockIndex::rootPointerOffset(uint64_t const slot) const
+    {
+        return detail::getOffsetOfBlockData(m_io, m_root) + ROOT_HEADER + (slot * 8);
+    }
+
+    uint64_t
+    BlockIndex::nodePointerOffset(uint64_t const node, uint64_t const slot) const
+    {
+        return detail::getOffsetOfBlockData(m_io, node) + (slot * 8);
+    }
+
+    uint64_t
+    BlockIndex::blockPointerOffset(uint64_t n) const
+    {
+        uint64_t span = pointerSpan(m_depth);
+        uint64_t offset = rootPointerOffset(n / span);
+        n %= span;
+        while (span > 1) {
+            span /= nodeFanout();
+            offset = nodePointerOffset(readPointer(offset), n / span);
+            n %= span;
+        }
+        return offset;
+    }
+
+    ContainerImageStream &
+    BlockIndex::stream() const
+    {
+        auto const mode = std::ios::in | std::ios::out | std::ios::binary;
+        if (!m_stream) {
+            m_stream = std::make_shared<ContainerImageStream>(m_io, mode);
+        } else if (!m_stream->is_open()) {
+            m_stream->open(m_io, mode);
+        }
+        return *m_stream;
+    }
+
+    uint64_t
+    BlockIndex::readPointer(uint64_t const offset) const
+    {
+        return readPointers(offset, 1).front();
+    }
+
+    std::vector<uint64_t>
+    BlockIndex::readPointers(uint64_t const offset, uint64_t const count) const
+    {
+        std::vector<uint64_t> pointers;
+        if (count == 0) {
+            return pointers;
+        }
+        std::vector<uint8_t> bytes(count * 8);
+        (void)stream().readAt(offset, (char*)&bytes.front(), bytes.size());
+        pointers.reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            pointers.push_back(detail::convertInt8ArrayToInt64(&bytes[i * 8]));
+        }
+        return pointers;
+    }
+
+    void
+    BlockIndex::writePointer(uint64_t const offset, uint64_t const value)
+    {
+        uint8_t bytes[8];
+        detail::convertUInt64ToInt8Array(value, bytes);
+        (void)stream().writeAt(offset, (char*)bytes, 8);
+    }
+
+    void
+    BlockIndex::writeHeader()
+    {
+        uint64_t const offset = rootPointerOffset(0) - ROOT_HEADER;
+        writePointer(offset, m_depth);
+        writePointer(offset + 8, m_count);
+    }
+
+    uint64_t
+    BlockIndex::newIndexBlock(bool const enforceRootBlock)
+    {
+        (void)stream();
+        auto block = m_io->blockBuilder->buildWritableFileBlock(m_io,
+                                                               OpenDisposition::buildAppendDisposition(),
+                                                               m_stream,
+                                                               enforceRootBlock);
+        block.registerBlockWithVolumeBitmap();
+        return block.getIndex();
+    }
+
+    void
+    BlockIndex::grow()
+    {
+        // the root's pointers move down into a new block which becomes
+        // the root's only pointer
+        auto const pointers = readPointers(rootPointerOffset(0), rootFanout());
+        uint64_t const node = newIndexBlock();
+        std::vector<uint8_t> bytes(pointers.size() * 8);
+        for (uint64_t i = 0; i < pointers.size(); ++i) {
+            detail::convertUInt64ToInt8Array(pointers[i], &bytes[i * 8]);
+        }
+        (void)stream().writeAt(nodePointerOffset(node, 0), (char*)&bytes.front(), bytes.size());
+
+        writePointer(rootPointerOffset(0), node);
+        ++m_depth;
+        writeHeader();
+    }
+
+    void
+    BlockIndex::appendRun(uint64_t const block, uint64_t count, uint64_t const * blocks)
+    {
+        while (count > 0) {
+            if (m_count == rootFanout() * pointerSpan(m_depth)) {
+                grow();
+            }
+
+            // walk down to where the next pointer goes; a pointer that is
+            // the first of its part of the tree needs a new index block to
+            // go in
+            uint64_t n = m_count;
+            uint64_t span = pointerSpan(m_depth);
+            uint64_t offset = rootPointerOffset(n / span);
+            n %= span;
+            while (span > 1) {
+                uint64_t node;
+                if (n == 0) {
+                    node = newIndexBlock();
+                    writePointer(offset, node);
+                } else {
+                    node = readPointer(offset);
+                }
+                span /= nodeFanout();
+                offset = nodePointerOffset(node, n / span);
+                n %= span;
+            }
+
+            // as many pointers as fit in the index block reached go out in
+            // one write
+            uint64_t const fanout = m_depth == 1 ? rootFanout() : nodeFanout();
+            uint64_t const run = std::min(count, fanout - (m_count % fanout));
+            std::vector<uint8_t> bytes(run * 8);
+            for (uint64_t i = 0; i < run; ++i) {
+                detail::convertUInt64ToInt8Array(blocks ? blocks[i] : block, &bytes[i * 8]);
+            }
+            if (blocks) {
+                blocks += run;
+            }
+            (void)stream().writeAt(offset, (char*)&bytes.front(), bytes.size());
+
+            m_count += run;
+            count -= run;
+        }
+
+        writeHeader();
+    }
+
+    void
+    BlockIndex::collect(uint64_t const node,
+                        uint64_t const level,
+                        uint64_t const count,
+                        std::vector<uint64_t> &blocks,
+                        bool const indexBlocks) const
+    {
+        if (indexBlocks) {
+            blocks.push_back(node);
+        }
+        uint64_t const span = pointerSpan(level);
+        uint64_t const slots = (count + span - 1) / span;
+        auto const pointers = readPointers(nodePointerOffset(node, 0), slots);
+        if (level == 1) {
+            if (!indexBlocks) {
+                blocks.insert(blocks.end(), pointers.begin(), pointers.end());
+            }
+            return;
+        }
+        for (uint64_t slot = 0; slot < slots; ++slot) {
+            collect(pointers[slot], level - 1, std::min(span, count - (slot * span)), blocks, indexBlocks);
+        }
+    }
+
+    void
+    BlockIndex::collectUnneeded(uint64_t const node,
+                                uint64_t const level,
+                                uint64_t const keep,
+                                uint64_t const count,
+                                std::vector<uint64_t> &blocks) const
+    {
+        if (keep == 0) {
+            collect(node, level, count, blocks, true);
+            return;
+        }
+
+        // a lowest level block that is still partly needed is kept as it
+        // is; the pointers past the end are written over as the file grows
+        if (level == 1) {
+            return;
+        }
+        uint64_t const span = pointerSpan(level);
+        uint64_t const slots = (count + span - 1) / span;
+        for (uint64_t slot = keep / span; slot < slots; ++slot) {
+            uint64_t const first = slot * span;
+            collectUnneeded(readPointer(nodePointerOffset(node, slot)),
+                            level - 1,
+                            keep > first ? keep - first : 0,
+                            std::min(span, count - first),
+                            blocks);
+        }
+    }
+
+}
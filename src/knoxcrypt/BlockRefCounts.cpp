@@ -0,0 +1,188 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/BlockRefCounts.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        // the most files other than the first that a count can record
+        uint8_t const MAX_SHARES = 255;
+
+        uint64_t tableBlockCount(SharedCoreIO const &io)
+        {
+            uint64_t const space = detail::getBlockWriteSpace(io);
+            return (io->blocks + space - 1) / space;
+        }
+
+        // the counts currently resident, keyed by image path
+        using ResidentCounts = std::map<std::string, std::weak_ptr<BlockRefCounts>>;
+        ResidentCounts g_residentCounts;
+        std::mutex g_residentMutex;
+    }
+
+    SharedBlockRefCounts
+    BlockRefCounts::load(SharedCoreIO const &io, bool const reread)
+    {
+        std::lock_guard<std::mutex> lock(g_residentMutex);
+        auto & resident = g_residentCounts[io->path];
+        if (!reread) {
+            if (auto counts = resident.lock()) {
+                return counts;
+            }
+        }
+        auto counts(std::make_shared<BlockRefCounts>(io));
+        resident = counts;
+        return counts;
+    }
+
+    void
+    BlockRefCounts::format(SharedCoreIO const &io)
+    {
+        io->bitmap->setBlockRangeInUse(firstTableBlock(io), io->blocks, true);
+        io->bitmap->sync();
+
+        auto counts(load(io, true /* reread */));
+        counts->m_counts.assign(counts->m_blocks, 0);
+        counts->m_resident = true;
+        std::vector<uint64_t> all(counts->m_blocks);
+        for (uint64_t b = 0; b < all.size(); ++b) {
+            all[b] = b;
+        }
+        counts->write(all);
+    }
+
+    uint64_t
+    BlockRefCounts::firstTableBlock(SharedCoreIO const &io)
+    {
+        return io->blocks - tableBlockCount(io);
+    }
+
+    BlockRefCounts::BlockRefCounts(SharedCoreIO const &io)
+        : m_stream(std::make_shared<ContainerImageStream>(io, std::ios::in | std::ios::out | std::ios::binary))
+        , m_blocks(io->blocks)
+        , m_space(detail::getBlockWriteSpace(io))
+        , m_offsets()
+        , m_counts()
+        , m_resident(false)
+    {
+        for (uint64_t b = firstTableBlock(io); b < io->blocks; ++b) {
+            m_offsets.push_back(detail::getOffsetOfBlockData(io, b));
+        }
+    }
+
+    bool
+    BlockRefCounts::isShared(uint64_t const block) const
+    {
+        makeResident();
+        return block < m_blocks && m_counts[block] > 0;
+    }
+
+    bool
+    BlockRefCounts::share(std::vector<uint64_t> const &blocks)
+    {
+        makeResident();
+        for (auto const block : blocks) {
+            if (m_counts[block] == MAX_SHARES) {
+                return false;
+            }
+        }
+        for (auto const block : blocks) {
+            ++m_counts[block];
+        }
+        std::vector<uint64_t> sorted(blocks);
+        std::sort(sorted.begin(), sorted.end());
+        write(sorted);
+        return true;
+    }
+
+    std::vector<uint64_t>
+    BlockRefCounts::release(std::vector<uint64_t> blocks)
+    {
+        makeResident();
+        std::sort(blocks.begin(), blocks.end());
+        std::vector<uint64_t> unreferenced;
+        std::vector<uint64_t> changed;
+        for (auto const block : blocks) {
+            if (m_counts[block] > 0) {
+                --m_counts[block];
+                changed.push_back(block);
+            } else {
+                unreferenced.push_back(block);
+            }
+        }
+        write(changed);
+        return unreferenced;
+    }
+
+    void
+    BlockRefCounts::makeResident() const
+    {
+        if (m_resident) {
+            return;
+        }
+        m_counts.resize(m_blocks);
+        for (uint64_t t = 0; t < m_offsets.size(); ++t) {
+            uint64_t const first = t * m_space;
+            uint64_t const bytes = std::min(m_space, m_blocks - first);
+            (void)m_stream->readAt(m_offsets[t], (char*)&m_counts[first], bytes);
+        }
+        m_resident = true;
+    }
+
+    void
+    BlockRefCounts::write(std::vector<uint64_t> const &blocks)
+    {
+        if (blocks.empty()) {
+            return;
+        }
+
+        // the changed counts held in each of the table's blocks go out in
+        // one write, from the first of them to the last
+        auto it = blocks.begin();
+        while (it != blocks.end()) {
+            uint64_t const t = *it / m_space;
+            uint64_t const first = *it;
+            uint64_t last = first;
+            for (; it != blocks.end() && *it / m_space == t; ++it) {
+                last = *it;
+            }
+            (void)m_stream->writeAt(m_offsets[t] + (first % m_space), (char*)&m_counts[first], (last - first) + 1);
+        }
+    }
+
+}
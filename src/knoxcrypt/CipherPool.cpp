@@ -0,0 +1,161 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/CipherPool.hpp"
+
+#include <algorithm>
+
+namespace knoxcrypt
+{
+
+    long const CipherPool::CHUNK_BYTES;
+
+    CipherPool::CipherPool(cryptostreampp::EncryptionProperties const &encProps, unsigned const threads)
+        : m_ciphers()
+        , m_workers()
+        , m_runMutex()
+        , m_chunks()
+        , m_encrypt(false)
+        , m_next(0)
+        , m_mutex()
+        , m_wake()
+        , m_done()
+        , m_generation(0)
+        , m_busy(0)
+        , m_stop(false)
+    {
+        for (unsigned t = 0; t < std::max(threads, 2u); ++t) {
+            m_ciphers.push_back(cryptostreampp::buildByteTransformer(encProps));
+        }
+        for (unsigned w = 1; w < m_ciphers.size(); ++w) {
+            m_workers.emplace_back(&CipherPool::workerLoop, this, w);
+        }
+    }
+
+    CipherPool::~CipherPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto & worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    unsigned
+    CipherPool::threads() const
+    {
+        return unsigned(m_ciphers.size());
+    }
+
+    void
+    CipherPool::encrypt(std::vector<Piece> const &pieces)
+    {
+        run(true, pieces);
+    }
+
+    void
+    CipherPool::decrypt(std::vector<Piece> const &pieces)
+    {
+        run(false, pieces);
+    }
+
+    void
+    CipherPool::run(bool const encrypt, std::vector<Piece> const &pieces)
+    {
+        std::lock_guard<std::mutex> runLock(m_runMutex);
+
+        // chunks end on multiples of CHUNK_BYTES in the image so that no
+        // keystream block is worked out by two threads
+        m_chunks.clear();
+        for (auto const & piece : pieces) {
+            long done = 0;
+            while (done < piece.n) {
+                uint64_t const at = piece.offset + uint64_t(done);
+                long const n = std::min(piece.n - done, long(CHUNK_BYTES - long(at % CHUNK_BYTES)));
+                m_chunks.push_back(Piece{piece.in + done, piece.out + done, at, n});
+                done += n;
+            }
+        }
+        if (m_chunks.empty()) {
+            return;
+        }
+        m_encrypt = encrypt;
+        m_next = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy = unsigned(m_workers.size());
+            ++m_generation;
+        }
+        m_wake.notify_all();
+        work(*m_ciphers.front());
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_busy == 0; });
+    }
+
+    void
+    CipherPool::work(cryptostreampp::IByteTransformer &cipher)
+    {
+        for (size_t c = m_next++; c < m_chunks.size(); c = m_next++) {
+            auto const & chunk = m_chunks[c];
+            if (m_encrypt) {
+                cipher.encrypt(chunk.in, chunk.out, std::ios_base::streamoff(chunk.offset), chunk.n);
+            } else {
+                cipher.decrypt(chunk.in, chunk.out, std::ios_base::streamoff(chunk.offset), chunk.n);
+            }
+        }
+    }
+
+    void
+    CipherPool::workerLoop(unsigned const worker)
+    {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop) {
+                    return;
+                }
+                seen = m_generation;
+            }
+            work(*m_ciphers[worker]);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_busy == 0) {
+                    m_done.notify_one();
+                }
+            }
+        }
+    }
+
+}
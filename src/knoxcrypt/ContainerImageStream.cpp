@@ -29,6 +29,10 @@
 
 #include "knoxcrypt/ContainerImageStream.hpp"
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 /// Since these are statics need to make sure they're instantiated here!
 bool cryptostreampp::IByteTransformer::m_init = false;
 uint8_t cryptostreampp::IByteTransformer::g_bigKey[32]; 
@@ -41,72 +45,285 @@ namespace knoxcrypt
                                                                           io->encProps,
                                                                           mode,
                                                                           io->firstTimeInit))
+        , m_image(ImageFile::open(io))
+        , m_cache(io->blockCache)
+        , m_pos(-1)
+        , m_behind(false)
+        , m_append((mode & std::ios::app) != 0)
+        , m_dirty(false)
+        , m_stale(false)
     {
         io->firstTimeInit = false;
     }
 
+    std::streamoff
+    ContainerImageStream::position()
+    {
+        if (m_pos < 0) {
+            m_pos = m_cryptoStream->tellg();
+        }
+        return m_pos;
+    }
+
+    void
+    ContainerImageStream::catchUp()
+    {
+        if (m_behind) {
+            (void)m_cryptoStream->seekg(m_pos);
+            m_behind = false;
+            m_stale = false;
+        } else if (m_stale) {
+            // seeking drops whatever the stream has buffered
+            std::streamoff const pos = m_cryptoStream->tellg();
+            if (pos >= 0) {
+                (void)m_cryptoStream->seekg(pos);
+            }
+            m_stale = false;
+        }
+    }
+
+    void
+    ContainerImageStream::flushPending()
+    {
+        if (m_dirty) {
+            m_cryptoStream->flush();
+            m_dirty = false;
+        }
+    }
+
+    std::streamsize
+    ContainerImageStream::readAt(uint64_t const offset, char * const buf, std::streamsize const n)
+    {
+        flushPending();
+        if (!m_cache || n <= 0) {
+            return m_image->readAt(offset, buf, n);
+        }
+
+        uint64_t const size = m_cache->blockSize();
+        std::streamsize done = 0;
+        while (done < n) {
+            uint64_t const at = offset + done;
+            uint64_t const block = at / size;
+            uint64_t const within = at % size;
+            uint64_t const want = std::min(uint64_t(n - done), size - within);
+            if (!m_cache->read(block, within, buf + done, want)) {
+
+                // the whole block is read in so that it can be held on to
+                std::vector<char> data(size);
+                auto const ticket = m_cache->beginLoad();
+                auto const got = m_image->readAt(block * size, &data.front(), size);
+                if (got != std::streamsize(size)) {
+
+                    // the image ends part way through the block
+                    auto const rest = m_image->readAt(at, buf + done, n - done);
+                    return rest < 0 ? rest : done + rest;
+                }
+                std::copy(data.begin() + within, data.begin() + within + want, buf + done);
+                m_cache->insert(block, std::move(data), ticket);
+            }
+            done += want;
+        }
+        return done;
+    }
+
+    std::streamsize
+    ContainerImageStream::writeAt(uint64_t const offset, char const * const buf, std::streamsize const n)
+    {
+        flushPending();
+        auto const written = m_image->writeAt(offset, buf, n);
+        if (m_cache) {
+            if (written == n) {
+                m_cache->update(offset, buf, n);
+            } else {
+                // not knowing what was written, nothing held can be trusted
+                m_cache->clear();
+            }
+        }
+        m_stale = true;
+        return written;
+    }
+
+    bool
+    ContainerImageStream::readBatch(std::vector<ImageFile::Transfer> const &transfers)
+    {
+        flushPending();
+        if (!m_cache) {
+            return m_image->readBatch(transfers);
+        }
+
+        // the blocks the cache doesn't hold are read in whole, all of them
+        // together, so that they can be held on to
+        uint64_t const size = m_cache->blockSize();
+        std::map<uint64_t, std::vector<char>> loads;
+        std::vector<std::pair<uint64_t, ImageFile::Transfer>> missing;
+        for (auto const & transfer : transfers) {
+            std::streamsize done = 0;
+            while (done < transfer.n) {
+                uint64_t const at = transfer.offset + done;
+                uint64_t const block = at / size;
+                uint64_t const within = at % size;
+                uint64_t const want = std::min(uint64_t(transfer.n - done), size - within);
+                if (!m_cache->read(block, within, transfer.buf + done, want)) {
+                    (void)loads[block];
+                    missing.emplace_back(block, ImageFile::Transfer{at, transfer.buf + done, std::streamsize(want)});
+                }
+                done += want;
+            }
+        }
+        if (missing.empty()) {
+            return true;
+        }
+
+        std::vector<ImageFile::Transfer> reads;
+        for (auto & load : loads) {
+            load.second.resize(size);
+            reads.push_back(ImageFile::Transfer{load.first * size, &load.second.front(), std::streamsize(size)});
+        }
+        auto const ticket = m_cache->beginLoad();
+        if (!m_image->readBatch(reads)) {
+
+            // the image ends part way through a block; nothing is held and
+            // each stretch is read for itself
+            bool all = true;
+            for (auto const & piece : missing) {
+                auto const & transfer = piece.second;
+                all = m_image->readAt(transfer.offset, transfer.buf, transfer.n) == transfer.n && all;
+            }
+            return all;
+        }
+        for (auto const & piece : missing) {
+            auto const & data = loads[piece.first];
+            auto const & transfer = piece.second;
+            auto const from = data.begin() + (transfer.offset % size);
+            std::copy(from, from + transfer.n, transfer.buf);
+        }
+        for (auto & load : loads) {
+            m_cache->insert(load.first, std::move(load.second), ticket);
+        }
+        return true;
+    }
+
+    void
+    ContainerImageStream::beginBatch()
+    {
+        flushPending();
+        m_image->beginBatch();
+    }
+
+    bool
+    ContainerImageStream::endBatch()
+    {
+        return m_image->endBatch();
+    }
+
     ContainerImageStream&
     ContainerImageStream::read(char * const buf, std::streamsize const n)
     {
+        std::streamoff const pos = position();
+        bool const positional = m_cache || m_image->isMapped() || m_image->enciphersInParallel(n);
+        if (positional && n > 0 && pos >= 0 && readAt(pos, buf, n) == n) {
+            m_pos = pos + n;
+            m_behind = true;
+            return *this;
+        }
+
+        // past the end of the image the stream is left failed as usual
+        catchUp();
         (void)m_cryptoStream->read(buf, n);
+        m_pos = (pos >= 0 && !m_cryptoStream->fail()) ? pos + n : -1;
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::write(char const * buf, std::streamsize const n)
     {
+        // an appending stream writes at the end whatever the position
+        std::streamoff at = m_append ? -1 : position();
+        bool const positional = m_image->isMapped() || m_image->enciphersInParallel(n);
+        if (positional && n > 0 && at >= 0 && writeAt(at, buf, n) == n) {
+            m_pos = at + n;
+            m_behind = true;
+            return *this;
+        }
+        catchUp();
         (void)m_cryptoStream->write(buf, n);
+        m_dirty = true;
+        if (m_append && !m_cryptoStream->fail()) {
+            at = std::streamoff(m_cryptoStream->tellp()) - n;
+        }
+        bool const written = at >= 0 && !m_cryptoStream->fail();
+        if (m_cache) {
+            if (written) {
+                m_cache->update(at, buf, n);
+            } else {
+                // not knowing what was written where, nothing held can be trusted
+                m_cache->clear();
+            }
+        }
+        m_pos = (written && !m_append) ? at + n : -1;
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::seekg(std::streampos pos)
     {
-        (void)m_cryptoStream->seekg(pos);
+        m_pos = pos;
+        m_behind = true;
         return *this;
     }
     ContainerImageStream&
     ContainerImageStream::seekg(std::streamoff off, std::ios_base::seekdir way)
     {
+        catchUp();
         (void)m_cryptoStream->seekg(off, way);
+        m_pos = -1;
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::seekp(std::streampos pos)
     {
-        (void)m_cryptoStream->seekp(pos);
+        m_pos = pos;
+        m_behind = true;
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::seekp(std::streamoff off, std::ios_base::seekdir way)
     {
+        catchUp();
         (void)m_cryptoStream->seekp(off, way);
+        m_pos = -1;
         return *this;
     }
 
     std::streampos
     ContainerImageStream::tellg()
     {
-        return m_cryptoStream->tellg();
+        return position();
     }
     std::streampos
     ContainerImageStream::tellp()
     {
-        return m_cryptoStream->tellp();
+        return position();
     }
 
     void
     ContainerImageStream::close()
     {
         m_cryptoStream->close();
+        m_pos = -1;
+        m_behind = false;
+        m_dirty = false;
+        m_stale = false;
     }
 
     void
     ContainerImageStream::flush()
     {
         m_cryptoStream->flush();
+        m_image->sync();
+        m_dirty = false;
     }
 
     bool
@@ -120,6 +337,13 @@ namespace knoxcrypt
                              std::ios::openmode mode)
     {
         m_cryptoStream->open(io->path, mode);
+        m_image = ImageFile::open(io);
+        m_cache = io->blockCache;
+        m_pos = -1;
+        m_behind = false;
+        m_append = (mode & std::ios::app) != 0;
+        m_dirty = false;
+        m_stale = false;
     }
 
     bool
@@ -154,6 +154,166 @@ namespace knoxcrypt
             return returnString;
         }
 
+        /**
+         * @brief determines if a file entry keeps the file's data itself
+         * rather than the index of the file's start block. The data then
+         * follows the null byte of the name and the size of the data takes
+         * the place of the start block index
+         * @param metaData the metadata
+         * @return true if the file is inline
+         */
+        bool entryIsInline(std::vector<uint8_t> const &bytes)
+        {
+            uint8_t byte = bytes[0];
+            return detail::isBitSetInByte(byte, 2);
+        }
+
+        /**
+         * @brief computes how much file data fits in an entry with given name
+         * @param name the name of the entry
+         * @return the number of bytes left in the name field after the name
+         */
+        uint32_t inlineRoom(std::string const &name)
+        {
+            return detail::MAX_FILENAME_LENGTH - name.length() - 1;
+        }
+
+        /**
+         * @brief builds the metadata of an entry
+         * @param entryType the type of the entry
+         * @param name the name of the entry
+         * @param startBlock the starting block index of the entry
+         * @return the metadata
+         */
+        std::vector<uint8_t> buildEntryMetaData(EntryType const &entryType,
+                                                std::string const &name,
+                                                uint64_t const startBlock)
+        {
+            // the first bit indicates that the entry is in use; the second
+            // that it is a file rather than a folder
+            std::vector<uint8_t> metaData(1);
+            detail::setBitInByte(metaData[0], 0);
+            detail::setBitInByte(metaData[0], 1, entryType == EntryType::FileType);
+            auto const filename(createFileNameVector(name));
+            metaData.insert(metaData.end(), filename.begin(), filename.end());
+            uint8_t buf[8];
+            detail::convertUInt64ToInt8Array(startBlock, buf);
+            metaData.insert(metaData.end(), buf, buf + 8);
+            return metaData;
+        }
+
+        /**
+         * @brief builds the metadata of a file entry holding the file's data
+         * @param name the name of the entry
+         * @param data the file data; must fit (see inlineRoom)
+         * @return the metadata
+         */
+        std::vector<uint8_t> buildInlineEntryMetaData(std::string const &name,
+                                                      std::vector<uint8_t> const &data)
+        {
+            auto metaData(buildEntryMetaData(EntryType::FileType, name, data.size()));
+            detail::setBitInByte(metaData[0], 2);
+            (void)std::copy(data.begin(), data.end(), metaData.begin() + 1 + name.length() + 1);
+            return metaData;
+        }
+
+        /**
+         * @brief retrieves the file data held by an inline entry
+         * @param metaData the metadata
+         * @return the file data
+         */
+        std::vector<uint8_t> getInlineDataForEntry(std::vector<uint8_t> const &metaData)
+        {
+            auto const name(getEntryName(metaData));
+            auto const begin(metaData.begin() + 1 + name.length() + 1);
+            return std::vector<uint8_t>(begin, begin + getBlockIndexForEntry(metaData));
+        }
+
+        // where a file entry records the file's size: the last 8 bytes of
+        // the name field, which only a name of up to 246 characters leaves free
+        uint64_t const ENTRY_SIZE_OFFSET = 1 + detail::MAX_FILENAME_LENGTH - 8;
+
+        /**
+         * @brief determines if a file entry records the file's size
+         * @param metaData the metadata
+         * @return true if the size is recorded
+         */
+        bool entryHasSize(std::vector<uint8_t> const &bytes)
+        {
+            uint8_t byte = bytes[0];
+            return detail::isBitSetInByte(byte, 3);
+        }
+
+        /**
+         * @brief determines if the entry of a file with given name has room
+         * for the file's size
+         * @param name the name of the entry
+         * @return true if the size fits
+         */
+        bool entrySizeFits(std::string const &name)
+        {
+            // the in-use and type byte, the name and its null byte come first
+            return 1 + name.length() + 1 <= ENTRY_SIZE_OFFSET;
+        }
+
+        /**
+         * @brief retrieves the file size recorded by an entry
+         * @param metaData the metadata
+         * @return the file size
+         */
+        uint64_t getSizeForEntry(std::vector<uint8_t> const &metaData)
+        {
+            std::vector<uint8_t> theBuffer(metaData.begin() + ENTRY_SIZE_OFFSET,
+                                           metaData.begin() + ENTRY_SIZE_OFFSET + 8);
+            return detail::convertInt8ArrayToInt64(&theBuffer.front());
+        }
+
+        /**
+         * @brief records a file's size in its entry
+         * @param metaData the metadata; its name must leave room for the size
+         * @param fileSize the size to record
+         */
+        void setSizeForEntry(std::vector<uint8_t> &metaData, uint64_t const fileSize)
+        {
+            detail::setBitInByte(metaData[0], 3);
+            detail::convertUInt64ToInt8Array(fileSize, &metaData[ENTRY_SIZE_OFFSET]);
+        }
+
+        /**
+         * @brief reads the metadata of entry n of a folder
+         * @param io the core knoxcrypt io
+         * @param folderBlock the start block of the folder
+         * @param n the index of the entry
+         * @return the metadata
+         */
+        std::vector<uint8_t> readEntryMetaData(SharedCoreIO const &io,
+                                               uint64_t const folderBlock,
+                                               uint64_t const n)
+        {
+            File folderData(io, "", folderBlock, OpenDisposition::buildReadOnlyDisposition());
+            return doSeekAndReadOfEntryMetaData(std::move(folderData), n);
+        }
+
+        /**
+         * @brief overwrites the metadata of entry n of a folder
+         * @param io the core knoxcrypt io
+         * @param folderBlock the start block of the folder
+         * @param n the index of the entry
+         * @param metaData the new metadata
+         */
+        void writeEntryMetaData(SharedCoreIO const &io,
+                                uint64_t const folderBlock,
+                                uint64_t const n,
+                                std::vector<uint8_t> const &metaData)
+        {
+            File folderData(io, "", folderBlock, OpenDisposition::buildOverwriteDisposition());
+            if (folderData.seek(8 + (n * metaData.size())) == -1) {
+                throw std::runtime_error("Problem writing entry metadata");
+            }
+            (void)folderData.write((char*)&metaData.front(), metaData.size());
+            folderData.flush();
+        }
+
         /**
          * @brief retrieves the name of an entry with given index
          * @return the name
@@ -173,17 +333,12 @@ namespace knoxcrypt
          * @return the number of folder entries
          */
         long getNumberOfEntries(File const & folderData,
-                                uint64_t const blocks,
-                                long const blockSize)
+                                SharedCoreIO const &io)
         {
             auto out(folderData.getStream());
-            uint64_t const offset = detail::getOffsetOfFileBlock(blockSize,
-                                                                 folderData.getStartVolumeBlockIndex(),
-                                                                 blocks);
-            (void)out->seekg(offset + detail::FILE_BLOCK_META);
-            if(!out->bad()) { // bad when not initialized, i.e., when sparse image
-                uint8_t buf[8];
-                (void)out->read((char*)buf, 8);
+            uint64_t const offset = detail::getOffsetOfBlockData(io, folderData.getFirstDataVolumeBlockIndex());
+            uint8_t buf[8];
+            if(out->readAt(offset, (char*)buf, 8) == 8) { // short when not initialized, i.e., when sparse image
 
                 // there will never be a number of entries that is greater than
                 // the max capacity of a long variable
@@ -204,7 +359,7 @@ namespace knoxcrypt
                        OpenDisposition::buildAppendDisposition())
         , m_startVolumeBlock(startVolumeBlock)
         , m_name(std::move(name))
-        , m_entryCount(getNumberOfEntries(m_folderData, m_io->blocks, m_io->blockSize))
+        , m_entryCount(getNumberOfEntries(m_folderData, m_io))
         , m_deadEntryCount(0)
         , m_entryInfoCacheMap()
         , m_checkForEarlyMetaData(true)
@@ -242,20 +397,6 @@ namespace knoxcrypt
         return m_folderData.write(buf, n);
     }
 
-    std::streamsize
-    ContentFolder::doWriteFirstByteToEntryMetaData(EntryType const &entryType)
-    {
-        // set the first bit to indicate that this entry is in use
-        uint8_t byte = 0;
-        detail::setBitInByte(byte, 0);
-
-        // set second bit to indicate that its type file; folder will be type 0
-        detail::setBitInByte(byte, 1, entryType == EntryType::FileType);
-
-        // write out first byte
-        return doWrite((char*)&byte, 1);
-    }
-
     std::streamsize
     ContentFolder::doWriteFilenameToEntryMetaData(std::string const &name)
     {
@@ -266,27 +407,21 @@ namespace knoxcrypt
         return doWrite((char*)&filename.front(), detail::MAX_FILENAME_LENGTH);
     }
 
-    std::streamsize
-    ContentFolder::doWriteFirstBlockIndexToEntryMetaData(uint64_t firstBlock)
-    {
-        // create bytes to represent first block
-        uint8_t buf[8];
-        detail::convertUInt64ToInt8Array(firstBlock, buf);
-        return doWrite((char*)buf, 8);
-    }
-
     void
     ContentFolder::writeNewMetaDataForEntry(std::string const &name,
                                             EntryType const &entryType,
-                                            uint64_t startBlock)
+                                            uint64_t startBlock,
+                                            uint64_t const fileSize)
     {
-        doWriteNewMetaDataForEntry(name, entryType, startBlock);
+        auto metaData(buildEntryMetaData(entryType, name, startBlock));
+        if (m_io->entrySizes && entryType == EntryType::FileType && entrySizeFits(name)) {
+            setSizeForEntry(metaData, fileSize);
+        }
+        doWriteNewMetaDataForEntry(metaData);
     }
 
     void
-    ContentFolder::doWriteNewMetaDataForEntry(std::string const &name,
-                                              EntryType const &entryType,
-                                              uint64_t startBlock)
+    ContentFolder::doWriteNewMetaDataForEntry(std::vector<uint8_t> const &metaData)
     {
         auto overWroteOld(doFindOffsetWhereMetaDataShouldBeWritten());
 
@@ -300,21 +435,16 @@ namespace knoxcrypt
             m_folderData.seek(0, std::ios_base::end);
         }
 
-        // create and write first byte of filename metadata
-        (void)doWriteFirstByteToEntryMetaData(entryType);
-
-        // create and write filename
-        (void)doWriteFilenameToEntryMetaData(name);
-
-        // write the first block index to the file entry metadata
-        (void)doWriteFirstBlockIndexToEntryMetaData(startBlock);
+        // write the in-use and type byte, the filename and then the first
+        // block index of the entry
+        (void)doWrite((char*)&metaData.front(), metaData.size());
 
         // increment entry count, but only if brand new
         if (!overWroteOld) {
             ++m_entryCount;
             detail::writeFolderEntryCount(*m_folderData.getStream(),
                                           m_io,
-                                          m_folderData.getStartVolumeBlockIndex(),
+                                          m_folderData.getFirstDataVolumeBlockIndex(),
                                           m_entryCount);
         }
 
@@ -331,11 +461,17 @@ namespace knoxcrypt
     void
     ContentFolder::addFile(std::string const &name)
     {
+        // a new file is empty so, if it can be, is kept in its entry
+        if (m_io->inlineFiles && inlineCapacity(name) > 0) {
+            doWriteNewMetaDataForEntry(buildInlineEntryMetaData(name, std::vector<uint8_t>()));
+            return;
+        }
+
         // Create a new file entry
         File entry(m_io, name);
 
         // write the first block index to the file entry metadata
-        doWriteNewMetaDataForEntry(name, EntryType::FileType, entry.getStartVolumeBlockIndex());
+        writeNewMetaDataForEntry(name, EntryType::FileType, entry.getStartVolumeBlockIndex());
     }
 
     void
@@ -344,7 +480,8 @@ namespace knoxcrypt
         // Create a new sub-folder entry
         auto entry(std::make_shared<ContentFolder>(m_io, name));
         // write the first block index to the file entry metadata
-        doWriteNewMetaDataForEntry(name, EntryType::FolderType, entry->m_folderData.getStartVolumeBlockIndex());
+        doWriteNewMetaDataForEntry(buildEntryMetaData(EntryType::FolderType, name,
+                                                      entry->m_folderData.getStartVolumeBlockIndex()));
     }
 
     void
@@ -354,8 +491,8 @@ namespace knoxcrypt
         auto entry(std::make_shared<CompoundFolder>(m_io, name));
 
         // write the first block index to the file entry metadata
-        doWriteNewMetaDataForEntry(name, EntryType::FolderType,
-          entry->getCompoundFolder()->m_folderData.getStartVolumeBlockIndex());
+        doWriteNewMetaDataForEntry(buildEntryMetaData(EntryType::FolderType, name,
+          entry->getCompoundFolder()->m_folderData.getStartVolumeBlockIndex()));
     }
 
     boost::optional<File>
@@ -367,17 +504,95 @@ namespace knoxcrypt
         // entry info which is hopefully cached
         auto info(doGetNamedEntryInfo(name));
         if (info) {
+            if (info->type() == EntryType::FileType && info->isInline()) {
+                File file(m_io, name, buildInlineData(info), openDisposition);
+                file.setOptionalSizeUpdateCallback(buildSizeUpdateCallback(info));
+                return file;
+            }
             if (info->type() == EntryType::FileType) {
                 File file(m_io, name, info->firstFileBlock(), openDisposition);
-                file.setOptionalSizeUpdateCallback(std::bind(&EntryInfo::updateSize,
-                                                             info,
-                                                             std::placeholders::_1));
+                file.setOptionalSizeUpdateCallback(buildSizeUpdateCallback(info));
                 return file;
             }
         }
         return boost::optional<File>();
     }
 
+    uint32_t
+    ContentFolder::inlineCapacity(std::string const &name) const
+    {
+        return std::min(inlineRoom(name), m_io->inlineFileBytes);
+    }
+
+    InlineData
+    ContentFolder::buildInlineData(SharedEntryInfo const &info) const
+    {
+        InlineData inlineData;
+        inlineData.bytes = getInlineDataForEntry(doSeekAndReadOfEntryMetaData(m_folderData, info->folderIndex()));
+        inlineData.capacity = inlineCapacity(info->filename());
+
+        // the file may outlive this folder object so the entry is found
+        // afresh each time; its name is read back in case of a rename
+        auto const io(m_io);
+        auto const folderBlock(m_startVolumeBlock);
+        auto const index(info->folderIndex());
+        inlineData.store = [io, folderBlock, index](std::vector<uint8_t> const &bytes) {
+            auto const metaData(readEntryMetaData(io, folderBlock, index));
+            if (!entryMetaDataIsEnabled(metaData)) {
+                return true; // the file has since been removed
+            }
+            auto const name(getEntryName(metaData));
+            if (bytes.size() > inlineRoom(name)) {
+                return false;
+            }
+            writeEntryMetaData(io, folderBlock, index, buildInlineEntryMetaData(name, bytes));
+            return true;
+        };
+        inlineData.promote = [io, folderBlock, index, info](uint64_t const startBlock) {
+            auto const metaData(readEntryMetaData(io, folderBlock, index));
+            if (!entryMetaDataIsEnabled(metaData)) {
+                return;
+            }
+            auto const name(getEntryName(metaData));
+            writeEntryMetaData(io, folderBlock, index, buildEntryMetaData(EntryType::FileType, name, startBlock));
+            info->updateFirstFileBlock(startBlock);
+        };
+        return inlineData;
+    }
+
+    std::function<void(uint64_t, bool)>
+    ContentFolder::buildSizeUpdateCallback(SharedEntryInfo const &info) const
+    {
+        if (!m_io->entrySizes) {
+            return std::bind(&EntryInfo::updateSize, info, std::placeholders::_1);
+        }
+
+        // as with inline data, the entry is found afresh each time. The
+        // size last recorded is remembered so that a flush that didn't
+        // change the size doesn't rewrite the entry
+        auto const io(m_io);
+        auto const folderBlock(m_startVolumeBlock);
+        auto const index(info->folderIndex());
+        auto const recorded(std::make_shared<boost::optional<uint64_t>>());
+        return [io, folderBlock, index, info, recorded](uint64_t const size, bool const flushed) {
+            info->updateSize(size);
+            if (!flushed || *recorded == size) {
+                return;
+            }
+            auto metaData(readEntryMetaData(io, folderBlock, index));
+            if (!entryMetaDataIsEnabled(metaData) || entryIsInline(metaData) ||
+                getBlockIndexForEntry(metaData) != info->firstFileBlock()) {
+                return; // the size of an inline file is its entry's anyway
+            }
+            if (entrySizeFits(getEntryName(metaData)) &&
+                !(entryHasSize(metaData) && getSizeForEntry(metaData) == size)) {
+                setSizeForEntry(metaData, size);
+                writeEntryMetaData(io, folderBlock, index, metaData);
+            }
+            *recorded = size;
+        };
+    }
+
     std::shared_ptr<ContentFolder>
     ContentFolder::getContentFolder(std::string const &name) const
     {
@@ -499,6 +714,47 @@ namespace knoxcrypt
         uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
         std::ios_base::streamoff offset = (8 + (index * bufferSize));
 
+        // the data of an inline file follows its name so has to move too
+        auto const metaData(doSeekAndReadOfEntryMetaData(m_folderData, index));
+        if (getTypeForEntry(metaData) == EntryType::FileType && entryIsInline(metaData)) {
+            auto const data(getInlineDataForEntry(metaData));
+            std::vector<uint8_t> newMetaData;
+            if (data.size() <= inlineRoom(dstName)) {
+                newMetaData = buildInlineEntryMetaData(dstName, data);
+            } else {
+                // not enough room left by the new name
+                File entry(m_io, dstName);
+                (void)entry.write((char*)&data.front(), data.size());
+                entry.flush();
+                newMetaData = buildEntryMetaData(EntryType::FileType, dstName, entry.getStartVolumeBlockIndex());
+                if (m_io->entrySizes && entrySizeFits(dstName)) {
+                    setSizeForEntry(newMetaData, data.size());
+                }
+            }
+            m_folderData = File(m_io, m_name, m_startVolumeBlock,
+                                OpenDisposition::buildOverwriteDisposition());
+            m_folderData.seek(offset);
+            (void)doWrite((char*)&newMetaData.front(), newMetaData.size());
+            m_folderData.flush();
+            invalidateEntryInEntryInfoCache(srcName);
+            return true;
+        }
+
+        // a recorded file size shares the name field so goes with the name
+        if (entryHasSize(metaData)) {
+            auto newMetaData(buildEntryMetaData(EntryType::FileType, dstName, getBlockIndexForEntry(metaData)));
+            if (entrySizeFits(dstName)) {
+                setSizeForEntry(newMetaData, getSizeForEntry(metaData));
+            }
+            m_folderData = File(m_io, m_name, m_startVolumeBlock,
+                                OpenDisposition::buildOverwriteDisposition());
+            m_folderData.seek(offset);
+            (void)doWrite((char*)&newMetaData.front(), newMetaData.size());
+            m_folderData.flush();
+            invalidateEntryInEntryInfoCache(srcName);
+            return true;
+        }
+
         // normally here we'd write the first byte to the metadata
         // before writing filename, but since we don't do this, we
         // need to seek forward by one byte
@@ -672,9 +928,17 @@ namespace knoxcrypt
         }
 
         auto const entryType(getTypeForEntry(metaData));
+        bool const isInline = entryType == EntryType::FileType && entryIsInline(metaData);
         uint64_t fileSize = 0;
         uint64_t startBlock;
-        if (entryType == EntryType::FileType) {
+        if (isInline) {
+            // the size is held where the start block index would be
+            fileSize = getBlockIndexForEntry(metaData);
+            startBlock = 0;
+        } else if (entryType == EntryType::FileType && entryHasSize(metaData)) {
+            fileSize = getSizeForEntry(metaData);
+            startBlock = getBlockIndexForEntry(metaData);
+        } else if (entryType == EntryType::FileType) {
             // note disposition doesn't matter here, can be anything
             startBlock = getBlockIndexForEntry(metaData);
             File fe(m_io, entryName, startBlock, OpenDisposition::buildAppendDisposition());
@@ -689,6 +953,7 @@ namespace knoxcrypt
                                               true, // writable
                                               startBlock,
                                               entryIndex));
+        info->setInline(isInline);
 
         m_entryInfoCacheMap.emplace(entryName, info);
 
@@ -30,6 +30,12 @@
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
 #include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "knoxcrypt/detail/DetailHolePunch.hpp"
+
+#include <algorithm>
+#include <vector>
 
 namespace knoxcrypt
 {
@@ -48,6 +54,11 @@ namespace knoxcrypt
         return m_io->blockSize;
     }
 
+    long CoreFS::getBlockWriteSpace() const
+    {
+        return detail::getBlockWriteSpace(m_io);
+    }
+
     CompoundFolder
     CoreFS::getFolder(std::string const &path)
     {
@@ -208,11 +219,29 @@ namespace knoxcrypt
         auto const srcPathParent(srcPathBoost.parent_path());
         auto dstFilename(dstPathBoost.filename().string());
 
+        // data held by the cached file is written out before its entry moves
+        resetCachedFile(srcPathBoost);
+
         if(destPathParent == srcPathParent) {
             parentSrc->updateMetaDataWithNewFilename(filename, dstFilename);
+        } else if(childInfo->isInline()) {
+            // an inline file's data is part of its entry so goes with it
+            auto src(parentSrc->getFile(filename, OpenDisposition::buildReadOnlyDisposition()));
+            std::vector<char> data(src.fileSize());
+            if(!data.empty()) {
+                (void)src.read(&data.front(), data.size());
+            }
+            parentSrc->putMetaDataOutOfUse(filename);
+            parentDst->addFile(dstFilename);
+            auto dstFile(parentDst->getFile(dstFilename, OpenDisposition::buildAppendDisposition()));
+            if(!data.empty()) {
+                (void)dstFile.write(&data.front(), data.size());
+            }
+            dstFile.flush();
         } else {
             parentSrc->putMetaDataOutOfUse(filename);
-            parentDst->writeNewMetaDataForEntry(dstFilename, childInfo->type(), childInfo->firstFileBlock());
+            parentDst->writeNewMetaDataForEntry(dstFilename, childInfo->type(), childInfo->firstFileBlock(),
+                                                childInfo->size());
         }
 
         // Need to remove parent entry from cache
@@ -224,21 +253,28 @@ namespace knoxcrypt
         }
 
         // need to also walk over children??
-
-        // need to also check if this now fucks up the cached file
-        resetCachedFile(srcPathBoost);
     }
 
     void
-    CoreFS::resetCachedFile(::boost::filesystem::path const &thePath)
+    CoreFS::resetCachedFile(::boost::filesystem::path const &thePath, bool const removed)
     {
         if(m_cachedFileAndPath) {
 
             auto cachedPath = boost::filesystem::path(m_cachedFileAndPath->first);
             auto boostFolderPath = thePath;
+            if(cachedPath == boostFolderPath) {
+                if(removed) {
+                    m_cachedFileAndPath->second->reset();
+                }
+                m_cachedFileAndPath.reset();
+                return;
+            }
             do {
                 cachedPath = cachedPath.parent_path();
                 if(cachedPath == boostFolderPath) {
+                    if(removed) {
+                        m_cachedFileAndPath->second->reset();
+                    }
                     m_cachedFileAndPath.reset();
                     m_cachedFileAndPath = nullptr;
                     break;
@@ -268,6 +304,7 @@ namespace knoxcrypt
         } catch (...) {
             throw KnoxCryptException(KnoxCryptError::NotFound);
         }
+        resetCachedFile(thePath, true /* removed */);
     }
 
     void
@@ -307,7 +344,7 @@ namespace knoxcrypt
             throw KnoxCryptException(KnoxCryptError::NotFound);
         }
         // need to also check if this now fucks up the cached file
-        resetCachedFile(thePath);
+        resetCachedFile(thePath, true /* removed */);
     }
 
     FileDevice
@@ -341,6 +378,131 @@ namespace knoxcrypt
         m_cachedFileAndPath->second->truncate(offset);
     }
 
+    void
+    CoreFS::preallocate(std::string const &path, uint64_t const bytes, bool const keepSize)
+    {
+        StateLock lock(m_stateMutex);
+        auto parentEntry(doGetParentCompoundFolder(path));
+        if (!parentEntry) {
+            throw KnoxCryptException(KnoxCryptError::NotFound);
+        }
+
+        // the same disposition as writes use so that the cached file, and
+        // the blocks it holds, are kept for the writes that follow
+        setCachedFile(path, parentEntry, OpenDisposition::buildAppendDisposition());
+        auto file(m_cachedFileAndPath->second);
+        file->reserve(bytes);
+
+        if (!keepSize && file->fileSize() < bytes) {
+            (void)file->seek(0, std::ios_base::end);
+            std::vector<char> const zeros(std::min(bytes - file->fileSize(), uint64_t(1048576)), 0);
+            while (file->fileSize() < bytes) {
+                auto const n = std::min(bytes - file->fileSize(), uint64_t(zeros.size()));
+                (void)file->write(&zeros.front(), n);
+            }
+            file->flush();
+        }
+    }
+
+    int64_t
+    CoreFS::findDataOrHole(std::string const &path, int64_t const offset, bool const hole)
+    {
+        StateLock lock(m_stateMutex);
+        auto parentEntry(doGetParentCompoundFolder(path));
+        if (!parentEntry) {
+            throw KnoxCryptException(KnoxCryptError::NotFound);
+        }
+
+        // a file already open is looked in as it is, along with any data
+        // it is still holding back
+        if (!m_cachedFileAndPath || m_cachedFileAndPath->first != path) {
+            setCachedFile(path, parentEntry, OpenDisposition::buildReadOnlyDisposition());
+        }
+        auto file(m_cachedFileAndPath->second);
+        return hole ? file->nextHole(offset) : file->nextData(offset);
+    }
+
+    void
+    CoreFS::cloneFile(std::string const &src, std::string const &dst)
+    {
+        StateLock lock(m_stateMutex);
+        auto parentSrc(doGetParentCompoundFolder(src));
+        auto parentDst(doGetParentCompoundFolder(dst));
+        if (!parentSrc || !parentDst || !doFileExists(src)) {
+            throw KnoxCryptException(KnoxCryptError::NotFound);
+        }
+        if (src == dst) {
+            return;
+        }
+
+        // both files are opened afresh below so anything either is still
+        // holding on to is written out first
+        resetCachedFile(src);
+        resetCachedFile(dst);
+
+        auto const dstName(boost::filesystem::path(dst).filename().string());
+        if (!doFileExists(dst)) {
+            if (doFolderExists(dst)) {
+                throw KnoxCryptException(KnoxCryptError::AlreadyExists);
+            }
+            parentDst->addFile(dstName);
+        }
+
+        auto source(parentSrc->getFile(boost::filesystem::path(src).filename().string(),
+                                       OpenDisposition::buildReadOnlyDisposition()));
+        auto dest(parentDst->getFile(dstName, OpenDisposition::buildAppendDisposition()));
+
+        // without shared blocks, or with blocks shared by too many files
+        // already, the data is copied. The copy is cut short rather than
+        // opened truncated so as to keep its start block
+        if (!dest.shareBlocksOf(source)) {
+            dest.truncate(0);
+            std::vector<char> buffer(std::min(source.fileSize(), uint64_t(1048576)));
+            std::streamsize n;
+            while (!buffer.empty() && (n = source.read(&buffer.front(), buffer.size())) > 0) {
+                (void)dest.write(&buffer.front(), n);
+            }
+        }
+        dest.flush();
+    }
+
+    void
+    CoreFS::flushFile(std::string const &path)
+    {
+        StateLock lock(m_stateMutex);
+        if (m_cachedFileAndPath && m_cachedFileAndPath->first == path &&
+            m_cachedFileAndPath->second->getOpenDisposition().readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+            m_cachedFileAndPath->second->flush();
+        }
+    }
+
+    uint64_t
+    CoreFS::trim()
+    {
+        StateLock lock(m_stateMutex);
+        // held data is given its blocks first so that none of them are
+        // punched as they are being written to
+        if (m_cachedFileAndPath &&
+            m_cachedFileAndPath->second->getOpenDisposition().readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+            m_cachedFileAndPath->second->flush();
+        }
+        return detail::punchFreeBlocks(m_io);
+    }
+
+    void
+    CoreFS::unmount()
+    {
+        StateLock lock(m_stateMutex);
+        if (m_cachedFileAndPath) {
+            // closed here rather than when the file goes, which might not be
+            // until a device still holding it does, so that the count takes
+            // it in and a failure is reported
+            m_cachedFileAndPath->second->close();
+            m_cachedFileAndPath.reset();
+        }
+        m_io->bitmap->unmount(m_io->freeBlocks);
+    }
+
     void
     CoreFS::setCachedFile(std::string const &path,
                            SharedCompoundFolder const &parentEntry,
@@ -350,7 +512,11 @@ namespace knoxcrypt
         if(m_cachedFileAndPath) {
             if( m_cachedFileAndPath->first != path ||
                !m_cachedFileAndPath->second->getOpenDisposition().equals(openMode)) {
+                // let go of the previous file first so that any data it
+                // still holds is written before the file is reopened
+                m_cachedFileAndPath->second.reset();
                 m_cachedFileAndPath->second = std::make_shared<File>(parentEntry->getFile(theName, openMode));
+                m_cachedFileAndPath->first = path;
             }
         } else {
             m_cachedFileAndPath.reset(new FileAndPathPair(path,
@@ -42,6 +42,7 @@ namespace knoxcrypt
         , m_writable(writable)
         , m_firstFileBlock(firstFileBlock)
         , m_folderIndex(folderIndex)
+        , m_inline(false)
         , m_hasBucketIndex(false)
         , m_bucketIndex(0) // TODO, is this initialization wise?
     {
@@ -84,6 +85,25 @@ namespace knoxcrypt
         return m_firstFileBlock;
     }
 
+    void
+    EntryInfo::updateFirstFileBlock(uint64_t const firstFileBlock)
+    {
+        m_firstFileBlock = firstFileBlock;
+        m_inline = false;
+    }
+
+    bool
+    EntryInfo::isInline() const
+    {
+        return m_inline;
+    }
+
+    void
+    EntryInfo::setInline(bool const isInline)
+    {
+        m_inline = isInline;
+    }
+
     uint64_t
     EntryInfo::folderIndex() const
     {
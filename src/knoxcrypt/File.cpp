@@ -26,14 +26,20 @@
   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "knoxcrypt/BlockIndex.hpp"
+#include "knoxcrypt/BlockRefCounts.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/File.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/FileBlockIterator.hpp"
 #include "knoxcrypt/FileEntryException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 #include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "knoxcrypt/detail/DetailHolePunch.hpp"
 
+#include <algorithm>
+#include <iostream>
 #include <stdexcept>
 
 namespace knoxcrypt
@@ -41,11 +47,39 @@ namespace knoxcrypt
 
     namespace {
 
-        uint32_t blockWriteSpace(long const blockSize)
+        uint32_t blockWriteSpace(SharedCoreIO const &io)
         {
-            return blockSize - detail::FILE_BLOCK_META;
+            return detail::getBlockWriteSpace(io);
         }
 
+        SharedBlockRefCounts const &refCounts(SharedCoreIO const &io)
+        {
+            if (!io->refCounts) {
+                io->refCounts = BlockRefCounts::load(io);
+            }
+            return io->refCounts;
+        }
+
+        // a batch of the image's writes, ended however the write ends
+        struct WriteBatch
+        {
+            SharedImageStream stream;
+
+            ~WriteBatch()
+            {
+                if (stream) {
+                    (void)stream->endBatch();
+                }
+            }
+
+            bool end()
+            {
+                SharedImageStream ended;
+                ended.swap(stream);
+                return !ended || ended->endBatch();
+            }
+        };
+
     }
 
     // for writing a brand new entry where start block isn't known
@@ -58,12 +92,18 @@ namespace knoxcrypt
         , m_fileSize(0)
         , m_workingBlock()
         , m_buffer()
+        , m_delayed()
         , m_startVolumeBlock(0)
+        , m_index()
         , m_blockIndex(0)
         , m_openDisposition(OpenDisposition::buildAppendDisposition())
         , m_pos(0)
         , m_blockCount(0)
+        , m_blocks()
         , m_stream()
+        , m_blockReservation(std::make_shared<BlockReservation>())
+        , m_inline()
+        , m_inlineDirty(false)
     {
     }
 
@@ -78,27 +118,35 @@ namespace knoxcrypt
         , m_fileSize(0)
         , m_workingBlock()
         , m_buffer()
+        , m_delayed()
         , m_startVolumeBlock(startBlock)
+        , m_index(io->blockIndex ? std::make_shared<BlockIndex>(io, startBlock) : SharedBlockIndex())
         , m_blockIndex(0)
         , m_openDisposition(openDisposition)
         , m_pos(0)
         , m_blockCount(0)
+        , m_blocks()
         , m_stream()
+        , m_blockReservation(std::make_shared<BlockReservation>())
+        , m_inline()
+        , m_inlineDirty(false)
     {
         // counts number of blocks and sets file size
         enumerateBlockStats();
 
         // sets the current working block to the very first file block
-        m_workingBlock = std::make_shared<FileBlock>(io, startBlock, openDisposition, m_stream);
-
-        m_stream = m_workingBlock->getStream();
+        if (m_blockCount > 0) {
+            m_workingBlock = std::make_shared<FileBlock>(io, getFirstBlock(), openDisposition, m_stream);
+            m_stream = m_workingBlock->getStream();
+        }
 
         // set up for specific write-mode
         if (m_openDisposition.readWrite() != ReadOrWriteOrBoth::ReadOnly) {
 
-            // if in trunc, unlink
+            // if in trunc, unlink; an indexed file keeps its start block
             if (m_openDisposition.trunc() == TruncateOrKeep::Truncate) {
-                unlink();
+                freeBlocks(true /* keep index root */);
+                doReset();
 
             } else {
                 // only if in append mode do we seek to end.
@@ -109,6 +157,70 @@ namespace knoxcrypt
         }
     }
 
+    // for a file kept in its folder entry
+    File::File(SharedCoreIO const &io,
+               std::string const &name,
+               InlineData inlineData,
+               OpenDisposition const &openDisposition)
+        : m_io(io)
+        , m_name(name)
+        , m_enforceStartBlock(false)
+        , m_fileSize(0)
+        , m_workingBlock()
+        , m_buffer()
+        , m_delayed()
+        , m_startVolumeBlock(0)
+        , m_index()
+        , m_blockIndex(0)
+        , m_openDisposition(openDisposition)
+        , m_pos(0)
+        , m_blockCount(0)
+        , m_blocks()
+        , m_stream()
+        , m_blockReservation(std::make_shared<BlockReservation>())
+        , m_inline(std::move(inlineData))
+        , m_inlineDirty(false)
+    {
+        if (m_openDisposition.readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+            if (m_openDisposition.trunc() == TruncateOrKeep::Truncate) {
+                m_inlineDirty = !m_inline->bytes.empty();
+                m_inline->bytes.clear();
+            } else if (m_openDisposition.append() == AppendOrOverwrite::Append) {
+                m_pos = m_inline->bytes.size();
+            }
+        }
+    }
+
+    File::~File()
+    {
+        // close is to be called, as FileDevice::close does, wherever a
+        // failure can be reported; here it can only be logged
+        try {
+            close();
+        } catch (std::exception const &e) {
+            std::cerr << "knoxcrypt: data held back for " << m_name << " was lost: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "knoxcrypt: data held back for " << m_name << " was lost" << std::endl;
+        }
+    }
+
+    void
+    File::close()
+    {
+        if (!m_delayed.empty() || m_inlineDirty) {
+            flush();
+        } else {
+            if (m_workingBlock) {
+                m_workingBlock->flush();
+            }
+            // the size is reported as final for it to be recorded
+            if (m_optionalSizeCallback && m_openDisposition.readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+                (*m_optionalSizeCallback)(fileSize(), true);
+            }
+        }
+        releasePreallocatedBlocks();
+    }
+
     std::string
     File::filename() const
     {
@@ -118,7 +230,10 @@ namespace knoxcrypt
     uint64_t
     File::fileSize() const
     {
-        return m_fileSize;
+        if (m_inline) {
+            return m_inline->bytes.size();
+        }
+        return m_fileSize + m_delayed.size();
     }
 
     OpenDisposition
@@ -136,6 +251,7 @@ namespace knoxcrypt
     uint64_t
     File::getCurrentVolumeBlockIndex()
     {
+        allocateDelayedData();
         if (!m_workingBlock) {
             checkAndUpdateWorkingBlockWithNew();
         }
@@ -145,13 +261,27 @@ namespace knoxcrypt
     uint64_t
     File::getStartVolumeBlockIndex() const
     {
-        if (!m_workingBlock) {
+        if (!m_workingBlock && !m_inline) {
             checkAndUpdateWorkingBlockWithNew();
-            m_startVolumeBlock = m_workingBlock->getIndex();
         }
         return m_startVolumeBlock;
     }
 
+    uint64_t
+    File::getFirstDataVolumeBlockIndex() const
+    {
+        if (!m_workingBlock && !m_inline) {
+            checkAndUpdateWorkingBlockWithNew();
+        }
+        return getFirstBlock();
+    }
+
+    bool
+    File::isInline() const
+    {
+        return static_cast<bool>(m_inline);
+    }
+
     std::streamsize
     File::readWorkingBlockBytes(uint32_t const thisMany)
     {
@@ -171,10 +301,8 @@ namespace knoxcrypt
 
         if (static_cast<uint64_t>(m_blockIndex + 1) < m_blockCount && bytesToRead == size) {
             ++m_blockIndex;
-            m_workingBlock = std::make_shared<FileBlock>(m_io,
-                                                           m_workingBlock->getNextIndex(),
-                                                           m_openDisposition,
-                                                           m_stream);
+            m_workingBlock->flush();
+            m_workingBlock = std::make_shared<FileBlock>(getBlockWithIndex(m_blockIndex));
         }
 
         return bytesToRead;
@@ -182,7 +310,28 @@ namespace knoxcrypt
 
     void File::newWritableFileBlock() const
     {
-        auto block(m_io->blockBuilder->buildWritableFileBlock(m_io,
+        // a file's first block goes wherever is free; after that, blocks are
+        // placed straight after their predecessors where possible
+        if (!m_preallocated.empty() && !m_enforceStartBlock) {
+            // reserved up front and already marked as in use
+            auto const id = m_preallocated.front();
+            m_preallocated.pop_front();
+            chainNewWorkingBlock(m_io->blockBuilder->buildAllocatedFileBlock(m_io,
+                                                                             id,
+                                                                             knoxcrypt::OpenDisposition::buildAppendDisposition(),
+                                                                             m_stream));
+            return;
+        }
+
+        bool const contiguous = m_io->extentAllocation && m_workingBlock &&
+                                !m_workingBlock->isHole() && !m_enforceStartBlock;
+        auto block(contiguous ?
+                   m_io->blockBuilder->buildWritableFileBlock(m_io,
+                                                              knoxcrypt::OpenDisposition::buildAppendDisposition(),
+                                                              m_stream,
+                                                              m_blockReservation,
+                                                              m_workingBlock->getIndex() + 1) :
+                   m_io->blockBuilder->buildWritableFileBlock(m_io,
                                                               knoxcrypt::OpenDisposition::buildAppendDisposition(),
                                                               m_stream,
                                                               m_enforceStartBlock));
@@ -190,9 +339,25 @@ namespace knoxcrypt
         if (m_enforceStartBlock) { m_enforceStartBlock = false; }
 
         block.registerBlockWithVolumeBitmap();
+        chainNewWorkingBlock(std::move(block));
+    }
 
+    void File::chainNewWorkingBlock(FileBlock block) const
+    {
+        // the finished block's data and metadata go out together. Where
+        // blocks can be shared the finished one might not be the file's
+        // alone, so it is left as it is; the index says what follows it
         if (m_workingBlock) {
-            m_workingBlock->setNextIndex(block.getIndex());
+            if (!m_io->sharedBlocks) {
+                m_workingBlock->setNextIndex(block.getIndex());
+            }
+            m_workingBlock->flush();
+        }
+        if (m_index) {
+            m_index->append(block.getIndex());
+        }
+        if (m_blocks.size() == m_blockCount) {
+            m_blocks.push_back(block.getIndex());
         }
 
         ++m_blockCount;
@@ -200,16 +365,77 @@ namespace knoxcrypt
         m_workingBlock = std::make_shared<FileBlock>(std::move(block));
     }
 
+    void
+    File::reserve(uint64_t const bytes)
+    {
+        if (m_inline) {
+            if (bytes <= m_inline->capacity) {
+                return;
+            }
+            promoteInlineData();
+        }
+
+        // count what the file has and what it has been given already
+        uint64_t const space = blockWriteSpace(m_io);
+        uint64_t const blocksRequired = (bytes + space - 1) / space;
+        uint64_t const blocksHeld = m_blockCount + m_preallocated.size();
+        if (blocksRequired <= blocksHeld) {
+            return;
+        }
+
+        uint64_t goal = 0;
+        if (!m_preallocated.empty()) {
+            goal = m_preallocated.back() + 1;
+        } else if (m_workingBlock) {
+            goal = m_workingBlock->getIndex() + 1;
+        }
+        auto const blocks = m_io->blockBuilder->allocateBlocks(m_io, blocksRequired - blocksHeld, goal);
+        m_preallocated.insert(m_preallocated.end(), blocks.begin(), blocks.end());
+    }
+
+    void
+    File::releasePreallocatedBlocks()
+    {
+        if (m_preallocated.empty()) {
+            return;
+        }
+        m_io->freeBlocks += m_preallocated.size();
+        m_io->bitmap->setBlocksInUse(std::vector<uint64_t>(m_preallocated.begin(), m_preallocated.end()), false);
+        m_io->bitmap->sync();
+        m_preallocated.clear();
+    }
+
+    uint64_t
+    File::getFirstBlock() const
+    {
+        if (!m_blocks.empty()) {
+            return m_blocks.front();
+        }
+        return m_index ? m_index->lookup(0) : m_startVolumeBlock;
+    }
+
     void File::enumerateBlockStats()
     {
+        // every block but the last is full so the index and the last block
+        // say all that is needed
+        if (m_index) {
+            m_blockCount = m_index->size();
+            if (m_blockCount > 0) {
+                FileBlock const last(getBlockWithIndex(m_blockCount - 1));
+                m_fileSize = ((m_blockCount - 1) * blockWriteSpace(m_io)) + last.getDataBytesWritten();
+            }
+            return;
+        }
+
         // find very first block
         FileBlockIterator block(m_io,
-                                m_startVolumeBlock,
+                                getFirstBlock(),
                                 m_openDisposition,
                                 m_stream);
         FileBlockIterator end;
         for (; block != end; ++block) {
             m_fileSize += block->getDataBytesWritten();
+            m_blocks.push_back(block->getIndex());
             ++m_blockCount;
         }
     }
@@ -233,7 +459,7 @@ namespace knoxcrypt
         // is always updates after reads/writes
         uint32_t const bytesWritten = m_workingBlock->tell();
 
-        if (bytesWritten < blockWriteSpace(m_io->blockSize)) {
+        if (bytesWritten < blockWriteSpace(m_io)) {
             return true;
         }
         return false;
@@ -246,31 +472,38 @@ namespace knoxcrypt
         // first case no file blocks so absolutely need one to write to
         if (!m_workingBlock) {
 
+            // in a container with block indices the index comes first and
+            // takes the file's start block
+            if (m_io->blockIndex && !m_index) {
+                createIndex();
+            }
+
             newWritableFileBlock();
 
             // when writing the file, the working block will be empty
             // and the start volume block will be unset so need to set now
-            m_startVolumeBlock = m_workingBlock->getIndex();
+            if (!m_index) {
+                m_startVolumeBlock = m_workingBlock->getIndex();
+            }
             return;
         }
 
         // in this case the current block is exhausted so we need a new one
         if (!workingBlockHasAvailableSpace()) {
+            // in the middle of the file, writing carries on in the block
+            // that follows
+            if (static_cast<uint64_t>(m_blockIndex + 1) < m_blockCount) {
+                m_workingBlock->flush();
+                ++m_blockIndex;
+                m_workingBlock = std::make_shared<FileBlock>(getBlockWithIndex(m_blockIndex));
+                return;
+            }
+
             // EDGE case: if overwrite causes us to go over end, need to
             // switch to append mode
             if (static_cast<uint64_t>(tell()) >= m_fileSize) {
                 m_openDisposition = OpenDisposition::buildAppendDisposition();
             }
-
-            // if in overwrite mode, maybe we want to overwrite current bytes
-            if (m_openDisposition.append() == AppendOrOverwrite::Overwrite) {
-                // if the reported stream position in the block is less that
-                // the block's total capacity, then we don't create a new block
-                // we simply overwrite
-                if (m_workingBlock->tell() < blockWriteSpace(m_io->blockSize)) {
-                    return;
-                }
-            }
             newWritableFileBlock();
 
             return;
@@ -288,7 +521,7 @@ namespace knoxcrypt
         // the stream position is subtracted since block may have already
         // had bytes written to it in which case the available size left
         // is approx. block size - stream position
-        return (blockWriteSpace(m_io->blockSize)) - streamPosition;
+        return (blockWriteSpace(m_io)) - streamPosition;
     }
 
     std::streamsize
@@ -298,6 +531,28 @@ namespace knoxcrypt
             throw FileEntryException(FileEntryError::NotReadable);
         }
 
+        if (m_inline) {
+            auto const &bytes = m_inline->bytes;
+            std::streamsize const available = std::max(std::streamsize(bytes.size()) - m_pos, std::streamsize(0));
+            std::streamsize const count = std::min(n, available);
+            if (count > 0) {
+                std::copy(bytes.begin() + m_pos, bytes.begin() + m_pos + count, s);
+                m_pos += count;
+            }
+            return count;
+        }
+
+        allocateDelayedData();
+
+        // a read over several blocks reads them all at once where it's
+        // known which blocks they are
+        if (m_workingBlock && m_stream && (m_blocks.size() == m_blockCount || m_index) &&
+            n > std::streamsize(m_workingBlock->getDataBytesWritten()) - m_workingBlock->tell()) {
+            auto const count = readBlocks(s, n);
+            m_pos += count;
+            return count;
+        }
+
         // read block data
         uint32_t read(0);
         uint64_t offset(0);
@@ -323,6 +578,52 @@ namespace knoxcrypt
         return read;
     }
 
+    std::streamsize
+    File::readBlocks(char * const s, std::streamsize const n)
+    {
+        // the working block might hold data yet to be written
+        m_workingBlock->flush();
+
+        uint64_t const space = blockWriteSpace(m_io);
+        uint64_t const count = static_cast<uint64_t>(m_pos) < m_fileSize ?
+                               std::min(uint64_t(n), m_fileSize - m_pos) : 0;
+        bool const listed = m_blocks.size() == m_blockCount;
+        std::vector<ImageFile::Transfer> transfers;
+        uint64_t block = m_blockIndex;
+        uint64_t within = m_workingBlock->tell();
+        uint64_t done = 0;
+        while (done < count) {
+            uint64_t const take = std::min(count - done, space - within);
+            uint64_t const id = listed ? m_blocks[block] : m_index->lookup(block);
+            if (id == detail::HOLE_BLOCK) {
+                std::fill(s + done, s + done + take, 0);
+            } else {
+                transfers.push_back(ImageFile::Transfer{detail::getOffsetOfBlockData(m_io, id) + within,
+                                                        s + done, std::streamsize(take)});
+            }
+            done += take;
+            within += take;
+
+            // as when reading block by block, the end of a full block is
+            // the start of the next one
+            if (within == space && block + 1 < m_blockCount) {
+                ++block;
+                within = 0;
+            }
+        }
+        if (!m_stream->readBatch(transfers)) {
+            throw std::runtime_error("batched read from the image failed");
+        }
+
+        // reading carries on from where this read got to
+        if (block != static_cast<uint64_t>(m_blockIndex)) {
+            m_blockIndex = block;
+            m_workingBlock = std::make_shared<FileBlock>(getBlockWithIndex(m_blockIndex));
+        }
+        m_workingBlock->seek(within);
+        return count;
+    }
+
     uint32_t
     File::bufferBytesForWorkingBlock(const char* s, std::streamsize n, uint32_t offset)
     {
@@ -345,6 +646,43 @@ namespace knoxcrypt
         return 0;
     }
 
+    bool
+    File::canDelayAllocation() const
+    {
+        return m_io->delayedAllocationBytes > 0 &&
+               m_openDisposition.append() == AppendOrOverwrite::Append &&
+               static_cast<uint64_t>(m_pos) == m_fileSize;
+    }
+
+    uint64_t
+    File::blocksNeededFor(uint64_t const bytes) const
+    {
+        uint64_t const space = blockWriteSpace(m_io);
+        uint64_t const spare = m_workingBlock ? space - m_workingBlock->tell() : 0;
+        if (bytes <= spare) {
+            return 0;
+        }
+        return (bytes - spare + space - 1) / space;
+    }
+
+    void
+    File::allocateDelayedData(uint64_t const bytesToFollow)
+    {
+        if (m_delayed.empty()) {
+            return;
+        }
+        std::vector<uint8_t> delayed;
+        delayed.swap(m_delayed);
+
+        // the final size is known now so the file can be given a run of
+        // blocks big enough for all of it
+        m_blockReservation->wanted = blocksNeededFor(delayed.size() + bytesToFollow);
+        (void)writeToBlocks((char*)&delayed.front(), delayed.size());
+        if (bytesToFollow == 0) {
+            m_blockReservation->wanted = 0;
+        }
+    }
+
     std::streamsize
     File::write(const char* s, std::streamsize n)
     {
@@ -353,12 +691,81 @@ namespace knoxcrypt
             throw FileEntryException(FileEntryError::NotWritable);
         }
 
+        if (m_inline) {
+            // stays in the folder entry for as long as it fits
+            if (static_cast<uint64_t>(m_pos + n) <= m_inline->capacity) {
+                auto &bytes = m_inline->bytes;
+                if (static_cast<uint64_t>(m_pos + n) > bytes.size()) {
+                    bytes.resize(m_pos + n);
+                }
+                std::copy(s, s + n, bytes.begin() + m_pos);
+                m_pos += n;
+                m_inlineDirty = true;
+                if (m_optionalSizeCallback) {
+                    (*m_optionalSizeCallback)(fileSize(), false);
+                }
+                return n;
+            }
+            promoteInlineData();
+        }
+
+        // a write past the end leaves a gap that reads back as zeros. The
+        // write goes straight out after it so as to end the file in a block
+        bool const extended = n > 0 && static_cast<uint64_t>(m_pos) > m_fileSize;
+        if (extended) {
+            extendTo(m_pos, true /* write follows */);
+        }
+
+        if (!extended && canDelayAllocation()) {
+            // hold back appended data until the file is flushed, or until
+            // there is too much of it to hold on to
+            if (m_delayed.size() + n <= m_io->delayedAllocationBytes) {
+                m_delayed.insert(m_delayed.end(), s, s + n);
+                if (m_optionalSizeCallback) {
+                    (*m_optionalSizeCallback)(fileSize(), false);
+                }
+                return n;
+            }
+        }
+        allocateDelayedData(n);
+        auto const wrote = writeToBlocks(s, n);
+        m_blockReservation->wanted = 0;
+        return wrote;
+    }
+
+    std::streamsize
+    File::writeToBlocks(const char* s, std::streamsize n)
+    {
+        // the blocks filled by a write over several go out together, once
+        // there's a stream to batch them on
+        bool const spansBlocks = blocksNeededFor(n) > (m_workingBlock ? 0 : 1);
+        WriteBatch batch;
+
         std::streamsize wrote(0);
         while (wrote < n) {
 
+            if (spansBlocks && !batch.stream && m_stream) {
+                m_stream->beginBatch();
+                batch.stream = m_stream;
+            }
+
             // check if the working block needs to be updated with a new one
             checkAndUpdateWorkingBlockWithNew();
 
+            // a hole is given a block before it can be written to
+            if (m_workingBlock->isHole()) {
+                auto const position = m_workingBlock->tell();
+                m_workingBlock = std::make_shared<FileBlock>(fillHole(m_blockIndex));
+                m_workingBlock->seek(position);
+            }
+
+            // as is a block shared with other files
+            if (isShared(*m_workingBlock)) {
+                auto const position = m_workingBlock->tell();
+                m_workingBlock = std::make_shared<FileBlock>(copyOnWrite(m_blockIndex));
+                m_workingBlock->seek(position);
+            }
+
             // buffers the data that will be written to the working block
             // computed as a function of the data left to write and the
             // working block's available space
@@ -368,12 +775,13 @@ namespace knoxcrypt
             writeBufferedDataToWorkingBlock(actualWritten);
             wrote += actualWritten;
 
-            // update stream position
+            // update stream position; the file only grows if written
+            // past its end
             m_pos += actualWritten;
-
-            if (m_openDisposition.append() == AppendOrOverwrite::Append) {
-                m_fileSize+=actualWritten;
-            }
+            m_fileSize = std::max(m_fileSize, uint64_t(m_pos));
+        }
+        if (!batch.end()) {
+            throw std::runtime_error("batched write to the image failed");
         }
         return wrote;
     }
@@ -381,76 +789,79 @@ namespace knoxcrypt
     void
     File::truncate(std::ios_base::streamoff newSize)
     {
-        // compute number of block required
-        auto const blockSize = blockWriteSpace(m_io->blockSize);
-
-        // edge case
-        if (newSize < blockSize) {
-            FileBlock zeroBlock = getBlockWithIndex(0);
-            zeroBlock.setSize(newSize);
-            zeroBlock.setNextIndex(zeroBlock.getIndex());
-            return;
+        if (m_inline) {
+            if (static_cast<uint64_t>(newSize) <= m_inline->capacity) {
+                m_inline->bytes.resize(newSize);
+                m_pos = std::min(m_pos, newSize);
+                m_inlineDirty = true;
+                if (m_optionalSizeCallback) {
+                    (*m_optionalSizeCallback)(fileSize(), false);
+                }
+                return;
+            }
+            promoteInlineData();
         }
 
-        boost::iostreams::stream_offset const leftOver = newSize % blockSize;
-
-        boost::iostreams::stream_offset const roundedDown = newSize - leftOver;
+        allocateDelayedData();
+        if (m_workingBlock) {
+            m_workingBlock->flush();
+        }
 
-        uint64_t blocksRequired = roundedDown / blockSize;
+        // growing leaves the file where it was
+        if (static_cast<uint64_t>(newSize) > m_fileSize) {
+            auto const position = m_pos;
+            extendTo(newSize);
+            if (m_optionalSizeCallback) {
+                (*m_optionalSizeCallback)(m_fileSize, false);
+            }
+            (void)seek(position);
+            return;
+        }
 
-        // edge case
-        SharedFileBlock block;
-        if (leftOver == 0) {
-            --blocksRequired;
-            block = std::make_shared<FileBlock>(getBlockWithIndex(blocksRequired));
-            block->setSize(blockSize);
-        } else {
-            block = std::make_shared<FileBlock>(getBlockWithIndex(blocksRequired));
-            block->setSize(leftOver);
+        // a file without blocks has nothing to cut
+        if (m_blockCount == 0) {
+            return;
         }
 
+        // the file keeps the blocks up to the one its new end falls in; an
+        // empty file keeps its first block
+        uint64_t const blockSize = blockWriteSpace(m_io);
+        uint64_t const keep = std::max(uint64_t(1), (uint64_t(newSize) + blockSize - 1) / blockSize);
+        uint64_t const lastBytes = newSize - ((keep - 1) * blockSize);
+
+        // the file's last block can't be a hole and, being cut short, has
+        // to be the file's own
+        SharedFileBlock block = std::make_shared<FileBlock>(getBlockWithIndex(keep - 1));
+        if (block->isHole()) {
+            block = std::make_shared<FileBlock>(fillHole(keep - 1));
+        } else if (isShared(*block)) {
+            block = std::make_shared<FileBlock>(copyOnWrite(keep - 1));
+        }
+        block->setSize(lastBytes);
         block->setNextIndex(block->getIndex());
+        block->flush();
+        freeTailBlocks(keep);
 
-        m_blockCount = blocksRequired;
+        m_fileSize = std::min(m_fileSize, uint64_t(newSize));
+        if (m_optionalSizeCallback) {
+            (*m_optionalSizeCallback)(m_fileSize, false);
+        }
 
+        // the working block might have been cut short or freed
+        m_pos = std::min(m_pos, newSize);
+        (void)seek(m_pos);
     }
 
     using SeekPair = std::pair<int64_t, boost::iostreams::stream_offset>;
     SeekPair
-    getPositionFromBegin(boost::iostreams::stream_offset off, long const blockSize)
+    getPositionFromBegin(boost::iostreams::stream_offset off, SharedCoreIO const &io)
     {
         // find what file block the offset would relate to and set extra offset in file block
-        // to that position
-        auto const blockSpace = blockWriteSpace(blockSize);
-        boost::iostreams::stream_offset casted = off;
-        boost::iostreams::stream_offset const leftOver = casted % blockSpace;
-        int64_t block = 0;
-        boost::iostreams::stream_offset blockPosition = 0;
-        if (off > blockSpace) {
-            if (leftOver > 0) {
-
-                // round down casted
-                casted -= leftOver;
-
-                // set the position of the stream in block to leftOver
-                blockPosition = leftOver;
-
-            } else {
-                blockPosition = 0;
-            }
-
-            // get exact number of blocks after round-down
-            block = casted / blockSpace;
-            if(leftOver == 0) {
-                --block;
-            }
-
-        } else {
-            // offset is smaller than the first block so keep block
-            // index at 0 and the position for the zero block at offset
-            blockPosition = off;
-        }
-
+        // to that position. An offset on a block boundary is the start of
+        // the block after it
+        auto const blockSpace = blockWriteSpace(io);
+        int64_t const block = off / blockSpace;
+        boost::iostreams::stream_offset const blockPosition = off % blockSpace;
         return std::make_pair(block, blockPosition);
     }
 
@@ -458,16 +869,16 @@ namespace knoxcrypt
     getPositionFromEnd(boost::iostreams::stream_offset off, 
                        int64_t endBlockIndex,
                        boost::iostreams::stream_offset bytesWrittenToEnd,
-                       long const blockSize)
+                       SharedCoreIO const &io)
     {
         // treat like begin and then 'inverse'
-        auto treatLikeBegin = getPositionFromBegin(std::abs(off), blockSize);
+        auto treatLikeBegin = getPositionFromBegin(std::abs(off), io);
 
         int64_t block = endBlockIndex - treatLikeBegin.first;
         auto blockPosition = bytesWrittenToEnd - treatLikeBegin.second;
 
         if (blockPosition < 0) {
-            uint16_t const blockSpace = blockWriteSpace(blockSize);
+            auto const blockSpace = blockWriteSpace(io);
             blockPosition = blockSpace + blockPosition;
             --block;
         }
@@ -480,11 +891,11 @@ namespace knoxcrypt
     getPositionFromCurrent(boost::iostreams::stream_offset off,
                            int64_t blockIndex,
                            boost::iostreams::stream_offset indexedBlockPosition,
-                           long const blockSize)
+                           SharedCoreIO const &io)
     {
         // find what file block the offset would relate to and set extra offset in file block
         // to that position
-        auto const blockSpace = blockWriteSpace(blockSize);
+        auto const blockSpace = blockWriteSpace(io);
         auto addition = off + indexedBlockPosition;
         auto leftOver = std::abs(addition) % blockSpace;
         auto roundedDown = std::abs(addition) - leftOver;
@@ -503,6 +914,54 @@ namespace knoxcrypt
     boost::iostreams::stream_offset
     File::seek(boost::iostreams::stream_offset off, std::ios_base::seekdir way)
     {
+        if (m_inline) {
+            boost::iostreams::stream_offset const from =
+                way == std::ios_base::beg ? 0 : (way == std::ios_base::cur ? m_pos : fileSize());
+            if (from + off < 0 ||
+                (static_cast<uint64_t>(from + off) > fileSize() &&
+                 m_openDisposition.readWrite() == ReadOrWriteOrBoth::ReadOnly)) {
+                return -1; // fail
+            }
+            m_pos = from + off;
+            return off;
+        }
+
+        if (!m_delayed.empty()) {
+            // seeking to where the file is already positioned, e.g., before
+            // each of a run of sequential writes, keeps the data held back
+            boost::iostreams::stream_offset const from =
+                way == std::ios_base::beg ? 0 : (way == std::ios_base::cur ? tell() : fileSize());
+            if (from + off == tell()) {
+                return off;
+            }
+            allocateDelayedData();
+        }
+
+        // the block being left, and the end block's size, must be up to date
+        if (m_workingBlock) {
+            m_workingBlock->flush();
+        }
+
+        // past the end is where a file open for writing is next written
+        // to, the gap being filled in then (see extendTo). Until it is, the
+        // working block stays at the end of the file
+        boost::iostreams::stream_offset const target =
+            (way == std::ios_base::beg ? 0 : (way == std::ios_base::cur ? m_pos : m_fileSize)) + off;
+        if (target > 0 && static_cast<uint64_t>(target) > m_fileSize) {
+            if (m_openDisposition.readWrite() == ReadOrWriteOrBoth::ReadOnly) {
+                return -1; // fail
+            }
+            if (m_blockCount > 0) {
+                (void)seek(0, std::ios_base::end);
+            }
+            m_pos = target;
+            return off;
+        }
+        if (way == std::ios_base::cur && static_cast<uint64_t>(m_pos) > m_fileSize) {
+            (void)seek(target);
+            return off;
+        }
+
         // reset any offset values to zero but only if not seeking from the current
         // position. When seeking from the current position, we need to keep
         // track of the original block offset
@@ -520,7 +979,7 @@ namespace knoxcrypt
             seekPair = getPositionFromEnd(off, 
                                           endBlock,
                                           getBlockWithIndex(endBlock).getDataBytesWritten(),
-                                          m_io->blockSize);
+                                          m_io);
 
         }
 
@@ -529,14 +988,24 @@ namespace knoxcrypt
         // if seeking from the beginning
 
         if (way == std::ios_base::beg) {
-            seekPair = getPositionFromBegin(off, m_io->blockSize);
+            seekPair = getPositionFromBegin(off, m_io);
         }
         // seek relative to the current position
         if (way == std::ios_base::cur) {
             seekPair = getPositionFromCurrent(off, 
                                               m_blockIndex,
                                               m_workingBlock->tell(),
-                                              m_io->blockSize);
+                                              m_io);
+        }
+
+        // the end of a full block is the start of the next one, except at
+        // the very end of the file where there is no next one
+        auto const blockSpace = blockWriteSpace(m_io);
+        if (seekPair.second == blockSpace && static_cast<uint64_t>(seekPair.first + 1) < m_blockCount) {
+            seekPair = std::make_pair(seekPair.first + 1, 0);
+        } else if (seekPair.second == 0 && seekPair.first > 0 &&
+                   static_cast<uint64_t>(seekPair.first) == m_blockCount) {
+            seekPair = std::make_pair(seekPair.first - 1, blockSpace);
         }
 
         // check bounds and error if too big
@@ -574,29 +1043,67 @@ namespace knoxcrypt
     boost::iostreams::stream_offset
     File::tell() const
     {
-        return m_pos;
+        return m_pos + m_delayed.size();
     }
 
     void
     File::flush()
     {
-        writeBufferedDataToWorkingBlock(m_buffer.size());
+        if (m_inline) {
+            if (m_inlineDirty) {
+                // a rename might have left the entry with less room
+                if (!m_inline->store(m_inline->bytes)) {
+                    promoteInlineData();
+                    return;
+                }
+                m_inlineDirty = false;
+            }
+            if (m_optionalSizeCallback) {
+                (*m_optionalSizeCallback)(fileSize(), true);
+            }
+            return;
+        }
+
+        allocateDelayedData();
+        if (m_workingBlock) {
+            writeBufferedDataToWorkingBlock(m_buffer.size());
+            m_workingBlock->flush();
+        }
         if (m_optionalSizeCallback) {
-            (*m_optionalSizeCallback)(m_fileSize);
+            (*m_optionalSizeCallback)(m_fileSize, true);
+        }
+
+        // persist any blocks allocated since the last flush
+        m_io->bitmap->sync();
+
+        // and hand the host what went through a mapping of the image
+        if (m_workingBlock) {
+            auto const stream = m_workingBlock->getStream();
+            if (stream) {
+                stream->flush();
+            }
         }
     }
 
     void
     File::reset()
     {
+        releasePreallocatedBlocks();
         doReset();
     }
 
     void
     File::doReset()
     {
+        if (m_inline) {
+            m_inline->bytes.clear();
+            m_inlineDirty = false;
+            m_pos = 0;
+        }
         m_fileSize = 0;
+        std::vector<uint8_t>().swap(m_delayed);
         m_blockCount = 0;
+        std::vector<uint64_t>().swap(m_blocks);
         m_workingBlock = nullptr;
         m_blockIndex = 0;
     }
@@ -604,17 +1111,98 @@ namespace knoxcrypt
     void
     File::unlink()
     {
-        // loop over all file blocks and update the volume bitmap indicating
-        // that block is no longer in use
-        FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
-        FileBlockIterator end;
+        freeBlocks(false /* keep index root */);
+        m_index.reset();
+        doReset();
+    }
+
+    void
+    File::promoteInlineData()
+    {
+        InlineData entry(std::move(*m_inline));
+        m_inline = boost::none;
+        m_inlineDirty = false;
+
+        // the data is appended to the file as though it were brand new and
+        // the file is then put back where it was
+        auto const position = m_pos;
+        auto const disposition = m_openDisposition;
+        m_openDisposition = OpenDisposition::buildAppendDisposition();
+        m_pos = 0;
+        if (!entry.bytes.empty()) {
+            (void)writeToBlocks((char*)&entry.bytes.front(), entry.bytes.size());
+        } else {
+            checkAndUpdateWorkingBlockWithNew();
+        }
+        flush();
+        entry.promote(m_startVolumeBlock);
+        m_openDisposition = disposition;
+        if (position != m_pos) {
+            (void)seek(position);
+        }
+    }
 
-        for (; it != end; ++it) {
-            it->unlink();
-            ++m_io->freeBlocks;
+    void
+    File::freeBlocks(bool const keepIndexRoot)
+    {
+        // gather all file blocks and mark them as no longer in use in one
+        // go. Their metadata is left alone; a block is started afresh when
+        // it is next handed out
+        std::vector<uint64_t> blocks(getBlocks());
+        blocks.erase(std::remove(blocks.begin(), blocks.end(), detail::HOLE_BLOCK), blocks.end());
+        if (m_index) {
+            auto const indexBlocks(keepIndexRoot ? m_index->shrink(0) : m_index->getIndexBlocks());
+            blocks.insert(blocks.end(), indexBlocks.begin(), indexBlocks.end());
         }
+        blocks.insert(blocks.end(), m_preallocated.begin(), m_preallocated.end());
+        m_preallocated.clear();
+        releaseBlocks(std::move(blocks));
+    }
 
-        doReset();
+    void
+    File::freeTailBlocks(uint64_t const count)
+    {
+        if (count >= m_blockCount) {
+            return;
+        }
+
+        // the blocks past the new end are found from the list of blocks or
+        // the index rather than by following the chain, and they keep
+        // their headers; a block is started afresh when next handed out
+        std::vector<uint64_t> blocks;
+        if (m_blocks.size() == m_blockCount) {
+            blocks.assign(m_blocks.begin() + count, m_blocks.end());
+        } else {
+            auto const all(m_index->getBlocks());
+            blocks.assign(all.begin() + std::min(uint64_t(all.size()), count), all.end());
+        }
+        blocks.erase(std::remove(blocks.begin(), blocks.end(), detail::HOLE_BLOCK), blocks.end());
+        if (m_index) {
+            auto const unneeded(m_index->shrink(count));
+            blocks.insert(blocks.end(), unneeded.begin(), unneeded.end());
+        }
+        m_blockCount = count;
+        m_blocks.resize(std::min(m_blocks.size(), size_t(count)));
+        releaseBlocks(std::move(blocks));
+    }
+
+    void
+    File::releaseBlocks(std::vector<uint64_t> blocks)
+    {
+        if (m_io->sharedBlocks && !blocks.empty()) {
+            blocks = refCounts(m_io)->release(std::move(blocks));
+        }
+        if (blocks.empty()) {
+            return;
+        }
+        m_io->freeBlocks += blocks.size();
+        m_io->bitmap->setBlocksInUse(blocks, false);
+        m_io->bitmap->sync();
+
+        // and give their space back to the host if asked to
+        if (m_io->punchHoles) {
+            (void)detail::punchHoles(m_io, std::move(blocks));
+        }
     }
 
     void
@@ -623,9 +1211,218 @@ namespace knoxcrypt
         m_optionalSizeCallback = OptionalSizeCallback(callback);
     }
 
+    void
+    File::extendTo(uint64_t const newSize, bool const writeFollows)
+    {
+        // zeros go on from the end of the file
+        if (m_blockCount > 0) {
+            (void)seek(0, std::ios_base::end);
+        } else {
+            m_pos = 0;
+            checkAndUpdateWorkingBlockWithNew();
+        }
+
+        uint64_t const space = blockWriteSpace(m_io);
+        std::vector<char> const zeros(space, 0);
+        auto const writeZeros = [&](uint64_t bytes) {
+            while (bytes > 0) {
+                auto const n = std::min(bytes, space);
+                (void)writeToBlocks(&zeros.front(), n);
+                bytes -= n;
+            }
+        };
+
+        uint64_t gap = newSize - m_fileSize;
+        if (m_index) {
+            // the last block is filled up first and whole blocks after it
+            // become holes. The file's last block is always a real one so
+            // that the file's size can be had from it, unless a write is
+            // about to give it one
+            uint64_t const fill = std::min(gap, uint64_t(getBytesLeftInWorkingBlock()));
+            writeZeros(fill);
+            gap -= fill;
+            uint64_t const holes = gap == 0 ? 0 : (writeFollows ? gap : gap - 1) / space;
+            if (holes > 0) {
+                m_workingBlock->flush();
+                m_index->appendHoles(holes);
+                m_blockCount += holes;
+                m_blockIndex = m_blockCount - 1;
+                m_fileSize += holes * space;
+                m_pos += holes * space;
+                gap -= holes * space;
+
+                // there is no point in keeping a list of blocks most of
+                // which are holes; the index is looked in instead
+                std::vector<uint64_t>().swap(m_blocks);
+                m_workingBlock = std::make_shared<FileBlock>(m_io, m_openDisposition);
+                m_workingBlock->seek(space);
+            }
+        }
+        writeZeros(gap);
+    }
+
+    FileBlock
+    File::fillHole(uint64_t const n) const
+    {
+        return replaceBlock(n, std::vector<char>(blockWriteSpace(m_io), 0));
+    }
+
+    FileBlock
+    File::copyOnWrite(uint64_t const n) const
+    {
+        FileBlock const shared(getBlockWithIndex(n));
+        std::vector<char> data(shared.getDataBytesWritten());
+        if (!data.empty()) {
+            FileBlock source(m_io, shared.getIndex(), OpenDisposition::buildReadOnlyDisposition(), m_stream);
+            (void)source.read(&data.front(), data.size());
+        }
+        auto block(replaceBlock(n, data));
+
+        // the file no longer counts towards the block's sharers
+        (void)refCounts(m_io)->release({shared.getIndex()});
+        return block;
+    }
+
+    FileBlock
+    File::replaceBlock(uint64_t const n, std::vector<char> const &data) const
+    {
+        // the new block takes the old one's place in the index but is not
+        // linked to its neighbours; a file with holes or shared blocks goes
+        // by its index alone
+        auto block(m_io->blockBuilder->buildWritableFileBlock(m_io,
+                                                              OpenDisposition::buildAppendDisposition(),
+                                                              m_stream,
+                                                              false));
+        block.registerBlockWithVolumeBitmap();
+        if (data.empty()) {
+            block.setSize(0);
+        } else {
+            (void)block.write(&data.front(), data.size());
+        }
+        block.flush();
+        block.seek(0);
+        m_index->set(n, block.getIndex());
+        if (m_blocks.size() == m_blockCount) {
+            m_blocks[n] = block.getIndex();
+        }
+        return block;
+    }
+
+    bool
+    File::isShared(FileBlock const &block) const
+    {
+        return m_io->sharedBlocks && !block.isHole() && refCounts(m_io)->isShared(block.getIndex());
+    }
+
+    void
+    File::createIndex() const
+    {
+        m_index = std::make_shared<BlockIndex>(m_io, m_enforceStartBlock);
+        m_enforceStartBlock = false;
+        m_startVolumeBlock = m_index->getRootBlock();
+    }
+
+    bool
+    File::shareBlocksOf(File &other)
+    {
+        if (!m_io->sharedBlocks || other.m_inline ||
+            m_openDisposition.readWrite() == ReadOrWriteOrBoth::ReadOnly) {
+            return false;
+        }
+
+        // the other file's blocks are counted as this file's too before
+        // this file gives up its own, which might be the very same blocks
+        if (other.m_openDisposition.readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+            other.flush();
+        }
+        if (other.m_blockCount == 0) {
+            return false;
+        }
+        auto const blocks(other.getBlocks());
+        std::vector<uint64_t> real(blocks);
+        real.erase(std::remove(real.begin(), real.end(), detail::HOLE_BLOCK), real.end());
+        if (!refCounts(m_io)->share(real)) {
+            return false;
+        }
+
+        if (m_inline) {
+            promoteInlineData();
+        }
+        releasePreallocatedBlocks();
+        freeBlocks(true /* keep index root */);
+        doReset();
+        if (!m_index) {
+            createIndex();
+        }
+
+        m_index->append(blocks);
+        m_blockCount = blocks.size();
+        m_fileSize = other.m_fileSize;
+        m_pos = 0;
+        m_workingBlock = std::make_shared<FileBlock>(getBlockWithIndex(0));
+        if (m_optionalSizeCallback) {
+            (*m_optionalSizeCallback)(m_fileSize, false);
+        }
+        return true;
+    }
+
+    boost::iostreams::stream_offset
+    File::nextData(boost::iostreams::stream_offset const off) const
+    {
+        return nextDataOrHole(off, false);
+    }
+
+    boost::iostreams::stream_offset
+    File::nextHole(boost::iostreams::stream_offset const off) const
+    {
+        return nextDataOrHole(off, true);
+    }
+
+    boost::iostreams::stream_offset
+    File::nextDataOrHole(boost::iostreams::stream_offset const off, bool const hole) const
+    {
+        if (off < 0 || static_cast<uint64_t>(off) >= fileSize()) {
+            return -1;
+        }
+        if (m_index) {
+            uint64_t const space = blockWriteSpace(m_io);
+            auto const blocks(getBlocks());
+            for (uint64_t n = off / space; n < blocks.size(); ++n) {
+                if ((blocks[n] == detail::HOLE_BLOCK) == hole) {
+                    return std::max(off, boost::iostreams::stream_offset(n * space));
+                }
+            }
+        }
+
+        // there is taken to be a hole at the end of the file
+        return hole ? boost::iostreams::stream_offset(fileSize()) : off;
+    }
+
+    std::vector<uint64_t>
+    File::getBlocks() const
+    {
+        if (m_blocks.size() != m_blockCount && m_index) {
+            return m_index->getBlocks();
+        }
+        return m_blocks;
+    }
+
     FileBlock
     File::getBlockWithIndex(uint64_t n) const
     {
+        // straight to the block if it is known where the file's blocks are
+        if (!m_blocks.empty()) {
+            n = std::min(n, uint64_t(m_blocks.size() - 1));
+            return FileBlock(m_io, m_blocks[n], m_openDisposition, m_stream);
+        }
+        if (m_index && m_index->size() > 0) {
+            n = std::min(n, m_index->size() - 1);
+            uint64_t const block = m_index->lookup(n);
+            if (block == detail::HOLE_BLOCK) {
+                return FileBlock(m_io, m_openDisposition);
+            }
+            return FileBlock(m_io, block, m_openDisposition, m_stream);
+        }
 
         {
             FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
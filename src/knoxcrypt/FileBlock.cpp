@@ -30,7 +30,9 @@
 #include "knoxcrypt/FileBlock.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/FileBlockException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace knoxcrypt
@@ -46,14 +48,17 @@ namespace knoxcrypt
         , m_bytesWritten(0)
         , m_initialBytesWritten(0)
         , m_next(index)
-        , m_offset(0)
+        , m_offset(detail::getOffsetOfBlockHeader(io, index))
+        , m_dataOffset(detail::getOffsetOfBlockData(io, index))
         , m_seekPos(0)
         , m_positionBeforeWrite(0)
         , m_openDisposition(openDisposition)
         , m_stream(stream)
+        , m_pending()
+        , m_pendingPos(0)
+        , m_headerDirty(false)
+        , m_hole(false)
     {
-        // set m_offset
-        m_offset = detail::getOffsetOfFileBlock(m_io->blockSize, m_index, m_io->blocks);
     }
 
     FileBlock::FileBlock(SharedCoreIO const &io,
@@ -64,27 +69,44 @@ namespace knoxcrypt
         , m_index(index)
         , m_bytesWritten(0)
         , m_next(0)
-        , m_offset(detail::getOffsetOfFileBlock(m_io->blockSize, index, m_io->blocks))
+        , m_offset(detail::getOffsetOfBlockHeader(io, index))
+        , m_dataOffset(detail::getOffsetOfBlockData(io, index))
         , m_seekPos(0)
         , m_openDisposition(openDisposition)
         , m_stream(stream)
+        , m_pending()
+        , m_pendingPos(0)
+        , m_headerDirty(false)
+        , m_hole(false)
     {
-        // set m_offset
         initImageStream();
-        detail::checkAndSeekG(*m_stream, m_offset);
 
-        // read m_bytesWritten
-        uint8_t sizeDat[4];
-        (void)m_stream->read((char*)sizeDat, 4);
-        m_bytesWritten = detail::convertInt4ArrayToInt32(sizeDat);
+        // read m_bytesWritten followed by m_next
+        uint8_t meta[detail::FILE_BLOCK_META];
+        (void)m_stream->readAt(m_offset, (char*)meta, detail::FILE_BLOCK_META);
+        m_bytesWritten = detail::convertInt4ArrayToInt32(meta);
         m_initialBytesWritten = m_bytesWritten;
+        m_next = detail::convertInt8ArrayToInt64(meta + 4);
+    }
 
-        // read m_next
-        uint8_t nextDat[8];
-        (void)m_stream->read((char*)nextDat, 8);
-        m_next = detail::convertInt8ArrayToInt64(nextDat);
-
-        assert(!m_stream->bad());
+    FileBlock::FileBlock(SharedCoreIO const &io,
+                         OpenDisposition const &openDisposition)
+        : m_io(io)
+        , m_index(detail::HOLE_BLOCK)
+        , m_bytesWritten(detail::getBlockWriteSpace(io))
+        , m_initialBytesWritten(m_bytesWritten)
+        , m_next(detail::HOLE_BLOCK)
+        , m_offset(0)
+        , m_dataOffset(0)
+        , m_seekPos(0)
+        , m_positionBeforeWrite(0)
+        , m_openDisposition(openDisposition)
+        , m_stream()
+        , m_pending()
+        , m_pendingPos(0)
+        , m_headerDirty(false)
+        , m_hole(true)
+    {
     }
 
     void
@@ -133,10 +155,19 @@ namespace knoxcrypt
                 throw FileBlockException(FileBlockError::NotReadable);
             }
 
+            // a hole is all zeros and has nothing to read or decrypt
+            if (m_hole) {
+                std::fill(buf, buf + n, 0);
+                m_seekPos += n;
+                return n;
+            }
+
+            // anything written but not yet flushed must be readable
+            flush();
+
             // open the image stream for reading
             initImageStream();
-            detail::checkAndSeekG(*m_stream, m_offset + detail::FILE_BLOCK_META + m_seekPos);
-            (void)m_stream->read((char*)buf, n);
+            (void)m_stream->readAt(m_dataOffset + m_seekPos, (char*)buf, n);
 
             // update the stream position
             m_seekPos += n;
@@ -153,51 +184,82 @@ namespace knoxcrypt
             throw FileBlockException(FileBlockError::NotWritable);
         }
 
-        // open the image stream for writing
-        this->initImageStream();
+        if (n <= 0) {
+            return 0;
+        }
 
-        if(!detail::checkAndSeekP(*m_stream, m_offset + detail::FILE_BLOCK_META + m_seekPos)) {
-            throw std::runtime_error("seek in write function broke");
+        if (m_hole) {
+            throw std::runtime_error("a hole has to be given a block before it is written to");
         }
-        assert(!m_stream->bad());
-        (void)m_stream->write((char*)buf, n);
 
-        // do updates to file block metadata only if in append mode
-        // note update to next index taken care of in FileEntry
-        if (m_openDisposition.append() == AppendOrOverwrite::Append) {
+        // the data is held on to until the block is flushed; only a run of
+        // contiguous writes can be held on to at once
+        if (!m_pending.empty() &&
+            m_seekPos != m_pendingPos + boost::iostreams::stream_offset(m_pending.size())) {
+            flush();
+        }
+        if (m_pending.empty()) {
+            m_pendingPos = m_seekPos;
+        }
+        m_pending.insert(m_pending.end(), buf, buf + n);
 
+        // the block grows if the write goes past its end; in the middle
+        // of the block the data is written over whatever the mode.
+        // Note update to next index taken care of in File
+        if (m_seekPos + n > m_bytesWritten) {
             m_positionBeforeWrite = m_seekPos;
+            m_bytesWritten = uint32_t(m_seekPos + n);
+            m_headerDirty = true;
+        }
 
-            // check if we need to update m_bytesWritten and m_next. This will be different
-            // probably if the number of bytes read is not consistent with the
-            // reported size stored in m_bytesWritten or if the stream has been moved
-            // to a position past its start as indicated by m_extraOffset
-            m_bytesWritten += uint32_t(n);
+        // update the stream position
+        m_seekPos += n;
 
-            // optimization. This number will be written on flush to record number bytes written
-            //m_bytesToWriteOnFlush = m_bytesWritten;
+        return n;
+    }
 
-            doSetSize(*m_stream, m_bytesWritten);
+    void
+    FileBlock::flush() const
+    {
+        if (m_hole || (m_pending.empty() && !m_headerDirty)) {
+            return;
         }
-        // if in overwrite mode, we still need to check if writing goes above
-        // the initial bytes written and update the size accordingly
-        else if (m_seekPos + n > m_initialBytesWritten) {
 
-            m_bytesWritten += uint32_t(n);
-
-            // optimization. This number will be written on flush to record number bytes written
-            //m_bytesToWriteOnFlush = m_seekPos + n;
+        this->initImageStream();
 
-            // update m_bytesWritten
-            doSetSize(*m_stream, m_seekPos + n);
+        // when the metadata sits right before the data, both go out in
+        // a single write
+        uint64_t const dataStart = m_dataOffset + m_pendingPos;
+        if (m_headerDirty && !m_pending.empty() && dataStart == m_offset + detail::FILE_BLOCK_META) {
+            std::vector<uint8_t> bytes(detail::FILE_BLOCK_META);
+            buildMetaData(&bytes.front());
+            bytes.insert(bytes.end(), m_pending.begin(), m_pending.end());
+            if (m_stream->writeAt(m_offset, (char*)&bytes.front(), bytes.size()) < 0) {
+                throw std::runtime_error("write in flush function broke");
+            }
+        } else {
+            if (m_headerDirty) {
+                uint8_t meta[detail::FILE_BLOCK_META];
+                buildMetaData(meta);
+                if (m_stream->writeAt(m_offset, (char*)meta, detail::FILE_BLOCK_META) < 0) {
+                    throw std::runtime_error("write in flush function broke");
+                }
+            }
+            if (!m_pending.empty() &&
+                m_stream->writeAt(dataStart, (char*)&m_pending.front(), m_pending.size()) < 0) {
+                throw std::runtime_error("write in flush function broke");
+            }
         }
 
-        m_stream->flush();
-
-        // update the stream position
-        m_seekPos += n;
+        std::vector<uint8_t>().swap(m_pending);
+        m_headerDirty = false;
+    }
 
-        return n;
+    void
+    FileBlock::buildMetaData(uint8_t * const meta) const
+    {
+        detail::convertInt32ToInt4Array(m_bytesWritten, meta);
+        detail::convertUInt64ToInt8Array(m_next, meta + 4);
     }
 
     uint32_t
@@ -224,13 +286,17 @@ namespace knoxcrypt
         return m_index;
     }
 
+    bool
+    FileBlock::isHole() const
+    {
+        return m_hole;
+    }
+
     void
     FileBlock::registerBlockWithVolumeBitmap()
     {
-        this->initImageStream();
-        detail::updateVolumeBitmapWithOne(*m_stream, m_index, m_io->blocks);
+        m_io->bitmap->setBlockInUse(m_index);
         m_io->freeBlocks--;
-        m_stream->flush();
     }
 
     void
@@ -238,53 +304,46 @@ namespace knoxcrypt
     {
         this->initImageStream();
         doSetSize(*m_stream, m_seekPos);
-        m_stream->flush();
     }
 
     void
     FileBlock::setSize(std::ios_base::streamoff size) const
     {
-        this->initImageStream();
-        doSetSize(*m_stream, size);
         m_initialBytesWritten = size;
         m_bytesWritten = size;
-        m_stream->flush();
+        m_headerDirty = true;
     }
 
     void
     FileBlock::doSetSize(ContainerImageStream &stream, std::ios_base::streamoff size) const
     {
         // update m_bytesWritten
-        (void)stream.seekp(m_offset);
         uint8_t sizeDat[4];
         detail::convertInt32ToInt4Array(size, sizeDat);
-        (void)stream.write((char*)sizeDat, 4);
+        (void)stream.writeAt(m_offset, (char*)sizeDat, 4);
     }
 
     void
     FileBlock::setNextIndex(uint64_t nextIndex) const
     {
-        this->initImageStream();
-        doSetNextIndex(*m_stream, nextIndex);
         m_next = nextIndex;
-        m_stream->flush();
+        m_headerDirty = true;
     }
 
     void
     FileBlock::doSetNextIndex(ContainerImageStream &stream, uint64_t nextIndex) const
     {
         // update m_next
-        (void)stream.seekp(m_offset + 4);
         uint8_t nextDat[8];
         detail::convertUInt64ToInt8Array(nextIndex, nextDat);
-        (void)stream.write((char*)nextDat, 8);
+        (void)stream.writeAt(m_offset + 4, (char*)nextDat, 8);
     }
 
     void
     FileBlock::unlink()
     {
         this->initImageStream();
-        detail::updateVolumeBitmapWithOne(*m_stream, m_index, m_io->blocks, false);
+        m_io->bitmap->setBlockInUse(m_index, false);
         doSetNextIndex(*m_stream, m_index);
         doSetSize(*m_stream, 0);
         m_next = m_index;
@@ -292,7 +351,8 @@ namespace knoxcrypt
         m_bytesWritten = 0;
         m_seekPos = 0;
         m_positionBeforeWrite = 0;
-        m_stream->flush();
+        std::vector<uint8_t>().swap(m_pending);
+        m_headerDirty = false;
     }
 
     bool
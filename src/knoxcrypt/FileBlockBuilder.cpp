@@ -28,32 +28,49 @@
 
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/KnoxCryptException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 
+#include <algorithm>
+
 namespace knoxcrypt
 {
 
     namespace
     {
 
-        knoxcrypt::BlockDeque populateBlockDeque(SharedCoreIO const &io)
+        // the most free blocks held by a builder at any one time
+        uint64_t const BLOCK_WINDOW = 1024;
+
+        // the most blocks reserved for a growing file at any one time
+        uint64_t const RESERVATION_BLOCKS = 64;
+
+        // how many free runs are looked at when searching for a run of
+        // RESERVATION_BLOCKS; the longest one seen is used if none is
+        // long enough
+        int const RUN_PROBES = 32;
+
+        knoxcrypt::BlockDeque populateBlockDeque(SharedCoreIO const &io, uint64_t const from)
         {
-            // obtain all available blocks and store in a map for quick lookup
-            knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
-            auto allBlocks = detail::getNAvailableBlocks(stream,
-                                                         io->freeBlocks,
-                                                         io->blocks);
-            BlockDeque deque(allBlocks.begin(), allBlocks.end());
+            // obtain the available blocks from where the last window left
+            // off; finding them is cheap so there's no need to hold on to
+            // more than a window's worth
+            auto blocks = io->bitmap->getNAvailableBlocks(BLOCK_WINDOW, from);
+            BlockDeque deque(blocks.begin(), blocks.end());
             return deque;
         }
 
         void checkAndInitStream(SharedCoreIO const & io, SharedImageStream &stream)
         {
+            auto mode = std::ios::in;
+            mode |= std::ios::out;
+            mode |= std::ios::binary;
             if(!stream) {
-                auto mode = std::ios::in;
-                mode |= std::ios::out;
-                mode |= std::ios::binary;
                 stream = std::make_shared<ContainerImageStream>(io, mode);
+            } else if(!stream->is_open()) {
+                stream->open(io, mode);
             }
         }
 
@@ -64,30 +81,32 @@ namespace knoxcrypt
             checkAndInitStream(io, stream);
 
             (void)stream->seekp(0, std::ios::end);
-            auto toReturn = stream->tellp();
+            uint64_t const end = stream->tellp();
             stream->seekp(0);
-            uint64_t const volumeBitMapBytes = io->blocks / uint64_t(8);
-            toReturn -= (detail::beginning() + 8 /* block count */ + volumeBitMapBytes + 8 /* count */);
-            if(toReturn == 0) { // no block written yet
+
+            uint64_t const start = detail::getOffsetOfBlockArea(io);
+            if(end <= start) { // no block written yet
                 return 0;
             }
-
-            return (toReturn / (detail::FILE_BLOCK_META + io->blockSize));
+            return ((end - start) / io->blockSize);
         }
     }
 
 
     FileBlockBuilder::FileBlockBuilder()
-      : m_blocksWritten(0)
+      : m_windowFrom(0)
+      , m_blocksWritten(0)
     {
 
     }
 
-    FileBlockBuilder::FileBlockBuilder(SharedCoreIO const &io)
-        : m_blockDeque(populateBlockDeque(io))
+    FileBlockBuilder::FileBlockBuilder(SharedCoreIO const &)
+        : m_blockDeque()
+        , m_windowFrom(0)
         , m_blocksWritten(0)
     {
-
+        // the window is filled when first needed so that mounting
+        // doesn't pay for it
     }
 
     FileBlock
@@ -103,36 +122,204 @@ namespace knoxcrypt
         if (enforceRootBlock) {
             id = io->rootBlock;
         } else {
+            id = takeUnreservedBlock(io);
+        }
 
-            if(io->useBlockCache) {
-                id = m_blockDeque.front();
-                m_blockDeque.pop_front();
-                // attempt to refill cache with blocks
-                if(m_blockDeque.empty()) {
-                    populateBlockDeque(io).swap(m_blockDeque);
-                }
-            } else {
-                checkAndInitStream(io, stream);
-                id = *(detail::getNextAvailableBlock(*stream, io->blocks));
+        return buildBlockWithIndex(io, id, openDisposition, stream);
+    }
+
+    FileBlock
+    FileBlockBuilder::buildWritableFileBlock(SharedCoreIO const &io,
+                                             OpenDisposition const &openDisposition,
+                                             SharedImageStream &stream,
+                                             SharedBlockReservation const &reservation,
+                                             uint64_t const goal)
+    {
+        // take the next block of the reservation if it is still free
+        while (reservation->next < reservation->end) {
+            auto const id = reservation->next++;
+            if (!io->bitmap->isBlockInUse(id)) {
+                return buildBlockWithIndex(io, id, openDisposition, stream);
             }
         }
 
+        reserveRun(io, reservation, goal);
+        if (reservation->next == reservation->end) {
+            // no run to be had; settle for any block
+            return buildBlockWithIndex(io, takeUnreservedBlock(io), openDisposition, stream);
+        }
+        auto const id = reservation->next++;
+        return buildBlockWithIndex(io, id, openDisposition, stream);
+    }
+
+    FileBlock
+    FileBlockBuilder::buildBlockWithIndex(SharedCoreIO const &io,
+                                          uint64_t const id,
+                                          OpenDisposition const &openDisposition,
+                                          SharedImageStream &stream)
+    {
         // check if block data is actually written into iomage structure (might not have been
-        // if image is sparse).
+        // if image is sparse). Blocks aren't necessarily handed out in order so
+        // any free ones skipped over are written too; those in use have been
+        // written already, possibly by another io
         if(m_blocksWritten == 0) {
             m_blocksWritten = getInitialBlocksWritten(io, stream);
         }
         if(id >= m_blocksWritten) {
             checkAndInitStream(io, stream);
-            detail::writeBlock(io, *stream, id);
+            for (; m_blocksWritten <= id; ++m_blocksWritten) {
+                if(m_blocksWritten == id || !io->bitmap->isBlockInUse(m_blocksWritten)) {
+                    detail::writeBlock(io, *stream, m_blocksWritten);
+                }
+            }
             stream->flush();
             stream->close();
-            ++m_blocksWritten;
+        } else {
+            // freed blocks keep whatever metadata they had when they were
+            // last in use so start the block afresh
+            checkAndInitStream(io, stream);
+            detail::writeBlockHeader(io, *stream, id);
+            stream->flush();
         }
 
         return FileBlock(io, id, id, openDisposition, stream);
     }
 
+    uint64_t
+    FileBlockBuilder::takeUnreservedBlock(SharedCoreIO const &io)
+    {
+        if(io->useBlockCache) {
+            // the window moves on past every block it hands out so coming
+            // back round to the first reserved block skipped means that
+            // every free block is reserved
+            bool skipped = false;
+            uint64_t firstSkipped = 0;
+            while(true) {
+                auto const id = takeCachedBlock(io);
+                if(!isReservedByOther(id, nullptr)) {
+                    return id;
+                }
+                if(skipped && id == firstSkipped) {
+                    throw KnoxCryptException(KnoxCryptError::OutOfSpace);
+                }
+                if(!skipped) {
+                    skipped = true;
+                    firstSkipped = id;
+                }
+            }
+        }
+
+        uint64_t from = 0;
+        while(true) {
+            auto block = io->bitmap->getNextAvailableBlock(from);
+            if(!block || *block < from) {
+                throw KnoxCryptException(KnoxCryptError::OutOfSpace);
+            }
+            if(!isReservedByOther(*block, nullptr)) {
+                return *block;
+            }
+            from = *block + 1;
+        }
+    }
+
+    bool
+    FileBlockBuilder::isReservedByOther(uint64_t const block, BlockReservation const *self)
+    {
+        for (auto const & weak : m_reservations) {
+            auto reservation = weak.lock();
+            if (reservation && reservation.get() != self &&
+                block >= reservation->next && block < reservation->end) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t
+    FileBlockBuilder::getRunLength(SharedCoreIO const &io,
+                                   uint64_t const block,
+                                   BlockReservation const *self,
+                                   uint64_t const limit)
+    {
+        uint64_t length(0);
+        while (length < limit && block + length < io->blocks &&
+               !io->bitmap->isBlockInUse(block + length) &&
+               !isReservedByOther(block + length, self)) {
+            ++length;
+        }
+        return length;
+    }
+
+    void
+    FileBlockBuilder::reserveRun(SharedCoreIO const &io,
+                                 SharedBlockReservation const &reservation,
+                                 uint64_t const goal)
+    {
+        // forget about the reservations of files that have gone away
+        m_reservations.erase(std::remove_if(m_reservations.begin(), m_reservations.end(),
+                                            [](std::weak_ptr<BlockReservation> const &weak) {
+                                                return weak.expired();
+                                            }),
+                             m_reservations.end());
+
+        // a file whose final size is known gets a run big enough for all of it
+        uint64_t const limit = std::max(RESERVATION_BLOCKS, reservation->wanted);
+        reservation->wanted = 0;
+
+        // carrying straight on from the file's previous block is best
+        uint64_t start = goal;
+        uint64_t length = getRunLength(io, goal, reservation.get(), limit);
+
+        // otherwise the longest of the next few free runs after the goal
+        if (length == 0) {
+            uint64_t from = goal;
+            for (int probe = 0; probe < RUN_PROBES && length < limit; ++probe) {
+                auto block = io->bitmap->getNextAvailableBlock(from);
+                if (!block) {
+                    break;
+                }
+                uint64_t const found = getRunLength(io, *block, reservation.get(), limit);
+                if (found > length) {
+                    start = *block;
+                    length = found;
+                }
+                from = *block + std::max(found, uint64_t(1));
+            }
+        }
+
+        reservation->next = start;
+        reservation->end = start + length;
+        if (std::find_if(m_reservations.begin(), m_reservations.end(),
+                         [&reservation](std::weak_ptr<BlockReservation> const &weak) {
+                             return weak.lock() == reservation;
+                         }) == m_reservations.end()) {
+            m_reservations.push_back(reservation);
+        }
+    }
+
+    uint64_t
+    FileBlockBuilder::takeCachedBlock(SharedCoreIO const &io)
+    {
+        while(true) {
+            // attempt to refill cache with blocks
+            if(m_blockDeque.empty()) {
+                populateBlockDeque(io, m_windowFrom).swap(m_blockDeque);
+                if(m_blockDeque.empty()) {
+                    throw KnoxCryptException(KnoxCryptError::OutOfSpace);
+                }
+            }
+            auto const id = m_blockDeque.front();
+            m_blockDeque.pop_front();
+            m_windowFrom = id + 1;
+
+            // skip any block that has been allocated since the window was
+            // filled, e.g., through another io onto the same container
+            if(!io->bitmap->isBlockInUse(id)) {
+                return id;
+            }
+        }
+    }
+
     FileBlock
     FileBlockBuilder::buildFileBlock(SharedCoreIO const &io,
                                      uint64_t const index,
@@ -144,4 +331,59 @@ namespace knoxcrypt
         }
         return FileBlock(io, index, openDisposition, stream);
     }
+
+    std::vector<uint64_t>
+    FileBlockBuilder::allocateBlocks(SharedCoreIO const &io,
+                                     uint64_t const count,
+                                     uint64_t const goal)
+    {
+        std::vector<uint64_t> blocks;
+        blocks.reserve(count);
+        uint64_t const start = goal < io->blocks ? goal : 0;
+        uint64_t from = start;
+        bool wrapped = false;
+        while (blocks.size() < count) {
+            auto const block = io->bitmap->getNextAvailableBlock(from);
+            if (!block) {
+                break;
+            }
+            // the search wraps around to the start of the volume; stop once
+            // it gets back to where it started
+            if (*block < from) {
+                if (wrapped) {
+                    break;
+                }
+                wrapped = true;
+            }
+            if (wrapped && *block >= start) {
+                break;
+            }
+            if (!isReservedByOther(*block, nullptr)) {
+                blocks.push_back(*block);
+            }
+            from = *block + 1;
+            if (from == io->blocks) {
+                if (wrapped) {
+                    break;
+                }
+                from = 0;
+                wrapped = true;
+            }
+        }
+        if (blocks.size() < count) {
+            throw KnoxCryptException(KnoxCryptError::OutOfSpace);
+        }
+        io->bitmap->setBlocksInUse(blocks);
+        io->freeBlocks -= count;
+        return blocks;
+    }
+
+    FileBlock
+    FileBlockBuilder::buildAllocatedFileBlock(SharedCoreIO const &io,
+                                              uint64_t const id,
+                                              OpenDisposition const &openDisposition,
+                                              SharedImageStream &stream)
+    {
+        return buildBlockWithIndex(io, id, openDisposition, stream);
+    }
 }
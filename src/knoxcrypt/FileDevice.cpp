@@ -49,9 +49,8 @@ namespace knoxcrypt
     std::streamsize
     FileDevice::write(const char* s, std::streamsize n)
     {
-        std::streamsize wrote = m_entry->write(s, n);
-        m_entry->flush();
-        return wrote;
+        // blocks are allocated when the file is flushed; see close
+        return m_entry->write(s, n);
     }
 
     std::streampos
@@ -71,4 +70,12 @@ namespace knoxcrypt
     {
         return m_entry->tell();
     }
+
+    void
+    FileDevice::close()
+    {
+        if (m_entry->getOpenDisposition().readWrite() != ReadOrWriteOrBoth::ReadOnly) {
+            m_entry->flush();
+        }
+    }
 }
@@ -0,0 +1,176 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/BlockCache.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "knoxcrypt/detail/DetailHolePunch.hpp"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+#define KNOXCRYPT_PUNCH_HOLES 1
+#endif
+
+namespace knoxcrypt { namespace detail
+{
+
+    namespace
+    {
+        /// an open descriptor on the container image; closed when done
+        class ImageDescriptor
+        {
+          public:
+            explicit ImageDescriptor(std::string const &path)
+                : m_fd(::open(path.c_str(), O_WRONLY))
+            {
+            }
+
+            ~ImageDescriptor()
+            {
+                if (m_fd >= 0) {
+                    (void)::close(m_fd);
+                }
+            }
+
+            ImageDescriptor(ImageDescriptor const &) = delete;
+            ImageDescriptor &operator=(ImageDescriptor const &) = delete;
+
+            int get() const
+            {
+                return m_fd;
+            }
+
+          private:
+            int m_fd;
+        };
+
+        /// releases the blocks [first, last); true if it worked
+        bool punchRun(ImageDescriptor const &image,
+                      SharedCoreIO const &io,
+                      uint64_t const first,
+                      uint64_t const last)
+        {
+#ifdef KNOXCRYPT_PUNCH_HOLES
+            // an aligned container's metadata table is left alone
+            off_t const offset = io->alignedBlocks ? getOffsetOfBlockData(io, first)
+                                                   : getOffsetOfBlockHeader(io, first);
+            off_t const length = off_t(last - first) * io->blockSize;
+            if (::fallocate(image.get(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) != 0) {
+                return false;
+            }
+
+            // the cache can't be written through here
+            if (io->blockCache) {
+                io->blockCache->invalidate(offset, length);
+            }
+            return true;
+#else
+            (void)image;
+            (void)io;
+            (void)first;
+            (void)last;
+            return false;
+#endif
+        }
+    }
+
+    bool
+    isHolePunchingSupported()
+    {
+#ifdef KNOXCRYPT_PUNCH_HOLES
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    uint64_t
+    punchHoles(SharedCoreIO const &io, std::vector<uint64_t> blocks)
+    {
+        if (!isHolePunchingSupported() || blocks.empty()) {
+            return 0;
+        }
+        ImageDescriptor image(io->path);
+        if (image.get() < 0) {
+            return 0;
+        }
+
+        std::sort(blocks.begin(), blocks.end());
+        uint64_t punched = 0;
+        auto it = blocks.begin();
+        while (it != blocks.end()) {
+            auto runEnd = std::next(it);
+            while (runEnd != blocks.end() && *runEnd == *std::prev(runEnd) + 1) {
+                ++runEnd;
+            }
+            uint64_t const first = *it;
+            uint64_t const last = *std::prev(runEnd) + 1;
+            if (punchRun(image, io, first, last)) {
+                punched += last - first;
+            }
+            it = runEnd;
+        }
+        return punched;
+    }
+
+    uint64_t
+    punchFreeBlocks(SharedCoreIO const &io)
+    {
+        if (!isHolePunchingSupported()) {
+            return 0;
+        }
+        ImageDescriptor image(io->path);
+        if (image.get() < 0) {
+            return 0;
+        }
+
+        uint64_t punched = 0;
+        uint64_t block = 0;
+        while (block < io->blocks) {
+            auto const first = io->bitmap->getNextAvailableBlock(block);
+            if (!first || *first < block) {
+                break; // no free blocks left past this point
+            }
+            uint64_t last = *first + 1;
+            while (last < io->blocks && !io->bitmap->isBlockInUse(last)) {
+                ++last;
+            }
+            if (punchRun(image, io, *first, last)) {
+                punched += last - *first;
+            }
+            block = last;
+        }
+        return punched;
+    }
+
+}
+}
@@ -0,0 +1,663 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/ImageFile.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        // the images currently open, keyed by image path, whether they're
+        // mapped, whether they batch with io_uring and their cipher threads
+        using OpenImages = std::map<std::tuple<std::string, bool, bool, unsigned>, std::weak_ptr<ImageFile>>;
+        OpenImages g_openImages;
+        std::mutex g_openMutex;
+
+        // the mapping reaches this far past the end of the image so that
+        // it needn't be remapped every time the image grows a little
+        uint64_t const MAPPING_SLACK = 67108864;
+
+        // how many reads or writes the ring holds, and how many writes are
+        // queued before they're handed to the kernel
+        unsigned const RING_ENTRIES = 64;
+        unsigned const WRITES_PER_SUBMIT = 16;
+
+        // transfers this large are split between the cipher threads, and a
+        // batch's writes are held on to until this many bytes have built up
+        std::streamsize const PARALLEL_BYTES = 2 * CipherPool::CHUNK_BYTES;
+        std::streamsize const HELD_BYTES = 1048576;
+
+        std::streamsize readFully(int const fd, char * const buf, std::streamsize const n, uint64_t const offset)
+        {
+            std::streamsize done = 0;
+            while (done < n) {
+                auto const got = ::pread(fd, buf + done, size_t(n - done), off_t(offset + done));
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got < 0) {
+                    return -1;
+                }
+                if (got == 0) {
+                    break; // the end of the image
+                }
+                done += got;
+            }
+            return done;
+        }
+
+        std::streamsize writeFully(int const fd, char const * const buf, std::streamsize const n, uint64_t const offset)
+        {
+            std::streamsize done = 0;
+            while (done < n) {
+                auto const put = ::pwrite(fd, buf + done, size_t(n - done), off_t(offset + done));
+                if (put < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (put < 0) {
+                    return -1;
+                }
+                done += put;
+            }
+            return done;
+        }
+    }
+
+    ImageFile::ImageFile(SharedCoreIO const &io)
+        : m_fd(::open(io->path.c_str(), O_RDWR))
+        , m_encProps(io->encProps)
+        , m_pool(io->cipherThreads > 1 ? std::make_unique<CipherPool>(io->encProps, io->cipherThreads) : nullptr)
+        , m_writable(true)
+        , m_mapImage(io->mapImage)
+        , m_map(nullptr)
+        , m_mapped(0)
+        , m_size(0)
+        , m_mapMutex()
+        , m_mapDirty(false)
+        , m_ringAllowed(io->ioUring)
+        , m_ringTried(false)
+        , m_ring()
+        , m_ringMutex()
+        , m_writes()
+        , m_writesPending(false)
+        , m_nextTag(0)
+        , m_unsubmitted(0)
+        , m_batchDepth(0)
+        , m_batchFailed(false)
+        , m_held()
+        , m_heldBytes(0)
+        , m_heldEnd(0)
+        , m_cipherMutex()
+        , m_idleCiphers(1, cryptostreampp::buildByteTransformer(io->encProps))
+    {
+        if (m_fd < 0) {
+            m_fd = ::open(io->path.c_str(), O_RDONLY);
+            m_writable = false;
+        }
+        if (m_mapImage && m_fd >= 0) {
+            growMapping();
+        }
+    }
+
+    ImageFile::~ImageFile()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            drainWrites();
+        }
+        unmap();
+        if (m_fd >= 0) {
+            (void)::close(m_fd);
+        }
+    }
+
+    SharedImageFile
+    ImageFile::open(SharedCoreIO const &io)
+    {
+        std::lock_guard<std::mutex> lock(g_openMutex);
+        auto & open = g_openImages[std::make_tuple(io->path, io->mapImage, io->ioUring, io->cipherThreads)];
+        if (auto image = open.lock()) {
+
+            // an image removed and built again at the same path is a
+            // different file
+            struct stat opened;
+            struct stat current;
+            if (image->isOpen() &&
+                ::fstat(image->m_fd, &opened) == 0 &&
+                ::stat(io->path.c_str(), &current) == 0 &&
+                opened.st_dev == current.st_dev && opened.st_ino == current.st_ino) {
+                return image;
+            }
+        }
+        auto image(std::make_shared<ImageFile>(io));
+        open = image;
+        return image;
+    }
+
+    bool
+    ImageFile::isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    bool
+    ImageFile::isMapped() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+        return m_map != nullptr;
+    }
+
+    bool
+    ImageFile::enciphersInParallel(std::streamsize const n) const
+    {
+        return m_pool && n >= PARALLEL_BYTES;
+    }
+
+    cryptostreampp::SharedByteTransformer
+    ImageFile::takeCipher() const
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_cipherMutex);
+            if (!m_idleCiphers.empty()) {
+                auto const cipher(m_idleCiphers.back());
+                m_idleCiphers.pop_back();
+                return cipher;
+            }
+        }
+        return cryptostreampp::buildByteTransformer(m_encProps);
+    }
+
+    void
+    ImageFile::giveBackCipher(cryptostreampp::SharedByteTransformer const &cipher) const
+    {
+        std::lock_guard<std::mutex> lock(m_cipherMutex);
+        m_idleCiphers.push_back(cipher);
+    }
+
+    void
+    ImageFile::encipher(std::vector<CipherPool::Piece> const &pieces) const
+    {
+        std::streamsize total = 0;
+        for (auto const & piece : pieces) {
+            total += piece.n;
+        }
+        if (enciphersInParallel(total)) {
+            m_pool->encrypt(pieces);
+            return;
+        }
+        auto const cipher(takeCipher());
+        for (auto const & piece : pieces) {
+            cipher->encrypt(piece.in, piece.out, std::ios_base::streamoff(piece.offset), piece.n);
+        }
+        giveBackCipher(cipher);
+    }
+
+    void
+    ImageFile::decipher(std::vector<CipherPool::Piece> const &pieces) const
+    {
+        std::streamsize total = 0;
+        for (auto const & piece : pieces) {
+            total += piece.n;
+        }
+        if (enciphersInParallel(total)) {
+            m_pool->decrypt(pieces);
+            return;
+        }
+        auto const cipher(takeCipher());
+        for (auto const & piece : pieces) {
+            cipher->decrypt(piece.in, piece.out, std::ios_base::streamoff(piece.offset), piece.n);
+        }
+        giveBackCipher(cipher);
+    }
+
+    void
+    ImageFile::growMapping() const
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(m_mapMutex);
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0 || st.st_size <= 0) {
+            return;
+        }
+        uint64_t const size = uint64_t(st.st_size);
+        if (m_map && size <= m_mapped) {
+            // pages of the mapping past what was the end of the image can
+            // be used as soon as the image reaches them
+            m_size = size;
+            return;
+        }
+        unmap();
+        uint64_t const length = size + MAPPING_SLACK;
+        int const protection = m_writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void * const map = ::mmap(nullptr, size_t(length), protection, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED) {
+            // too big for the address space, say; pread and pwrite it is
+            return;
+        }
+        m_map = static_cast<char*>(map);
+        m_mapped = length;
+        m_size = size;
+    }
+
+    void
+    ImageFile::unmap() const
+    {
+        if (m_map) {
+            (void)::munmap(m_map, size_t(m_mapped));
+            m_map = nullptr;
+            m_mapped = 0;
+            m_size = 0;
+        }
+    }
+
+    std::streamsize
+    ImageFile::readAt(uint64_t const offset, char * const buf, std::streamsize const n) const
+    {
+        if (n <= 0) {
+            return 0;
+        }
+        if (m_writesPending) {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            drainWrites(offset);
+        }
+        if (m_mapImage) {
+            // the image may have grown since it was last looked at
+            for (bool grown = false; ; grown = true) {
+                {
+                    std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+                    if (m_map && offset + uint64_t(n) <= m_size) {
+                        decipher({{m_map + offset, buf, offset, long(n)}});
+                        return n;
+                    }
+                }
+                if (grown) {
+                    break;
+                }
+                growMapping();
+            }
+        }
+        auto const done = readFully(m_fd, buf, n, offset);
+        if (done < 0) {
+            return -1;
+        }
+        decipher({{buf, buf, offset, long(done)}});
+        return done;
+    }
+
+    std::streamsize
+    ImageFile::writeAt(uint64_t const offset, char const * const buf, std::streamsize const n) const
+    {
+        if (n <= 0) {
+            return 0;
+        }
+        if (m_pool) {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            if (m_batchDepth > 0) {
+                m_held.emplace_back();
+                m_held.back().offset = offset;
+                m_held.back().data.assign(buf, buf + n);
+                m_heldBytes += n;
+                m_heldEnd = std::max(m_heldEnd, offset + uint64_t(n));
+                m_writesPending = true;
+                if (m_heldBytes >= HELD_BYTES) {
+                    releaseHeld();
+                }
+                return n;
+            }
+        }
+        if (m_mapImage && m_writable) {
+            std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+            if (m_map && offset + uint64_t(n) <= m_size) {
+                // the cipher only reads from its input, and enciphering
+                // straight into the mapping means plain text never
+                // reaches the image's pages
+                encipher({{const_cast<char*>(buf), m_map + offset, offset, long(n)}});
+                m_mapDirty = true;
+                return n;
+            }
+        }
+        std::vector<char> enciphered(buf, buf + n);
+        encipher({{&enciphered.front(), &enciphered.front(), offset, long(n)}});
+        {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            if (m_batchDepth > 0 && !m_mapImage && queueWrite(offset, std::move(enciphered))) {
+                return n;
+            }
+        }
+        return putEnciphered(offset, &enciphered.front(), n);
+    }
+
+    std::streamsize
+    ImageFile::putEnciphered(uint64_t const offset, char const * const data, std::streamsize const n) const
+    {
+        if (m_mapImage && m_writable) {
+            std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+            if (m_map && offset + uint64_t(n) <= m_size) {
+                std::copy(data, data + n, m_map + offset);
+                m_mapDirty = true;
+                return n;
+            }
+        }
+        auto const done = writeFully(m_fd, data, n, offset);
+        if (done < 0) {
+            return -1;
+        }
+
+        // the mapping takes in what the image has grown by
+        if (m_mapImage) {
+            bool grown;
+            {
+                std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+                grown = m_map && offset + uint64_t(n) > m_size;
+            }
+            if (grown) {
+                growMapping();
+            }
+        }
+        return done;
+    }
+
+    IoRing *
+    ImageFile::ring() const
+    {
+        if (m_ringAllowed && !m_ringTried) {
+            m_ringTried = true;
+            m_ring = IoRing::create(RING_ENTRIES);
+        }
+        return m_ring.get();
+    }
+
+    bool
+    ImageFile::queueWrite(uint64_t const offset, std::vector<char> &&data) const
+    {
+        IoRing * const ring = this->ring();
+        if (!ring) {
+            return false;
+        }
+
+        // the kernel keeps no order between the writes it's given, so one
+        // over another still outstanding waits for those before it
+        uint64_t const end = offset + data.size();
+        bool overlapped = false;
+        for (auto const & write : m_writes) {
+            auto const & pending = write.second;
+            if (offset < pending.offset + pending.data.size() && pending.offset < end) {
+                overlapped = true;
+                break;
+            }
+        }
+        while (m_ring && m_writes.size() >= m_ring->capacity()) {
+            reapWrites(1);
+        }
+        if (!m_ring) {
+            return false;
+        }
+
+        uint64_t const tag = m_nextTag++;
+        auto & pending = m_writes[tag];
+        pending.offset = offset;
+        pending.data = std::move(data);
+        pending.iov.iov_base = &pending.data.front();
+        pending.iov.iov_len = pending.data.size();
+        if (!m_ring->push(true, m_fd, &pending.iov, offset, tag, overlapped)) {
+            data = std::move(pending.data);
+            m_writes.erase(tag);
+            return false;
+        }
+        m_writesPending = true;
+        if (++m_unsubmitted >= WRITES_PER_SUBMIT) {
+            m_unsubmitted = 0;
+            if (!m_ring->submit(0)) {
+                abandonRing();
+            }
+        }
+        return true;
+    }
+
+    void
+    ImageFile::reapWrites(unsigned const waitFor) const
+    {
+        m_unsubmitted = 0;
+        if (!m_ring->submit(waitFor)) {
+            abandonRing();
+            return;
+        }
+        uint64_t tag;
+        int result;
+        while (m_ring->pop(tag, result)) {
+            auto const it = m_writes.find(tag);
+            if (it == m_writes.end()) {
+                continue;
+            }
+
+            // a later write over this one may already have been made, so a
+            // short or failed write can't just be made again
+            if (result != std::streamsize(it->second.data.size())) {
+                m_batchFailed = true;
+            }
+            m_writes.erase(it);
+        }
+        m_writesPending = !m_writes.empty() || !m_held.empty();
+    }
+
+    void
+    ImageFile::drainWrites(uint64_t const from) const
+    {
+        if (m_heldEnd > from) {
+            releaseHeld();
+        }
+        while (!m_writes.empty()) {
+            reapWrites(1);
+        }
+    }
+
+    void
+    ImageFile::releaseHeld() const
+    {
+        if (m_held.empty()) {
+            return;
+        }
+        std::vector<PendingWrite> held;
+        held.swap(m_held);
+        m_heldBytes = 0;
+        m_heldEnd = 0;
+
+        std::vector<CipherPool::Piece> pieces;
+        for (auto & write : held) {
+            pieces.push_back(CipherPool::Piece{&write.data.front(), &write.data.front(),
+                                               write.offset, long(write.data.size())});
+        }
+        encipher(pieces);
+
+        // written in the order they were made, later writes over earlier
+        for (auto & write : held) {
+            std::streamsize const n = write.data.size();
+            if (!m_mapImage && queueWrite(write.offset, std::move(write.data))) {
+                continue;
+            }
+            if (putEnciphered(write.offset, &write.data.front(), n) != n) {
+                m_batchFailed = true;
+            }
+        }
+        m_writesPending = !m_writes.empty();
+    }
+
+    void
+    ImageFile::abandonRing() const
+    {
+        // closing the ring waits for whatever it's still doing, after which
+        // everything outstanding is written again to be sure of it
+        m_ring.reset();
+        for (auto const & write : m_writes) {
+            auto const & pending = write.second;
+            if (writeFully(m_fd, &pending.data.front(), pending.data.size(), pending.offset) < 0) {
+                m_batchFailed = true;
+            }
+        }
+        m_writes.clear();
+        m_writesPending = !m_held.empty();
+        m_unsubmitted = 0;
+    }
+
+    void
+    ImageFile::beginBatch() const
+    {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        ++m_batchDepth;
+    }
+
+    bool
+    ImageFile::endBatch() const
+    {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        if (--m_batchDepth > 0) {
+            return true;
+        }
+        drainWrites();
+        bool const written = !m_batchFailed;
+        m_batchFailed = false;
+        return written;
+    }
+
+    bool
+    ImageFile::readBatch(std::vector<Transfer> const &transfers) const
+    {
+        std::unique_lock<std::mutex> lock(m_ringMutex);
+        IoRing * const ring = m_mapImage ? nullptr : this->ring();
+        drainWrites();
+        if (!ring) {
+            lock.unlock();
+            std::streamsize total = 0;
+            for (auto const & transfer : transfers) {
+                total += std::max(transfer.n, std::streamsize(0));
+            }
+            bool all = true;
+            if (!enciphersInParallel(total)) {
+                for (auto const & transfer : transfers) {
+                    all = readAt(transfer.offset, transfer.buf, transfer.n) == transfer.n && all;
+                }
+                return all;
+            }
+
+            // everything is read in, the mapping's pages being the ones pread
+            // sees, and then deciphered together
+            std::vector<CipherPool::Piece> pieces;
+            for (auto const & transfer : transfers) {
+                auto const got = readFully(m_fd, transfer.buf, transfer.n, transfer.offset);
+                all = got == transfer.n && all;
+                if (got > 0) {
+                    pieces.push_back(CipherPool::Piece{transfer.buf, transfer.buf, transfer.offset, long(got)});
+                }
+            }
+            decipher(pieces);
+            return all;
+        }
+
+        bool all = true;
+        std::vector<struct iovec> iovs(transfers.size());
+        std::vector<bool> done(transfers.size(), false);
+        size_t next = 0;
+        size_t outstanding = 0;
+        while (next < transfers.size() || outstanding > 0) {
+
+            // as many reads as the ring takes go out together
+            while (m_ring && next < transfers.size() && outstanding < m_ring->capacity()) {
+                auto const & transfer = transfers[next];
+                iovs[next].iov_base = transfer.buf;
+                iovs[next].iov_len = size_t(std::max(transfer.n, std::streamsize(0)));
+                if (!m_ring->push(false, m_fd, &iovs[next], transfer.offset, next)) {
+                    break;
+                }
+                ++next;
+                ++outstanding;
+            }
+            if (!m_ring || !m_ring->submit(1)) {
+                abandonRing();
+                break;
+            }
+
+            // the reads are deciphered as they come in, the others carrying on
+            std::vector<CipherPool::Piece> ready;
+            uint64_t tag;
+            int result;
+            while (m_ring->pop(tag, result)) {
+                --outstanding;
+                auto const & transfer = transfers[tag];
+                std::streamsize got = result > 0 ? result : 0;
+                if (got < transfer.n) {
+                    auto const more = readFully(m_fd, transfer.buf + got, transfer.n - got, transfer.offset + got);
+                    got += more > 0 ? more : 0;
+                }
+                all = got == transfer.n && all;
+                ready.push_back(CipherPool::Piece{transfer.buf, transfer.buf, transfer.offset, long(got)});
+                done[tag] = true;
+            }
+            decipher(ready);
+        }
+
+        // whatever the ring didn't get to is read directly
+        std::vector<CipherPool::Piece> rest;
+        for (size_t t = 0; t < transfers.size(); ++t) {
+            if (!done[t]) {
+                auto const & transfer = transfers[t];
+                auto const got = readFully(m_fd, transfer.buf, transfer.n, transfer.offset);
+                all = got == transfer.n && all;
+                if (got > 0) {
+                    rest.push_back(CipherPool::Piece{transfer.buf, transfer.buf, transfer.offset, long(got)});
+                }
+            }
+        }
+        decipher(rest);
+        return all;
+    }
+
+    void
+    ImageFile::sync() const
+    {
+        if (m_mapDirty.exchange(false)) {
+            std::shared_lock<std::shared_timed_mutex> lock(m_mapMutex);
+            if (m_map) {
+                (void)::msync(m_map, size_t(m_size), MS_ASYNC);
+            }
+        }
+    }
+
+}
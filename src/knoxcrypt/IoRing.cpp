@@ -0,0 +1,236 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/IoRing.hpp"
+
+#include <cstring>
+
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_OFF_SQES)
+#define KNOXCRYPT_IO_URING 1
+#endif
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+#ifdef KNOXCRYPT_IO_URING
+        template <typename T>
+        T *at(void * const base, unsigned const offset)
+        {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+#endif
+    }
+
+    IoRing::IoRing()
+        : m_fd(-1)
+        , m_entries(0)
+        , m_unsubmitted(0)
+        , m_sqRing(nullptr)
+        , m_sqRingSize(0)
+        , m_cqRing(nullptr)
+        , m_cqRingSize(0)
+        , m_sqes(nullptr)
+        , m_sqesSize(0)
+        , m_sqHead(nullptr)
+        , m_sqTail(nullptr)
+        , m_sqMask(nullptr)
+        , m_sqArray(nullptr)
+        , m_cqHead(nullptr)
+        , m_cqTail(nullptr)
+        , m_cqMask(nullptr)
+        , m_cqes(nullptr)
+    {
+    }
+
+    IoRing::~IoRing()
+    {
+#ifdef KNOXCRYPT_IO_URING
+        if (m_sqes) {
+            (void)::munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing) {
+            (void)::munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing) {
+            (void)::munmap(m_sqRing, m_sqRingSize);
+        }
+#endif
+        // closing the ring waits for anything still outstanding
+        if (m_fd >= 0) {
+            (void)::close(m_fd);
+        }
+    }
+
+    UniqueIoRing
+    IoRing::create(unsigned const entries)
+    {
+#ifdef KNOXCRYPT_IO_URING
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int const fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            // an old kernel, or a sandbox that forbids it
+            return UniqueIoRing();
+        }
+
+        UniqueIoRing ring(new IoRing);
+        ring->m_fd = fd;
+        ring->m_entries = params.sq_entries;
+        ring->m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        ring->m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+        void * const sq = ::mmap(nullptr, ring->m_sqRingSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) {
+            return UniqueIoRing();
+        }
+        ring->m_sqRing = sq;
+        void * const cq = ::mmap(nullptr, ring->m_cqRingSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            return UniqueIoRing();
+        }
+        ring->m_cqRing = cq;
+        void * const sqes = ::mmap(nullptr, ring->m_sqesSize, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return UniqueIoRing();
+        }
+        ring->m_sqes = sqes;
+
+        ring->m_sqHead = at<unsigned>(sq, params.sq_off.head);
+        ring->m_sqTail = at<unsigned>(sq, params.sq_off.tail);
+        ring->m_sqMask = at<unsigned>(sq, params.sq_off.ring_mask);
+        ring->m_sqArray = at<unsigned>(sq, params.sq_off.array);
+        ring->m_cqHead = at<unsigned>(cq, params.cq_off.head);
+        ring->m_cqTail = at<unsigned>(cq, params.cq_off.tail);
+        ring->m_cqMask = at<unsigned>(cq, params.cq_off.ring_mask);
+        ring->m_cqes = at<void>(cq, params.cq_off.cqes);
+        return ring;
+#else
+        (void)entries;
+        return UniqueIoRing();
+#endif
+    }
+
+    unsigned
+    IoRing::capacity() const
+    {
+        return m_entries;
+    }
+
+    bool
+    IoRing::push(bool const write, int const fd, struct iovec const * const iov,
+                 uint64_t const offset, uint64_t const tag, bool const ordered)
+    {
+#ifdef KNOXCRYPT_IO_URING
+        unsigned const tail = *m_sqTail;
+        if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) {
+            return false;
+        }
+        unsigned const index = tail & *m_sqMask;
+        auto * const sqe = static_cast<struct io_uring_sqe*>(m_sqes) + index;
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = uint64_t(reinterpret_cast<uintptr_t>(iov));
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = tag;
+        sqe->flags = ordered ? IOSQE_IO_DRAIN : 0;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++m_unsubmitted;
+        return true;
+#else
+        (void)write;
+        (void)fd;
+        (void)iov;
+        (void)offset;
+        (void)tag;
+        (void)ordered;
+        return false;
+#endif
+    }
+
+    bool
+    IoRing::submit(unsigned const waitFor)
+    {
+#ifdef KNOXCRYPT_IO_URING
+        while (true) {
+            unsigned const flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+            int const taken = int(::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, waitFor, flags, nullptr, 0));
+            if (taken >= 0) {
+                m_unsubmitted -= unsigned(taken);
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+#else
+        (void)waitFor;
+        return false;
+#endif
+    }
+
+    bool
+    IoRing::pop(uint64_t &tag, int &result)
+    {
+#ifdef KNOXCRYPT_IO_URING
+        unsigned const head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        auto const * const cqe = static_cast<struct io_uring_cqe*>(m_cqes) + (head & *m_cqMask);
+        tag = cqe->user_data;
+        result = cqe->res;
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+#else
+        (void)tag;
+        (void)result;
+        return false;
+#endif
+    }
+
+}
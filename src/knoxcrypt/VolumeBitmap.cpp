@@ -0,0 +1,406 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailBitmapKernels.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        // dirty ranges closer together than this many bytes are written out
+        // as a single range; rewriting a few unchanged bytes is cheaper than
+        // an extra seek and encrypted write
+        uint64_t const DIRTY_GAP = 64;
+
+        // the top bit of the volume state is set when the container has
+        // been cleanly unmounted; the remaining bits hold the free block count
+        uint64_t const CLEAN_UNMOUNT = uint64_t(1) << 63;
+
+        uint64_t bitmapOffset()
+        {
+            return detail::beginning() + 8 /* block count */;
+        }
+
+        uint64_t volumeStateOffset(uint64_t const blocks)
+        {
+            return bitmapOffset() + (blocks / uint64_t(8));
+        }
+
+        // the bitmaps currently resident, keyed by image path
+        using ResidentBitmaps = std::map<std::string, std::weak_ptr<VolumeBitmap>>;
+        ResidentBitmaps g_residentBitmaps;
+        std::mutex g_residentMutex;
+    }
+
+    SharedVolumeBitmap
+    VolumeBitmap::load(SharedCoreIO const &io, bool const reread)
+    {
+        std::lock_guard<std::mutex> lock(g_residentMutex);
+        auto & resident = g_residentBitmaps[io->path];
+        if (!reread) {
+            if (auto bitmap = resident.lock()) {
+                return bitmap;
+            }
+        }
+        auto bitmap(std::make_shared<VolumeBitmap>(io));
+        resident = bitmap;
+        return bitmap;
+    }
+
+    VolumeBitmap::VolumeBitmap(SharedCoreIO const &io)
+        : m_stream(std::make_shared<ContainerImageStream>(io, std::ios::in | std::ios::out | std::ios::binary))
+        , m_blocks(io->blocks)
+        , m_byteCount(io->blocks / uint64_t(8))
+        , m_resident(false)
+        , m_words()
+        , m_summary()
+        , m_dirty()
+    {
+    }
+
+    VolumeBitmap::~VolumeBitmap()
+    {
+        sync();
+    }
+
+    bool
+    VolumeBitmap::isBlockInUse(uint64_t const block) const
+    {
+        makeResident();
+        return (m_words[block / 64] >> (block % 64)) & 1;
+    }
+
+    void
+    VolumeBitmap::setBlockInUse(uint64_t const block, bool const set)
+    {
+        makeResident();
+        uint64_t const bit = uint64_t(1) << (block % 64);
+        auto & word = m_words[block / 64];
+        word = set ? (word | bit) : (word & ~bit);
+        markDirty(block / 8, (block / 8) + 1);
+        updateSummary(block / 64);
+    }
+
+    void
+    VolumeBitmap::setBlockRangeInUse(uint64_t const first, uint64_t const last, bool const set)
+    {
+        if (first >= last) {
+            return;
+        }
+        makeResident();
+        detail::setBitRange(&m_words.front(), first, last, set);
+        markDirty(first / 8, ((last - 1) / 8) + 1);
+        for (uint64_t w = first / 64; w <= (last - 1) / 64; ++w) {
+            updateSummary(w);
+        }
+    }
+
+    void
+    VolumeBitmap::setBlocksInUse(std::vector<uint64_t> blocks, bool const set)
+    {
+        if (blocks.empty()) {
+            return;
+        }
+        makeResident();
+        std::sort(blocks.begin(), blocks.end());
+
+        // bits are applied a word at a time and each run of nearby bytes is
+        // marked dirty once
+        uint64_t runBegin = blocks.front() / 8;
+        uint64_t runEnd = runBegin + 1;
+        auto it = blocks.begin();
+        while (it != blocks.end()) {
+            uint64_t const w = *it / 64;
+            uint64_t mask = 0;
+            for (; it != blocks.end() && *it / 64 == w; ++it) {
+                uint64_t const byte = *it / 8;
+                if (byte > runEnd + DIRTY_GAP) {
+                    markDirty(runBegin, runEnd);
+                    runBegin = byte;
+                }
+                runEnd = byte + 1;
+                mask |= uint64_t(1) << (*it % 64);
+            }
+            m_words[w] = set ? (m_words[w] | mask) : (m_words[w] & ~mask);
+            updateSummary(w);
+        }
+        markDirty(runBegin, runEnd);
+    }
+
+    VolumeBitmap::OptionalBlock
+    VolumeBitmap::getNextAvailableBlock(uint64_t const from) const
+    {
+        makeResident();
+        auto block = findAvailableBlockFrom(from);
+        if (!block && from > 0) {
+            block = findAvailableBlockFrom(0);
+        }
+        return block;
+    }
+
+    std::vector<uint64_t>
+    VolumeBitmap::getNAvailableBlocks(uint64_t const blocksRequired,
+                                      uint64_t const from) const
+    {
+        makeResident();
+        std::vector<uint64_t> blocks;
+        blocks.reserve(std::min(blocksRequired, m_blocks));
+
+        // from the start block to the end of the volume
+        uint64_t block = from;
+        while (blocks.size() < blocksRequired) {
+            auto found = findAvailableBlockFrom(block);
+            if (!found) {
+                break;
+            }
+            blocks.push_back(*found);
+            block = *found + 1;
+        }
+
+        // and then round again up to the start block
+        block = 0;
+        while (blocks.size() < blocksRequired) {
+            auto found = findAvailableBlockFrom(block);
+            if (!found || *found >= from) {
+                break;
+            }
+            blocks.push_back(*found);
+            block = *found + 1;
+        }
+        return blocks;
+    }
+
+    uint64_t
+    VolumeBitmap::getNumberOfAllocatedBlocks() const
+    {
+        makeResident();
+        if (m_words.empty()) {
+            return 0;
+        }
+        // discount the padding, which always reads as in use
+        uint64_t const padding = (m_words.size() * 64) - (m_byteCount * 8);
+        return detail::countSetBits(&m_words.front(), m_words.size()) - padding;
+    }
+
+    void
+    VolumeBitmap::sync()
+    {
+        if (m_dirty.empty()) {
+            return;
+        }
+        std::vector<uint8_t> bytes;
+        for (auto const & range : m_dirty) {
+            bytes.resize(range.second - range.first);
+            detail::convertBitmapWordsToBytes(&m_words.front(), range.first, bytes.size(), &bytes.front());
+            (void)m_stream->writeAt(bitmapOffset() + range.first, (char*)&bytes.front(), bytes.size());
+        }
+        m_dirty.clear();
+    }
+
+    uint64_t
+    VolumeBitmap::mount()
+    {
+        uint8_t dat[8];
+        (void)m_stream->readAt(volumeStateOffset(m_blocks), (char*)dat, 8);
+        uint64_t const state = detail::convertInt8ArrayToInt64(dat);
+
+        uint64_t freeBlocks;
+        if (state & CLEAN_UNMOUNT) {
+            freeBlocks = state & ~CLEAN_UNMOUNT;
+        } else {
+            // not cleanly unmounted (or created before the count was kept)
+            freeBlocks = m_blocks - getNumberOfAllocatedBlocks();
+        }
+
+        // until unmounted again the stored count can't be trusted
+        writeVolumeState(freeBlocks);
+        return freeBlocks;
+    }
+
+    void
+    VolumeBitmap::unmount(uint64_t const freeBlocks)
+    {
+        sync();
+        writeVolumeState(freeBlocks | CLEAN_UNMOUNT);
+    }
+
+    void
+    VolumeBitmap::writeVolumeState(uint64_t const state)
+    {
+        uint8_t dat[8];
+        detail::convertUInt64ToInt8Array(state, dat);
+        (void)m_stream->writeAt(volumeStateOffset(m_blocks), (char*)dat, 8);
+    }
+
+    void
+    VolumeBitmap::makeResident() const
+    {
+        if (m_resident) {
+            return;
+        }
+        std::vector<uint8_t> bytes(m_byteCount);
+        if (m_byteCount > 0) {
+            (void)m_stream->readAt(bitmapOffset(), (char*)&bytes.front(), m_byteCount);
+        }
+        detail::convertBitmapBytesToWords(bytes.data(), m_byteCount, m_words);
+        buildSummary();
+        m_resident = true;
+    }
+
+    void
+    VolumeBitmap::markDirty(uint64_t const first, uint64_t const last)
+    {
+        uint64_t begin = first;
+        uint64_t end = last;
+
+        // merge with the preceding range if it overlaps or nearly touches
+        auto it = m_dirty.upper_bound(begin);
+        if (it != m_dirty.begin()) {
+            auto previous = std::prev(it);
+            if (previous->second >= end) {
+                return; // already dirty
+            }
+            if (previous->second + DIRTY_GAP >= begin) {
+                begin = previous->first;
+                (void)m_dirty.erase(previous);
+            }
+        }
+
+        // merge with any following ranges that overlap or nearly touch
+        while (it != m_dirty.end() && it->first <= end + DIRTY_GAP) {
+            end = std::max(end, it->second);
+            it = m_dirty.erase(it);
+        }
+
+        m_dirty[begin] = end;
+    }
+
+    void
+    VolumeBitmap::buildSummary() const
+    {
+        m_summary.clear();
+        uint64_t const words = m_words.size();
+        if (words == 0) {
+            return;
+        }
+
+        // level 0: a bit for each bitmap word that has a free block
+        SummaryLevel level((words + 63) / 64, 0);
+        auto bit = detail::findFirstClearBit(&m_words.front(), words);
+        while (bit) {
+            uint64_t const w = *bit / 64;
+            level[w / 64] |= uint64_t(1) << (w % 64);
+            bit = detail::findFirstClearBit(&m_words.front(), words, (w + 1) * 64);
+        }
+        m_summary.push_back(level);
+
+        // higher levels: a bit for each non-zero word of the level below
+        while (m_summary.back().size() > 1) {
+            auto const & below = m_summary.back();
+            SummaryLevel above((below.size() + 63) / 64, 0);
+            for (uint64_t w = 0; w < below.size(); ++w) {
+                if (below[w] != 0) {
+                    above[w / 64] |= uint64_t(1) << (w % 64);
+                }
+            }
+            m_summary.push_back(above);
+        }
+    }
+
+    void
+    VolumeBitmap::updateSummary(uint64_t const n)
+    {
+        bool hasFree = m_words[n] != ~uint64_t(0);
+        uint64_t index = n;
+        for (auto & level : m_summary) {
+            auto & word = level[index / 64];
+            uint64_t const bit = uint64_t(1) << (index % 64);
+            uint64_t const updated = hasFree ? (word | bit) : (word & ~bit);
+            if (updated == word) {
+                return; // nothing above can have changed either
+            }
+            word = updated;
+            hasFree = word != 0;
+            index /= 64;
+        }
+    }
+
+    VolumeBitmap::OptionalBlock
+    VolumeBitmap::findNextSummaryBit(size_t const level, uint64_t const index) const
+    {
+        auto const & bits = m_summary[level];
+        uint64_t const w = index / 64;
+        if (w >= bits.size()) {
+            return OptionalBlock();
+        }
+        uint64_t const masked = bits[w] & (~uint64_t(0) << (index % 64));
+        if (masked != 0) {
+            return OptionalBlock((w * 64) + __builtin_ctzll(masked));
+        }
+
+        // the rest of this word is empty; ask the level above which word
+        // of this level next has something set
+        if (level + 1 == m_summary.size()) {
+            return OptionalBlock();
+        }
+        auto const next = findNextSummaryBit(level + 1, w + 1);
+        if (!next) {
+            return OptionalBlock();
+        }
+        return OptionalBlock((*next * 64) + __builtin_ctzll(bits[*next]));
+    }
+
+    VolumeBitmap::OptionalBlock
+    VolumeBitmap::findAvailableBlockFrom(uint64_t const block) const
+    {
+        if (block >= m_blocks || m_summary.empty()) {
+            return OptionalBlock();
+        }
+
+        // try the remainder of the word that block is in first
+        uint64_t const w = block / 64;
+        uint64_t const free = ~m_words[w] & (~uint64_t(0) << (block % 64));
+        if (free != 0) {
+            return OptionalBlock((w * 64) + __builtin_ctzll(free));
+        }
+
+        auto const next = findNextSummaryBit(0, w + 1);
+        if (!next) {
+            return OptionalBlock();
+        }
+        return OptionalBlock((*next * 64) + __builtin_ctzll(~m_words[*next]));
+    }
+}
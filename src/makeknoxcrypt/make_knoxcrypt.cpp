@@ -66,6 +66,11 @@ int main(int argc, char *argv[])
     namespace po = boost::program_options;
     bool magicPartition;
     bool sparse;
+    bool blockIndex;
+    bool alignedBlocks;
+    bool inlineFiles;
+    bool entrySizes;
+    bool sharedBlocks;
     std::string cipher;
     long blockSize;
     po::options_description desc("Allowed options");
@@ -76,6 +81,11 @@ int main(int argc, char *argv[])
         ("blockCount", po::value<uint64_t>(), "size of filesystem in blocks")
         ("coffee", po::value<bool>(&magicPartition)->default_value(false), "create alternative sub-volume")
         ("sparse", po::value<bool>(&sparse)->default_value(false), "create a sparse image")
+        ("blockIndex", po::value<bool>(&blockIndex)->default_value(false), "index file blocks for fast seeking (format version 21)")
+        ("alignedBlocks", po::value<bool>(&alignedBlocks)->default_value(false), "page-aligned blocks with separate metadata (format version 22)")
+        ("inlineFiles", po::value<bool>(&inlineFiles)->default_value(false), "keep small files in their folder entries (format version 24)")
+        ("entrySizes", po::value<bool>(&entrySizes)->default_value(false), "record file sizes in folder entries (format version 28)")
+        ("sharedBlocks", po::value<bool>(&sharedBlocks)->default_value(false), "let cloned files share blocks; implies blockIndex (format version 37)")
         ("cipher", po::value<std::string>(&cipher)->default_value("aes"), "the cipher type used");
 
     po::positional_options_description positionalOptions;
@@ -113,6 +123,11 @@ int main(int argc, char *argv[])
                 exit(0);
             }
 
+            if(alignedBlocks && (blockSize <= 0 || (blockSize & (blockSize - 1)) != 0)) {
+                std::cout<<"Error: aligned blocks need a power-of-two block size"<<std::endl;
+                exit(0);
+            }
+
             std::cout<<"image path: "<<vm["imageName"].as<std::string>()<<std::endl;
             std::cout<<"block size in bytes: "<<blockSize<<std::endl;
             std::cout<<"number of blocks: "<<vm["blockCount"].as<uint64_t>()<<std::endl;
@@ -133,6 +148,11 @@ int main(int argc, char *argv[])
     io->path = vm["imageName"].as<std::string>().c_str();
     io->blockSize = blockSize;
     io->blocks = blocks;
+    io->blockIndex = blockIndex || sharedBlocks;
+    io->alignedBlocks = alignedBlocks;
+    io->inlineFiles = inlineFiles;
+    io->entrySizes = entrySizes;
+    io->sharedBlocks = sharedBlocks;
     io->freeBlocks = blocks;
     io->encProps.password.append(knoxcrypt::utility::getPassword("knoxcrypt password: "));
     io->rounds = 64; // obsolete (not currently used; used to be used by XTEA)
@@ -26,15 +26,29 @@
   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "test/AlignedLayoutTest.hpp"
+#include "test/BatchedIOTest.hpp"
+#include "test/BitmapKernelsTest.hpp"
+#include "test/BlockCacheTest.hpp"
+#include "test/BlockIndexTest.hpp"
+#include "test/CipherPoolTest.hpp"
 #include "test/CoreFSTest.hpp"
+#include "test/EntrySizeTest.hpp"
 #include "test/FileBlockTest.hpp"
 #include "test/FileBlockIteratorTest.hpp"
 #include "test/FileTest.hpp"
 #include "test/FileDeviceTest.hpp"
+#include "test/HolePunchTest.hpp"
+#include "test/InlineFileTest.hpp"
 #include "test/MakeKnoxCryptTest.hpp"
+#include "test/MappedImageTest.hpp"
 #include "test/ContentFolderTest.hpp"
+#include "test/PositionalIOTest.hpp"
+#include "test/SharedBlocksTest.hpp"
 #include "test/SimpleTest.hpp"
+#include "test/SparseFileTest.hpp"
 #include "test/TestHelpers.hpp"
+#include "test/VolumeBitmapTest.hpp"
 
 #include <boost/timer/timer.hpp>
 
@@ -52,6 +66,20 @@ int main()
         FileBlockIteratorTest();
         FileTest();
         ContentFolderTest();
+        VolumeBitmapTest();
+        BitmapKernelsTest();
+        HolePunchTest();
+        BlockIndexTest();
+        AlignedLayoutTest();
+        InlineFileTest();
+        EntrySizeTest();
+        SparseFileTest();
+        SharedBlocksTest();
+        BlockCacheTest();
+        PositionalIOTest();
+        MappedImageTest();
+        BatchedIOTest();
+        CipherPoolTest();
     }
 
     simpletest::showResults();
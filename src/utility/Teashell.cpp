@@ -33,6 +33,7 @@
  * (has 'ls', 'cd', 'pwd', 'rm', 'mkdir' commands)
  */
 
+#include "knoxcrypt/BlockCache.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/EntryInfo.hpp"
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
@@ -40,6 +41,7 @@
 #include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
 #include "knoxcrypt/FileStreamPtr.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "utility/CipherCallback.hpp"
 #include "utility/CopyFromPhysical.hpp"
 #include "utility/EcholessPasswordPrompt.hpp"
@@ -87,6 +89,17 @@ struct CommandDescriptor
 using Commands = std::vector<CommandDescriptor>;
 Commands g_availableCommands;
 
+/// the io of the open container
+knoxcrypt::SharedCoreIO g_io;
+
+/// cleanly unmounts the container and exits; exit skips the CoreFS's
+/// destructor so the file it still has open is let go of here
+void com_quit(knoxcrypt::CoreFS &theBfs)
+{
+    theBfs.unmount();
+    exit(0);
+}
+
 /// lists all available commands
 void com_help()
 {
@@ -169,6 +182,31 @@ void com_rm(knoxcrypt::CoreFS &theBfs, std::string const &path)
     knoxcrypt::utility::removeEntry(theBfs, thePath);
 }
 
+/// the 'trim' command for giving the space of free blocks back to the host
+void com_trim(knoxcrypt::CoreFS &theBfs)
+{
+    std::cout<<"released "<<theBfs.trim()<<" blocks"<<std::endl;
+}
+
+/// the 'cache' command for seeing how well the block cache is doing
+void com_cache()
+{
+    if (!g_io->blockCache) {
+        std::cout<<"no block cache"<<std::endl;
+        return;
+    }
+    auto const &cache = *g_io->blockCache;
+    std::cout<<boost::format("%1% of %2% blocks held, %3% hits, %4% misses\n")
+        % cache.size() % cache.capacity() % cache.hits() % cache.misses();
+}
+
+/// the 'cp' command for copying a file within the container; where the
+/// container allows it the copy shares the original's blocks
+void com_cp(knoxcrypt::CoreFS &theBfs, std::string const &src, std::string const &dst)
+{
+    theBfs.cloneFile(src, dst);
+}
+
 /// the 'mkdir' command for adding a folder to the current working dir
 void com_mkdir(knoxcrypt::CoreFS &theBfs, std::string const &path)
 {
@@ -316,6 +354,12 @@ void parse(knoxcrypt::CoreFS &theBfs, std::string const &commandStr, std::string
         } else {
             com_mkdir(theBfs, formattedPath(workingDir, comTokens[1]));
         }
+    } else if (comTokens[0] == "cp") {
+        if (comTokens.size() < 3) {
+            std::cout<<"Error: please specify /src/path and /dst/path"<<std::endl;
+        } else {
+            com_cp(theBfs, formattedPath(workingDir, comTokens[1]), formattedPath(workingDir, comTokens[2]));
+        }
     } else if (comTokens[0] == "add") {
         if (comTokens.size() < 2) {
             std::cout<<"Error: please specify file:///path"<<std::endl;
@@ -342,12 +386,16 @@ void parse(knoxcrypt::CoreFS &theBfs, std::string const &commandStr, std::string
         } else {
             com_extract(theBfs, formattedPath(workingDir, comTokens[1]), comTokens[2]);
         }
+    } else if (comTokens[0] == "trim") {
+        com_trim(theBfs);
+    } else if (comTokens[0] == "cache") {
+        com_cache();
     } else if (comTokens[0] == "help") {
         com_help();
     } else if (comTokens[0] == "quit") {
-        exit(0);
+        com_quit(theBfs);
     } else if (comTokens[0] == "exit") {
-        exit(0);
+        com_quit(theBfs);
     }
 }
 
@@ -550,6 +598,10 @@ void populateCommands()
         CommandDescriptor command("rm","remove entry","rm <entryName>");
         g_availableCommands.push_back(command);
     }
+    {
+        CommandDescriptor command("cp","copy a file","cp <fileName> <copyName>");
+        g_availableCommands.push_back(command);
+    }
     {
         CommandDescriptor command("add","add a file or folder to current working dir","add <file:///path/to/thing>");
         g_availableCommands.push_back(command);
@@ -566,6 +618,14 @@ void populateCommands()
         CommandDescriptor command("quit","exit the shell","quit");
         g_availableCommands.push_back(command);
     }
+    {
+        CommandDescriptor command("trim","give the space of free blocks back to the host","trim");
+        g_availableCommands.push_back(command);
+    }
+    {
+        CommandDescriptor command("cache","show how often blocks were found in the block cache","cache");
+        g_availableCommands.push_back(command);
+    }
     {
         CommandDescriptor command("exit","exit the shell","exit");
         g_availableCommands.push_back(command);
@@ -576,12 +636,24 @@ int main(int argc, char *argv[])
 {
     // parse the program options
     bool magic = false;
+    bool punchHoles = false;
+    uint32_t inlineFileBytes = 254;
+    uint64_t blockCache = 1024;
+    bool mapImage = false;
+    bool ioUring = false;
+    unsigned cipherThreads = 1;
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help", "produce help message")
         ("imageName", po::value<std::string>(), "knoxcrypt image path")
         ("coffee", po::value<bool>(&magic)->default_value(false), "mount alternative sub-volume")
+        ("punchHoles", po::value<bool>(&punchHoles)->default_value(false), "give deleted file space back to the host")
+        ("inlineFileBytes", po::value<uint32_t>(&inlineFileBytes)->default_value(254), "largest file kept in its folder entry")
+        ("blockCache", po::value<uint64_t>(&blockCache)->default_value(1024), "decrypted blocks held in memory; 0 for none")
+        ("mapImage", po::value<bool>(&mapImage)->default_value(false), "read and write the image through a memory mapping")
+        ("ioUring", po::value<bool>(&ioUring)->default_value(false), "batch reads and writes over several blocks with io_uring")
+        ("cipherThreads", po::value<unsigned>(&cipherThreads)->default_value(1), "threads enciphering and deciphering large transfers")
         ;
 
     po::positional_options_description positionalOptions;
@@ -619,6 +691,11 @@ int main(int argc, char *argv[])
     // the knoxcrypt image
     auto io(std::make_shared<knoxcrypt::CoreIO>());
     io->useBlockCache = true;
+    io->punchHoles = punchHoles;
+    io->mapImage = mapImage;
+    io->ioUring = ioUring;
+    io->cipherThreads = cipherThreads;
+    io->inlineFileBytes = inlineFileBytes;
     io->path = vm["imageName"].as<std::string>().c_str();
     io->encProps.password = knoxcrypt::utility::getPassword("knoxcrypt password: ");
     io->rootBlock = magic ? atoi(knoxcrypt::utility::getPassword("magic number: ").c_str()) : 0;
@@ -627,6 +704,12 @@ int main(int argc, char *argv[])
     // and the number of xtea rounds from the ninth byte
     knoxcrypt::detail::readImageIVAndRounds(io);
 
+    // the block size is known now; the cache has to be in place before the
+    // bitmap opens its stream so that every stream shares it
+    if (blockCache > 0) {
+        io->blockCache = std::make_shared<knoxcrypt::BlockCache>(io->blockSize, blockCache);
+    }
+
     // Obtain the number of blocks in the image by reading the image's block count
     long const amount = knoxcrypt::detail::CIPHER_BUFFER_SIZE / 100000;
     auto f(std::bind(&knoxcrypt::cipherCallback, std::placeholders::_1, amount));
@@ -645,16 +728,16 @@ int main(int argc, char *argv[])
 
     io->blocks = knoxcrypt::detail::getBlockCount(stream);
 
-    printf("Counting allocated blocks. Please wait...\n");
-
-    io->freeBlocks = io->blocks - knoxcrypt::detail::getNumberOfAllocatedBlocks(stream);
+    // the bitmap only needs to be read and counted if the container
+    // wasn't cleanly unmounted last time
+    io->bitmap = knoxcrypt::VolumeBitmap::load(io);
+    io->freeBlocks = io->bitmap->mount();
     io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
 
-    printf("Finished counting allocated blocks.\n");
-
     stream.close();
 
     // Create the basic file system
+    g_io = io;
     knoxcrypt::CoreFS theBfs(io);
     return loop(theBfs);
 }